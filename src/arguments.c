@@ -27,6 +27,11 @@
 #include "dfu-bool.h"
 #include "dfu-device.h"
 #include "arguments.h"
+#include "digest.h"
+#include "cache.h"
+#include "profile.h"
+#include "manifest.h"
+#include "topology.h"
 #include "version.h"
 
 // Modes used to display the list of targets.
@@ -180,6 +185,8 @@ static struct target_mapping_structure target_map[] = {
     { "stm32f4_C",      tar_stm32f4_C,      DC_STM32,  0xdf11, 0x0483, 0x40000, 0x0000, BL_EXTRA,  512,   0,      0 },
     { "stm32f4_E",      tar_stm32f4_E,      DC_STM32,  0xdf11, 0x0483, 0x80000, 0x0000, BL_EXTRA,  512,   0,      0 },
     { "stm32f4_G",      tar_stm32f4_G,      DC_STM32,  0xdf11, 0x0483, 0x100000,0x0000, BL_EXTRA,  512,   0,      0 },
+    // the flash size is taken from the layout the bootloader describes
+    { "stm32",          tar_stm32,          DC_STM32,  0xdf11, 0x0483, 0x100000,0x0000, BL_EXTRA,  512,   0,      0 },
     { NULL }
     // END_TARGET_LIST_LINE .. used for autocompletion script
 };
@@ -190,9 +197,18 @@ static struct option_mapping_structure command_map[] = {
     { "read",         com_read      },
     { "erase",        com_erase     },
     { "flash",        com_flash     },
+    { "verify",       com_verify    },
+    { "checksum",     com_checksum  },
+    { "diff",         com_diff      },
+    { "make-patch",   com_make_patch },
+    { "apply-patch",  com_apply_patch },
+    { "bundle",       com_bundle    },
+    { "flash-bundle", com_flash_bundle },
+    { "autotune",     com_autotune  },
     { "get",          com_get       },
     { "getfuse",      com_getfuse   },
     { "setfuse",      com_setfuse   },
+    { "set",          com_set       },
     { "setsecure",    com_setsecure },
     { "launch",       com_launch    },
     { "dfumode",      com_dfumode   },
@@ -362,18 +378,45 @@ static void usage()
         "global-options:\n"
         "        --quiet\n"
         "        --debug level    (level is an integer specifying level of detail)\n"
+        "        --stats          print USB round trip times and timeouts when done\n"
+        "        --cache=dir      keep parsed hex files in dir to skip parsing them\n"
+        "                         again (default $" CACHE_ENVIRONMENT ")\n"
+        "        --profiles=file  load tuned settings for the bootloader from\n"
+        "                         file (default $" PROFILE_ENVIRONMENT ")\n"
         "        --dishonor_interfaceclass ignoring checking usb class interface (removed hardcoded values from code)\n"
         "        Global options can be used with any command and must come\n"
         "        after the command and before any file or data value\n"
         "\n"
         "command summary:\n"
-        "        launch       [--no-reset]\n"
-        "        read         [--force] [--bin] [(flash)|--user|--eeprom]\n"
+        "        launch       [--no-reset] [--wait[=ms]] [--app=vid:pid]\n"
+        "        read         [--force] [--bin [--fill=byte]|--dfu]\n"
+        "                     [(flash)|--user|--eeprom]\n"
         "        erase        [--force] [--suppress-validation]\n"
         "        flash        [--force] [(flash)|--user|--eeprom]\n"
         "                     [--suppress-validation]\n"
         "                     [--suppress-bootloader-mem]\n"
-        "                     [--serial=hexdigits:offset] {file|STDIN}\n"
+        "                     [--serial=hexdigits:offset[:+step]...]\n"
+        "                     [--checkpoint=file] {file|STDIN}\n"
+        "        verify       [(flash)|--user|--eeprom]\n"
+        "                     [--hash={crc32|crc32c|sha1|sha256}]\n"
+        "                     {file|STDIN}\n"
+        "        checksum     [(flash)|--user|--eeprom]\n"
+        "                     [--hash={(crc32)|crc32c|sha1|sha256}]\n"
+        "                     [--start=address] [--end=address]\n"
+        "                     [--bin] [file|STDIN]\n"
+        "        diff         [(flash)|--user|--eeprom] [--bin]\n"
+        "                     [--format={(text)|json}] old-file new-file\n"
+        "        make-patch   [(flash)|--user|--eeprom] [--bin]\n"
+        "                     old-file new-file\n"
+        "        apply-patch  [--suppress-validation] {file|STDIN}\n"
+        "        bundle       {flash:file|eeprom:file|user:file|\n"
+        "                      configure-name=value|fuse-name=value}...\n"
+        "        flash-bundle [--force] [--suppress-validation]\n"
+        "                     [--suppress-bootloader-mem] {file|STDIN}\n"
+        "        autotune\n"
+        "        manifest     [--jobs=count] (in place of the target)\n"
+        "                     [--usb-limits=root:count,hub:count,tt:count]\n"
+        "                     file\n"
         "        setsecure\n"
         "        configure {BSB|SBV|SSB|EB|HSB} [--suppress-validation] data\n"
         "        get     {bootloader-version|ID1|ID2|BSB|SBV|SSB|EB|\n"
@@ -385,22 +428,72 @@ static void usage()
         "        setfuse {LOCK|EPFL|BOOTPROT|BODLEVEL|BODHYST|\n"
         "                 BODEN|ISP_BOD_EN|ISP_IO_COND_EN|\n"
         "                 ISP_FORCE} data\n"
+        "        set     {configure-name=value|fuse-name=value}...\n"
         "\n"
         "additional details:\n"
         " launch: Launch from the bootloader into the main program using a watchdog\n"
         "         reset.  To jump directly into the main program use --no-reset.\n"
+        "         With --wait the application must show up on the same port, or\n"
+        "         with the ids of --app, within ms (default %d) and the time it\n"
+        "         took is printed.\n"
         "   read: Read the program memory in flash and output non-blank pages in ihex\n"
         "         format.  Use --force to output the entire memory and --bin for binary\n"
         "         output.  User page and eeprom are selected using --user and --eeprom\n"
+        "         Binary output writes erased runs of 4 KiB or more as --fill\n"
+        "         (default 0xFF), shorter runs of 0xFF are kept as data.  When\n"
+        "         it goes to a file runs of zeros are left as sparse holes, so\n"
+        "         --fill=0 gives compact dumps.  hex2bin and dump take --fill too.\n"
+        "         --dfu writes a DfuSe (.dfu) file instead.  DfuSe files are\n"
+        "         accepted wherever a hex file is.\n"
         "  erase: Erase memory contents if the chip is not blank or always with --force\n"
         "  flash: Flash a program onto device flash memory.  EEPROM and user page are\n"
         "         selected using --eeprom|--user flags. Use --force to ignore warning\n"
         "         when data exists in target memory region.  Bootloader configuration\n"
         "         uses last 4 to 8 bytes of user page, --force always required here.\n"
+        "         With --checkpoint progress is saved to file so an interrupted run\n"
+        "         can be repeated on the same device and will resume where it\n"
+        "         stopped.\n"
+        " verify: Compare device memory with a program without writing to it.\n"
+        "         With --hash the memory is hashed as it is read and compared\n"
+        "         with the digest of the program, using little memory.\n"
+        "checksum: Print the digest of a memory range, by default the whole\n"
+        "         segment.  Given a hex file (or a binary with --bin) the digest\n"
+        "         is computed from the file without a device, blank bytes as 0xFF.\n"
+        "   diff: Compare two hex files (or binaries with --bin) without a device\n"
+        "         and list the changed address ranges with the flash pages, or\n"
+        "         sectors on STM32, that an update would have to rewrite.\n"
+        "make-patch: Write a binary patch to stdout with the pages (and STM32\n"
+        "         sectors) that turn old-file into new-file, plus a digest of\n"
+        "         each page in old-file.  No device is used.\n"
+        "apply-patch: Check that the device holds the old image on every page\n"
+        "         the patch touches, then program only those pages.\n"
+        " bundle: Write everything a board needs to stdout as one file: the hex\n"
+        "         files for each segment and configure (BSB..HSB) and setfuse\n"
+        "         (LOCK..ISP_FORCE) values, e.g. flash:app.hex BOOTPROT=2\n"
+        "flash-bundle: Program and validate every segment of a bundle, then\n"
+        "         write its configuration and fuses as set does.\n"
+        "         Erase first as for flash, --force is needed for the user page.\n"
+        "    set: Write several configure (BSB..HSB) or setfuse (LOCK..ISP_FORCE)\n"
+        "         values in one session, e.g. BOOTPROT=2 ISP_FORCE=0.  The values\n"
+        "         are read first, only those that differ are written, then read\n"
+        "         back once to check them.\n"
+        "autotune: Find the fastest transfer size, erase poll interval and\n"
+        "         status timing of the bootloader and store them in --profiles,\n"
+        "         where later runs pick them up.  Erases and overwrites the\n"
+        "         flash, so use a board that can spare its program.\n"
+        "manifest: Program every board of a station listed in file, each with\n"
+        "         its own target, port or serial number and commands, up to\n"
+        "         --jobs boards at once (default %d).  Files used by several\n"
+        "         boards are read once.  See manifest.h for the format.\n"
+        "         --usb-limits caps the transfers in flight through each root\n"
+        "         port, hub and transaction translator, --stats prints the\n"
+        "         throughput of each.\n"
+        "Hex and binary files compressed with gzip, zstd or xz are decoded as\n"
+        "they are read, using the installed gzip, zstd and xz tools.\n"
         "Note: version 0.6.1 commands still supported.\n"
     ;
 
-    fprintf(stderr, info);
+    fprintf(stderr, info, LAUNCH_WAIT_TIMEOUT, MANIFEST_DEFAULT_WORKERS);
 }
 
 
@@ -570,6 +663,51 @@ static int32_t assign_global_options( struct programmer_arguments *args,
         }
     }
 
+    /* Find '--stats' if it is here */
+    for( i = 0; i < argc; i++ ) {
+        if( 0 == strcmp("--stats", argv[i]) ) {
+            *argv[i] = '\0';
+            args->stats = 1;
+            break;
+        }
+    }
+
+    /* Find '--cache=<directory>', or take it from the environment */
+    args->cache = getenv( CACHE_ENVIRONMENT );
+    if( (NULL != args->cache) && ('\0' == *args->cache) ) {
+        args->cache = NULL;
+    }
+    for( i = 0; i < argc; i++ ) {
+        if( 0 == strncmp("--cache=", argv[i], 8) ) {
+            if( '\0' == argv[i][8] ) {
+                fprintf( stderr, "cache directory is missing\n" );
+                return -1;
+            }
+            args->cache = &argv[i][8];
+            /* blanks the option only, the directory follows the '=' */
+            *argv[i] = '\0';
+            break;
+        }
+    }
+
+    /* Find '--profiles=<file>', or take it from the environment */
+    args->profiles = getenv( PROFILE_ENVIRONMENT );
+    if( (NULL != args->profiles) && ('\0' == *args->profiles) ) {
+        args->profiles = NULL;
+    }
+    for( i = 0; i < argc; i++ ) {
+        if( 0 == strncmp("--profiles=", argv[i], 11) ) {
+            if( '\0' == argv[i][11] ) {
+                fprintf( stderr, "profile file is missing\n" );
+                return -1;
+            }
+            args->profiles = &argv[i][11];
+            /* blanks the option only, the file follows the '=' */
+            *argv[i] = '\0';
+            break;
+        }
+    }
+
     /* Find '--suppress-bootloader-mem' if it is here */
     for( i = 0; i < argc; i++ ) {
         if( 0 == strcmp("--suppress-bootloader-mem", argv[i]) ) {
@@ -595,6 +733,8 @@ static int32_t assign_global_options( struct programmer_arguments *args,
                 case com_flash:
                 case com_eflash:
                 case com_user:
+                case com_apply_patch:
+                case com_flash_bundle:
                     args->com_flash_data.suppress_validation = 1;
                     break;
                 default:
@@ -617,6 +757,68 @@ static int32_t assign_global_options( struct programmer_arguments *args,
                 case com_udump:
                     args->com_read_data.bin = 1;
                     break;
+                case com_checksum:
+                    args->com_checksum_data.bin = 1;
+                    break;
+                case com_diff:
+                case com_make_patch:
+                    args->com_diff_data.bin = 1;
+                    break;
+                default:
+                    /* not supported. */
+                    return -1;
+            }
+            break;
+        }
+    }
+
+    /* Find '--dfu' for read as a DfuSe file */
+    for( i = 0; i < argc; i++ ) {
+        if( 0 == strcmp("--dfu", argv[i]) ) {
+            *argv[i] = '\0';
+
+            switch( args->command ) {
+                case com_read:
+                case com_dump:
+                case com_edump:
+                case com_udump:
+                    if( args->com_read_data.bin ) {
+                        fprintf( stderr, "--dfu and --bin can not be used together\n" );
+                        return -1;
+                    }
+                    args->com_read_data.dfu = 1;
+                    break;
+                default:
+                    /* not supported. */
+                    return -1;
+            }
+            break;
+        }
+    }
+
+    /* Find '--fill=<byte>' for the value of blank memory in binary output */
+    for( i = 0; i < argc; i++ ) {
+        if( 0 == strncmp("--fill=", argv[i], 7) ) {
+            unsigned long fill;
+            char *end = NULL;
+
+            fill = strtoul( &argv[i][7], &end, 0 );
+            if( ('\0' == argv[i][7]) || ('\0' != *end) || (fill > 0xff) ) {
+                fprintf( stderr, "invalid fill value '%s'\n", &argv[i][7] );
+                return -1;
+            }
+            *argv[i] = '\0';
+
+            switch( args->command ) {
+                case com_read:
+                case com_dump:
+                case com_edump:
+                case com_udump:
+                    args->com_read_data.fill = (uint8_t) fill;
+                    break;
+                case com_hex2bin:
+                    args->com_convert_data.fill = (uint8_t) fill;
+                    break;
                 default:
                     /* not supported. */
                     return -1;
@@ -636,11 +838,19 @@ static int32_t assign_global_options( struct programmer_arguments *args,
                     break;
                 case com_flash:
                 case com_user:
+                case com_verify:
                     args->com_flash_data.segment = mem_user;
                     break;
                 case com_bin2hex:
                     args->com_convert_data.segment = mem_user;
                     break;
+                case com_checksum:
+                    args->com_checksum_data.segment = mem_user;
+                    break;
+                case com_diff:
+                case com_make_patch:
+                    args->com_diff_data.segment = mem_user;
+                    break;
                 default:
                     /* not supported. */
                     return -1;
@@ -660,11 +870,19 @@ static int32_t assign_global_options( struct programmer_arguments *args,
                     break;
                 case com_flash:
                 case com_user:
+                case com_verify:
                     args->com_flash_data.segment = mem_eeprom;
                     break;
                 case com_bin2hex:
                     args->com_convert_data.segment = mem_eeprom;
                     break;
+                case com_checksum:
+                    args->com_checksum_data.segment = mem_eeprom;
+                    break;
+                case com_diff:
+                case com_make_patch:
+                    args->com_diff_data.segment = mem_eeprom;
+                    break;
                 default:
                     /* not supported. */
                     return -1;
@@ -682,6 +900,7 @@ static int32_t assign_global_options( struct programmer_arguments *args,
                 case com_flash :
                 case com_eflash :
                 case com_user :
+                case com_flash_bundle :
                     args->com_flash_data.force = true;
                     break;
                 case com_read :
@@ -714,6 +933,52 @@ static int32_t assign_global_options( struct programmer_arguments *args,
         }
     }
 
+    /* Find '--wait[=<ms>]' and '--app=<vid>:<pid>' */
+    for( i = 0; i < argc; i++ ) {
+        unsigned int vendor;
+        unsigned int product;
+        char extra;
+
+        if( (0 == strcmp("--wait", argv[i])) ||
+                (0 == strncmp("--wait=", argv[i], 7)) ) {
+            if( com_launch != args->command ) {
+                /* not supported. */
+                return -1;
+            }
+            if( '=' == argv[i][6] ) {
+                unsigned long timeout;
+                char *end = NULL;
+
+                timeout = strtoul( &argv[i][7], &end, 0 );
+                if( ('\0' == argv[i][7]) || ('\0' != *end) ||
+                        (0 == timeout) || (timeout > UINT32_MAX) ) {
+                    fprintf( stderr, "invalid time to wait '%s', give it "
+                             "in ms\n", &argv[i][7] );
+                    return -1;
+                }
+                args->com_launch_config.timeout = (uint32_t) timeout;
+            }
+            args->com_launch_config.wait = true;
+            *argv[i] = '\0';
+        } else if( 0 == strncmp("--app=", argv[i], 6) ) {
+            if( com_launch != args->command ) {
+                /* not supported. */
+                return -1;
+            }
+            if( (2 != sscanf(&argv[i][6], "%x:%x%c", &vendor, &product,
+                             &extra)) || (0 == vendor) ||
+                    (vendor > UINT16_MAX) || (product > UINT16_MAX) ) {
+                fprintf( stderr, "--app takes the vendor and product id "
+                         "of the application, e.g. --app=03eb:2404\n" );
+                return -1;
+            }
+            args->com_launch_config.app_vendor = (uint16_t) vendor;
+            args->com_launch_config.app_product = (uint16_t) product;
+            args->com_launch_config.wait = true;
+            *argv[i] = '\0';
+        }
+    }
+
     /* Find '--debug' if it is here */
     for( i = 0; i < argc; i++ ) {
         if( 0 == strncmp("--debug", argv[i], 7) ) {
@@ -735,7 +1000,7 @@ static int32_t assign_global_options( struct programmer_arguments *args,
         }
     }
 
-    /* Find '--serial=<hexdigit+>:<offset>' */
+    /* Find every '--serial=<hexdigit+>:<offset>[:+<step>]' */
     for( i = 0; i < argc; i++ ) {
         if( 0 == strncmp("--serial=", argv[i], 9) ) {
             *argv[i] = '\0';
@@ -743,64 +1008,171 @@ static int32_t assign_global_options( struct programmer_arguments *args,
             switch( args->command ) {
                 case com_flash:
                 case com_eflash:
-                case com_user: {
-                    char *hexdigits = &argv[i][9];
-                    char *offset_start = hexdigits;
-                    size_t num_digits = 0;
-                    int16_t *serial_data = NULL;
-                    long serial_offset = 0;
-                    size_t j = 0;
-                    char buffer[3] = {0,0,0};
-                    while (*offset_start != ':') {
-                        char c = *offset_start;
-                        if ('\0' == c) {
+                case com_user:
+                    switch( overlay_parse(&args->com_flash_data.overlay,
+                                          &argv[i][9]) ) {
+                        case 0:
+                            break;
+                        case -1:
+                            fprintf( stderr, "--serial takes an even number "
+                                     "of hexdigits, a colon and the offset, "
+                                     "then optionally :+step\n" );
                             return -1;
-                        } else if (('0' <= c && c <= '9')
-                            || ('a' <= c && c <= 'f')
-                            || ('A' <= c && c <= 'F')) {
-                            ++offset_start;
-                        } else {
-                          fprintf(stderr, "other character: '%c'\n", *offset_start);
+                        default:
                             return -1;
-                        }
                     }
-                    num_digits = offset_start - hexdigits;
-                    if (num_digits & 1) {
-                        fprintf(stderr,"There must be an even number of hexdigits in the serial data\n");
+                    break;
+                default:
+                    /* not supported. */
+                  fprintf(stderr,"command did not match: %d    flash: %d\n", args->command, com_flash);
+                    return -1;
+            }
+            if( 1 == args->com_flash_data.overlay.count ) {
+                fprintf(stderr, "Success getting serial number\n");
+            }
+        }
+    }
+
+    /* Find '--jobs=<count>' */
+    for( i = 0; i < argc; i++ ) {
+        if( 0 == strncmp("--jobs=", argv[i], 7) ) {
+            unsigned long jobs;
+            char *end = NULL;
+
+            if( com_manifest != args->command ) {
+                /* not supported. */
+                return -1;
+            }
+            jobs = strtoul( &argv[i][7], &end, 0 );
+            if( ('\0' == argv[i][7]) || ('\0' != *end) || (0 == jobs) ||
+                    (jobs > MANIFEST_MAX_WORKERS) ) {
+                fprintf( stderr, "invalid job count '%s', 1 to %d\n",
+                         &argv[i][7], MANIFEST_MAX_WORKERS );
+                return -1;
+            }
+            args->com_manifest_data.jobs = (uint32_t) jobs;
+            *argv[i] = '\0';
+            break;
+        }
+    }
+
+    /* Find '--usb-limits=<kind:count,...>' */
+    for( i = 0; i < argc; i++ ) {
+        if( 0 == strncmp("--usb-limits=", argv[i], 13) ) {
+            if( com_manifest != args->command ) {
+                /* not supported. */
+                return -1;
+            }
+            if( 0 != topology_parse_limits(&argv[i][13],
+                                           args->com_manifest_data.limits) ) {
+                fprintf( stderr, "invalid usb limits '%s'\n", &argv[i][13] );
+                return -1;
+            }
+            *argv[i] = '\0';
+            break;
+        }
+    }
+
+    /* Find '--checkpoint=<file>' */
+    for( i = 0; i < argc; i++ ) {
+        if( 0 == strncmp("--checkpoint=", argv[i], 13) ) {
+            switch( args->command ) {
+                case com_flash:
+                case com_eflash:
+                case com_user:
+                    if( '\0' == argv[i][13] ) {
+                        fprintf( stderr, "checkpoint filename is missing\n" );
                         return -1;
                     }
-                    *offset_start++ = '\0';
-                    if( 1 != sscanf(offset_start, "%ld", &serial_offset) ) {
-                      fprintf(stderr, "sscanf failed\n");
-                      return -1;
+                    args->com_flash_data.checkpoint = &argv[i][13];
+                    break;
+                default:
+                    /* not supported. */
+                    return -1;
+            }
+            /* blanks the option only, the file name follows the '=' */
+            *argv[i] = '\0';
+            break;
+        }
+    }
+
+    /* Find '--hash=<algorithm>' */
+    for( i = 0; i < argc; i++ ) {
+        if( 0 == strncmp("--hash=", argv[i], 7) ) {
+            switch( args->command ) {
+                case com_verify:
+                    args->com_flash_data.hash =
+                        digest_parse_algorithm( &argv[i][7] );
+                    if( args->com_flash_data.hash < 0 ) {
+                        fprintf( stderr, "unknown hash '%s'\n", &argv[i][7] );
+                        return -1;
                     }
-                    serial_data = (int16_t *) malloc( (num_digits/2) * sizeof(int16_t) );
-                    for (j=0; j < num_digits; j+=2) {
-                      int data;
-                      buffer[0] = hexdigits[j];
-                      buffer[1] = hexdigits[j+1];
-                      buffer[2] = 0;
-                      if( 1 != sscanf(buffer, "%02x", &data) ) {
-                        fprintf(stderr, "sscanf failed with buffer: %s\n", buffer);
+                    break;
+                case com_checksum:
+                    args->com_checksum_data.hash =
+                        digest_parse_algorithm( &argv[i][7] );
+                    if( args->com_checksum_data.hash < 0 ) {
+                        fprintf( stderr, "unknown hash '%s'\n", &argv[i][7] );
                         return -1;
-                      }
-                      serial_data[j/2] = (int16_t)data;
                     }
-                    args->com_flash_data.serial_data = serial_data;
-                    args->com_flash_data.serial_offset = serial_offset;
-                    args->com_flash_data.serial_length = num_digits/2;
                     break;
-                }
                 default:
                     /* not supported. */
-                  fprintf(stderr,"command did not match: %d    flash: %d\n", args->command, com_flash);
                     return -1;
             }
-            fprintf(stderr, "Success getting serial number\n");
+            *argv[i] = '\0';
             break;
         }
     }
 
+    /* Find '--format=<text|json>' */
+    for( i = 0; i < argc; i++ ) {
+        if( 0 == strncmp("--format=", argv[i], 9) ) {
+            if( com_diff != args->command ) {
+                /* not supported. */
+                return -1;
+            }
+            if( 0 == strcasecmp("json", &argv[i][9]) ) {
+                args->com_diff_data.json = true;
+            } else if( 0 == strcasecmp("text", &argv[i][9]) ) {
+                args->com_diff_data.json = false;
+            } else {
+                fprintf( stderr, "unknown format '%s'\n", &argv[i][9] );
+                return -1;
+            }
+            *argv[i] = '\0';
+            break;
+        }
+    }
+
+    /* Find '--start=<address>' and '--end=<address>' */
+    for( i = 0; i < argc; i++ ) {
+        uint32_t *address = NULL;
+        char *value = NULL;
+        char *end = NULL;
+
+        if( 0 == strncmp("--start=", argv[i], 8) ) {
+            address = &args->com_checksum_data.start;
+            value = &argv[i][8];
+        } else if( 0 == strncmp("--end=", argv[i], 6) ) {
+            address = &args->com_checksum_data.end;
+            value = &argv[i][6];
+        } else {
+            continue;
+        }
+
+        if( com_checksum != args->command ) {
+            /* not supported. */
+            return -1;
+        }
+        *address = (uint32_t) strtoul( value, &end, 0 );
+        if( ('\0' == *value) || ('\0' != *end) ) {
+            fprintf( stderr, "invalid address '%s'\n", value );
+            return -1;
+        }
+        *argv[i] = '\0';
+    }
+
     return 0;
 }
 
@@ -871,6 +1243,86 @@ static int32_t assign_com_flash_option( struct programmer_arguments *args,
     return 0;
 }
 
+static int32_t assign_com_checksum_option( struct programmer_arguments *args,
+                                           const int32_t parameter,
+                                           char *value )
+{
+    /* optional file */
+    args->com_checksum_data.original_first_char = *value;
+    args->com_checksum_data.file = value;
+
+    return 0;
+}
+
+static int32_t assign_com_diff_option( struct programmer_arguments *args,
+                                       const int32_t parameter,
+                                       char *value )
+{
+    /* old file & new file */
+    if( parameter > 1 )
+        return -1;
+
+    args->com_diff_data.original_first_char[parameter] = *value;
+    args->com_diff_data.file[parameter] = value;
+
+    return 0;
+}
+
+static int32_t assign_setting( struct setting_struct *list,
+                               size_t *settings,
+                               char *value )
+{
+    struct setting_struct *setting;
+    char *equals;
+    int32_t temp = 0;
+
+    /* name=value, the name of a configure or a setfuse property */
+    if( (NULL == (equals = strchr(value, '='))) ||
+            (*settings >= BUNDLE_MAX_SETTINGS) )
+        return -1;
+
+    setting = &list[*settings];
+    *equals = '\0';
+    if( 0 == assign_option(&setting->name, value, configure_map) ) {
+        setting->fuse = false;
+    } else if( 0 == assign_option(&setting->name, value, setfuse_map) ) {
+        setting->fuse = true;
+    } else {
+        return -2;
+    }
+
+    if( (1 != sscanf(equals + 1, "%i", &temp)) || (temp < 0) )
+        return -3;
+    setting->value = temp;
+    (*settings)++;
+
+    return 0;
+}
+
+static int32_t assign_com_bundle_option( struct programmer_arguments *args,
+                                         const int32_t parameter,
+                                         char *value )
+{
+    static const char *segment[] = { "flash:", "eeprom:", "user:" };
+    struct com_bundle_struct *bundle = &args->com_bundle_data;
+    size_t i;
+    size_t n;
+
+    /* segment:file */
+    for( i = 0; i < sizeof(segment) / sizeof(segment[0]); i++ ) {
+        n = strlen( segment[i] );
+        if( 0 == strncasecmp(value, segment[i], n) ) {
+            if( '\0' == value[n] )
+                return -1;
+            bundle->file[i] = &value[n];
+            return 0;
+        }
+    }
+
+    /* name=value of a configure or setfuse setting */
+    return assign_setting( bundle->setting, &bundle->settings, value );
+}
+
 static int32_t assign_com_convert_option( struct programmer_arguments *args,
                                           const int32_t parameter,
                                           char *value )
@@ -940,6 +1392,9 @@ static int32_t assign_command_options( struct programmer_arguments *args,
             case com_flash:
             case com_eflash:
             case com_user:
+            case com_verify:
+            case com_apply_patch:
+            case com_flash_bundle:
                 required_params = 1;
                 if( 0 != assign_com_flash_option(args, param, argv[i]) )
                     return -3;
@@ -952,6 +1407,35 @@ static int32_t assign_command_options( struct programmer_arguments *args,
                     return -3;
                 break;
 
+            case com_checksum:
+                /* the file is optional, without one the device is read */
+                required_params = 1;
+                if( 0 != assign_com_checksum_option(args, param, argv[i]) )
+                    return -3;
+                break;
+
+            case com_diff:
+            case com_make_patch:
+                required_params = 2;
+                if( 0 != assign_com_diff_option(args, param, argv[i]) )
+                    return -3;
+                break;
+
+            case com_bundle:
+                /* any number of items */
+                required_params = param + 1;
+                if( 0 != assign_com_bundle_option(args, param, argv[i]) )
+                    return -3;
+                break;
+
+            case com_set:
+                /* any number of name=value settings */
+                required_params = param + 1;
+                if( 0 != assign_setting(args->com_set_data.setting,
+                                        &args->com_set_data.settings, argv[i]) )
+                    return -3;
+                break;
+
             case com_getfuse:
                 required_params = 1;
                 if( 0 != assign_com_getfuse_option(args, param, argv[i]) )
@@ -964,6 +1448,12 @@ static int32_t assign_command_options( struct programmer_arguments *args,
                     return -4;
                 break;
 
+            case com_manifest:
+                required_params = 1;
+                args->com_manifest_data.file = argv[i];
+                args->com_manifest_data.original_first_char = *argv[i];
+                break;
+
             default:
                 return -5;
         }
@@ -1005,6 +1495,10 @@ static void print_args( struct programmer_arguments *args )
     fprintf( stderr, "      quiet: %s\n", (0 == args->quiet) ? "false" : "true" );
     fprintf( stderr, "      debug: %d\n", debug );
     fprintf( stderr, "device_type: %s\n", args->device_type_string );
+    fprintf( stderr, "      cache: %s\n",
+             (NULL == args->cache) ? "(none)" : args->cache );
+    fprintf( stderr, "   profiles: %s\n",
+             (NULL == args->profiles) ? "(none)" : args->profiles );
     fprintf( stderr, "------ command specific below ------\n" );
 
     switch( args->command ) {
@@ -1028,11 +1522,65 @@ static void print_args( struct programmer_arguments *args )
                         "false" : "true" );
             fprintf( stderr, "   hex file: %s\n", args->com_flash_data.file );
             break;
+        case com_verify:
+            fprintf( stderr, "       hash: %s\n",
+                     digest_name(args->com_flash_data.hash) );
+            fprintf( stderr, "   hex file: %s\n", args->com_flash_data.file );
+            break;
+        case com_checksum:
+            fprintf( stderr, "       hash: %s\n",
+                     digest_name(args->com_checksum_data.hash) );
+            fprintf( stderr, "      start: 0x%X\n", args->com_checksum_data.start );
+            fprintf( stderr, "        end: 0x%X\n", args->com_checksum_data.end );
+            fprintf( stderr, "       file: %s\n",
+                     (NULL == args->com_checksum_data.file) ?
+                        "(device)" : args->com_checksum_data.file );
+            break;
+        case com_diff:
+        case com_make_patch:
+            fprintf( stderr, "        old: %s\n", args->com_diff_data.file[0] );
+            fprintf( stderr, "        new: %s\n", args->com_diff_data.file[1] );
+            fprintf( stderr, "     format: %s\n",
+                     args->com_diff_data.json ? "json" : "text" );
+            break;
+        case com_bundle:
+            fprintf( stderr, "      flash: %s\n", args->com_bundle_data.file[0] );
+            fprintf( stderr, "     eeprom: %s\n", args->com_bundle_data.file[1] );
+            fprintf( stderr, "       user: %s\n", args->com_bundle_data.file[2] );
+            fprintf( stderr, "   settings: %u\n",
+                     (uint32_t) args->com_bundle_data.settings );
+            break;
+        case com_set:
+            fprintf( stderr, "   settings: %u\n",
+                     (uint32_t) args->com_set_data.settings );
+            break;
+        case com_apply_patch:
+        case com_flash_bundle:
+            fprintf( stderr, "   validate: %s\n",
+                     (args->com_flash_data.suppress_validation) ?
+                        "false" : "true" );
+            fprintf( stderr, "%s: %s\n", (com_apply_patch == args->command) ?
+                        " patch file" : "bundle file", args->com_flash_data.file );
+            break;
+        case com_manifest:
+            fprintf( stderr, "   manifest: %s\n", args->com_manifest_data.file );
+            fprintf( stderr, "       jobs: %u\n", args->com_manifest_data.jobs );
+            fprintf( stderr, " usb limits: root %u, hub %u, tt %u\n",
+                     args->com_manifest_data.limits[TOPOLOGY_ROOT_PORT],
+                     args->com_manifest_data.limits[TOPOLOGY_HUB],
+                     args->com_manifest_data.limits[TOPOLOGY_TT] );
+            break;
         case com_get:
             fprintf( stderr, "       name: %d\n", args->com_get_data.name );
             break;
         case com_launch:
             fprintf( stderr, "   no-reset: %d\n", args->com_launch_config.noreset );
+            if( args->com_launch_config.wait ) {
+                fprintf( stderr, "       wait: %u ms for %04x:%04x\n",
+                         args->com_launch_config.timeout,
+                         args->com_launch_config.app_vendor,
+                         args->com_launch_config.app_product );
+            }
             break;
         default:
             break;
@@ -1056,6 +1604,7 @@ int32_t parse_arguments( struct programmer_arguments *args,
     args->command = com_none;
     args->quiet   = 0;
     args->suppressbootloader = 0;
+    args->stats   = 0;
 
     /* Special case - check for the help commands which do not require a device type */
     if( argc == 2 ) {
@@ -1089,21 +1638,33 @@ int32_t parse_arguments( struct programmer_arguments *args,
         return -1;
     }
 
-    if( 0 != assign_target(args, argv[1], target_map) ) {
-        fprintf( stderr, "Unsupported target '%s'.\n", argv[1]);
-        status = -3;
-        goto done;
-    }
+    if( 0 == strcasecmp(argv[1], "manifest") ) {
+        /* the manifest names the target of each board */
+        args->command = com_manifest;
+        args->com_manifest_data.file = NULL;
+        args->com_manifest_data.jobs = MANIFEST_DEFAULT_WORKERS;
+        memset( args->com_manifest_data.limits, 0,
+                sizeof(args->com_manifest_data.limits) );
+        *argv[0] = '\0';
+        *argv[1] = '\0';
+    } else {
+        if( 0 != assign_target(args, argv[1], target_map) ) {
+            fprintf( stderr, "Unsupported target '%s'.\n", argv[1]);
+            status = -3;
+            goto done;
+        }
 
-    if( 0 != assign_option((int32_t *) &(args->command), argv[2], command_map) ) {
-        status = -4;
-        goto done;
-    }
+        if( 0 != assign_option((int32_t *) &(args->command), argv[2],
+                               command_map) ) {
+            status = -4;
+            goto done;
+        }
 
-    /* These were taken care of above. */
-    *argv[0] = '\0';
-    *argv[1] = '\0';
-    *argv[2] = '\0';
+        /* These were taken care of above. */
+        *argv[0] = '\0';
+        *argv[1] = '\0';
+        *argv[2] = '\0';
+    }
 
     /* assign command specific default values */
     switch( args->command ) {
@@ -1111,16 +1672,47 @@ int32_t parse_arguments( struct programmer_arguments *args,
             args->com_flash_data.force = 0;
             args->com_flash_data.segment = mem_flash;
             break;
+        case com_verify :
+            args->com_flash_data.segment = mem_flash;
+            args->com_flash_data.hash = DIGEST_NONE;
+            break;
+        case com_checksum :
+            args->com_checksum_data.hash = DIGEST_CRC32;
+            args->com_checksum_data.bin = 0;
+            args->com_checksum_data.start = UINT32_MAX;
+            args->com_checksum_data.end = UINT32_MAX;
+            args->com_checksum_data.file = NULL;
+            args->com_checksum_data.segment = mem_flash;
+            break;
         case com_launch :
             args->com_launch_config.noreset = 0;
+            args->com_launch_config.wait = false;
+            args->com_launch_config.timeout = LAUNCH_WAIT_TIMEOUT;
+            args->com_launch_config.app_vendor = 0;
+            args->com_launch_config.app_product = 0;
             break;
         case com_dump :
             args->com_read_data.segment = mem_flash;
             args->com_flash_data.force = 0;
+            args->com_read_data.fill = 0xff;
+            break;
+        case com_read :
+        case com_edump :
+        case com_udump :
+            args->com_read_data.fill = 0xff;
             break;
         case com_bin2hex :
             args->com_convert_data.segment = mem_flash;
             break;
+        case com_hex2bin :
+            args->com_convert_data.fill = 0xff;
+            break;
+        case com_diff :
+        case com_make_patch :
+            args->com_diff_data.bin = 0;
+            args->com_diff_data.json = false;
+            args->com_diff_data.segment = mem_flash;
+            break;
         default :
             break;
     }
@@ -1146,7 +1738,9 @@ int32_t parse_arguments( struct programmer_arguments *args,
 
     /* if this is a flash command, restore the filename */
     if( (com_flash == args->command) || (com_eflash == args->command)
-            || (com_user == args->command) ) {
+            || (com_user == args->command) || (com_verify == args->command)
+            || (com_apply_patch == args->command)
+            || (com_flash_bundle == args->command) ) {
         if( 0 == args->com_flash_data.file ) {
 // TODO : it should be ok to not have a filename if --serial=hexdigits:offset is
 // provided, this should be implemented.. in fact, given that most of this
@@ -1169,6 +1763,24 @@ int32_t parse_arguments( struct programmer_arguments *args,
         args->com_convert_data.file[0] = args->com_convert_data.original_first_char;
     }
 
+    if( com_manifest == args->command ) {
+        args->com_manifest_data.file[0] =
+            args->com_manifest_data.original_first_char;
+    }
+
+    if( (com_checksum == args->command) &&
+            (NULL != args->com_checksum_data.file) ) {
+        args->com_checksum_data.file[0] =
+            args->com_checksum_data.original_first_char;
+    }
+
+    if( (com_diff == args->command) || (com_make_patch == args->command) ) {
+        for( i = 0; i < 2; i++ ) {
+            args->com_diff_data.file[i][0] =
+                args->com_diff_data.original_first_char[i];
+        }
+    }
+
 done:
     if( 1 < debug ) {
         print_args( args );
@@ -24,8 +24,12 @@
 #include "dfu-bool.h"
 #include "dfu-device.h"
 #include "atmel.h"
+#include "overlay.h"
 
 #define DEVICE_TYPE_STRING_MAX_LENGTH   6
+#define BUNDLE_MAX_SETTINGS             16
+#define LAUNCH_WAIT_TIMEOUT             5000    /* ms launch --wait gives
+                                                   the application */
 /*
  *  atmel_programmer target command
  *
@@ -129,13 +133,16 @@ enum targets_enum { tar_at89c51snd1c,
                     tar_stm32f4_C,
                     tar_stm32f4_E,
                     tar_stm32f4_G,
+                    tar_stm32,
                     tar_none };
 
 enum commands_enum { com_none, com_erase, com_flash, com_user, com_eflash,
                      com_configure, com_get, com_getfuse, com_dump, com_edump,
                      com_udump, com_setfuse, com_setsecure, com_start_app,
                      com_reset, com_launch, com_read, com_hex2bin, com_bin2hex,
-                     com_dfumode };
+                     com_dfumode, com_verify, com_checksum, com_diff,
+                     com_make_patch, com_apply_patch, com_bundle,
+                     com_flash_bundle, com_autotune, com_manifest, com_set };
 
 enum configure_enum { conf_BSB = ATMEL_SET_CONFIG_BSB,
                       conf_SBV = ATMEL_SET_CONFIG_SBV,
@@ -155,6 +162,12 @@ enum getfuse_enum { get_lock, get_epfl, get_bootprot, get_bodlevel,
                     get_bodhyst, get_boden, get_isp_bod_en,
                     get_isp_io_cond_en, get_isp_force };
 
+struct setting_struct {
+    dfu_bool fuse;              /* setfuse, otherwise configure */
+    int32_t name;               /* setfuse_enum or configure_enum */
+    int32_t value;
+};
+
 struct programmer_arguments {
     /* target-specific inputs */
     enum targets_enum target;
@@ -180,6 +193,11 @@ struct programmer_arguments {
     enum commands_enum command;
     char quiet;
     char suppressbootloader;
+    char stats;                 /* print transfer statistics when done */
+    char *cache;                /* directory of parsed hex files, NULL
+                                   parses them every time */
+    char *profiles;             /* file of tuned bootloader settings, NULL
+                                   uses the built in ones */
 
     union {
         struct com_configure_struct {
@@ -195,7 +213,9 @@ struct programmer_arguments {
 
         struct com_read_struct {
             dfu_bool bin;
+            dfu_bool dfu;               /* DfuSe file output */
             dfu_bool force;             /* do not remove blank pages */
+            uint8_t fill;               /* binary output of erased bytes */
             enum atmel_memory_unit_enum segment;
         } com_read_data;
 
@@ -206,15 +226,29 @@ struct programmer_arguments {
 
         struct com_launch_struct {
             dfu_bool noreset;
+            dfu_bool wait;              /* until the application is on
+                                           the bus, report how long it took */
+            uint32_t timeout;           /* ms to wait for it */
+            uint16_t app_vendor;        /* ids of the application, 0 for */
+            uint16_t app_product;       /*   any on the port of the board */
         } com_launch_config;
 
         struct com_flash_struct {
             int32_t suppress_validation;
             char original_first_char;
             char *file;
-            int16_t *serial_data; /* serial number or other device specific bytes */
-            size_t serial_offset; /* where the serial_data should be written */
-            size_t serial_length; /* how many bytes to write */
+            image_overlay_t overlay;  /* serial numbers or other device
+                                     specific bytes written over the file */
+            char *checkpoint;     /* file used to resume an interrupted
+                                     programming run, NULL if not used */
+            int32_t hash;         /* digest_algorithm verify streams the
+                                     read back through, DIGEST_NONE compares
+                                     against the whole image instead */
+            const intel_buffer_out_t *image;  /* file loaded by the manifest
+                                     runner and shared by its jobs, NULL
+                                     reads file */
+            const atmel_frames_t *frames;   /* encoded from image once
+                                     for every job, NULL if not */
             dfu_bool force;       /* bootloader configuration for UC3 devices
                                      is on last one or two words in the user
                                      page depending on the version of the
@@ -226,10 +260,52 @@ struct programmer_arguments {
             size_t bin_offset;          // where the bin data starts
             char original_first_char;
             dfu_bool force;             /* do not remove blank pages */
+            uint8_t fill;               /* hex2bin output of unassigned bytes */
             char *file;                 // for bin2hex / hex2bin conversions
             enum atmel_memory_unit_enum segment;    // to auto-select offset
         } com_convert_data;
 
+        struct com_checksum_struct {
+            int32_t hash;               /* digest_algorithm to compute */
+            dfu_bool bin;               /* file is a binary image, not ihex */
+            uint32_t start;             /* first address of the range and */
+            uint32_t end;               /* the last, UINT32_MAX for the
+                                           bottom or top of the segment */
+            char original_first_char;
+            char *file;                 /* NULL to read the device instead */
+            enum atmel_memory_unit_enum segment;
+        } com_checksum_data;
+
+        struct com_diff_struct {
+            dfu_bool bin;               /* files are binary images */
+            dfu_bool json;              /* machine readable output */
+            char original_first_char[2];
+            char *file[2];              /* the old and the new image */
+            enum atmel_memory_unit_enum segment;
+        } com_diff_data;                /* make-patch takes the same */
+
+        struct com_bundle_struct {
+            char *file[3];              /* flash, eeprom and user page hex
+                                           files, NULL when not bundled */
+            size_t settings;
+            struct setting_struct setting[BUNDLE_MAX_SETTINGS];
+        } com_bundle_data;
+
+        struct com_set_struct {
+            size_t settings;            /* written in one pass, the last
+                                           of a name wins */
+            struct setting_struct setting[BUNDLE_MAX_SETTINGS];
+        } com_set_data;
+
+        struct com_manifest_struct {
+            char original_first_char;
+            char *file;                 /* the boards and their commands */
+            uint32_t jobs;              /* boards programmed at once */
+            uint32_t limits[DFU_TOPOLOGY_NODES];    /* transfers in flight
+                                           through each root port, hub and
+                                           translator, 0 is no limit */
+        } com_manifest_data;
+
         struct com_get_struct {
             enum get_enum name;
         } com_get_data;
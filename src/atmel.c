@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
 #include <errno.h>
@@ -49,10 +50,18 @@
                                         ATMEL_AVR32_CONTROL_BLOCK_SIZE +    \
                                         ATMEL_FOOTER_SIZE)
 
+#define ATMEL_PAGE_SELECT_SIZE          5
 #define ATMEL_FOOTER_SIZE               16
 #define ATMEL_CONTROL_BLOCK_SIZE        32
 #define ATMEL_AVR32_CONTROL_BLOCK_SIZE  64
 
+/* the AVR32 config memory holds one fuse bit in each of its bytes */
+#define ATMEL_FUSE_BITS                 32
+
+/* bounds (in ms) for the bwPollTimeout used while waiting for an erase */
+#define ATMEL_ERASE_POLL_MIN    5
+#define ATMEL_ERASE_POLL_MAX    100
+
 #define ATMEL_DEBUG_THRESHOLD   50
 #define ATMEL_TRACE_THRESHOLD   55
 
@@ -70,6 +79,14 @@
 
 extern int debug;       /* defined in main.c */
 
+/* where atmel_flash is in frames that may be sent among shared ones */
+typedef struct {
+    size_t own;             // next of the frames themselves
+    size_t base;            // next of frames->base
+    size_t cover;           // first own frame that may replace base ones
+    dfu_bool at_base;       // the frame last returned is from base
+} atmel_cursor_t;
+
 // ________  P R O T O T Y P E S  _______________________________
 static int32_t atmel_read_command( dfu_device_t *device,
                                    const uint8_t data0,
@@ -88,6 +105,17 @@ static int32_t __atmel_flash_block( dfu_device_t *device,
  * code if one is obtained, or negative if communitcation with device fails.
  */
 
+static int32_t atmel_fuse_bits( uint16_t *fuses,
+                                const uint8_t property,
+                                const uint32_t value,
+                                uint32_t *first,
+                                uint32_t *last );
+/* store the bits of value for a setfuse property at their addresses in
+ * fuses, which holds one byte of the config memory per entry, and set first
+ * and last to the addresses used.  returns 0 on success, -1 if the property
+ * may not be set in this build or -2 if it is unknown
+ */
+
 static int32_t atmel_select_memory_unit( dfu_device_t *device,
         enum atmel_memory_unit_enum unit );
 /* select a memory unit from the following list (enumerated)
@@ -111,6 +139,24 @@ static int32_t __atmel_blank_page_check( dfu_device_t *device,
  * returns a negative number if the blank check fails
  */
 
+static int32_t atmel_blank_check_range( dfu_device_t *device,
+                                        const uint32_t start,
+                                        const uint32_t end );
+/* blank check start to end (inclusive) one 64kB page at a time, the memory
+ * unit must already be selected.  returns 0 when blank, the first address
+ * that is not blank + 1, or < 0 on communication errors
+ */
+
+static dfu_bool atmel_page_populated( intel_buffer_out_t *bout,
+                                      const uint32_t page );
+/* true if the image writes anything in the flash page starting at page
+ */
+
+static int32_t atmel_blank_check_resume( dfu_device_t *device );
+/* clear the error status a failed blank check may leave behind so checking
+ * can continue, returns 0 on success or < 0 on communication errors
+ */
+
 static int32_t __atmel_read_block( dfu_device_t *device,
                                    intel_buffer_in_t *buin,
                                    const dfu_bool eeprom );
@@ -120,12 +166,109 @@ static int32_t __atmel_read_block( dfu_device_t *device,
  * data between data_start and data_end
  */
 
+static int32_t atmel_read_range( dfu_device_t *device,
+                                 const uint32_t start,
+                                 const uint32_t end,
+                                 const dfu_bool eeprom,
+                                 uint8_t *data );
+/* read start to end (64kB page relative, same limits as __atmel_read_block)
+ * into data
+ */
+
+static int32_t atmel_read_blocks( dfu_device_t *device,
+                                  intel_buffer_info_t *info,
+                                  const uint8_t mem_segment,
+                                  uint8_t *data,
+                                  dfu_block_sink_t sink,
+                                  void *context,
+                                  const dfu_bool quiet );
+/* read info->data_start to info->data_end one transfer at a time.  each block
+ * is stored in data (indexed by address) when data is not NULL, otherwise it
+ * is read into the transfer buffer, and is then passed to sink if there is
+ * one
+ */
+
 static inline void __print_progress( intel_buffer_info_t *info,
                                         uint32_t *progress );
 /* calculate how many progress indicator steps to print and print them
  * update progress value
  */
 
+static size_t atmel_encode_page_select( uint8_t *command,
+                                        const atmel_device_class_t type,
+                                        const uint16_t mem_page );
+/* encode the command selecting a 64kB page into command (at least
+ * ATMEL_PAGE_SELECT_SIZE bytes), returns its length or 0 if the device
+ * class has no page select
+ */
+
+static size_t atmel_encode_block( uint8_t *message,
+                                  const uint16_t *data,
+                                  const uint32_t start,
+                                  const uint32_t end,
+                                  const atmel_device_class_t type,
+                                  const dfu_bool eeprom );
+/* encode the download message (header, aligned data and footer) that
+ * programs addresses start to end with data[0] to data[end - start] into
+ * message (at least ATMEL_MAX_FLASH_BUFFER_SIZE bytes), returns the
+ * message length
+ */
+
+static int32_t atmel_send_frame( dfu_device_t *device,
+                                 uint8_t *message,
+                                 const size_t length );
+/* download an encoded message and check the resulting status.  returns 0 on
+ * success, positive dfu error code if one is obtained, or negative if
+ * communication with the device fails
+ */
+
+static int32_t atmel_frames_add( atmel_frames_t *frames,
+                                 const uint16_t *data,
+                                 const uint8_t kind,
+                                 const uint16_t page,
+                                 const uint32_t start,
+                                 const uint32_t end );
+/* append a page select or data frame, data[0] being the value of start,
+ * growing the arena and frame table as needed.  returns 0 on success,
+ * negative if out of memory
+ */
+
+static int32_t atmel_frames_encode( atmel_frames_t *frames,
+                                    const uint16_t *data,
+                                    const uint32_t first,
+                                    const uint32_t last );
+/* append the page select and data frames for addresses first to last,
+ * data[0] being the value of first, split as atmel_flash always has.
+ * returns 0 on success, negative if out of memory
+ */
+
+static const atmel_frame_t *atmel_frames_next( const atmel_frames_t *frames,
+                                               atmel_cursor_t *cursor,
+                                               const uint8_t **arena );
+/* the frame to send at cursor and the arena it is encoded in, or NULL
+ * when every frame is sent.  frames of frames->base that frames replace
+ * are stepped over
+ */
+
+static void atmel_frames_step( atmel_cursor_t *cursor );
+/* move cursor past the frame atmel_frames_next returned
+ */
+
+static size_t atmel_transfer_size( const size_t requested );
+/* the data bytes per frame for a profile transfer size, where 0 or too
+ * large a size means ATMEL_MAX_TRANSFER_SIZE
+ */
+
+static int32_t atmel_flash_recover( dfu_device_t *device,
+                                    dfu_checkpoint_t *checkpoint,
+                                    const dfu_bool eeprom,
+                                    const uint16_t mem_page );
+/* after a failed transfer, spend one of the checkpoint retries bringing the
+ * device back to dfuIDLE and re-selecting the memory unit and 64kB page.
+ * returns 0 if the block at the checkpoint should be sent again, negative
+ * if there is no checkpoint, no retries are left or recovery failed
+ */
+
 // ________  F U N C T I O N S  _______________________________
 static int32_t atmel_read_command( dfu_device_t *device,
                                    const uint8_t data0,
@@ -207,12 +350,12 @@ static inline void __print_progress( intel_buffer_info_t *info,
 int32_t atmel_read_fuses( dfu_device_t *device,
                            atmel_avr32_fuses_t *info ) {
     intel_buffer_in_t buin;
-    uint8_t buffer[32];
+    uint8_t buffer[ATMEL_FUSE_BITS];
     int i;
 
     // init the necessary parts of buin
     buin.info.block_start = 0;
-    buin.info.block_end = 31;
+    buin.info.block_end = ATMEL_FUSE_BITS - 1;
     buin.data = buffer;
 
     if( NULL == device ) {
@@ -317,12 +460,28 @@ int32_t atmel_read_config( dfu_device_t *device,
     return retVal;
 }
 
+int32_t atmel_read_version( dfu_device_t *device ) {
+    TRACE( "%s( %p )\n", __FUNCTION__, device );
+
+    if( NULL == device ) {
+        DEBUG( "invalid arguments.\n" );
+        return -1;
+    }
+
+    // the first row of the atmel_read_config table for the device class
+    if( (ADC_AVR32 | ADC_XMEGA) & device->type ) {
+        return atmel_read_command( device, 0x04, 0x00 );
+    }
+    return atmel_read_command( device, 0x00, 0x00 );
+}
+
 int32_t atmel_erase_flash( dfu_device_t *device,
                            const uint8_t mode,
                            dfu_bool quiet ) {
     uint8_t command[3] = { 0x04, 0x00, 0x00 };
     dfu_status_t status;
     int32_t retries;
+    uint32_t poll;
     time_t start;
 
     TRACE( "%s( %p, %d )\n", __FUNCTION__, device, mode );
@@ -349,7 +508,9 @@ int32_t atmel_erase_flash( dfu_device_t *device,
     }
 
     if( !quiet ) fprintf( stderr, "Erasing flash...  " );
+    dfu_expect_slow( device, DFU_TIMEOUT );
     if( 3 != dfu_download(device, 3, command) ) {
+        dfu_expect_slow( device, 0 );
         if( !quiet ) fprintf( stderr, "ERROR\n" );
         DEBUG( "dfu_download failed\n" );
         return -2;
@@ -369,11 +530,21 @@ int32_t atmel_erase_flash( dfu_device_t *device,
             // Status return is valid
             if( (DFU_STATUS_ERROR_NOTDONE == status.bStatus) &&
                 (STATE_DFU_DOWNLOAD_BUSY == status.bState) ) {
-                // Erase is still in progress.
-                // Wait 100ms and get status again.
-                usleep(100000);
+                // Erase is still in progress.  Wait as long as the profile
+                // or else the device asked for (within limits) and get
+                // status again.
+                poll = status.bwPollTimeout;
+                if( 0 != device->profile.erase_poll ) {
+                    poll = device->profile.erase_poll;
+                } else if( poll < ATMEL_ERASE_POLL_MIN ) {
+                    poll = ATMEL_ERASE_POLL_MIN;
+                } else if( poll > ATMEL_ERASE_POLL_MAX ) {
+                    poll = ATMEL_ERASE_POLL_MAX;
+                }
+                usleep( 1000 * poll );
             } else {
                 // Erase complete.
+                dfu_expect_slow( device, 0 );
                 if( !quiet ) fprintf( stderr, "Success\n" );
                 DEBUG ( "CMD_ERASE status: Erase Done.\n" );
                 return status.bStatus;
@@ -386,6 +557,7 @@ int32_t atmel_erase_flash( dfu_device_t *device,
             DEBUG ( "CMD_ERASE status check %d returned nonzero.\n", retries );
         }
     } while( (retries < 10) && (start != -1) && ((time(NULL) - start) < ERASE_SECONDS) );
+    dfu_expect_slow( device, 0 );
 
     if( retries < 10 )
         DEBUG ( "CMD_ERASE time limit %ds exceeded.\n", ERASE_SECONDS );
@@ -393,47 +565,25 @@ int32_t atmel_erase_flash( dfu_device_t *device,
     return -3;
 }
 
-int32_t atmel_set_fuse( dfu_device_t *device,
-                        const uint8_t property,
-                        const uint32_t value ) {
-    uint16_t buffer[16];
-    int32_t address;
-    int8_t numbytes;
-    int8_t i;
-    intel_buffer_out_t bout;
-
-    if( NULL == device ) {
-        DEBUG( "invalid arguments.\n" );
-        return -1;
-    }
-
-    if( !(ADC_AVR32 & device->type) ) {
-       DEBUG( "target does not support fuse operation.\n" );
-       fprintf( stderr, "target does not support fuse operation.\n" );
-       return -1;
-    }
-
-    if( 0 != atmel_select_memory_unit(device, mem_config) ) {
-        return -3;
-    }
+static int32_t atmel_fuse_bits( uint16_t *fuses,
+                                const uint8_t property,
+                                const uint32_t value,
+                                uint32_t *first,
+                                uint32_t *last ) {
+    uint32_t address;
+    uint32_t numbytes;
+    uint32_t i;
 
     switch( property ) {
         case set_lock:
-            for( i = 0; i < 16; i++ ) {
-                buffer[i] = value & (0x0001 << i);
-            }
             numbytes = 16;
             address = 0;
             break;
         case set_epfl:
-            buffer[0] = value & 0x0001;
             numbytes = 1;
             address = 16;
             break;
         case set_bootprot:
-            buffer[0] = value & 0x0001;
-            buffer[1] = value & 0x0002;
-            buffer[2] = value & 0x0004;
             numbytes = 3;
             address = 17;
             break;
@@ -441,9 +591,6 @@ int32_t atmel_set_fuse( dfu_device_t *device,
 #ifdef SUPPORT_SET_BOD_FUSES
             /* Enable at your own risk - this has not been tested &
              * may brick your device. */
-            for(i = 20;i < 26; i++){
-                buffer[i] = value & (0x0001 << (i-20));
-            }
             numbytes = 6;
             address = 20;
             break;
@@ -457,7 +604,6 @@ int32_t atmel_set_fuse( dfu_device_t *device,
 #ifdef SUPPORT_SET_BOD_FUSES
             /* Enable at your own risk - this has not been tested &
              * may brick your device. */
-            buffer[0] = value & 0x0001;
             numbytes = 1;
             address = 26;
             break;
@@ -471,8 +617,6 @@ int32_t atmel_set_fuse( dfu_device_t *device,
 #ifdef SUPPORT_SET_BOD_FUSES
             /* Enable at your own risk - this has not been tested &
              * may brick your device. */
-            buffer[0] = value & 0x0001;
-            buffer[1] = value & 0x0002;
             numbytes = 2;
             address = 27;
             break;
@@ -486,7 +630,6 @@ int32_t atmel_set_fuse( dfu_device_t *device,
 #ifdef SUPPORT_SET_BOD_FUSES
             /* Enable at your own risk - this has not been tested &
              * may brick your device. */
-            buffer[0] = value & 0x0001;
             numbytes = 1;
             address = 29;
             break;
@@ -497,12 +640,10 @@ int32_t atmel_set_fuse( dfu_device_t *device,
             return -1;
 #endif
         case set_isp_io_cond_en:
-            buffer[0] = value & 0x0001;
             numbytes = 1;
             address = 30;
             break;
         case set_isp_force:
-            buffer[0] = value & 0x0001;
             numbytes = 1;
             address = 31;
             break;
@@ -513,14 +654,136 @@ int32_t atmel_set_fuse( dfu_device_t *device,
             break;
     }
 
+    // each byte of the config memory holds one fuse bit
+    for( i = 0; i < numbytes; i++ ) {
+        fuses[address + i] = (value >> i) & 0x0001;
+    }
+    *first = address;
+    *last = address + numbytes - 1;
+
+    return 0;
+}
+
+int32_t atmel_set_fuse( dfu_device_t *device,
+                        const uint8_t property,
+                        const uint32_t value ) {
+    uint16_t buffer[ATMEL_FUSE_BITS];
+    uint32_t first;
+    uint32_t last;
+    int32_t result;
+    intel_buffer_out_t bout;
+
+    if( NULL == device ) {
+        DEBUG( "invalid arguments.\n" );
+        return -1;
+    }
+
+    if( !(ADC_AVR32 & device->type) ) {
+       DEBUG( "target does not support fuse operation.\n" );
+       fprintf( stderr, "target does not support fuse operation.\n" );
+       return -1;
+    }
+
+    if( 0 != atmel_select_memory_unit(device, mem_config) ) {
+        return -3;
+    }
+
+    if( 0 != (result = atmel_fuse_bits(buffer, property, value,
+                                       &first, &last)) ) {
+        return result;
+    }
+
     bout.data = buffer;
-    bout.info.block_start = address;
-    bout.info.block_end = address + numbytes - 1;
+    bout.info.block_start = first;
+    bout.info.block_end = last;
+
+    if( 0 != __atmel_flash_block(device, &bout, false) ) {
+        return -6;
+    }
+
+    return 0;
+}
+
+int32_t atmel_set_fuses( dfu_device_t *device,
+                         const uint8_t *properties,
+                         const uint32_t *values,
+                         const size_t count ) {
+    uint8_t current[ATMEL_FUSE_BITS];
+    uint16_t wanted[ATMEL_FUSE_BITS];
+    intel_buffer_in_t buin;
+    intel_buffer_out_t bout;
+    uint32_t first;
+    uint32_t last;
+    int32_t result;
+    size_t i;
+
+    TRACE( "%s( %p, %p, %p, %u )\n", __FUNCTION__, device, properties,
+           values, (uint32_t) count );
+
+    if( (NULL == device) || ((0 != count) &&
+                ((NULL == properties) || (NULL == values))) ) {
+        DEBUG( "invalid arguments.\n" );
+        return -1;
+    }
+
+    if( !(ADC_AVR32 & device->type) ) {
+       DEBUG( "target does not support fuse operation.\n" );
+       fprintf( stderr, "target does not support fuse operation.\n" );
+       return -1;
+    }
+
+    if( 0 != atmel_select_memory_unit(device, mem_config) ) {
+        return -3;
+    }
+
+    // start from what the device holds so unnamed fuses are kept
+    buin.info.block_start = 0;
+    buin.info.block_end = ATMEL_FUSE_BITS - 1;
+    buin.data = current;
+    if( 0 != __atmel_read_block(device, &buin, false) ) {
+        return -5;
+    }
+    for( i = 0; i < ATMEL_FUSE_BITS; i++ ) {
+        wanted[i] = current[i];
+    }
+    for( i = 0; i < count; i++ ) {
+        if( 0 != (result = atmel_fuse_bits(wanted, properties[i], values[i],
+                                           &first, &last)) ) {
+            return result;
+        }
+    }
+
+    // one block from the first to the last fuse that changes
+    for( first = 0; first < ATMEL_FUSE_BITS; first++ ) {
+        if( wanted[first] != current[first] ) break;
+    }
+    if( ATMEL_FUSE_BITS == first ) {
+        DEBUG( "The fuses are already set.\n" );
+        return 0;
+    }
+    for( last = ATMEL_FUSE_BITS - 1; last > first; last-- ) {
+        if( wanted[last] != current[last] ) break;
+    }
+    DEBUG( "Writing fuses %u to %u.\n", first, last );
 
+    bout.data = wanted;
+    bout.info.block_start = first;
+    bout.info.block_end = last;
     if( 0 != __atmel_flash_block(device, &bout, false) ) {
         return -6;
     }
 
+    if( 0 != __atmel_read_block(device, &buin, false) ) {
+        return -5;
+    }
+    for( i = 0; i < ATMEL_FUSE_BITS; i++ ) {
+        if( wanted[i] != current[i] ) {
+            DEBUG( "Fuse %u reads 0x%02X, expected 0x%02X.\n", (uint32_t) i,
+                   current[i], wanted[i] );
+            return -7;
+        }
+    }
+
     return 0;
 }
 
@@ -573,14 +836,23 @@ int32_t atmel_set_config( dfu_device_t *device,
 static int32_t __atmel_read_block( dfu_device_t *device,
                                    intel_buffer_in_t *buin,
                                    const dfu_bool eeprom ) {
+    return atmel_read_range( device, buin->info.block_start,
+            buin->info.block_end, eeprom, &buin->data[buin->info.block_start] );
+}
+
+static int32_t atmel_read_range( dfu_device_t *device,
+                                 const uint32_t start,
+                                 const uint32_t end,
+                                 const dfu_bool eeprom,
+                                 uint8_t *data ) {
     uint8_t command[6] = { 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 };
     int32_t result;
 
-    if( buin->info.block_end < buin->info.block_start ) {
+    if( end < start ) {
         // this would cause a problem bc read length could be way off
         DEBUG("ERROR: start address is after end address.\n");
         return -1;
-    } else if( buin->info.block_end - buin->info.block_start + 1 > ATMEL_MAX_TRANSFER_SIZE ) {
+    } else if( end - start + 1 > ATMEL_MAX_TRANSFER_SIZE ) {
         // this could cause a read problem
         DEBUG("ERROR: transfer size must not exceed %d.\n",
                 ATMEL_MAX_TRANSFER_SIZE );
@@ -592,18 +864,17 @@ static int32_t __atmel_read_block( dfu_device_t *device,
         command[1] = 0x02;
     }
 
-    command[2] = 0xff & (buin->info.block_start >> 8);
-    command[3] = 0xff & (buin->info.block_start);
-    command[4] = 0xff & (buin->info.block_end >> 8);
-    command[5] = 0xff & (buin->info.block_end);
+    command[2] = 0xff & (start >> 8);
+    command[3] = 0xff & start;
+    command[4] = 0xff & (end >> 8);
+    command[5] = 0xff & end;
 
     if( 6 != dfu_download(device, 6, command) ) {
         DEBUG( "dfu_download failed\n" );
         return -1;
     }
 
-    result = dfu_upload( device, buin->info.block_end - buin->info.block_start + 1,
-                                &buin->data[buin->info.block_start] );
+    result = dfu_upload( device, end - start + 1, data );
     if( result < 0) {
         dfu_status_t status;
 
@@ -630,12 +901,6 @@ int32_t atmel_read_flash( dfu_device_t *device,
                           intel_buffer_in_t *buin,
                           const uint8_t mem_segment,
                           const dfu_bool quiet ) {
-    uint8_t mem_page = 0;           // tracks the current memory page
-    uint32_t progress = 0;          // used to indicate progress
-    int32_t result = 0;
-    // TODO : use status instead of result
-    int32_t retval = -1;            // the return value for this function
-
     TRACE( "%s( %p, %p, %u, %s )\n", __FUNCTION__, device, buin,
             mem_segment, ((true == quiet) ? "true" : "false"));
 
@@ -644,7 +909,54 @@ int32_t atmel_read_flash( dfu_device_t *device,
         if( !quiet )
             fprintf( stderr, "Program Error, use debug for more info.\n" );
         return -1;
-    } else if ( mem_segment != mem_flash &&
+    }
+
+    return atmel_read_blocks( device, &buin->info, mem_segment, buin->data,
+                              NULL, NULL, quiet );
+}
+
+int32_t atmel_read_stream( dfu_device_t *device,
+                           const uint32_t start,
+                           const uint32_t end,
+                           const uint8_t mem_segment,
+                           dfu_block_sink_t sink,
+                           void *context,
+                           const dfu_bool quiet ) {
+    intel_buffer_info_t info;
+
+    TRACE( "%s( %p, 0x%X, 0x%X, %u, %s )\n", __FUNCTION__, device, start, end,
+            mem_segment, ((true == quiet) ? "true" : "false"));
+
+    if( (NULL == device) || (NULL == sink) || (start > end) ) {
+        DEBUG( "invalid arguments.\n" );
+        if( !quiet )
+            fprintf( stderr, "Program Error, use debug for more info.\n" );
+        return -1;
+    }
+
+    memset( &info, 0, sizeof(info) );
+    info.data_start = start;
+    info.data_end = end;
+
+    return atmel_read_blocks( device, &info, mem_segment, NULL,
+                              sink, context, quiet );
+}
+
+static int32_t atmel_read_blocks( dfu_device_t *device,
+                                  intel_buffer_info_t *info,
+                                  const uint8_t mem_segment,
+                                  uint8_t *data,
+                                  dfu_block_sink_t sink,
+                                  void *context,
+                                  const dfu_bool quiet ) {
+    uint8_t mem_page = 0;           // tracks the current memory page
+    uint32_t progress = 0;          // used to indicate progress
+    uint8_t *block;                 // where the current block is read to
+    int32_t result = 0;
+    // TODO : use status instead of result
+    int32_t retval = -1;            // the return value for this function
+
+    if ( mem_segment != mem_flash &&
                 mem_segment != mem_user &&
                 mem_segment != mem_eeprom ) {
         DEBUG( "Invalid memory segment %d to read.\n", mem_segment );
@@ -653,6 +965,14 @@ int32_t atmel_read_flash( dfu_device_t *device,
         return -1;
     }
 
+    // without a destination, blocks go through the transfer buffer
+    if( (NULL == data) && (NULL == (block = dfu_transfer_buffer(device,
+                    ATMEL_MAX_TRANSFER_SIZE))) ) {
+        if( !quiet )
+            fprintf( stderr, "Program Error, use debug for more info.\n" );
+        return -1;
+    }
+
     // For the AVR32/XMEGA chips, select the flash space. (safe for all parts)
     if( 0 != atmel_select_memory_unit(device, mem_segment) ) {
         DEBUG ("Error selecting memory unit.\n");
@@ -667,7 +987,7 @@ int32_t atmel_read_flash( dfu_device_t *device,
             fprintf( stderr, PROGRESS_METER );
         }
         fprintf( stderr, "Reading 0x%X bytes...\n",
-                buin->info.data_end - buin->info.data_start + 1 );
+                info->data_end - info->data_start + 1 );
         if( debug <= ATMEL_DEBUG_THRESHOLD ) {
             // NOTE: From here on we should go to finally on error
             fprintf( stderr, PROGRESS_START );
@@ -675,8 +995,8 @@ int32_t atmel_read_flash( dfu_device_t *device,
     }
 
     // select the first memory page ( not safe for mem_user )
-    buin->info.block_start = buin->info.data_start;
-    mem_page = buin->info.block_start / ATMEL_64KB_PAGE;
+    info->block_start = info->data_start;
+    mem_page = info->block_start / ATMEL_64KB_PAGE;
     if ( mem_segment != mem_user ) {
         if( 0 != (result = atmel_select_page( device, mem_page )) ) {
             DEBUG( "ERROR selecting 64kB page %d.\n", result );
@@ -685,10 +1005,10 @@ int32_t atmel_read_flash( dfu_device_t *device,
         }
     }
 
-    while (buin->info.block_start <= buin->info.data_end) {
+    while (info->block_start <= info->data_end) {
         // ensure the memory page is correct
-        if ( buin->info.block_start / ATMEL_64KB_PAGE != mem_page ) {
-            mem_page = buin->info.block_start / ATMEL_64KB_PAGE;
+        if ( info->block_start / ATMEL_64KB_PAGE != mem_page ) {
+            mem_page = info->block_start / ATMEL_64KB_PAGE;
             if( 0 != (result = atmel_select_page( device, mem_page )) ) {
                 DEBUG( "ERROR selecting 64kB page %d.\n", result );
                 retval = -3;
@@ -697,25 +1017,38 @@ int32_t atmel_read_flash( dfu_device_t *device,
         }
 
         // find end value for the current transfer
-        buin->info.block_end = buin->info.block_start +
+        info->block_end = info->block_start +
             ATMEL_MAX_TRANSFER_SIZE - 1;
-        if ( buin->info.block_end / ATMEL_64KB_PAGE > mem_page ) {
-            buin->info.block_end = ATMEL_64KB_PAGE * mem_page - 1;
+        if ( info->block_end / ATMEL_64KB_PAGE > mem_page ) {
+            info->block_end = ATMEL_64KB_PAGE * mem_page - 1;
         }
-        if ( buin->info.block_end > buin->info.data_end ) {
-            buin->info.block_end = buin->info.data_end;
+        if ( info->block_end > info->data_end ) {
+            info->block_end = info->data_end;
+        }
+
+        if( NULL != data ) {
+            block = &data[info->block_start];
         }
 
-        if( 0 != (result = __atmel_read_block(device, buin,
-                    mem_segment == mem_eeprom ? 1 : 0)) ) {
+        if( 0 != (result = atmel_read_range(device, info->block_start,
+                    info->block_end, mem_segment == mem_eeprom ? 1 : 0,
+                    block)) ) {
             DEBUG( "Error reading block 0x%X to 0x%X: err %d.\n",
-                    buin->info.block_start, buin->info.block_end, result );
+                    info->block_start, info->block_end, result );
             retval = -5;
             goto finally;
         }
 
-        buin->info.block_start = buin->info.block_end + 1;
-        if ( !quiet ) __print_progress( &buin->info, &progress );
+        if( (NULL != sink) && (0 != (result = sink(context, info->block_start,
+                    block, info->block_end - info->block_start + 1))) ) {
+            DEBUG( "Reading stopped at 0x%X: err %d.\n",
+                    info->block_start, result );
+            retval = -6;
+            goto finally;
+        }
+
+        info->block_start = info->block_end + 1;
+        if ( !quiet ) __print_progress( info, &progress );
     }
     retval = 0;
 
@@ -805,38 +1138,16 @@ static int32_t __atmel_blank_page_check( dfu_device_t *device,
     return 0;
 }
 
-int32_t atmel_blank_check( dfu_device_t *device,
-                           const uint32_t start,
-                           const uint32_t end,
-                           dfu_bool quiet ) {
+static int32_t atmel_blank_check_range( dfu_device_t *device,
+                                        const uint32_t start,
+                                        const uint32_t end ) {
     int32_t result;                     // blank_page_check_result
     uint32_t blank_upto = start;        // up to is not inclusive
     uint32_t check_until;               // end address of page check
     uint16_t current_page;              // 64kb page number
-    int32_t retval;
 
     TRACE( "%s( %p, 0x%08X, 0x%08X )\n", __FUNCTION__, device, start, end );
 
-    if( (NULL == device) ) {
-        DEBUG( "ERROR: Invalid arguments, device pointer is NULL.\n" );
-        return -1;
-    } else if ( start > end ) {
-        DEBUG( "ERROR: End address 0x%X before start address 0x%X.\n",
-                end, start );
-        return -1;
-    }
-
-    // safe to call this with any type of device
-    if( 0 != atmel_select_memory_unit(device, mem_flash) ) {
-        return -2;
-    }
-
-    if( !quiet ) {
-        fprintf( stderr, "Checking memory from 0x%X to 0x%X...  ",
-                start, end );
-        // from here need to go to retval on error
-        if( debug > ATMEL_DEBUG_THRESHOLD ) fprintf( stderr, "\n" );
-    }
     do {
         // want to have checks align with pages
         current_page = blank_upto / ATMEL_64KB_PAGE;
@@ -847,8 +1158,7 @@ int32_t atmel_blank_check( dfu_device_t *device,
         // below 0x10000 doesn't mean you are definitely on page 0)
         if ( 0 != atmel_select_page(device, current_page) ) {
             DEBUG ("page select error.\n");
-            retval = -3;
-            goto error;
+            return -3;
         }
 
         // send the 'page' address, not absolute address
@@ -863,52 +1173,221 @@ int32_t atmel_blank_check( dfu_device_t *device,
         } else if ( result > 0 ) {
             blank_upto = result - 1 + ATMEL_64KB_PAGE * current_page;
             DEBUG ( "Flash NOT blank beginning at 0x%X.\n", blank_upto );
-            retval = blank_upto + 1;
-            goto error;
+            return blank_upto + 1;
         } else {
             DEBUG ( "Blank check fail err %d. Flash status unknown.\n", result );
-            retval = result;
-            goto error;
+            return result;
         }
     } while ( blank_upto < end );
-    retval = 0;
 
-error:
-    if( retval == 0 ) {
-        if( !quiet ) fprintf( stderr, "Empty.\n" );
-    } else if ( retval > 0 ) {
-        if( !quiet ) fprintf( stderr, "Not blank at 0x%X.\n", retval );
-    } else {
-        if( !quiet ) fprintf( stderr, "ERROR.\n" );
-    }
-    return retval;
+    return 0;
 }
 
-int32_t atmel_start_app_reset( dfu_device_t *device ) {
-    uint8_t command[3] = { 0x04, 0x03, 0x00 };
+int32_t atmel_blank_check( dfu_device_t *device,
+                           const uint32_t start,
+                           const uint32_t end,
+                           dfu_bool quiet ) {
     int32_t retval;
 
-    TRACE( "%s( %p )\n", __FUNCTION__, device );
+    TRACE( "%s( %p, 0x%08X, 0x%08X )\n", __FUNCTION__, device, start, end );
 
-    if( 3 != dfu_download(device, 3, command) ) {
-        DEBUG( "dfu_download failed.\n" );
+    if( (NULL == device) ) {
+        DEBUG( "ERROR: Invalid arguments, device pointer is NULL.\n" );
+        return -1;
+    } else if ( start > end ) {
+        DEBUG( "ERROR: End address 0x%X before start address 0x%X.\n",
+                end, start );
         return -1;
     }
 
-    if( 0 != (retval = dfu_download(device, 0, NULL)) ) {
-        DEBUG( "dfu_download failed (rv=%d).\n", retval );
+    // safe to call this with any type of device
+    if( 0 != atmel_select_memory_unit(device, mem_flash) ) {
         return -2;
     }
 
-    return 0;
-}
-
-int32_t atmel_start_app_noreset( dfu_device_t *device ) {
-    uint8_t command[5] = { 0x04, 0x03, 0x01, 0x00, 0x00 };
+    if( !quiet ) {
+        fprintf( stderr, "Checking memory from 0x%X to 0x%X...  ",
+                start, end );
+        if( debug > ATMEL_DEBUG_THRESHOLD ) fprintf( stderr, "\n" );
+    }
 
-    TRACE( "%s( %p )\n", __FUNCTION__, device );
+    retval = atmel_blank_check_range( device, start, end );
 
-    if( 5 != dfu_download(device, 5, command) ) {
+    if( retval == 0 ) {
+        if( !quiet ) fprintf( stderr, "Empty.\n" );
+    } else if ( retval > 0 ) {
+        if( !quiet ) fprintf( stderr, "Not blank at 0x%X.\n", retval );
+    } else {
+        if( !quiet ) fprintf( stderr, "ERROR.\n" );
+    }
+    return retval;
+}
+
+static dfu_bool atmel_page_populated( intel_buffer_out_t *bout,
+                                      const uint32_t page ) {
+    uint32_t i;
+
+    for( i = page; (i < page + bout->info.page_size) &&
+                   (i <= bout->info.data_end); i++ ) {
+        if( bout->data[i] <= UINT8_MAX ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int32_t atmel_blank_check_resume( dfu_device_t *device ) {
+    dfu_status_t status;
+
+    if( 0 != dfu_get_status(device, &status) ) {
+        DEBUG( "DFU_GETSTATUS failed.\n" );
+        return -3;
+    }
+
+    if( STATE_DFU_ERROR == status.bState ) {
+        if( 0 != dfu_clear_status(device) ) {
+            DEBUG( "DFU_CLRSTATUS failed.\n" );
+            return -3;
+        }
+    }
+
+    return 0;
+}
+
+int32_t atmel_blank_check_image( dfu_device_t *device,
+                                 intel_buffer_out_t *bout,
+                                 const uint32_t from,
+                                 const dfu_bool all,
+                                 const dfu_bool quiet ) {
+    uint32_t page_size;
+    uint32_t page;          // start of the page being looked at
+    uint32_t extent_start;  // first address of a run of populated pages
+    uint32_t extent_end;    // last address of that run
+    uint32_t conflict;      // address found not blank
+    uint32_t extents = 0;   // number of runs checked
+    uint32_t pages = 0;     // number of pages not blank
+    int32_t result;
+    int32_t retval = 0;
+
+    TRACE( "%s( %p, %p, 0x%08X, %s, %s )\n", __FUNCTION__, device, bout, from,
+           ((true == all) ? "true" : "false"),
+           ((true == quiet) ? "true" : "false") );
+
+    if( (NULL == device) || (NULL == bout) || (0 == bout->info.page_size) ) {
+        DEBUG( "ERROR: Invalid arguments.\n" );
+        return -1;
+    }
+    page_size = bout->info.page_size;
+
+    if( (UINT32_MAX == bout->info.data_start) || (from > bout->info.data_end) ) {
+        return 0;
+    }
+
+    // safe to call this with any type of device
+    if( 0 != atmel_select_memory_unit(device, mem_flash) ) {
+        return -2;
+    }
+
+    if( !quiet ) {
+        fprintf( stderr, "Checking memory used by the image...  " );
+        if( debug > ATMEL_DEBUG_THRESHOLD ) fprintf( stderr, "\n" );
+    }
+
+    page = from - (from % page_size);
+    while( page <= bout->info.data_end ) {
+        // skip pages the image does not write
+        if( !atmel_page_populated(bout, page) ) {
+            page += page_size;
+            continue;
+        }
+
+        // and check each run of populated pages in one go
+        extent_start = (page < from) ? from : page;
+        for( extent_end = page + page_size;
+             (extent_end <= bout->info.data_end) &&
+                atmel_page_populated(bout, extent_end);
+             extent_end += page_size ) {
+        }
+        extent_end--;
+        if( extent_end > bout->info.valid_end ) {
+            extent_end = bout->info.valid_end;
+        }
+
+        extents++;
+        DEBUG( "Checking extent 0x%X to 0x%X.\n", extent_start, extent_end );
+        result = atmel_blank_check_range( device, extent_start, extent_end );
+
+        if( result < 0 ) {
+            retval = result;
+            break;
+        } else if( 0 == result ) {
+            page = extent_end + 1;
+            continue;
+        }
+
+        conflict = result - 1;
+        page = conflict - (conflict % page_size);
+        pages++;
+        if( 0 == retval ) {
+            retval = result;
+            if( !quiet ) fprintf( stderr, "Not blank at 0x%X.\n", conflict );
+        }
+        if( !all ) {
+            break;
+        }
+        if( !quiet ) {
+            fprintf( stderr, "  page 0x%X to 0x%X is not blank.\n", page,
+                     page + page_size - 1 );
+        }
+
+        // carry on with the page after the conflict, once the device is
+        // out of the error state the failed check may have left it in
+        if( 0 != (result = atmel_blank_check_resume(device)) ) {
+            retval = result;
+            break;
+        }
+        page += page_size;
+    }
+
+    DEBUG( "Checked %u extents, %u pages not blank.\n", extents, pages );
+
+    if( !quiet ) {
+        if( 0 == retval ) {
+            fprintf( stderr, "Empty.\n" );
+        } else if( retval < 0 ) {
+            fprintf( stderr, "ERROR.\n" );
+        }
+    }
+
+    return retval;
+}
+
+int32_t atmel_start_app_reset( dfu_device_t *device ) {
+    uint8_t command[3] = { 0x04, 0x03, 0x00 };
+    int32_t retval;
+
+    TRACE( "%s( %p )\n", __FUNCTION__, device );
+
+    if( 3 != dfu_download(device, 3, command) ) {
+        DEBUG( "dfu_download failed.\n" );
+        return -1;
+    }
+
+    if( 0 != (retval = dfu_download(device, 0, NULL)) ) {
+        DEBUG( "dfu_download failed (rv=%d).\n", retval );
+        return -2;
+    }
+
+    return 0;
+}
+
+int32_t atmel_start_app_noreset( dfu_device_t *device ) {
+    uint8_t command[5] = { 0x04, 0x03, 0x01, 0x00, 0x00 };
+
+    TRACE( "%s( %p )\n", __FUNCTION__, device );
+
+    if( 5 != dfu_download(device, 5, command) ) {
         DEBUG( "dfu_download failed.\n" );
         return -1;
     }
@@ -984,6 +1463,8 @@ static int32_t atmel_select_page( dfu_device_t *device,
                                   const uint16_t mem_page ) {
     TRACE( "%s( %p, %u )\n", __FUNCTION__, device, mem_page );
     dfu_status_t status;
+    uint8_t command[ATMEL_PAGE_SELECT_SIZE];
+    size_t length;
 
     if( NULL == device ) {
         DEBUG ( "ERROR: Device pointer is NULL.\n" );
@@ -998,23 +1479,10 @@ static int32_t atmel_select_page( dfu_device_t *device,
     DEBUG( "Selecting page %d, address 0x%X.\n",
             mem_page, ATMEL_64KB_PAGE * mem_page );
 
-    if( GRP_AVR32 & device->type ) {
-        uint8_t command[5] = { 0x06, 0x03, 0x01, 0x00, 0x00 };
-        command[3] = 0xff & (mem_page >> 8);
-        command[4] = 0xff & mem_page;
-
-        if( 5 != dfu_download(device, 5, command) ) {
-            DEBUG( "atmel_select_page DFU_DNLOAD failed.\n" );
-            return -1;
-        }
-    } else if( ADC_AVR == device->type ) {      // AVR but not 8051
-        uint8_t command[4] = { 0x06, 0x03, 0x00, 0x00 };
-        command[3] = 0xff & mem_page;
-
-        if( 4 != dfu_download(device, 4, command) ) {
-            DEBUG( "atmel_select_page DFU_DNLOAD failed.\n" );
-            return -1;
-        }
+    length = atmel_encode_page_select( command, device->type, mem_page );
+    if( (0 != length) && (length != dfu_download(device, length, command)) ) {
+        DEBUG( "atmel_select_page DFU_DNLOAD failed.\n" );
+        return -1;
     }
 
     // check that page number was set
@@ -1136,21 +1604,71 @@ int32_t atmel_getsecure( dfu_device_t *device ) {
     return( (0 == buffer[0]) ? ATMEL_SECURE_OFF : ATMEL_SECURE_ON );
 }
 
+static size_t atmel_transfer_size( const size_t requested ) {
+    if( (0 == requested) || (requested > ATMEL_MAX_TRANSFER_SIZE) ) {
+        return ATMEL_MAX_TRANSFER_SIZE;
+    }
+    return requested;
+}
+
+static int32_t atmel_flash_recover( dfu_device_t *device,
+                                    dfu_checkpoint_t *checkpoint,
+                                    const dfu_bool eeprom,
+                                    const uint16_t mem_page ) {
+    TRACE( "%s( %p, %p, %s, %u )\n", __FUNCTION__, device, checkpoint,
+           ((true == eeprom) ? "true" : "false"), mem_page );
+
+    if( (NULL == checkpoint) || (0 == checkpoint->retries) ) {
+        return -1;
+    }
+    checkpoint->retries--;
+
+    DEBUG( "Recovering device to resume at 0x%X, %u retries left.\n",
+           checkpoint->resume_from, checkpoint->retries );
+
+    if( 0 != dfu_make_idle(device, false) ) {
+        DEBUG( "Unable to return the device to dfuIDLE.\n" );
+        return -2;
+    }
+
+    if( 0 != atmel_select_memory_unit(device, eeprom ? mem_eeprom : mem_flash) ) {
+        DEBUG( "Unable to re-select the memory unit.\n" );
+        return -3;
+    }
+
+    if( 0 != atmel_select_page(device, mem_page) ) {
+        DEBUG( "Unable to re-select 64kB page %u.\n", mem_page );
+        return -4;
+    }
+
+    return 0;
+}
+
 int32_t atmel_flash( dfu_device_t *device,
                      intel_buffer_out_t *bout,
                      const dfu_bool eeprom,
                      const dfu_bool force,
-                     const dfu_bool quiet ) {
-    uint32_t i;
+                     const dfu_bool quiet,
+                     dfu_checkpoint_t *checkpoint,
+                     const atmel_frames_t *frames ) {
+    atmel_cursor_t cursor;  // the next frame to send
     uint32_t progress = 0;  // keep record of sent progress as bytes * 32
     uint8_t mem_page = 0;   // tracks the current memory page
+    uint32_t check_start;   // where the blank check starts
     int32_t result = 0;     // result storage for many function calls
     int32_t retval = -1;    // the return value for this function
+    atmel_frames_t local_frames;    // used when frames were not provided
+    const atmel_frame_t *frame;
+    const uint8_t *arena;   // where frame is encoded
+    uint8_t *message;       // the transfer buffer frames are sent from
 
     TRACE( "%s( %p, %p, %s, %s )\n", __FUNCTION__, device, bout,
                     ((true == eeprom) ? "true" : "false"),
                     ((true == quiet) ? "true" : "false") );
 
+    memset( &local_frames, 0, sizeof(local_frames) );
+    memset( &cursor, 0, sizeof(cursor) );
+
     // check arguments
     if( (NULL == device) || (NULL == bout) ) {
         DEBUG( "ERROR: Invalid arguments, device/buffer pointer is NULL.\n" );
@@ -1165,23 +1683,38 @@ int32_t atmel_flash( dfu_device_t *device,
         return -1;
     }
 
-    // for each page with data, fill unassigned values on the page with 0xFF
-    // bout->data[0] always aligns with a flash page boundary irrespective
-    // of where valid_start is located
-    if( 0 != intel_flash_prep_buffer( bout ) ) {
-        if( !quiet )
-            fprintf( stderr, "Program Error, use debug for more info.\n" );
-        return -2;
-    }
-
-    // determine the limits of where actual data resides in the buffer
-    bout->info.data_start = UINT32_MAX;
-    for( i = 0; i < bout->info.total_size; i++ ) {
-        if( bout->data[i] <= UINT8_MAX ) {
-            bout->info.data_end = i;
-            if (bout->info.data_start == UINT32_MAX)
-                bout->info.data_start = i;
+    if( (NULL != frames) && (NULL != frames->base) ) {
+        // bout is shared and was prepared when base was built from it; the
+        // overlay can not be encoded again from bout, but may add data
+        if( !atmel_frames_fit(frames, device, eeprom) ) {
+            DEBUG( "ERROR: Overlay frames are for another device.\n" );
+            if( !quiet )
+                fprintf( stderr, "Program Error, use debug for more info.\n" );
+            return -2;
+        }
+        for( cursor.own = 0; cursor.own < frames->count; cursor.own++ ) {
+            frame = &frames->frames[cursor.own];
+            if( (UINT32_MAX == bout->info.data_start) ||
+                    (frame->end > bout->info.data_end) ) {
+                bout->info.data_end = frame->end;
+            }
+            if( frame->start < bout->info.data_start ) {
+                bout->info.data_start = frame->start;
+            }
         }
+        cursor.own = 0;
+    } else {
+        // for each page with data, fill unassigned values on the page with
+        // 0xFF.  bout->data[0] always aligns with a flash page boundary
+        // irrespective of where valid_start is located
+        if( 0 != intel_flash_prep_buffer( bout ) ) {
+            if( !quiet )
+                fprintf( stderr, "Program Error, use debug for more info.\n" );
+            return -2;
+        }
+
+        // determine the limits of where actual data resides in the buffer
+        intel_flash_data_limits( bout );
     }
 
     // debug info about data limits
@@ -1216,8 +1749,20 @@ int32_t atmel_flash( dfu_device_t *device,
         if( !quiet )
             fprintf( stderr, "Hex file error, use debug for more info.\n" );
         return -1;
-    } else if( !force && 0 != (result = atmel_blank_check(device,
-                    bout->info.data_start, bout->info.data_end, quiet)) ) {
+    }
+
+    // when resuming, everything below the checkpoint is already programmed
+    // and the block that was in flight may be partially written
+    check_start = bout->info.data_start;
+    if( (NULL != checkpoint) && (checkpoint->resume_from > check_start) ) {
+        check_start = checkpoint->resume_from + ATMEL_MAX_TRANSFER_SIZE;
+    }
+
+    // only pages the image writes are checked, every conflicting page is
+    // listed unless quiet since programming is abandoned anyway
+    if( !force && (check_start <= bout->info.data_end) &&
+            0 != (result = atmel_blank_check_image(device, bout,
+                    check_start, !quiet, quiet)) ) {
         if ( !quiet )
             fprintf( stderr,
                     "The target memory for the program is not blank.\n"
@@ -1226,12 +1771,55 @@ int32_t atmel_flash( dfu_device_t *device,
         return -1;
     }
 
+    // the pages of an overlay may be where the image has nothing
+    if( !force && (NULL != frames) && (NULL != frames->base) ) {
+        for( cursor.own = 0; cursor.own < frames->count; cursor.own++ ) {
+            frame = &frames->frames[cursor.own];
+            if( (ATMEL_FRAME_DATA != frame->kind) ||
+                    (frame->end < check_start) ) {
+                continue;
+            }
+            if( 0 != atmel_blank_check(device, (frame->start < check_start) ?
+                                       check_start : frame->start,
+                                       frame->end, quiet) ) {
+                if ( !quiet )
+                    fprintf( stderr,
+                            "The target memory for the program is not blank.\n"
+                            "Use --force flag to override this error check.\n");
+                DEBUG("The target memory is not blank.\n");
+                return -1;
+            }
+        }
+        cursor.own = 0;
+    }
+
+    // encode the program unless the caller already did for this device
+    if( !atmel_frames_fit(frames, device, eeprom) ) {
+        if( 0 != atmel_frames_build(&local_frames, bout, device->type, eeprom,
+                                    device->profile.transfer_size) ) {
+            if( !quiet )
+                fprintf( stderr, "Program Error, use debug for more info.\n" );
+            return -2;
+        }
+        frames = &local_frames;
+    }
+
     // select eeprom/flash as the desired memory target, safe for non GRP_AVR32
     mem_page = eeprom ? mem_eeprom : mem_flash;
     if( 0 != atmel_select_memory_unit(device, mem_page) ) {
         DEBUG ("Error selecting memory unit.\n");
         if( !quiet )
             fprintf( stderr, "Memory access error, use debug for more info.\n" );
+        atmel_frames_free( &local_frames );
+        return -2;
+    }
+
+    if( NULL == (message = dfu_transfer_buffer(device,
+                    ATMEL_MAX_FLASH_BUFFER_SIZE)) ) {
+        DEBUG( "ERROR: No transfer buffer.\n" );
+        if( !quiet )
+            fprintf( stderr, "Program Error, use debug for more info.\n" );
+        atmel_frames_free( &local_frames );
         return -2;
     }
 
@@ -1248,64 +1836,75 @@ int32_t atmel_flash( dfu_device_t *device,
         }
     }
 
-    // program the data
-    bout->info.block_start = bout->info.data_start;
-    mem_page = bout->info.block_start / ATMEL_64KB_PAGE;
-    if( 0 != (result = atmel_select_page( device, mem_page )) ) {
-        DEBUG( "ERROR selecting 64kB page %d.\n", result );
-        retval = -3;
-        goto finally;
-    }
-
-    while (bout->info.block_start <= bout->info.data_end) {
-        // select the memory page if needed (safe for non GRP_AVR32)
-        if ( bout->info.block_start / ATMEL_64KB_PAGE != mem_page ) {
-            mem_page = bout->info.block_start / ATMEL_64KB_PAGE;
+    // replay the frames, skipping anything the checkpoint says is written
+    if( (NULL != checkpoint) && (checkpoint->resume_from > bout->info.data_start) ) {
+        while( NULL != (frame = atmel_frames_next(frames, &cursor, &arena)) ) {
+            if( (ATMEL_FRAME_DATA == frame->kind) &&
+                    (frame->end >= checkpoint->resume_from) ) break;
+            atmel_frames_step( &cursor );
+        }
+        if( NULL != frame ) {
+            DEBUG( "Resuming at 0x%X.\n", frame->start );
+            mem_page = frame->page;
             if( 0 != (result = atmel_select_page( device, mem_page )) ) {
                 DEBUG( "ERROR selecting 64kB page %d.\n", result );
                 retval = -3;
                 goto finally;
             }
         }
+    }
+
+    while( NULL != (frame = atmel_frames_next(frames, &cursor, &arena)) ) {
+        mem_page = frame->page;
+
+        if( ATMEL_FRAME_PAGE == frame->kind ) {
+            DEBUG( "Selecting page %d, address 0x%X.\n",
+                    frame->page, ATMEL_64KB_PAGE * frame->page );
+        } else {
+            DEBUG("Program data block: 0x%X to 0x%X (p. %u), 0x%X bytes.\n",
+                    frame->start, frame->end, frame->page,
+                    frame->end - frame->start + 1);
+        }
 
-        // find end address (info.block_end) for data section to write
-        for(bout->info.block_end = bout->info.block_start;
-                bout->info.block_end <= bout->info.data_end;
-                bout->info.block_end++) {
-            // check if the current value is valid
-            if( bout->data[bout->info.block_end] > UINT8_MAX ) break;
-            // check if the current data packet is too big
-            if( (bout->info.block_end - bout->info.block_start + 1) > ATMEL_MAX_TRANSFER_SIZE ) break;
-            // check if the current data value is outside of the 64kB flash page
-            if( bout->info.block_end / ATMEL_64KB_PAGE - mem_page ) break;
-        }
-        bout->info.block_end--; // bout->info.block_end was one step beyond the last data value to flash
-
-        // write the data
-        DEBUG("Program data block: 0x%X to 0x%X (p. %u), 0x%X bytes.\n",
-                bout->info.block_start, bout->info.block_end,
-                bout->info.block_end / ATMEL_64KB_PAGE,
-                bout->info.block_end - bout->info.block_start + 1);
-        result = __atmel_flash_block( device, bout, eeprom );
+        // the frames may be shared, so they are copied once into the
+        // transfer buffer rather than handed to libusb to copy
+        memcpy( message, &arena[frame->offset], frame->length );
+        result = atmel_send_frame( device, message, frame->length );
         if( 0 != result ) {
-            DEBUG( "Error flashing the block: err %d.\n", result );
-            retval = -4;
+            DEBUG( "Error sending frame at 0x%X: err %d.\n", frame->start,
+                   result );
+            // only communication failures (negative) are worth a retry
+            if( result < 0 && 0 == atmel_flash_recover(device,
+                        checkpoint, eeprom, mem_page) ) {
+                continue;
+            }
+            retval = (ATMEL_FRAME_PAGE == frame->kind) ? -3 : -4;
             goto finally;
         }
+        atmel_frames_step( &cursor );
+
+        if( ATMEL_FRAME_DATA == frame->kind ) {
+            bout->info.block_start = frame->start;
+            bout->info.block_end = frame->end;
 
-        // incrment bout->info.block_start to the next valid address
-        for(bout->info.block_start = bout->info.block_end + 1;
-                bout->info.block_start <= bout->info.data_end;
-                bout->info.block_start++) {
-            if( (bout->data[bout->info.block_start] <= UINT8_MAX) ) break;
-        } // bout->info.block_start is now on the first valid data for the next segment
+            if( 0 != checkpoint_advance(checkpoint, frame->end + 1) ) {
+                DEBUG( "WARNING: unable to save the checkpoint.\n" );
+            }
 
-        // display progress in 32 increments (if not hidden)
-        if ( !quiet ) __print_progress( &bout->info, &progress );
+            // display progress in 32 increments (if not hidden)
+            if ( !quiet ) __print_progress( &bout->info, &progress );
+        }
     }
     retval = 0;
+    checkpoint_clear( checkpoint );
 
 finally:
+    if( 0 != retval && 0 != checkpoint_save(checkpoint) ) {
+        DEBUG( "WARNING: unable to save the checkpoint.\n" );
+    }
+
+    atmel_frames_free( &local_frames );
+
     if ( !quiet ) {
         if( 0 == retval ) {
             if ( debug <= ATMEL_DEBUG_THRESHOLD ) {
@@ -1403,45 +2002,45 @@ static void atmel_flash_populate_header( uint8_t *header,
     header[5] = 0xff & end;
 }
 
-static int32_t __atmel_flash_block( dfu_device_t *device,
-                                    intel_buffer_out_t *bout,
-                                    const dfu_bool eeprom ) {
+static size_t atmel_encode_page_select( uint8_t *command,
+                                        const atmel_device_class_t type,
+                                        const uint16_t mem_page ) {
+    if( GRP_AVR32 & type ) {
+        command[0] = 0x06;
+        command[1] = 0x03;
+        command[2] = 0x01;
+        command[3] = 0xff & (mem_page >> 8);
+        command[4] = 0xff & mem_page;
+        return 5;
+    } else if( ADC_AVR == type ) {      // AVR but not 8051
+        command[0] = 0x06;
+        command[1] = 0x03;
+        command[2] = 0x00;
+        command[3] = 0xff & mem_page;
+        return 4;
+    }
+
+    return 0;
+}
+
+static size_t atmel_encode_block( uint8_t *message,
+                                  const uint16_t *source,
+                                  const uint32_t start,
+                                  const uint32_t end,
+                                  const atmel_device_class_t type,
+                                  const dfu_bool eeprom ) {
     // from doc7618, AT90 / ATmega app note protocol:
-    const size_t length = bout->info.block_end - bout->info.block_start + 1;
-    uint8_t message[ATMEL_MAX_FLASH_BUFFER_SIZE];
+    const size_t length = end - start + 1;
     uint8_t *header;
     uint8_t *data;
     uint8_t *footer;
-    size_t message_length;
-    int32_t result;
-    dfu_status_t status;
-    int32_t i;
+    size_t i;
     size_t control_block_size;  /* USB control block size */
     size_t alignment;
 
-    TRACE( "%s( %p, %p, %s )\n", __FUNCTION__, device, bout,
-                            ((true == eeprom) ? "true" : "false") );
-
-    // check input args
-    if( (NULL == device) || (NULL == bout) ) {
-        DEBUG( "ERROR: Invalid arguments, device/buffer pointer is NULL.\n" );
-        return -1;
-    } else if ( bout->info.block_start > bout->info.block_end ) {
-        DEBUG( "ERROR: End address 0x%X before start address 0x%X.\n",
-                bout->info.block_end, bout->info.block_start );
-        return -1;
-    } else if ( length > ATMEL_MAX_TRANSFER_SIZE ) {
-        DEBUG( "ERROR: 0x%X byte message > MAX TRANSFER SIZE (0x%X).\n",
-                length, ATMEL_MAX_TRANSFER_SIZE );
-        return -1;
-    }
-
-    // 0 out the message
-    memset( message, 0, ATMEL_MAX_FLASH_BUFFER_SIZE );
-
-    if( GRP_AVR32 & device->type ) {
+    if( GRP_AVR32 & type ) {
         control_block_size = ATMEL_AVR32_CONTROL_BLOCK_SIZE;
-        alignment = bout->info.block_start % ATMEL_AVR32_CONTROL_BLOCK_SIZE;
+        alignment = start % ATMEL_AVR32_CONTROL_BLOCK_SIZE;
     } else {
         control_block_size = ATMEL_CONTROL_BLOCK_SIZE;
         alignment = 0;
@@ -1451,28 +2050,36 @@ static int32_t __atmel_flash_block( dfu_device_t *device,
     data   = &message[control_block_size + alignment];
     footer = &data[length];
 
+    // only the control block and alignment padding need clearing
+    memset( header, 0, control_block_size + alignment );
+
     atmel_flash_populate_header( header,
-            bout->info.block_start % ATMEL_64KB_PAGE,
-            bout->info.block_end % ATMEL_64KB_PAGE,
-            eeprom );
+            start % ATMEL_64KB_PAGE, end % ATMEL_64KB_PAGE, eeprom );
     /* for programming flash or eeprom for xmega or avr32, header[1] = 0x00 */
     /* for programming eeprom, memory was selected in atmel_flash */
-    if( ADC_XMEGA & device->type ) {
-	header[1] = 0x00;
+    if( ADC_XMEGA & type ) {
+        header[1] = 0x00;
     }
 
     // Copy the data
     for( i = 0; i < length; i++ ) {
-        data[i] = (uint8_t) bout->data[bout->info.block_start + i];
+        data[i] = (uint8_t) source[i];
     }
 
     atmel_flash_populate_footer( message, footer, 0xffff, 0xffff, 0xffff );
 
-    message_length = ((size_t) (footer - header)) + ATMEL_FOOTER_SIZE;
+    return ((size_t) (footer - header)) + ATMEL_FOOTER_SIZE;
+}
 
-    result = dfu_download( device, message_length, message );
+static int32_t atmel_send_frame( dfu_device_t *device,
+                                 uint8_t *message,
+                                 const size_t length ) {
+    int32_t result;
+    dfu_status_t status;
+
+    result = dfu_download( device, length, message );
 
-    if( message_length != result ) {
+    if( length != result ) {
         if( -EPIPE == result ) {
             /* The control pipe stalled - this is an error
              * caused by the device saying "you can't do that"
@@ -1483,12 +2090,15 @@ static int32_t __atmel_flash_block( dfu_device_t *device,
         } else {
             DEBUG( "atmel_flash: flash data dfu_download failed.\n" );
             DEBUG( "Expected message length of %d, got %d.\n",
-                    message_length, result );
+                    length, result );
         }
         return -2;
     }
 
-    // check status
+    // check status, after the time the profile says the block takes
+    if( 0 != device->profile.status_delay ) {
+        usleep( device->profile.status_delay );
+    }
     if( 0 != dfu_get_status(device, &status) ) {
         DEBUG( "dfu_get_status failed.\n" );
         return -3;
@@ -1507,6 +2117,353 @@ static int32_t __atmel_flash_block( dfu_device_t *device,
     return 0;
 }
 
+static int32_t __atmel_flash_block( dfu_device_t *device,
+                                    intel_buffer_out_t *bout,
+                                    const dfu_bool eeprom ) {
+    const size_t length = bout->info.block_end - bout->info.block_start + 1;
+    uint8_t *message;
+    size_t message_length;
+
+    TRACE( "%s( %p, %p, %s )\n", __FUNCTION__, device, bout,
+                            ((true == eeprom) ? "true" : "false") );
+
+    // check input args
+    if( (NULL == device) || (NULL == bout) ) {
+        DEBUG( "ERROR: Invalid arguments, device/buffer pointer is NULL.\n" );
+        return -1;
+    } else if ( bout->info.block_start > bout->info.block_end ) {
+        DEBUG( "ERROR: End address 0x%X before start address 0x%X.\n",
+                bout->info.block_end, bout->info.block_start );
+        return -1;
+    } else if ( length > ATMEL_MAX_TRANSFER_SIZE ) {
+        DEBUG( "ERROR: 0x%X byte message > MAX TRANSFER SIZE (0x%X).\n",
+                length, ATMEL_MAX_TRANSFER_SIZE );
+        return -1;
+    }
+
+    // encode straight into the transfer buffer so it is sent without a copy
+    if( NULL == (message = dfu_transfer_buffer(device,
+                    ATMEL_MAX_FLASH_BUFFER_SIZE)) ) {
+        DEBUG( "ERROR: No transfer buffer.\n" );
+        return -1;
+    }
+
+    message_length = atmel_encode_block( message,
+            &bout->data[bout->info.block_start],
+            bout->info.block_start, bout->info.block_end,
+            device->type, eeprom );
+
+    return atmel_send_frame( device, message, message_length );
+}
+
+static int32_t atmel_frames_add( atmel_frames_t *frames,
+                                 const uint16_t *data,
+                                 const uint8_t kind,
+                                 const uint16_t page,
+                                 const uint32_t start,
+                                 const uint32_t end ) {
+    atmel_frame_t *frame;
+
+    // make room for the frame record and a frame of the largest size
+    if( frames->count == frames->capacity ) {
+        size_t capacity = (0 == frames->capacity) ? 64 : 2 * frames->capacity;
+        atmel_frame_t *grown = realloc( frames->frames,
+                                        capacity * sizeof(atmel_frame_t) );
+        if( NULL == grown ) {
+            return -1;
+        }
+        frames->frames = grown;
+        frames->capacity = capacity;
+    }
+    if( frames->arena_size + ATMEL_MAX_FLASH_BUFFER_SIZE > frames->arena_capacity ) {
+        size_t capacity = (0 == frames->arena_capacity) ?
+                            64 * ATMEL_MAX_FLASH_BUFFER_SIZE :
+                            2 * frames->arena_capacity;
+        uint8_t *grown = realloc( frames->arena, capacity );
+        if( NULL == grown ) {
+            return -1;
+        }
+        frames->arena = grown;
+        frames->arena_capacity = capacity;
+    }
+
+    frame = &frames->frames[frames->count];
+    frame->kind = kind;
+    frame->page = page;
+    frame->start = start;
+    frame->end = end;
+    frame->offset = frames->arena_size;
+    if( ATMEL_FRAME_PAGE == kind ) {
+        frame->length = atmel_encode_page_select( &frames->arena[frame->offset],
+                                                  frames->type, page );
+        if( 0 == frame->length ) {
+            // nothing to select on this device class
+            return 0;
+        }
+    } else {
+        frame->length = atmel_encode_block( &frames->arena[frame->offset],
+                                            data, start, end,
+                                            frames->type, frames->eeprom );
+    }
+
+    frames->arena_size += frame->length;
+    frames->count++;
+
+    return 0;
+}
+
+static int32_t atmel_frames_encode( atmel_frames_t *frames,
+                                    const uint16_t *data,
+                                    const uint32_t first,
+                                    const uint32_t last ) {
+    uint32_t start = first;
+    uint32_t end;
+    uint16_t mem_page;
+
+    // split the data exactly as the block loop in atmel_flash always has
+    mem_page = start / ATMEL_64KB_PAGE;
+    if( 0 != atmel_frames_add(frames, NULL, ATMEL_FRAME_PAGE, mem_page,
+                              start, start) ) {
+        return -1;
+    }
+
+    while( start <= last ) {
+        if( start / ATMEL_64KB_PAGE != mem_page ) {
+            mem_page = start / ATMEL_64KB_PAGE;
+            if( 0 != atmel_frames_add(frames, NULL, ATMEL_FRAME_PAGE, mem_page,
+                                      start, start) ) {
+                return -1;
+            }
+        }
+
+        for( end = start; end <= last; end++ ) {
+            if( data[end - first] > UINT8_MAX ) break;
+            if( (end - start + 1) > frames->transfer_size ) break;
+            if( end / ATMEL_64KB_PAGE != mem_page ) break;
+        }
+        end--;
+
+        if( 0 != atmel_frames_add(frames, &data[start - first],
+                                  ATMEL_FRAME_DATA, mem_page, start, end) ) {
+            return -1;
+        }
+
+        for( start = end + 1; start <= last; start++ ) {
+            if( data[start - first] <= UINT8_MAX ) break;
+        }
+    }
+
+    return 0;
+}
+
+static const atmel_frame_t *atmel_frames_next( const atmel_frames_t *frames,
+                                               atmel_cursor_t *cursor,
+                                               const uint8_t **arena ) {
+    const atmel_frame_t *own = NULL;
+    const atmel_frame_t *base = NULL;
+
+    if( cursor->own < frames->count ) {
+        own = &frames->frames[cursor->own];
+    }
+
+    // an own data frame replaces every base one it overlaps, whole
+    if( NULL != frames->base ) {
+        for( ; cursor->base < frames->base->count; cursor->base++ ) {
+            base = &frames->base->frames[cursor->base];
+            if( ATMEL_FRAME_DATA != base->kind ) {
+                break;
+            }
+            while( (cursor->cover < frames->count) &&
+                    ((ATMEL_FRAME_DATA != frames->frames[cursor->cover].kind) ||
+                     (frames->frames[cursor->cover].end < base->start)) ) {
+                cursor->cover++;
+            }
+            if( (cursor->cover == frames->count) ||
+                    (frames->frames[cursor->cover].start > base->end) ) {
+                break;
+            }
+            base = NULL;
+        }
+    }
+
+    // in address order; an own run selects its page again after base ones
+    if( (NULL != own) && ((NULL == base) || (own->start < base->start)) ) {
+        cursor->at_base = false;
+        *arena = frames->arena;
+        return own;
+    }
+    cursor->at_base = true;
+    if( NULL != base ) {
+        *arena = frames->base->arena;
+    }
+    return base;
+}
+
+static void atmel_frames_step( atmel_cursor_t *cursor ) {
+    if( cursor->at_base ) {
+        cursor->base++;
+    } else {
+        cursor->own++;
+    }
+}
+
+int32_t atmel_frames_build( atmel_frames_t *frames,
+                            intel_buffer_out_t *bout,
+                            const atmel_device_class_t type,
+                            const dfu_bool eeprom,
+                            const size_t transfer_size ) {
+    TRACE( "%s( %p, %p, 0x%X, %s )\n", __FUNCTION__, frames, bout, type,
+           ((true == eeprom) ? "true" : "false") );
+
+    if( (NULL == frames) || (NULL == bout) ) {
+        DEBUG( "ERROR: Invalid arguments, frames/buffer pointer is NULL.\n" );
+        return -1;
+    }
+
+    memset( frames, 0, sizeof(atmel_frames_t) );
+    frames->type = type;
+    frames->eeprom = eeprom;
+    frames->transfer_size = atmel_transfer_size( transfer_size );
+
+    if( 0 != intel_flash_prep_buffer(bout) ) {
+        return -2;
+    }
+    intel_flash_data_limits( bout );
+    if( UINT32_MAX == bout->info.data_start ) {
+        DEBUG( "No data to encode.\n" );
+        return 0;
+    }
+
+    if( 0 != atmel_frames_encode(frames, &bout->data[bout->info.data_start],
+                                 bout->info.data_start,
+                                 bout->info.data_end) ) {
+        goto error;
+    }
+
+    DEBUG( "Encoded %u frames, 0x%X bytes.\n", frames->count,
+           frames->arena_size );
+    return 0;
+
+error:
+    DEBUG( "ERROR: Unable to allocate frame memory.\n" );
+    atmel_frames_free( frames );
+    return -3;
+}
+
+int32_t atmel_frames_overlay( atmel_frames_t *frames,
+                              const atmel_frames_t *base,
+                              const intel_buffer_out_t *bout,
+                              const overlay_pages_t *pages ) {
+    const overlay_extent_t *extent;
+    uint16_t *data = NULL;
+    uint32_t start;
+    uint32_t end;
+    size_t low;
+    size_t high;
+    size_t next;
+    size_t i;
+    size_t j;
+    size_t k;
+
+    TRACE( "%s( %p, %p, %p, %p )\n", __FUNCTION__, frames, base, bout, pages );
+
+    if( (NULL == frames) || (NULL == base) || (NULL == bout) ||
+            (NULL == pages) ) {
+        DEBUG( "ERROR: Invalid arguments, pointer is NULL.\n" );
+        return -1;
+    }
+
+    memset( frames, 0, sizeof(atmel_frames_t) );
+    frames->type = base->type;
+    frames->eeprom = base->eeprom;
+    frames->transfer_size = base->transfer_size;
+    frames->base = base;
+
+    for( i = 0; i < pages->count; i = next ) {
+        start = pages->extents[i].start;
+        end = pages->extents[i].end;
+
+        // the first base frame that ends in the extent or after it
+        for( low = 0, high = base->count; low < high; ) {
+            k = low + (high - low) / 2;
+            if( base->frames[k].end < start ) {
+                low = k + 1;
+            } else {
+                high = k;
+            }
+        }
+
+        // grow to the whole base frames it overlaps, and the extents
+        // those reach, so base frames are only ever replaced whole
+        next = i + 1;
+        for( k = low; (k < base->count) && (base->frames[k].start <= end);
+                k++ ) {
+            if( ATMEL_FRAME_DATA != base->frames[k].kind ) {
+                continue;
+            }
+            if( base->frames[k].start < start ) {
+                start = base->frames[k].start;
+            }
+            if( base->frames[k].end > end ) {
+                end = base->frames[k].end;
+            }
+            while( (next < pages->count) &&
+                    (pages->extents[next].start <= end) ) {
+                if( pages->extents[next].end > end ) {
+                    end = pages->extents[next].end;
+                }
+                next++;
+            }
+        }
+
+        data = (uint16_t *) malloc( (end - start + 1) * sizeof(uint16_t) );
+        if( NULL == data ) {
+            goto error;
+        }
+        memcpy( data, &bout->data[start], (end - start + 1) * sizeof(uint16_t) );
+        for( j = i; j < next; j++ ) {
+            extent = &pages->extents[j];
+            memcpy( &data[extent->start - start], extent->data,
+                    (extent->end - extent->start + 1) * sizeof(uint16_t) );
+        }
+
+        if( 0 != atmel_frames_encode(frames, data, start, end) ) {
+            goto error;
+        }
+        free( data );
+        data = NULL;
+    }
+
+    DEBUG( "Encoded %u overlay frames, 0x%X bytes.\n", frames->count,
+           frames->arena_size );
+    return 0;
+
+error:
+    DEBUG( "ERROR: Unable to allocate frame memory.\n" );
+    free( data );
+    atmel_frames_free( frames );
+    return -3;
+}
+
+dfu_bool atmel_frames_fit( const atmel_frames_t *frames,
+                           const dfu_device_t *device,
+                           const dfu_bool eeprom ) {
+    return ((NULL != frames) && (frames->type == device->type) &&
+            (frames->eeprom == eeprom) && (frames->transfer_size ==
+                atmel_transfer_size(device->profile.transfer_size)))
+            ? true : false;
+}
+
+void atmel_frames_free( atmel_frames_t *frames ) {
+    if( NULL == frames ) {
+        return;
+    }
+
+    free( frames->frames );
+    free( frames->arena );
+    memset( frames, 0, sizeof(atmel_frames_t) );
+}
+
 void atmel_print_device_info( FILE *stream, atmel_device_info_t *info ) {
     fprintf( stream, "%18s: 0x%04x - %d\n", "Bootloader Version", info->bootloaderVersion, info->bootloaderVersion );
     fprintf( stream, "%18s: 0x%04x - %d\n", "Device boot ID 1", info->bootID1, info->bootID1 );
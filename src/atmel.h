@@ -26,6 +26,8 @@
 #include "dfu-bool.h"
 #include "dfu-device.h"
 #include "intel_hex.h"
+#include "checkpoint.h"
+#include "overlay.h"
 
 #define ATMEL_USER_PAGE_OFFSET 0x80800000
 
@@ -94,6 +96,12 @@ int32_t atmel_read_config( dfu_device_t *device,
  *  returns 0 if successful, < 0 if not
  */
 
+int32_t atmel_read_version( dfu_device_t *device );
+/*  Read only the bootloader version, as atmel_read_config would.
+ *
+ *  returns the version, or < 0 on error
+ */
+
 int32_t atmel_read_fuses( dfu_device_t *device,
                           atmel_avr32_fuses_t * info );
 
@@ -116,6 +124,19 @@ int32_t atmel_set_fuse( dfu_device_t *device,
                           const uint8_t property,
                           const uint32_t value );
 
+int32_t atmel_set_fuses( dfu_device_t *device,
+                         const uint8_t *properties,
+                         const uint32_t *values,
+                         const size_t count );
+/*  Set several fuses at once: the config memory is read, the setfuse
+ *  properties[i] are given values[i] (the last of a property wins), the
+ *  bytes from the first to the last changed fuse are written as one block
+ *  and everything is read back once to check it.  Nothing is written when
+ *  the fuses already hold the values.
+ *
+ *  returns 0 on success, -7 if the read back differs, < 0 on other errors
+ */
+
 int32_t atmel_set_config( dfu_device_t *device,
                           const uint8_t property,
                           const uint8_t value );
@@ -129,6 +150,19 @@ int32_t atmel_read_flash( dfu_device_t *device,
  * atmel_memory_unit_enum.
  */
 
+int32_t atmel_read_stream( dfu_device_t *device,
+                           const uint32_t start,
+                           const uint32_t end,
+                           const uint8_t mem_segment,
+                           dfu_block_sink_t sink,
+                           void *context,
+                           const dfu_bool quiet );
+/* read memory from start to end (inclusive) like atmel_read_flash, but pass
+ * each block to sink as it arrives instead of keeping the whole image, only
+ * one block is held in memory at a time.  returns 0 on success, -6 if the
+ * sink stopped the read, other negative values on errors
+ */
+
 int32_t atmel_blank_check( dfu_device_t *device,
                            const uint32_t start,
                            const uint32_t end,
@@ -137,6 +171,20 @@ int32_t atmel_blank_check( dfu_device_t *device,
  * returns 0 for success, < 0 for communication errors, > 0 for not blank
  */
 
+int32_t atmel_blank_check_image( dfu_device_t *device,
+                                 intel_buffer_out_t *bout,
+                                 const uint32_t from,
+                                 const dfu_bool all,
+                                 const dfu_bool quiet );
+/* check that the flash pages the image writes (from address from on) are
+ * blank, pages without data are skipped and runs of populated pages are
+ * checked together.  bout must have been through intel_flash_prep_buffer.
+ * stops at the first page that is not blank unless all is set, in which case
+ * every such page is checked and listed.
+ * returns 0 for success, < 0 for communication errors, > 0 for not blank
+ * (the first address not blank + 1)
+ */
+
 int32_t atmel_start_app_reset( dfu_device_t *device );
 /* Reset the processor and start application.
  * This is done internally by forcing a watchdog reset.
@@ -152,11 +200,70 @@ int32_t atmel_secure( dfu_device_t *device );
 
 int32_t atmel_getsecure( dfu_device_t *device );
 
+#define ATMEL_FRAME_PAGE    0   /* command selecting a 64kB page */
+#define ATMEL_FRAME_DATA    1   /* download with header, data and footer */
+
+typedef struct {
+    uint8_t kind;           // ATMEL_FRAME_PAGE or ATMEL_FRAME_DATA
+    uint16_t page;          // 64kB page the frame belongs to
+    uint32_t start;         // first image address programmed by the frame
+    uint32_t end;           // last image address programmed by the frame
+    size_t offset;          // position of the encoded frame in the arena
+    size_t length;          // encoded length in bytes
+} atmel_frame_t;
+
+typedef struct atmel_frames {
+    atmel_device_class_t type;  // device class the frames are encoded for
+    dfu_bool eeprom;            // encoded for eeprom rather than flash
+    size_t transfer_size;       // most data bytes in a frame
+    uint8_t *arena;             // every encoded frame, back to back
+    size_t arena_size;
+    size_t arena_capacity;
+    atmel_frame_t *frames;      // one record per frame, in sending order
+    size_t count;
+    size_t capacity;
+    const struct atmel_frames *base;    // shared frames sent along with
+                                        // these, NULL unless an overlay
+} atmel_frames_t;
+
+int32_t atmel_frames_build( atmel_frames_t *frames,
+                            intel_buffer_out_t *bout,
+                            const atmel_device_class_t type,
+                            const dfu_bool eeprom,
+                            const size_t transfer_size );
+/* Encode the whole program once into ready to send page select and data
+ * frames, so every device programmed with the image only replays them.
+ * bout is prepared (intel_flash_prep_buffer) and its data limits are set as
+ * atmel_flash would.  transfer_size limits the data of a frame, 0 uses the
+ * largest size.  Returns 0 on success, negative on error.
+ */
+
+int32_t atmel_frames_overlay( atmel_frames_t *frames,
+                              const atmel_frames_t *base,
+                              const intel_buffer_out_t *bout,
+                              const overlay_pages_t *pages );
+/* Encode only the pages of an overlay, and the frames of base they run
+ * into, as frames sent in place of those of base; bout is the image base
+ * was built from and both are only read, so devices can share them.
+ * Returns 0 on success, negative on error.
+ */
+
+dfu_bool atmel_frames_fit( const atmel_frames_t *frames,
+                           const dfu_device_t *device,
+                           const dfu_bool eeprom );
+/* true if frames were encoded for the device class, memory and transfer
+ * size of the profile of device
+ */
+
+void atmel_frames_free( atmel_frames_t *frames );
+
 int32_t atmel_flash( dfu_device_t *device,
                      intel_buffer_out_t *bout,
                      const dfu_bool eeprom,
                      const dfu_bool force,
-                     const dfu_bool hide_progress );
+                     const dfu_bool hide_progress,
+                     dfu_checkpoint_t *checkpoint,
+                     const atmel_frames_t *frames );
 /* Flash data from the buffer to the main program memory on the device.
  * buffer contains the data to flash where buffer[0] is aligned with memory
  * address zero (which could be inside the bootloader and unavailable).
@@ -165,6 +272,13 @@ int32_t atmel_flash( dfu_device_t *device,
  * flash_page_size is the size of flash pages - used for alignment
  * eeprom bool tells if you want to flash to eeprom or flash memory
  * hide_progress bool sets whether to display progress
+ * checkpoint (may be NULL) is advanced as blocks are acknowledged; a block
+ * that fails to transfer is retried from it after recovering the device,
+ * and programming starts at checkpoint->resume_from if that is set
+ * frames (may be NULL) are the frames built from bout by atmel_frames_build,
+ * they are encoded here when missing or built for another device class;
+ * frames from atmel_frames_overlay have to fit the device and bout is then
+ * the prepared image their base was built from, which is only read
  */
 
 int32_t atmel_user( dfu_device_t *device,
@@ -0,0 +1,301 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "binout.h"
+#include "util.h"
+
+#define BINOUT_DEBUG_THRESHOLD  40
+#define BINOUT_TRACE_THRESHOLD  45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               BINOUT_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               BINOUT_TRACE_THRESHOLD, __VA_ARGS__ )
+
+// ________  P R O T O T Y P E S  _______________________________
+static int32_t binout_flush( binout_t *out );
+/* write the buffer out, retrying short writes
+ */
+
+static int32_t binout_append( binout_t *out, const uint8_t *data,
+                              size_t length );
+/* copy data to the buffer, flushing it whenever it fills up.  data NULL
+ * appends zeros
+ */
+
+static int32_t binout_settle( binout_t *out );
+/* write the zeros held back, as a hole if there are enough of them
+ */
+
+static size_t binout_zero_prefix( const uint8_t *data, const size_t length );
+/* returns the number of zero bytes data starts with
+ */
+
+// ________  F U N C T I O N S  _______________________________
+static int32_t binout_flush( binout_t *out ) {
+    size_t done = 0;
+    ssize_t n;
+
+    while( done < out->used ) {
+        n = write( out->fd, &out->buffer[done], out->used - done );
+        if( n < 0 ) {
+            if( EINTR == errno ) {
+                continue;
+            }
+            DEBUG( "write failed: %s\n", strerror(errno) );
+            return -1;
+        }
+        done += (size_t) n;
+    }
+    out->used = 0;
+
+    return 0;
+}
+
+static int32_t binout_append( binout_t *out, const uint8_t *data,
+                              size_t length ) {
+    size_t n;
+
+    while( length > 0 ) {
+        n = BINOUT_BUFFER_SIZE - out->used;
+        if( n > length ) {
+            n = length;
+        }
+        if( NULL == data ) {
+            memset( &out->buffer[out->used], 0, n );
+        } else {
+            memcpy( &out->buffer[out->used], data, n );
+            data += n;
+        }
+        out->used += n;
+        length -= n;
+
+        if( BINOUT_BUFFER_SIZE == out->used ) {
+            if( 0 != binout_flush(out) ) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int32_t binout_settle( binout_t *out ) {
+    uint64_t zeros = out->zeros;
+
+    out->zeros = 0;
+    if( zeros < BINOUT_HOLE_SIZE ) {
+        return binout_append( out, NULL, (size_t) zeros );
+    }
+
+    if( 0 != binout_flush(out) ) {
+        return -1;
+    }
+    if( (off_t) -1 == lseek(out->fd, (off_t) zeros, SEEK_CUR) ) {
+        DEBUG( "seek failed: %s\n", strerror(errno) );
+        return -2;
+    }
+    TRACE( "Left a hole of 0x%llX bytes.\n", (unsigned long long) zeros );
+
+    return 0;
+}
+
+static size_t binout_zero_prefix( const uint8_t *data, const size_t length ) {
+    size_t i = 0;
+    uint64_t word;
+
+    for( ; i + 8 <= length; i += 8 ) {
+        memcpy( &word, &data[i], 8 );
+        if( 0 != word ) {
+            break;
+        }
+    }
+    for( ; i < length && 0 == data[i]; i++ ) {}
+
+    return i;
+}
+
+int32_t binout_open( binout_t *out, FILE *stream, const uint8_t fill ) {
+    struct stat st;
+    off_t offset;
+    int flags;
+
+    fflush( stream );
+
+    out->fd = fileno( stream );
+    out->fill = fill;
+    out->zeros = 0;
+    out->used = 0;
+    out->sparse = false;
+
+    if( out->fd < 0 ) {
+        DEBUG( "The output has no file descriptor.\n" );
+        return -1;
+    }
+
+    // holes need a regular file whose writes go where the offset says and
+    // that ends there, an old file's contents would show through them
+    flags = fcntl( out->fd, F_GETFL );
+    if( (0 == fstat(out->fd, &st)) && S_ISREG(st.st_mode) &&
+            (flags >= 0) && !(flags & O_APPEND) &&
+            ((off_t) -1 != (offset = lseek(out->fd, 0, SEEK_CUR))) &&
+            (st.st_size <= offset) ) {
+        out->sparse = true;
+    }
+    DEBUG( "Binary output %s holes.\n",
+            out->sparse ? "with" : "without" );
+
+    return 0;
+}
+
+int32_t binout_write( binout_t *out, const uint8_t *data, size_t length ) {
+    const uint8_t *next;
+    size_t n;
+
+    if( !out->sparse ) {
+        return binout_append( out, data, length );
+    }
+
+    while( length > 0 ) {
+        n = binout_zero_prefix( data, length );
+        out->zeros += n;
+        data += n;
+        length -= n;
+        if( 0 == length ) {
+            break;
+        }
+
+        if( 0 != binout_settle(out) ) {
+            return -1;
+        }
+        next = memchr( data, 0, length );
+        n = (NULL == next) ? length : (size_t) (next - data);
+        if( 0 != binout_append(out, data, n) ) {
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+int32_t binout_memory( binout_t *out, const uint8_t *data, size_t length ) {
+    size_t start;           // first byte not written yet
+    size_t run;             // first byte of the current run of 0xFF
+    size_t i;
+
+    if( 0xff == out->fill ) {
+        return binout_write( out, data, length );
+    }
+
+    // data goes out as it is up to each run long enough to be erased memory
+    for( start = 0, i = 0; i < length; ) {
+        if( 0xff != data[i] ) {
+            i++;
+            continue;
+        }
+        for( run = i; (i < length) && (0xff == data[i]); i++ ) {}
+        if( i - run < BINOUT_HOLE_SIZE ) {
+            continue;
+        }
+        if( (0 != binout_write(out, &data[start], run - start)) ||
+            (0 != binout_blank(out, i - run)) ) {
+            return -1;
+        }
+        start = i;
+    }
+
+    return binout_write( out, &data[start], length - start );
+}
+
+int32_t binout_erased( binout_t *out, size_t length ) {
+    uint8_t chunk[0x1000];
+    size_t n;
+
+    if( (length >= BINOUT_HOLE_SIZE) || (0xff == out->fill) ) {
+        return binout_blank( out, length );
+    }
+
+    // too short to be anything but data, which is 0xFF
+    memset( chunk, 0xff, sizeof(chunk) );
+    while( length > 0 ) {
+        n = (length < sizeof(chunk)) ? length : sizeof(chunk);
+        if( 0 != binout_write(out, chunk, n) ) {
+            return -1;
+        }
+        length -= n;
+    }
+
+    return 0;
+}
+
+int32_t binout_blank( binout_t *out, size_t length ) {
+    uint8_t chunk[0x1000];
+    size_t n;
+
+    if( (0 == out->fill) && out->sparse ) {
+        out->zeros += length;
+        return 0;
+    }
+
+    memset( chunk, out->fill, sizeof(chunk) );
+    while( length > 0 ) {
+        n = (length < sizeof(chunk)) ? length : sizeof(chunk);
+        if( 0 != binout_write(out, chunk, n) ) {
+            return -1;
+        }
+        length -= n;
+    }
+
+    return 0;
+}
+
+int32_t binout_close( binout_t *out ) {
+    off_t end;
+
+    if( out->zeros < BINOUT_HOLE_SIZE ) {
+        if( 0 != binout_settle(out) ) {
+            return -1;
+        }
+        return binout_flush( out );
+    }
+
+    // a trailing hole has nothing written after it to set the length
+    if( 0 != binout_settle(out) ) {
+        return -1;
+    }
+    end = lseek( out->fd, 0, SEEK_CUR );
+    if( ((off_t) -1 == end) || (0 != ftruncate(out->fd, end)) ) {
+        DEBUG( "Unable to extend the output: %s\n", strerror(errno) );
+        return -2;
+    }
+
+    return 0;
+}
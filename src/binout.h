@@ -0,0 +1,94 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __BINOUT_H__
+#define __BINOUT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "dfu-bool.h"
+
+/* bytes collected before each write to the output */
+#define BINOUT_BUFFER_SIZE  0x10000
+
+/* the shortest run of zero bytes that is skipped over instead of written
+ * when the output is a regular file, leaving a hole.  also the shortest run
+ * of erased bytes that is written as the fill value */
+#define BINOUT_HOLE_SIZE    0x1000
+
+typedef struct {
+    int fd;                 /* descriptor the output goes to */
+    dfu_bool sparse;        /* seeking is possible, zero runs become holes */
+    uint8_t fill;           /* value written for blank memory */
+    uint64_t zeros;         /* zero bytes held back after the buffer */
+    size_t used;            /* bytes waiting in buffer */
+    uint8_t buffer[BINOUT_BUFFER_SIZE];
+} binout_t;
+
+int32_t binout_open( binout_t *out, FILE *stream, const uint8_t fill );
+/*  Start writing binary data to stream (normally stdout).  Anything already
+ *  buffered in stream is flushed first, afterwards the stream must not be
+ *  used until binout_close.  If stream is a regular file that is not in
+ *  append mode and has nothing after its offset, long runs of zero bytes
+ *  are left as holes, which read back as the same zeros.
+ *
+ *  fill    - the byte written for blank memory by binout_blank and for
+ *            erased memory by binout_memory and binout_erased
+ *
+ *  returns 0 on success, negative on error
+ */
+
+int32_t binout_write( binout_t *out, const uint8_t *data, size_t length );
+/*  Append length bytes as they are.
+ *
+ *  returns 0 on success, negative if the output could not be written
+ */
+
+int32_t binout_memory( binout_t *out, const uint8_t *data, size_t length );
+/*  Append length bytes read from device memory, with each run of at least
+ *  BINOUT_HOLE_SIZE erased bytes (0xFF) written as the fill value.  Shorter
+ *  runs are data that happens to be 0xFF and are written as they are.  A
+ *  run at either end of data is judged by the part of it in data.
+ *
+ *  returns 0 on success, negative if the output could not be written
+ */
+
+int32_t binout_erased( binout_t *out, size_t length );
+/*  Append a run of length erased bytes, as the fill value if it is at least
+ *  BINOUT_HOLE_SIZE long and as 0xFF otherwise, see binout_memory.
+ *
+ *  returns 0 on success, negative if the output could not be written
+ */
+
+int32_t binout_blank( binout_t *out, size_t length );
+/*  Append length bytes of the fill value.
+ *
+ *  returns 0 on success, negative if the output could not be written
+ */
+
+int32_t binout_close( binout_t *out );
+/*  Write out whatever is still buffered.  When the output ends in a hole the
+ *  file is extended to its full length.
+ *
+ *  returns 0 on success, negative if the output could not be written
+ */
+
+#endif
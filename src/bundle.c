@@ -0,0 +1,341 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bundle.h"
+#include "digest.h"
+#include "util.h"
+
+#define BUNDLE_DEBUG_THRESHOLD  40
+#define BUNDLE_TRACE_THRESHOLD  45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               BUNDLE_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               BUNDLE_TRACE_THRESHOLD, __VA_ARGS__ )
+
+#define BUNDLE_ALIGNED(n)   (((n) + BUNDLE_ALIGN - 1) & ~((size_t) BUNDLE_ALIGN - 1))
+
+// ________  P R O T O T Y P E S  _______________________________
+static void bundle_put32( uint8_t *out, const uint32_t value );
+static uint32_t bundle_get32( const uint8_t *in );
+/* store and load a little endian uint32
+ */
+
+static bundle_entry_t *bundle_add_entry( dfu_bundle_t *bundle );
+/* returns a new zeroed entry at the end of the table, NULL if memory ran out
+ */
+
+static int32_t bundle_read_stdin( dfu_bundle_t *bundle );
+/* read standard input into bundle->data, returns 0 on success
+ */
+
+// ________  F U N C T I O N S  _______________________________
+static void bundle_put32( uint8_t *out, const uint32_t value ) {
+    out[0] = (uint8_t) value;
+    out[1] = (uint8_t) (value >> 8);
+    out[2] = (uint8_t) (value >> 16);
+    out[3] = (uint8_t) (value >> 24);
+}
+
+static uint32_t bundle_get32( const uint8_t *in ) {
+    return ((uint32_t) in[0]) | ((uint32_t) in[1] << 8) |
+           ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+static bundle_entry_t *bundle_add_entry( dfu_bundle_t *bundle ) {
+    bundle_entry_t *entries;
+
+    entries = (bundle_entry_t *) realloc( bundle->entries,
+                (bundle->entry_count + 1) * sizeof(bundle_entry_t) );
+    if( NULL == entries ) {
+        DEBUG( "ERROR: out of memory.\n" );
+        return NULL;
+    }
+    bundle->entries = entries;
+    memset( &entries[bundle->entry_count], 0, sizeof(bundle_entry_t) );
+
+    return &entries[bundle->entry_count++];
+}
+
+static int32_t bundle_read_stdin( dfu_bundle_t *bundle ) {
+    uint8_t *grown;
+    size_t capacity = 0;
+    size_t n;
+
+    do {
+        if( bundle->size == capacity ) {
+            capacity = (0 == capacity) ? 0x10000 : 2 * capacity;
+            if( NULL == (grown = (uint8_t *) realloc(bundle->data, capacity)) ) {
+                DEBUG( "ERROR: out of memory.\n" );
+                return -1;
+            }
+            bundle->data = grown;
+        }
+        n = fread( bundle->data + bundle->size, 1, capacity - bundle->size,
+                   stdin );
+        bundle->size += n;
+    } while( 0 != n );
+
+    return ferror(stdin) ? -1 : 0;
+}
+
+void bundle_init( dfu_bundle_t *bundle, const uint16_t vendor_id,
+                  const uint16_t chip_id ) {
+    memset( bundle, 0, sizeof(dfu_bundle_t) );
+    bundle->vendor_id = vendor_id;
+    bundle->chip_id = chip_id;
+}
+
+int32_t bundle_add_image( dfu_bundle_t *bundle, const uint32_t segment,
+                          intel_buffer_out_t *bout ) {
+    bundle_entry_t *entry;
+    uint8_t *data;
+    size_t start;
+    size_t end;
+    size_t i;
+
+    TRACE( "%s( %p, %u, %p )\n", __FUNCTION__, bundle, segment, bout );
+
+    for( start = 0; start < bout->info.total_size; start = end ) {
+        if( bout->data[start] > UINT8_MAX ) {
+            end = start + 1;
+            continue;
+        }
+        for( end = start; (end < bout->info.total_size) &&
+                          (bout->data[end] <= UINT8_MAX); end++ ) ;
+
+        data = (uint8_t *) realloc( bundle->data,
+                    BUNDLE_ALIGNED(bundle->size + (end - start)) );
+        if( (NULL == data) || (NULL == (entry = bundle_add_entry(bundle))) ) {
+            if( NULL != data ) {
+                bundle->data = data;
+            }
+            DEBUG( "ERROR: out of memory.\n" );
+            return -1;
+        }
+        bundle->data = data;
+
+        // offsets count from the data area until the bundle is written
+        entry->kind = BUNDLE_IMAGE;
+        entry->name = segment;
+        entry->value = (uint32_t) start;
+        entry->length = (uint32_t) (end - start);
+        entry->offset = (uint32_t) bundle->size;
+        for( i = start; i < end; i++ ) {
+            data[bundle->size++] = (uint8_t) bout->data[i];
+        }
+        entry->crc = digest_crc32( 0, data + entry->offset, entry->length );
+        while( bundle->size % BUNDLE_ALIGN ) {
+            data[bundle->size++] = 0;
+        }
+        DEBUG( "Segment %u: 0x%X bytes at 0x%X.\n", segment, entry->length,
+               entry->value );
+    }
+
+    return 0;
+}
+
+int32_t bundle_add_setting( dfu_bundle_t *bundle, const uint32_t kind,
+                            const uint32_t name, const uint32_t value ) {
+    bundle_entry_t *entry;
+
+    TRACE( "%s( %p, %u, %u, %u )\n", __FUNCTION__, bundle, kind, name, value );
+
+    if( NULL == (entry = bundle_add_entry(bundle)) ) {
+        return -1;
+    }
+    entry->kind = kind;
+    entry->name = name;
+    entry->value = value;
+
+    return 0;
+}
+
+int32_t bundle_write( dfu_bundle_t *bundle, FILE *fp ) {
+    uint8_t header[BUNDLE_HEADER_SIZE];
+    uint8_t *table;
+    uint8_t *record;
+    size_t table_size = (size_t) bundle->entry_count * BUNDLE_ENTRY_SIZE;
+    size_t base = BUNDLE_ALIGNED( BUNDLE_HEADER_SIZE + table_size );
+    uint32_t i;
+    int32_t retval = -1;
+
+    TRACE( "%s( %p, %p )\n", __FUNCTION__, bundle, fp );
+
+    if( NULL == (table = (uint8_t *) calloc(1, base - BUNDLE_HEADER_SIZE)) ) {
+        DEBUG( "ERROR: out of memory.\n" );
+        return -1;
+    }
+    for( i = 0; i < bundle->entry_count; i++ ) {
+        record = &table[i * BUNDLE_ENTRY_SIZE];
+        bundle_put32( &record[0], bundle->entries[i].kind );
+        bundle_put32( &record[4], bundle->entries[i].name );
+        bundle_put32( &record[8], bundle->entries[i].value );
+        bundle_put32( &record[12], bundle->entries[i].length );
+        bundle_put32( &record[16], (BUNDLE_IMAGE == bundle->entries[i].kind) ?
+                        (uint32_t) base + bundle->entries[i].offset : 0 );
+        bundle_put32( &record[20], bundle->entries[i].crc );
+    }
+
+    memset( header, 0, sizeof(header) );
+    memcpy( header, BUNDLE_MAGIC, 8 );
+    header[8] = (uint8_t) BUNDLE_VERSION;
+    header[9] = (uint8_t) (BUNDLE_VERSION >> 8);
+    header[12] = (uint8_t) bundle->vendor_id;
+    header[13] = (uint8_t) (bundle->vendor_id >> 8);
+    header[14] = (uint8_t) bundle->chip_id;
+    header[15] = (uint8_t) (bundle->chip_id >> 8);
+    bundle_put32( &header[16], bundle->entry_count );
+    bundle_put32( &header[20], digest_crc32(0, table, table_size) );
+
+    if( (sizeof(header) != fwrite(header, 1, sizeof(header), fp)) ||
+        (base - BUNDLE_HEADER_SIZE !=
+            fwrite(table, 1, base - BUNDLE_HEADER_SIZE, fp)) ||
+        (bundle->size != fwrite(bundle->data, 1, bundle->size, fp)) ||
+        (0 != fflush(fp)) ) {
+        DEBUG( "ERROR: unable to write the bundle.\n" );
+        goto error;
+    }
+
+    retval = 0;
+
+error:
+    free( table );
+
+    return retval;
+}
+
+int32_t bundle_open( dfu_bundle_t *bundle, const char *filename ) {
+    int fd;
+    struct stat st;
+    uint8_t *record;
+    bundle_entry_t *entry;
+    size_t table_size;
+    uint32_t i;
+
+    TRACE( "%s( %p, %s )\n", __FUNCTION__, bundle, filename );
+
+    memset( bundle, 0, sizeof(dfu_bundle_t) );
+    if( 0 == strcmp("STDIN", filename) ) {
+        if( 0 != bundle_read_stdin(bundle) ) {
+            DEBUG( "ERROR: unable to read the bundle.\n" );
+            goto error;
+        }
+    } else {
+        if( -1 == (fd = open(filename, O_RDONLY)) ) {
+            DEBUG( "ERROR: unable to open %s.\n", filename );
+            return -1;
+        }
+        if( (0 != fstat(fd, &st)) || (st.st_size < BUNDLE_HEADER_SIZE) ) {
+            DEBUG( "ERROR: %s is too short.\n", filename );
+            close( fd );
+            return -1;
+        }
+        bundle->data = (uint8_t *) mmap( NULL, st.st_size, PROT_READ,
+                                         MAP_PRIVATE, fd, 0 );
+        close( fd );
+        if( MAP_FAILED == (void *) bundle->data ) {
+            DEBUG( "ERROR: unable to map %s.\n", filename );
+            bundle->data = NULL;
+            return -1;
+        }
+        bundle->size = st.st_size;
+        bundle->mapped = true;
+    }
+
+    if( (bundle->size < BUNDLE_HEADER_SIZE) ||
+            (0 != memcmp(bundle->data, BUNDLE_MAGIC, 8)) ) {
+        DEBUG( "ERROR: %s is not a bundle.\n", filename );
+        goto error;
+    }
+    if( BUNDLE_VERSION != (bundle->data[8] | (bundle->data[9] << 8)) ) {
+        DEBUG( "ERROR: unsupported bundle version.\n" );
+        goto error;
+    }
+    bundle->vendor_id = bundle->data[12] | (bundle->data[13] << 8);
+    bundle->chip_id = bundle->data[14] | (bundle->data[15] << 8);
+    bundle->entry_count = bundle_get32( &bundle->data[16] );
+
+    table_size = (size_t) bundle->entry_count * BUNDLE_ENTRY_SIZE;
+    if( (bundle->entry_count > (bundle->size - BUNDLE_HEADER_SIZE) /
+                BUNDLE_ENTRY_SIZE) ||
+            (bundle_get32(&bundle->data[20]) != digest_crc32(0,
+                &bundle->data[BUNDLE_HEADER_SIZE], table_size)) ) {
+        DEBUG( "ERROR: the entry table is damaged.\n" );
+        goto error;
+    }
+
+    bundle->entries = (bundle_entry_t *) malloc(
+                (bundle->entry_count + 1) * sizeof(bundle_entry_t) );
+    if( NULL == bundle->entries ) {
+        DEBUG( "ERROR: out of memory.\n" );
+        goto error;
+    }
+    for( i = 0; i < bundle->entry_count; i++ ) {
+        record = &bundle->data[BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE];
+        entry = &bundle->entries[i];
+        entry->kind = bundle_get32( &record[0] );
+        entry->name = bundle_get32( &record[4] );
+        entry->value = bundle_get32( &record[8] );
+        entry->length = bundle_get32( &record[12] );
+        entry->offset = bundle_get32( &record[16] );
+        entry->crc = bundle_get32( &record[20] );
+
+        if( BUNDLE_IMAGE != entry->kind ) {
+            continue;
+        }
+        if( ((uint64_t) entry->offset + entry->length > bundle->size) ||
+                (entry->crc != digest_crc32(0, bundle->data + entry->offset,
+                                            entry->length)) ) {
+            DEBUG( "ERROR: the data of entry %u is damaged.\n", i );
+            goto error;
+        }
+    }
+
+    return 0;
+
+error:
+    bundle_close( bundle );
+
+    return -1;
+}
+
+void bundle_close( dfu_bundle_t *bundle ) {
+    if( true == bundle->mapped ) {
+        munmap( bundle->data, bundle->size );
+    } else {
+        free( bundle->data );
+    }
+    free( bundle->entries );
+    bundle->data = NULL;
+    bundle->entries = NULL;
+    bundle->entry_count = 0;
+    bundle->size = 0;
+    bundle->mapped = false;
+}
@@ -0,0 +1,111 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __BUNDLE_H__
+#define __BUNDLE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "dfu-bool.h"
+#include "intel_hex.h"
+
+/*  A bundle holds everything programmed into a board: the images of the
+ *  flash, eeprom and user page and the configuration and fuse values.
+ *  All values are little endian:
+ *
+ *    header   "DFUBUNDL", uint16 version, uint16 0, uint16 vendor id,
+ *             uint16 chip id of the target, uint32 entry count, uint32
+ *             crc32 of the entry table and 8 bytes of 0
+ *    entries  uint32 kind, name, value, length, offset and crc32 and
+ *             8 bytes of 0 for each entry
+ *    data     the bytes of the image entries, each starting on a
+ *             BUNDLE_ALIGN boundary so a mapped bundle can be used as is
+ *
+ *  An image entry is one contiguous run of bytes: name is the memory
+ *  segment, value the address of the first byte in it, and offset and
+ *  length locate the bytes in the file, crc is their crc32.  Setting
+ *  entries have name and value only.
+ */
+#define BUNDLE_MAGIC            "DFUBUNDL"
+#define BUNDLE_VERSION          1
+#define BUNDLE_HEADER_SIZE      32
+#define BUNDLE_ENTRY_SIZE       32
+#define BUNDLE_ALIGN            16
+
+enum bundle_kind { BUNDLE_IMAGE = 1, BUNDLE_CONFIGURE, BUNDLE_SETFUSE };
+
+typedef struct {
+    uint32_t kind;          /* bundle_kind */
+    uint32_t name;          /* memory segment, or configure / fuse name */
+    uint32_t value;         /* first address of an image, or the value */
+    uint32_t length;        /* bytes of image data */
+    uint32_t offset;        /* of the data from the start of the file */
+    uint32_t crc;           /* crc32 of the data */
+} bundle_entry_t;
+
+typedef struct {
+    uint16_t vendor_id;     /* the target the bundle was made for */
+    uint16_t chip_id;
+    uint32_t entry_count;
+    bundle_entry_t *entries;
+    uint8_t *data;          /* the file, or the data collected so far */
+    size_t size;
+    dfu_bool mapped;        /* data is a mapping of the file */
+} dfu_bundle_t;
+
+void bundle_init( dfu_bundle_t *bundle, const uint16_t vendor_id,
+                  const uint16_t chip_id );
+/*  Start an empty bundle for a target.
+ */
+
+int32_t bundle_add_image( dfu_bundle_t *bundle, const uint32_t segment,
+                          intel_buffer_out_t *bout );
+/*  Add an entry for each run of assigned bytes in bout.
+ *
+ *  returns 0 on success, negative if memory ran out
+ */
+
+int32_t bundle_add_setting( dfu_bundle_t *bundle, const uint32_t kind,
+                            const uint32_t name, const uint32_t value );
+/*  Add a BUNDLE_CONFIGURE or BUNDLE_SETFUSE entry.
+ *
+ *  returns 0 on success, negative if memory ran out
+ */
+
+int32_t bundle_write( dfu_bundle_t *bundle, FILE *fp );
+/*  Write the bundle file to fp.
+ *
+ *  returns 0 on success, negative on error
+ */
+
+int32_t bundle_open( dfu_bundle_t *bundle, const char *filename );
+/*  Map a bundle file (STDIN is read into memory instead) and check the
+ *  header, the entry table and the crc of every image entry, so the data
+ *  can be used without further checks.
+ *
+ *  returns 0 on success, negative if the file is unreadable or damaged
+ */
+
+void bundle_close( dfu_bundle_t *bundle );
+/*  Release a bundle that was built or opened.
+ */
+
+#endif
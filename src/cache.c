@@ -0,0 +1,357 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "digest.h"
+#include "util.h"
+
+#define CACHE_DEBUG_THRESHOLD   40
+#define CACHE_TRACE_THRESHOLD   45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               CACHE_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               CACHE_TRACE_THRESHOLD, __VA_ARGS__ )
+
+#define CACHE_MAGIC         "DFUIMAGE"
+#define CACHE_VERSION       1
+#define CACHE_BYTE_ORDER    0x01020304  /* entries are not portable */
+
+typedef struct {
+    char magic[8];              /* CACHE_MAGIC */
+    uint32_t byte_order;        /* CACHE_BYTE_ORDER of the writer */
+    uint32_t version;
+    uint8_t source[32];         /* sha256 of the hex file */
+    uint64_t source_size;
+    uint32_t total_size;        /* the buffer the file was parsed into */
+    uint32_t target_offset;
+    int32_t outside;            /* bytes outside memory, as parsed */
+    uint32_t data_start;
+    uint32_t data_end;
+    uint32_t extent_count;
+    uint32_t data_size;         /* bytes following the extents */
+    uint32_t crc;               /* crc32 of the extents and data */
+} cache_header_t;
+
+typedef struct {
+    uint32_t start;
+    uint32_t length;
+} cache_extent_t;
+
+// ________  P R O T O T Y P E S  _______________________________
+static int32_t cache_digest_file( const char *filename, cache_header_t *key );
+/* fill in source and source_size of key from the file
+ * returns 0 on success, -1 if the file cannot be read
+ */
+
+static int32_t cache_load( const char *path, cache_header_t *key,
+                           intel_buffer_out_t *bout );
+/* map the entry at path and copy it into bout if it matches key
+ * returns the parse result stored in it, or INT32_MIN if there is no
+ * usable entry (bout is untouched then)
+ */
+
+static void cache_store( const char *path, cache_header_t *key,
+                         intel_buffer_out_t *bout, const int32_t outside );
+/* write bout as the entry at path, through a temporary file that is
+ * renamed into place so readers never see half an entry
+ */
+
+static int32_t cache_write( const int fd, const void *data,
+                            const size_t length, uint32_t *crc );
+/* write all of data, adding it to crc unless that is NULL
+ * returns 0 on success, -1 on error
+ */
+
+// ________  F U N C T I O N S  _______________________________
+static int32_t cache_digest_file( const char *filename, cache_header_t *key ) {
+    uint8_t chunk[0x10000];
+    digest_t digest;
+    FILE *fp;
+    size_t n;
+
+    if( NULL == (fp = fopen(filename, "rb")) ) {
+        return -1;
+    }
+
+    digest_init( &digest, DIGEST_SHA256 );
+    key->source_size = 0;
+    while( 0 != (n = fread(chunk, 1, sizeof(chunk), fp)) ) {
+        digest_update( &digest, chunk, n );
+        key->source_size += n;
+    }
+    if( ferror(fp) ) {
+        fclose( fp );
+        return -1;
+    }
+    fclose( fp );
+    digest_final( &digest, key->source );
+
+    return 0;
+}
+
+static int32_t cache_load( const char *path, cache_header_t *key,
+                           intel_buffer_out_t *bout ) {
+    int32_t retval = INT32_MIN;
+    int fd;
+    struct stat st;
+    void *map = MAP_FAILED;
+    const cache_header_t *header;
+    const cache_extent_t *extent;
+    const uint8_t *data;
+    uint64_t used = 0;
+    uint32_t i;
+    uint32_t j;
+    uint16_t *out;
+
+    if( -1 == (fd = open(path, O_RDONLY)) ) {
+        DEBUG( "No cached image %s.\n", path );
+        return INT32_MIN;
+    }
+    if( (0 != fstat(fd, &st)) || ((size_t) st.st_size < sizeof(cache_header_t)) ) {
+        goto done;
+    }
+    map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if( MAP_FAILED == map ) {
+        DEBUG( "Unable to map %s: %s\n", path, strerror(errno) );
+        goto done;
+    }
+
+    header = (const cache_header_t *) map;
+    extent = (const cache_extent_t *) (header + 1);
+    if( (0 != memcmp(header->magic, CACHE_MAGIC, 8)) ||
+            (CACHE_BYTE_ORDER != header->byte_order) ||
+            (CACHE_VERSION != header->version) ||
+            (0 != memcmp(header->source, key->source, 32)) ||
+            (header->source_size != key->source_size) ||
+            (header->total_size != key->total_size) ||
+            (header->target_offset != key->target_offset) ||
+            ((uint64_t) st.st_size != sizeof(cache_header_t) +
+                (uint64_t) header->extent_count * sizeof(cache_extent_t) +
+                header->data_size) ) {
+        DEBUG( "Cached image %s does not match.\n", path );
+        goto done;
+    }
+    if( header->crc != digest_crc32(0, (const uint8_t *) extent,
+                st.st_size - sizeof(cache_header_t)) ) {
+        DEBUG( "Cached image %s is corrupted.\n", path );
+        goto done;
+    }
+    for( i = 0; i < header->extent_count; i++ ) {
+        used += extent[i].length;
+        if( ((uint64_t) extent[i].start + extent[i].length >
+                    bout->info.total_size) || (used > header->data_size) ) {
+            DEBUG( "Cached image %s has a bad extent.\n", path );
+            goto done;
+        }
+    }
+
+    // widen the packed bytes into the 16 bit image
+    data = (const uint8_t *) (extent + header->extent_count);
+    for( i = 0; i < header->extent_count; i++ ) {
+        out = &bout->data[extent[i].start];
+        for( j = 0; j < extent[i].length; j++ ) {
+            out[j] = data[j];
+        }
+        data += extent[i].length;
+    }
+    bout->info.data_start = header->data_start;
+    bout->info.data_end = header->data_end;
+    retval = header->outside;
+    DEBUG( "Using cached image %s, %u extents.\n", path,
+           header->extent_count );
+
+done:
+    if( MAP_FAILED != map ) {
+        munmap( map, st.st_size );
+    }
+    close( fd );
+
+    return retval;
+}
+
+static int32_t cache_write( const int fd, const void *data,
+                            const size_t length, uint32_t *crc ) {
+    const uint8_t *next = (const uint8_t *) data;
+    size_t left = length;
+    ssize_t n;
+
+    while( left > 0 ) {
+        if( -1 == (n = write(fd, next, left)) ) {
+            if( EINTR == errno ) continue;
+            return -1;
+        }
+        next += n;
+        left -= n;
+    }
+    if( NULL != crc ) {
+        *crc = digest_crc32( *crc, (const uint8_t *) data, length );
+    }
+
+    return 0;
+}
+
+static void cache_store( const char *path, cache_header_t *key,
+                         intel_buffer_out_t *bout, const int32_t outside ) {
+    char temp[4096];
+    cache_header_t header;
+    cache_extent_t extent;
+    uint8_t chunk[4096];
+    uint32_t i;
+    uint32_t j;
+    size_t n = 0;
+    int fd;
+
+    if( sizeof(temp) <= (size_t) snprintf(temp, sizeof(temp),
+                "%s.XXXXXX", path) ) {
+        return;
+    }
+    if( -1 == (fd = mkstemp(temp)) ) {
+        DEBUG( "Unable to create %s: %s\n", temp, strerror(errno) );
+        return;
+    }
+
+    header = *key;
+    memcpy( header.magic, CACHE_MAGIC, 8 );
+    header.byte_order = CACHE_BYTE_ORDER;
+    header.version = CACHE_VERSION;
+    header.outside = outside;
+    header.data_start = bout->info.data_start;
+    header.data_end = bout->info.data_end;
+    header.extent_count = 0;
+    header.data_size = 0;
+    header.crc = 0;
+
+    // the header is written again once the counts are known
+    if( 0 != cache_write(fd, &header, sizeof(header), NULL) ) {
+        goto error;
+    }
+    for( i = 0; i < bout->info.total_size; i = j ) {
+        if( bout->data[i] > UINT8_MAX ) {
+            j = i + 1;
+            continue;
+        }
+        for( j = i; (j < bout->info.total_size) &&
+                    (bout->data[j] <= UINT8_MAX); j++ ) ;
+        extent.start = i;
+        extent.length = j - i;
+        if( 0 != cache_write(fd, &extent, sizeof(extent), &header.crc) ) {
+            goto error;
+        }
+        header.extent_count++;
+        header.data_size += extent.length;
+    }
+    for( i = 0; i < bout->info.total_size; i++ ) {
+        if( bout->data[i] > UINT8_MAX ) continue;
+        chunk[n++] = (uint8_t) bout->data[i];
+        if( sizeof(chunk) == n ) {
+            if( 0 != cache_write(fd, chunk, n, &header.crc) ) {
+                goto error;
+            }
+            n = 0;
+        }
+    }
+    if( (0 != cache_write(fd, chunk, n, &header.crc)) ||
+            (0 != lseek(fd, 0, SEEK_SET)) ||
+            (0 != cache_write(fd, &header, sizeof(header), NULL)) ||
+            (0 != close(fd)) ) {
+        fd = -1;
+        goto error;
+    }
+    if( 0 != rename(temp, path) ) {
+        DEBUG( "Unable to rename %s: %s\n", temp, strerror(errno) );
+        unlink( temp );
+        return;
+    }
+    DEBUG( "Cached the image as %s, %u extents.\n", path,
+           header.extent_count );
+
+    return;
+
+error:
+    DEBUG( "Unable to write %s: %s\n", temp, strerror(errno) );
+    if( -1 != fd ) {
+        close( fd );
+    }
+    unlink( temp );
+}
+
+int32_t cache_hex_to_buffer( const char *cache, char *filename,
+                             intel_buffer_out_t *bout,
+                             uint32_t target_offset, dfu_bool quiet ) {
+    char path[4096];
+    cache_header_t key;
+    int32_t result;
+    size_t n;
+    uint32_t i;
+
+    TRACE( "%s( %s, %s, %p, 0x%X, %s )\n", __FUNCTION__,
+           ((NULL == cache) ? "NULL" : cache), filename, bout, target_offset,
+           ((true == quiet) ? "true" : "false") );
+
+    if( (NULL == cache) || (NULL == filename) ||
+            (0 == strcmp("STDIN", filename)) ) {
+        return intel_hex_to_buffer( filename, bout, target_offset, quiet );
+    }
+
+    memset( &key, 0, sizeof(key) );
+    key.total_size = bout->info.total_size;
+    key.target_offset = target_offset;
+    if( 0 != cache_digest_file(filename, &key) ) {
+        // let the parser report it
+        return intel_hex_to_buffer( filename, bout, target_offset, quiet );
+    }
+
+    n = snprintf( path, sizeof(path), "%s/", cache );
+    for( i = 0; (i < 32) && (n < sizeof(path)); i++ ) {
+        n += snprintf( &path[n], sizeof(path) - n, "%02x", key.source[i] );
+    }
+    if( (n >= sizeof(path)) ||
+            (sizeof(path) - n <= (size_t) snprintf(&path[n], sizeof(path) - n,
+                "-%x-%x.img", key.total_size, key.target_offset)) ) {
+        DEBUG( "The cache path is too long.\n" );
+        return intel_hex_to_buffer( filename, bout, target_offset, quiet );
+    }
+
+    if( INT32_MIN != (result = cache_load(path, &key, bout)) ) {
+        return result;
+    }
+
+    result = intel_hex_to_buffer( filename, bout, target_offset, quiet );
+    if( result >= 0 ) {
+        if( (0 != mkdir(cache, 0777)) && (EEXIST != errno) ) {
+            DEBUG( "Unable to create %s: %s\n", cache, strerror(errno) );
+        } else {
+            cache_store( path, &key, bout, result );
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,51 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdint.h>
+#include "dfu-bool.h"
+#include "intel_hex.h"
+
+/*  The image cache keeps hex files that were parsed once as compact binary
+ *  files, so flashing the same release again only maps the result instead
+ *  of parsing the text.  Each entry is named after the sha256 of the hex
+ *  file and the memory size and offset it was parsed for, which is what
+ *  invalidates it when the file changes.  An entry holds, in host byte
+ *  order, a header with the source digest and the parse result, the
+ *  extents (start and length) of the assigned bytes, the bytes themselves
+ *  packed back to back, and is checked with a crc32 before it is used.
+ */
+#define CACHE_ENVIRONMENT   "DFU_PROGRAMMER_CACHE"
+
+int32_t cache_hex_to_buffer( const char *cache, char *filename,
+                             intel_buffer_out_t *bout,
+                             uint32_t target_offset, dfu_bool quiet );
+/*  intel_hex_to_buffer through the cache in the directory cache.  A valid
+ *  entry is mapped and copied into bout, otherwise the file is parsed and
+ *  the entry written for the next run.  With cache NULL, or for STDIN, the
+ *  file is just parsed.  Problems with the cache itself are not errors,
+ *  they only mean the file is parsed.
+ *
+ *  returns what intel_hex_to_buffer returns for the file
+ */
+
+#endif
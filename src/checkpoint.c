@@ -0,0 +1,202 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "checkpoint.h"
+#include "digest.h"
+#include "util.h"
+
+#define CHECKPOINT_DEBUG_THRESHOLD  40
+#define CHECKPOINT_TRACE_THRESHOLD  45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               CHECKPOINT_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               CHECKPOINT_TRACE_THRESHOLD, __VA_ARGS__ )
+
+// ________  P R O T O T Y P E S  _______________________________
+static uint32_t checkpoint_image_crc( intel_buffer_out_t *bout );
+/* crc32 over the whole image, each 16 bit entry taken little endian so
+ * unassigned (0xFFFF) and 0xFF data entries are told apart
+ */
+
+// ________  F U N C T I O N S  _______________________________
+static uint32_t checkpoint_image_crc( intel_buffer_out_t *bout ) {
+    uint8_t chunk[1024];
+    uint32_t crc = 0;
+    size_t i;
+    size_t n = 0;
+
+    for( i = 0; i < bout->info.total_size; i++ ) {
+        chunk[n++] = 0xff & bout->data[i];
+        chunk[n++] = 0xff & (bout->data[i] >> 8);
+        if( sizeof(chunk) == n ) {
+            crc = digest_crc32( crc, chunk, n );
+            n = 0;
+        }
+    }
+
+    return digest_crc32( crc, chunk, n );
+}
+
+int32_t checkpoint_init( dfu_checkpoint_t *checkpoint, char *path,
+                         intel_buffer_out_t *bout, const char *identity,
+                         const dfu_bool quiet ) {
+    FILE *fp;
+    unsigned int crc;
+    unsigned int resume_from;
+    char saved[CHECKPOINT_IDENTITY_LENGTH];
+    dfu_bool readable;
+
+    TRACE( "%s( %p, %s, %p, %s, %s )\n", __FUNCTION__, checkpoint,
+           ((NULL == path) ? "NULL" : path), bout,
+           ((NULL == identity) ? "NULL" : identity),
+           ((true == quiet) ? "true" : "false") );
+
+    if( (NULL == checkpoint) || (NULL == bout) || (NULL == bout->data) ) {
+        DEBUG( "ERROR: Invalid arguments.\n" );
+        return -1;
+    }
+
+    checkpoint->path = path;
+    checkpoint->image_crc = 0;
+    checkpoint->resume_from = 0;
+    checkpoint->retries = CHECKPOINT_RETRIES;
+    snprintf( checkpoint->identity, sizeof(checkpoint->identity), "%s",
+              (NULL == identity) ? "" : identity );
+
+    // an in-memory checkpoint is never compared with another image
+    if( NULL == path ) {
+        return 0;
+    }
+
+    checkpoint->image_crc = checkpoint_image_crc( bout );
+    DEBUG( "Image crc32 0x%08X.\n", checkpoint->image_crc );
+
+    if( NULL == (fp = fopen(path, "r")) ) {
+        if( ENOENT != errno ) {
+            DEBUG( "Unable to open checkpoint '%s': %s\n", path,
+                   strerror(errno) );
+            return -2;
+        }
+        DEBUG( "No checkpoint in '%s', starting from the beginning.\n", path );
+        return 0;
+    }
+
+    // the rest of the line names the device, which may contain spaces
+    saved[0] = '\0';
+    readable = (2 == fscanf(fp, "%x %x", &crc, &resume_from)) &&
+               (EOF != fscanf(fp, "%*[ ]")) &&
+               (NULL != fgets(saved, sizeof(saved), fp));
+    saved[strcspn(saved, "\n")] = '\0';
+
+    if( !readable ) {
+        DEBUG( "Checkpoint '%s' is not readable, ignoring it.\n", path );
+    } else if( crc != checkpoint->image_crc ) {
+        DEBUG( "Checkpoint crc 0x%08X does not match image, ignoring it.\n",
+               crc );
+        if( !quiet ) {
+            fprintf( stderr, "Checkpoint is for a different image, "
+                             "programming from the start.\n" );
+        }
+    } else if( 0 != strcmp(saved, checkpoint->identity) ) {
+        DEBUG( "Checkpoint is for device '%s', ignoring it.\n", saved );
+        if( !quiet ) {
+            fprintf( stderr, "Checkpoint is for a different device, "
+                             "programming from the start.\n" );
+        }
+    } else {
+        checkpoint->resume_from = resume_from;
+        if( !quiet && 0 != resume_from ) {
+            fprintf( stderr, "Resuming from checkpoint at 0x%X.\n",
+                     resume_from );
+        }
+    }
+
+    fclose( fp );
+
+    return 0;
+}
+
+int32_t checkpoint_advance( dfu_checkpoint_t *checkpoint,
+                            const uint32_t next ) {
+    uint32_t previous;
+
+    if( NULL == checkpoint ) {
+        return 0;
+    }
+
+    previous = checkpoint->resume_from;
+    checkpoint->resume_from = next;
+    checkpoint->retries = CHECKPOINT_RETRIES;
+
+    if( previous / CHECKPOINT_SAVE_INTERVAL != next / CHECKPOINT_SAVE_INTERVAL ) {
+        return checkpoint_save( checkpoint );
+    }
+
+    return 0;
+}
+
+int32_t checkpoint_save( dfu_checkpoint_t *checkpoint ) {
+    FILE *fp;
+
+    if( (NULL == checkpoint) || (NULL == checkpoint->path) ) {
+        return 0;
+    }
+
+    TRACE( "%s( %p ) 0x%08X 0x%X\n", __FUNCTION__, checkpoint,
+           checkpoint->image_crc, checkpoint->resume_from );
+
+    if( NULL == (fp = fopen(checkpoint->path, "w")) ) {
+        DEBUG( "Unable to write checkpoint '%s': %s\n", checkpoint->path,
+               strerror(errno) );
+        return -1;
+    }
+
+    fprintf( fp, "%08x %x %s\n", checkpoint->image_crc,
+             checkpoint->resume_from, checkpoint->identity );
+
+    if( 0 != fclose(fp) ) {
+        DEBUG( "Unable to write checkpoint '%s': %s\n", checkpoint->path,
+               strerror(errno) );
+        return -2;
+    }
+
+    return 0;
+}
+
+void checkpoint_clear( dfu_checkpoint_t *checkpoint ) {
+    if( NULL == checkpoint ) {
+        return;
+    }
+
+    checkpoint->resume_from = 0;
+
+    if( NULL != checkpoint->path ) {
+        if( 0 != remove(checkpoint->path) && ENOENT != errno ) {
+            DEBUG( "Unable to remove checkpoint '%s': %s\n", checkpoint->path,
+                   strerror(errno) );
+        }
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stdint.h>
+#include "dfu-bool.h"
+#include "intel_hex.h"
+
+/* number of times a single failed block is retried after recovering the
+ * device before the programming run is abandoned */
+#define CHECKPOINT_RETRIES          3
+
+/* the checkpoint file is rewritten whenever programming crosses one of
+ * these boundaries, and always when the run is abandoned */
+#define CHECKPOINT_SAVE_INTERVAL    0x4000
+
+/* room for the identity of the device, see dfu_device_identity */
+#define CHECKPOINT_IDENTITY_LENGTH  128
+
+typedef struct {
+    char *path;             /* file to persist to, NULL keeps it in memory */
+    uint32_t image_crc;     /* crc32 of the image being programmed */
+    uint32_t resume_from;   /* first address not yet confirmed written */
+    uint32_t retries;       /* recovery attempts left for the current block */
+    char identity[CHECKPOINT_IDENTITY_LENGTH];  /* the device programmed */
+} dfu_checkpoint_t;
+
+int32_t checkpoint_init( dfu_checkpoint_t *checkpoint, char *path,
+                         intel_buffer_out_t *bout, const char *identity,
+                         const dfu_bool quiet );
+/*  Prepare a checkpoint for programming bout.  If path names an existing
+ *  checkpoint for the same image on the same device, resume_from is
+ *  restored from it.  A checkpoint for a different image or device is
+ *  ignored.
+ *
+ *  checkpoint  - the checkpoint to initialize
+ *  path        - checkpoint file, or NULL for an in-memory checkpoint
+ *  bout        - the fully prepared image that is about to be programmed
+ *  identity    - the device being programmed, NULL if it is not known
+ *  quiet       - suppress the resume message
+ *
+ *  returns 0 on success, negative on error
+ */
+
+int32_t checkpoint_advance( dfu_checkpoint_t *checkpoint,
+                            const uint32_t next );
+/*  Record that everything below next has been written and acknowledged by
+ *  the device.  This also refills the retry budget and persists the
+ *  checkpoint each time a CHECKPOINT_SAVE_INTERVAL boundary is crossed.
+ *
+ *  returns 0 on success, negative if the file could not be written
+ */
+
+int32_t checkpoint_save( dfu_checkpoint_t *checkpoint );
+/*  Write the checkpoint to its file (does nothing for in-memory ones).
+ *
+ *  returns 0 on success, negative on error
+ */
+
+void checkpoint_clear( dfu_checkpoint_t *checkpoint );
+/*  Forget the checkpoint once the image has been completely programmed,
+ *  removing the checkpoint file if there is one.
+ */
+
+#endif
@@ -22,6 +22,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "dfu-bool.h"
 #include "commands.h"
@@ -29,24 +31,268 @@
 #include "intel_hex.h"
 #include "stm32.h"
 #include "atmel.h"
+#include "checkpoint.h"
+#include "digest.h"
+#include "binout.h"
+#include "patch.h"
+#include "bundle.h"
+#include "decompress.h"
+#include "dfuse_file.h"
+#include "cache.h"
+#include "profile.h"
+#include "manifest.h"
+#include "overlay.h"
 #include "util.h"
 #include "dfu.h"
+#include "usb.h"
 
 #define COMMAND_DEBUG_THRESHOLD 40
 
+/* autotune programs this much of the flash with each setting */
+#define AUTOTUNE_IMAGE_SIZE     0x4000
+
 #define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
                                COMMAND_DEBUG_THRESHOLD, __VA_ARGS__ )
 
 
-static int security_bit_state;
+/* per thread, the jobs of a manifest run at the same time */
+static __thread int security_bit_state;
+
+/* image preparation that runs while the device is being opened */
+struct prepare_job {
+    pthread_t thread;
+    dfu_bool started;
+    struct programmer_arguments args;   /* private copy for the worker */
+    intel_buffer_out_t bout;
+    atmel_frames_t frames;
+    int32_t retval;
+};
+
+static struct prepare_job prepare;
+
+typedef struct {
+    binout_t out;           /* where the dump goes */
+    uint32_t position;      /* output offset after the last data written */
+    size_t blank;           /* erased bytes read since then */
+    size_t unread;          /* of blank, the bytes below the first address
+                               read, always written as the fill value */
+    dfu_bool failed;        /* the output could not be written */
+} dump_stream_t;
+
+typedef struct {
+    size_t memory_size;     /* bytes in an image of the segment */
+    size_t page_size;
+    uint32_t bottom;        /* first and last address that can hold data */
+    uint32_t top;
+    uint32_t target_offset; /* hex file address of the segment start */
+} segment_layout_t;
+
+typedef struct {
+    dfu_patch_t *patch;
+    uint32_t next;          /* the page the next byte read belongs to */
+    uint32_t filled;        /* bytes of it read so far */
+    uint32_t crc;
+    uint32_t base;          /* pages matching the base image */
+    uint32_t image;         /* pages matching the patched image */
+    uint32_t first_bad;     /* first page matching neither, or UINT32_MAX */
+} patch_check_t;
 
 // ________  P R O T O T Y P E S  _______________________________
 static int32_t execute_validate( dfu_device_t *device,
                                  intel_buffer_out_t *bout,
+                                 const overlay_pages_t *pages,
                                  uint8_t mem_segment,
                                  dfu_bool quiet );
 /* provide an out buffer to validate and whether this is from
  * flash or eeprom data sections, also wether you want it quiet
+ * pages (may be NULL) were programmed over bout as an overlay
+ */
+
+static void profile_args( dfu_device_t *device,
+                          struct programmer_arguments *args );
+/* load the profile of an Atmel bootloader from args->profiles, reading the
+ * bootloader version only when the file has a profile for the device
+ */
+
+static uint64_t command_now_us( void );
+/* monotonic time in us
+ */
+
+static int32_t execute_autotune( dfu_device_t *device,
+                                 struct programmer_arguments *args );
+/* time erasing and programming a test image with each candidate setting
+ * and save the fastest ones that validate as the profile of the bootloader
+ */
+
+static void layout_args( dfu_device_t *device,
+                         struct programmer_arguments *args );
+/* take the flash size of an STM32 from the memory layout the device
+ * described, so reads and range checks follow the actual part
+ */
+
+static void flash_command_args( struct programmer_arguments *args );
+/* the flash-eeprom and flash-user commands are flash with another segment,
+ * update args accordingly
+ */
+
+static int32_t prepare_flash_image( struct programmer_arguments *args,
+                                    intel_buffer_out_t *bout,
+                                    atmel_frames_t *frames );
+/* build the memory image for a flash command from the hex file and the
+ * serial data and check it against the target, then encode the atmel
+ * download frames for it.  nothing here talks to the device.  returns
+ * SUCCESS or the error to exit with, bout->data is only allocated on success
+ */
+
+static int32_t prepare_wait( struct programmer_arguments *args,
+                             intel_buffer_out_t *bout,
+                             atmel_frames_t *frames );
+/* hand over the image started by execute_prepare, or build it now if
+ * preparation was not started in the background or the layout of the
+ * device changed the size of its flash since
+ */
+
+static int32_t verify_sink( void *context, const uint32_t address,
+                            const uint8_t *data, const size_t length );
+/* dfu_block_sink_t that adds each block read back to the digest_t in context
+ */
+
+static void image_range_digest( intel_buffer_out_t *bout, const uint32_t start,
+                          const uint32_t end, digest_t *digest );
+/* add the image from start to end to digest, with unassigned bytes as the
+ * erased value 0xff
+ */
+
+static int32_t execute_verify( dfu_device_t *device,
+                               struct programmer_arguments *args );
+/* compare the device memory to an image without writing anything, either
+ * byte for byte or by streaming the memory into a digest
+ */
+
+static int32_t segment_layout( struct programmer_arguments *args,
+                               const enum atmel_memory_unit_enum segment,
+                               segment_layout_t *layout );
+/* describe a memory segment of the target for the host only commands.
+ * returns SUCCESS, or ARGUMENT_ERROR if the target does not have it
+ */
+
+static int32_t load_image( struct programmer_arguments *args,
+                           char *filename, const dfu_bool bin,
+                           segment_layout_t *layout,
+                           intel_buffer_out_t *bout );
+/* read a hex file, or a binary image starting at address 0, into a new
+ * buffer.  returns SUCCESS or BUFFER_INIT_ERROR, bout->data is only
+ * allocated on success
+ */
+
+static int32_t checksum_file( struct programmer_arguments *args,
+                              const uint32_t start, const uint32_t end,
+                              segment_layout_t *layout,
+                              digest_t *digest );
+/* digest the range from a hex file, or from a binary image starting at
+ * address 0 with --bin.  bytes missing from the file count as 0xff so the
+ * result matches a device that was programmed with the file
+ */
+
+static int32_t dump_sink( void *context, const uint32_t address,
+                          const uint8_t *data, const size_t length );
+/* dfu_block_sink_t writing each block read to the dump_stream_t in context
+ */
+
+static int32_t dump_binary( dfu_device_t *device,
+                            struct programmer_arguments *args,
+                            const uint32_t start, const uint32_t end,
+                            const size_t page_size );
+/* read start to end and write it to stdout as it arrives, from address 0.
+ * without --force the output stops at the end of the last page with data
+ */
+
+static int32_t execute_checksum( dfu_device_t *device,
+                                 struct programmer_arguments *args );
+/* print the digest of a memory range read from the device, or computed from
+ * a file when one is given
+ */
+
+static uint32_t diff_unit( struct programmer_arguments *args,
+                           segment_layout_t *layout,
+                           const uint32_t address );
+/* returns the flash page, or on STM32 the sector, that holds address
+ */
+
+static int32_t execute_diff( dfu_device_t *device,
+                             struct programmer_arguments *args );
+/* compare two image files and print what changed, no device is used
+ */
+
+static void image_page( intel_buffer_out_t *bout, const uint32_t address,
+                        const size_t page_size, uint8_t *page );
+/* copy the page at address out of an image, unassigned bytes as 0xff
+ */
+
+static int32_t execute_make_patch( dfu_device_t *device,
+                                   struct programmer_arguments *args );
+/* write the patch that turns the old image file into the new one to
+ * stdout, no device is used
+ */
+
+static int32_t patch_sink( void *context, const uint32_t address,
+                           const uint8_t *data, const size_t length );
+/* dfu_block_sink_t that checks each page read against the patch_check_t
+ * in context
+ */
+
+static int32_t patch_check( dfu_device_t *device,
+                            struct programmer_arguments *args,
+                            dfu_patch_t *patch, patch_check_t *check );
+/* read every page of the patch from the device and count how many match
+ * the base and the patched image.  returns SUCCESS or FLASH_READ_ERROR
+ */
+
+static int32_t execute_apply_patch( dfu_device_t *device,
+                                    struct programmer_arguments *args );
+/* check the device against the base of a patch file, then program the
+ * pages of the patch
+ */
+
+static int32_t execute_bundle( dfu_device_t *device,
+                               struct programmer_arguments *args );
+/* write a bundle of the hex files and settings given to stdout, no device
+ * is used
+ */
+
+static int32_t bundle_image( struct programmer_arguments *args,
+                             dfu_bundle_t *bundle,
+                             const enum atmel_memory_unit_enum segment,
+                             intel_buffer_out_t *bout );
+/* collect the image entries of a segment into a new buffer and check it
+ * against the target like flash does.  returns SUCCESS with bout->data NULL
+ * if the bundle has nothing for the segment, SUCCESS with the image, or the
+ * error to exit with
+ */
+
+static int32_t execute_flash_bundle( dfu_device_t *device,
+                                     struct programmer_arguments *args );
+/* program and validate each segment of a bundle file, then write its
+ * configure and setfuse values as set does
+ */
+
+static int16_t *config_value( atmel_device_info_t *info, const int32_t name );
+/* the byte of info that a configure property reads back as, NULL if the
+ * name is unknown
+ */
+
+static int32_t execute_settings( dfu_device_t *device,
+                                 struct programmer_arguments *args,
+                                 const struct setting_struct *setting,
+                                 const size_t count );
+/* write a list of configure and setfuse values in one session: the current
+ * values are read once, only those that differ are written, then they are
+ * read back once to check them.  returns 0 on success, < 0 if not
+ */
+
+static int32_t execute_set( dfu_device_t *device,
+                            struct programmer_arguments *args );
+/* write the settings given with set
  */
 
 // ________  F U N C T I O N S  _______________________________
@@ -149,24 +395,16 @@ static int32_t serialize_memory_image( intel_buffer_out_t *bout,
     else if( args->device_type & GRP_STM32 )
         target_offset = STM32_FLASH_OFFSET;
 
-    if ( NULL != args->com_flash_data.serial_data ) {
-        int16_t *serial_data = args->com_flash_data.serial_data;
-        uint32_t length = args->com_flash_data.serial_length;
-        uint32_t offset = args->com_flash_data.serial_offset;
-        uint32_t i;
-
-        for( i=0; i < length; ++i ) {
-            if ( 0 != intel_process_data(bout, serial_data[i],
-                        target_offset, offset + i) ) {
-                return BUFFER_INIT_ERROR;
-            }
-        }
+    if ( 0 != overlay_apply(&args->com_flash_data.overlay, bout,
+                            target_offset) ) {
+        return BUFFER_INIT_ERROR;
     }
     return SUCCESS;
 }
 
 static int32_t execute_validate( dfu_device_t *device,
                                  intel_buffer_out_t *bout,
+                                 const overlay_pages_t *pages,
                                  uint8_t mem_segment,
                                  const dfu_bool quiet ) {
     int32_t retval = UNSPECIFIED_ERROR;
@@ -194,6 +432,11 @@ static int32_t execute_validate( dfu_device_t *device,
         goto error;
     }
 
+    // bout is shared, so the overlay is checked here and then left out
+    if( NULL != pages ) {
+        overlay_pages_fold( pages, bout, &buin );
+    }
+
     if( 0 != (result = intel_validate_buffer( &buin, bout, quiet )) ) {
         if( result < 0 ) {
             retval = VALIDATION_ERROR_IN_REGION;
@@ -228,12 +471,17 @@ static void print_flash_usage( intel_buffer_info_t *info ) {
 static int32_t execute_hex2bin( dfu_device_t *device,
         struct programmer_arguments *args ) {
     int32_t  retval = -1;
+    int32_t  result = 0;
     uint32_t  i;
+    uint32_t  n;
     intel_buffer_out_t bout;
+    binout_t *out = NULL;
+    uint8_t  chunk[0x1000];
     size_t   memory_size;
     size_t   page_size;
     uint32_t target_offset = 0;
 
+    bout.data = NULL;
     memory_size = args->memory_address_top + 1;
     page_size = args->flash_page_size;
 
@@ -243,8 +491,8 @@ static int32_t execute_hex2bin( dfu_device_t *device,
         goto error;
     }
 
-    if( 0!= intel_hex_to_buffer( args->com_convert_data.file, &bout,
-                target_offset, args->quiet ) ) {
+    if( 0!= cache_hex_to_buffer( args->cache, args->com_convert_data.file,
+                &bout, target_offset, args->quiet ) ) {
         DEBUG( "Something went wrong with creating the memory image.\n" );
         goto error;
     }
@@ -252,15 +500,36 @@ static int32_t execute_hex2bin( dfu_device_t *device,
     if( !args->quiet )
         fprintf( stderr, "Dumping 0x%X bytes from address offset 0x%X.\n",
                 bout.info.data_end + 1, target_offset );
-    for( i = 0; i <= bout.info.data_end; i++ ) {
-        fprintf( stdout, "%c", bout.data[i] <= 0xFF ? bout.data[i] & 0xFF : 0xFF);
+    if( NULL == (out = (binout_t *) malloc(sizeof(binout_t))) ||
+            0 != binout_open(out, stdout, args->com_convert_data.fill) ) {
+        goto error;
+    }
+    for( i = 0; i <= bout.info.data_end; i += n ) {
+        // runs of unassigned bytes are blank, the rest is copied in chunks
+        if( bout.data[i] > 0xFF ) {
+            for( n = 1; (i + n <= bout.info.data_end) &&
+                        (bout.data[i + n] > 0xFF); n++ ) {}
+            result = binout_blank( out, n );
+        } else {
+            for( n = 0; (n < sizeof(chunk)) && (i + n <= bout.info.data_end) &&
+                        (bout.data[i + n] <= 0xFF); n++ ) {
+                chunk[n] = (uint8_t) bout.data[i + n];
+            }
+            result = binout_write( out, chunk, n );
+        }
+        if( 0 != result ) {
+            break;
+        }
+    }
+    if( (0 != result) || (0 != binout_close(out)) ) {
+        fprintf( stderr, "Error writing the output.\n" );
+        goto error;
     }
-
-    fflush( stdout );
 
     retval = 0;
 
 error:
+    free( out );
     if( NULL != bout.data ) {
         free( bout.data );
         bout.data = NULL;
@@ -279,6 +548,7 @@ static int32_t execute_bin2hex( dfu_device_t *device,
     uint32_t target_offset = 0; // address offset on the target device
         // NOTE: target_offset may not be set appropriately for device
         // classes other than ADC_AVR32
+    decompress_t file = { NULL, 0, NULL };
     FILE *fp = NULL;
     char *filename = args->com_convert_data.file;
 
@@ -321,18 +591,21 @@ static int32_t execute_bin2hex( dfu_device_t *device,
         goto error;
     }
 
-    if( 0 == strcmp("STDIN", filename) ) {
-        fp = stdin;
-    } else {
-        fp = fopen( filename, "r" );
-        if( NULL == fp ) {
-            if( !args->quiet ) fprintf( stderr, "Error opening %s\n", filename );
-            retval = -3;
-            goto error;
-        }
+    if( 0 != decompress_open(&file, filename) ) {
+        if( !args->quiet ) fprintf( stderr, "Error opening %s\n", filename );
+        retval = -3;
+        goto error;
     }
+    fp = file.fp;
 
     buin.info.data_end = fread(buin.data, 1, buin.info.total_size, fp);
+    if( 0 != decompress_close(&file) ) {
+        if( !args->quiet ) fprintf( stderr, "Error decoding %s with %s.\n",
+                                    filename,
+                                    (NULL != file.tool) ? file.tool : "input" );
+        retval = -4;
+        goto error;
+    }
     if( buin.info.data_end == 0 ) {
         if( !args->quiet ) fprintf( stderr, "ERROR: no bytes read\n" );
         retval = -4;
@@ -346,6 +619,7 @@ static int32_t execute_bin2hex( dfu_device_t *device,
     retval = intel_hex_from_buffer( &buin, args->com_convert_data.force, target_offset );
 
 error:
+    decompress_close( &file );
     if( NULL != buin.data ) {
         free( buin.data );
         buin.data = NULL;
@@ -354,17 +628,20 @@ error:
     return retval;
 }
 
-static int32_t execute_flash( dfu_device_t *device,
-                                struct programmer_arguments *args ) {
+static int32_t prepare_flash_image( struct programmer_arguments *args,
+                                    intel_buffer_out_t *bout,
+                                    atmel_frames_t *frames ) {
     int32_t  retval = UNSPECIFIED_ERROR;
     int32_t  result;
     uint32_t  i;
-    intel_buffer_out_t bout;
     size_t   memory_size;
     size_t   page_size;
     enum atmel_memory_unit_enum mem_type = args->com_flash_data.segment;
     uint32_t target_offset = 0;
 
+    bout->data = NULL;
+    memset( frames, 0, sizeof(atmel_frames_t) );
+
     /* assign the correct memory size */
     switch ( mem_type ) {
         case mem_flash:
@@ -399,14 +676,14 @@ static int32_t execute_flash( dfu_device_t *device,
     }
 
     // ----------------- CONVERT HEX FILE TO BINARY -------------------------
-    if( 0 != intel_init_buffer_out(&bout, memory_size, page_size) ) {
+    if( 0 != intel_init_buffer_out(bout, memory_size, page_size) ) {
         DEBUG("ERROR initializing a buffer.\n");
         retval = BUFFER_INIT_ERROR;
         goto error;
     }
 
-    result = intel_hex_to_buffer( args->com_flash_data.file, &bout,
-            target_offset, args->quiet );
+    result = cache_hex_to_buffer( args->cache, args->com_flash_data.file,
+            bout, target_offset, args->quiet );
 
     if ( result < 0 ) {
         DEBUG( "Something went wrong with creating the memory image.\n" );
@@ -430,21 +707,21 @@ static int32_t execute_flash( dfu_device_t *device,
 // file.. this would be easier than using serialize and could return the address
 // location of the start of the string (to be used in the program file)
 
-    if (0 != serialize_memory_image( &bout, args )) {
+    if (0 != serialize_memory_image( bout, args )) {
         retval = BUFFER_INIT_ERROR;
         goto error;
     }
 
     if( mem_type == mem_flash ) {
-        bout.info.valid_start = args->flash_address_bottom;
-        bout.info.valid_end = args->flash_address_top;
+        bout->info.valid_start = args->flash_address_bottom;
+        bout->info.valid_end = args->flash_address_top;
 
         // check that there isn't anything overlapping the bootloader
         for( i = args->bootloader_bottom; i <= args->bootloader_top; i++) {
-            if( bout.data[i] <= UINT8_MAX ) {
+            if( bout->data[i] <= UINT8_MAX ) {
                 if( true == args->suppressbootloader ) {
                     //If we're ignoring the bootloader, don't write to it
-                    bout.data[i] = UINT16_MAX;
+                    bout->data[i] = UINT16_MAX;
                 } else {
                     fprintf( stderr, "Bootloader and code overlap.\n" );
                     fprintf( stderr, "Use --suppress-bootloader-mem to ignore\n" );
@@ -456,17 +733,17 @@ static int32_t execute_flash( dfu_device_t *device,
     } else if ( mem_type == mem_user ) {
         // check here about overwriting?
 
-        if ( bout.info.data_start == UINT32_MAX ) {
+        if ( bout->info.data_start == UINT32_MAX ) {
             fprintf( stderr,
                     "ERROR: No data to write into the user page.\n" );
             retval = BUFFER_INIT_ERROR;
             goto error;
         } else {
             DEBUG("Hex file contains %u bytes to write.\n",
-                    bout.info.data_end - bout.info.data_start + 1 );
+                    bout->info.data_end - bout->info.data_start + 1 );
         }
 
-        if ( !(args->com_flash_data.force) ) {
+        if ( !(args->com_flash_data.force) && (com_verify != args->command) ) {
             /* depending on the version of the bootloader, there could be
             * configuration values in the last word or last two words of the
             * user page.  If these are overwritten the device may not start.
@@ -489,11 +766,11 @@ static int32_t execute_flash( dfu_device_t *device,
             // checking the bootloader version to make sure the right number of
             // words are blocked / written.
             //  ----------- the below for loop is not currently in use -----------
-            for ( i = bout.info.total_size - 8; i < bout.info.total_size; i++ ) {
-                if ( -1 != bout.data[i] ) {
+            for ( i = bout->info.total_size - 8; i < bout->info.total_size; i++ ) {
+                if ( -1 != bout->data[i] ) {
                     fprintf( stderr,
                             "ERROR: data overlap with bootloader configuration word(s).\n" );
-                    DEBUG( "At position %d, value is %d.\n", i, bout.data[i] );
+                    DEBUG( "At position %d, value is %d.\n", i, bout->data[i] );
                     fprintf( stderr,
                             "ERROR: use the --force-config flag to write the data.\n" );
                     retval = ARGUMENT_ERROR;
@@ -503,18 +780,174 @@ static int32_t execute_flash( dfu_device_t *device,
         }
     }
 
+    // fill the pages and find the data limits while the image is still
+    // ours alone, a manifest shares it between boards that only read it
+    if( (mem_type != mem_user) && (com_verify != args->command) ) {
+        if( 0 != intel_flash_prep_buffer(bout) ) {
+            retval = BUFFER_INIT_ERROR;
+            goto error;
+        }
+        intel_flash_data_limits( bout );
+    }
+
+    // encode the download frames once, atmel_flash only replays them
+    if( (mem_type != mem_user) && !(args->device_type & GRP_STM32) &&
+            (com_verify != args->command) ) {
+        if( 0 != atmel_frames_build(frames, bout, args->device_type,
+                    mem_type == mem_eeprom ? true : false, 0) ) {
+            DEBUG( "Unable to encode frames, atmel_flash will retry.\n" );
+        }
+    }
+
+    return SUCCESS;
+
+error:
+    if( NULL != bout->data ) {
+        free( bout->data );
+        bout->data = NULL;
+    }
+
+    return retval;
+}
+
+static void *prepare_worker( void *arg ) {
+    struct prepare_job *job = (struct prepare_job *) arg;
+
+    job->retval = prepare_flash_image( &job->args, &job->bout, &job->frames );
+
+    return NULL;
+}
+
+static int32_t prepare_wait( struct programmer_arguments *args,
+                             intel_buffer_out_t *bout,
+                             atmel_frames_t *frames ) {
+    if( false == prepare.started ) {
+        return prepare_flash_image( args, bout, frames );
+    }
+
+    pthread_join( prepare.thread, NULL );
+    prepare.started = false;
+    DEBUG( "Image preparation finished with %d.\n", prepare.retval );
+
+    *bout = prepare.bout;
+    prepare.bout.data = NULL;
+    *frames = prepare.frames;
+    memset( &prepare.frames, 0, sizeof(atmel_frames_t) );
+
+    // the worker used the target table, layout_args may have corrected it
+    if( (SUCCESS == prepare.retval) &&
+            (mem_flash == args->com_flash_data.segment) &&
+            (bout->info.total_size != args->memory_address_top + 1) ) {
+        DEBUG( "Flash is 0x%X bytes, not 0x%X, preparing the image again.\n",
+               args->memory_address_top + 1, (uint32_t) bout->info.total_size );
+        free( bout->data );
+        bout->data = NULL;
+        atmel_frames_free( frames );
+        return prepare_flash_image( args, bout, frames );
+    }
+
+    return prepare.retval;
+}
+
+static int32_t execute_flash( dfu_device_t *device,
+                                struct programmer_arguments *args ) {
+    int32_t  retval = UNSPECIFIED_ERROR;
+    int32_t  result;
+    intel_buffer_out_t bout;
+    atmel_frames_t frames;
+    overlay_pages_t pages;
+    dfu_checkpoint_t checkpoint;
+    char identity[CHECKPOINT_IDENTITY_LENGTH];
+    enum atmel_memory_unit_enum mem_type = args->com_flash_data.segment;
+    const intel_buffer_out_t *image = args->com_flash_data.image;
+    const image_overlay_t *overlay = &args->com_flash_data.overlay;
+    const atmel_frames_t *encoded = &frames;
+    dfu_bool prepared = true;   /* bout went through prepare_flash_image */
+
+    memset( &frames, 0, sizeof(atmel_frames_t) );
+    memset( &pages, 0, sizeof(overlay_pages_t) );
+
+    // ----------------- CONVERT HEX FILE TO BINARY -------------------------
+    // a manifest image is shared with other jobs, only its info is ours.
+    // The flash size of an STM32 is only known now, so it may not fit.
+    if( (NULL != image) && ((mem_type != mem_flash) ||
+                (image->info.total_size == args->memory_address_top + 1)) ) {
+        bout = *image;
+        if( 0 == overlay->count ) {
+            // nothing of our own, so the frames are shared as well
+            if( NULL != args->com_flash_data.frames ) {
+                encoded = args->com_flash_data.frames;
+            }
+        } else if( (mem_type != mem_user) &&
+                atmel_frames_fit(args->com_flash_data.frames, device,
+                                 mem_type == mem_eeprom ? true : false) ) {
+            // only the pages the overlay writes are ours
+            if( 0 != overlay_pages_build(&pages, overlay, image, 0) ) {
+                fprintf( stderr, "Serial data is outside the memory.\n" );
+                retval = BUFFER_INIT_ERROR;
+                goto error;
+            }
+            if( 0 != atmel_frames_overlay(&frames, args->com_flash_data.frames,
+                                          image, &pages) ) {
+                retval = BUFFER_INIT_ERROR;
+                goto error;
+            }
+        } else {
+            // no frames to share, so the image is copied and written over
+            bout.data = (uint16_t *) malloc( bout.info.total_size *
+                                             sizeof(uint16_t) );
+            image = NULL;
+            prepared = false;
+            if( NULL == bout.data ) {
+                retval = BUFFER_INIT_ERROR;
+                goto error;
+            }
+            memcpy( bout.data, args->com_flash_data.image->data,
+                    bout.info.total_size * sizeof(uint16_t) );
+            if( 0 != serialize_memory_image(&bout, args) ) {
+                retval = BUFFER_INIT_ERROR;
+                goto error;
+            }
+        }
+    } else if( 0 != (retval = prepare_wait(args, &bout, &frames)) ) {
+        // normally this already ran on the worker started by execute_prepare
+        image = NULL;
+        goto error;
+    } else {
+        image = NULL;
+    }
+
     // ------------------ WRITE PROGRAM DATA -------------------------------
     if( mem_type == mem_user ) {
         result = atmel_user( device, &bout );
     } else {
+        if( 0 != dfu_device_identity(device, identity, sizeof(identity)) ) {
+            identity[0] = '\0';
+        }
+        if( 0 != checkpoint_init(&checkpoint, args->com_flash_data.checkpoint,
+                    &bout, identity, args->quiet) ) {
+            fprintf( stderr, "Unable to read checkpoint '%s'.\n",
+                     args->com_flash_data.checkpoint );
+            retval = ARGUMENT_ERROR;
+            goto error;
+        }
+
         if( args->device_type & GRP_STM32 ) {
             result = stm32_write_flash( device, &bout,
                     mem_type == mem_eeprom ? true : false,
-                    args->com_flash_data.force, args->quiet );
+                    args->com_flash_data.force, args->quiet, &checkpoint,
+                    prepared );
         } else {
             result = atmel_flash(device, &bout,
                     mem_type == mem_eeprom ? true : false,
-                    args->com_flash_data.force, args->quiet);
+                    args->com_flash_data.force, args->quiet, &checkpoint,
+                    encoded);
+        }
+
+        if( 0 != result && NULL != checkpoint.path && 0 == args->quiet ) {
+            fprintf( stderr, "Progress saved to '%s' at 0x%X, "
+                             "repeat the command to resume.\n",
+                     checkpoint.path, checkpoint.resume_from );
         }
     }
     if( 0 != result ) {
@@ -525,7 +958,9 @@ static int32_t execute_flash( dfu_device_t *device,
 
     // ------------------  VALIDATE PROGRAM ------------------------------
     if( 0 == args->com_flash_data.suppress_validation ) {
-        if( 0 != ( retval = execute_validate(device, &bout, mem_type, args->quiet)) ) {
+        if( 0 != ( retval = execute_validate(device, &bout,
+                        (0 != pages.count) ? &pages : NULL, mem_type,
+                        args->quiet)) ) {
             fprintf( stderr, "Memory did not validate. Did you erase?\n" );
             goto error;
         } else if ( 0 == args->quiet ) {
@@ -539,7 +974,9 @@ static int32_t execute_flash( dfu_device_t *device,
     retval = SUCCESS;
 
 error:
-    if( NULL != bout.data ) {
+    atmel_frames_free( &frames );
+    overlay_pages_free( &pages );
+    if( (NULL == image) && (NULL != bout.data) ) {
         free( bout.data );
         bout.data = NULL;
     }
@@ -547,390 +984,2048 @@ error:
     return retval;
 }
 
-static int32_t execute_getfuse( dfu_device_t *device,
-                            struct programmer_arguments *args ) {
-    atmel_avr32_fuses_t info;
-    char *message = NULL;
-    int32_t value = 0;
-    int32_t status;
+static int32_t verify_sink( void *context, const uint32_t address,
+                            const uint8_t *data, const size_t length ) {
+    digest_update( (digest_t *) context, data, length );
+    return 0;
+}
 
-    /* only ADC_AVR32 seems to support fuse operation */
-    if( !(ADC_AVR32 & args->device_type) ) {
-        DEBUG( "target doesn't support fuse set operation.\n" );
-        fprintf( stderr, "target doesn't support fuse set operation.\n" );
-        return ARGUMENT_ERROR;
+static void image_range_digest( intel_buffer_out_t *bout, const uint32_t start,
+                          const uint32_t end, digest_t *digest ) {
+    uint8_t chunk[256];
+    uint32_t i;
+    size_t n = 0;
+
+    // the memory should read back as the image, and blank where unassigned
+    for( i = start; i <= end; i++ ) {
+        chunk[n++] = (bout->data[i] <= UINT8_MAX) ? bout->data[i] : 0xff;
+        if( sizeof(chunk) == n ) {
+            digest_update( digest, chunk, n );
+            n = 0;
+        }
     }
+    digest_update( digest, chunk, n );
+}
 
-    /* Check AVR32 security bit in order to provide a better error message. */
-    security_check( device );
-
-    if( args->device_type & GRP_STM32 ) {
-        fprintf( stderr, "Operation not supported on %s.\n",
-                args->device_type_string );
-        return ARGUMENT_ERROR;
-    } else {
-        status = atmel_read_fuses( device, &info );
-    }
+static int32_t execute_verify( dfu_device_t *device,
+                               struct programmer_arguments *args ) {
+    int32_t  retval = UNSPECIFIED_ERROR;
+    int32_t  result;
+    intel_buffer_out_t bout;
+    atmel_frames_t frames;
+    digest_t digest;
+    uint8_t image_digest[DIGEST_MAX_SIZE];
+    uint8_t device_digest[DIGEST_MAX_SIZE];
+    size_t length;
+    enum digest_algorithm hash = args->com_flash_data.hash;
+    enum atmel_memory_unit_enum mem_type = args->com_flash_data.segment;
 
-    if( 0 != status ) {
-        DEBUG( "Error reading %s config information.\n",
-               args->device_type_string );
-        fprintf( stderr, "Error reading %s config information.\n",
-                         args->device_type_string );
-        security_message();
-        return status;
+    if( 0 != (retval = prepare_wait(args, &bout, &frames)) ) {
+        goto error;
     }
 
-    switch( args->com_getfuse_data.name ) {
-        case get_lock:
-            value = info.lock;
-            message = "Locked regions";
-            break;
-        case get_epfl:
-            value = info.epfl;
-            message = "External Privileged Fetch Lock";
-            break;
-        case get_bootprot:
-            value = info.bootprot;
-            message = "Bootloader protected area";
-            break;
-        case get_bodlevel:
-            value = info.bodlevel;
-            message = "Brown-out detector trigger level";
-            break;
-        case get_bodhyst:
-            value = info.bodhyst;
-            message = "BOD Hysteresis enable";
-            break;
-        case get_boden:
-            value = info.boden;
-            message = "BOD Enable";
-            break;
-        case get_isp_bod_en:
-            value = info.isp_bod_en;
-            message = "ISP BOD enable";
-            break;
-        case get_isp_io_cond_en:
-            value = info.isp_io_cond_en;
-            message = "ISP IO condition enable";
-            break;
-        case get_isp_force:
-            value = info.isp_force;
-            message = "ISP Force";
-            break;
+    if( DIGEST_NONE == hash ) {
+        if( 0 == (retval = execute_validate(device, &bout, NULL, mem_type,
+                                             args->quiet)) ) {
+            retval = SUCCESS;
+        }
+        goto error;
     }
-    fprintf( stdout, "%s%s0x%02x (%d)\n",
-             ((0 == args->quiet) ? message : ""),
-             ((0 == args->quiet) ? ": " : ""),
-             value, value );
-    return 0;
-}
-
-static int32_t execute_get( dfu_device_t *device,
-                            struct programmer_arguments *args ) {
-    atmel_device_info_t info;
-    char *message = NULL;
-    int16_t value = 0;
-    int32_t status;
-    int32_t controller_error = 0;
 
-    /* Check AVR32 security bit in order to provide a better error message. */
-    security_check( device );
+    // only the digest of the image is kept while the device is read
+    digest_init( &digest, hash );
+    image_range_digest( &bout, bout.info.valid_start, bout.info.valid_end,
+                  &digest );
+    length = digest_final( &digest, image_digest );
+    free( bout.data );
+    bout.data = NULL;
 
+    digest_init( &digest, hash );
     if( args->device_type & GRP_STM32 ) {
-        fprintf( stderr, "Operation not supported on %s.\n",
-                args->device_type_string );
-        return -1;
+        result = stm32_read_stream( device, bout.info.valid_start,
+                bout.info.valid_end, verify_sink, &digest, args->quiet );
     } else {
-        status = atmel_read_config( device, &info );
+        result = atmel_read_stream( device, bout.info.valid_start,
+                bout.info.valid_end, mem_type, verify_sink, &digest,
+                args->quiet );
+    }
+    if( 0 != result ) {
+        DEBUG( "ERROR: could not read memory, err %d.\n", result );
+        retval = FLASH_READ_ERROR;
+        goto error;
+    }
+    digest_final( &digest, device_digest );
+
+    if( !args->quiet ) {
+        fprintf( stderr, "Image  %s: ", digest_name(hash) );
+        digest_print( stderr, image_digest, length );
+        fprintf( stderr, "\nDevice %s: ", digest_name(hash) );
+        digest_print( stderr, device_digest, length );
+        fprintf( stderr, "\nValidating...  " );
     }
 
-    if( 0 != status ) {
-        DEBUG( "Error reading %s config information.\n",
-               args->device_type_string );
-        fprintf( stderr, "Error reading %s config information.\n",
-                         args->device_type_string );
-        security_message();
-        return status;
+    if( 0 != memcmp(image_digest, device_digest, length) ) {
+        if( !args->quiet ) fprintf( stderr, "ERROR\n" );
+        retval = VALIDATION_ERROR_IN_REGION;
+        goto error;
     }
+    if( !args->quiet ) fprintf( stderr, "Success\n" );
 
-    switch( args->com_get_data.name ) {
-        case get_bootloader:
-            value = info.bootloaderVersion;
-            message = "Bootloader Version";
-            break;
-        case get_ID1:
-            value = info.bootID1;
-            message = "Device boot ID 1";
-            break;
-        case get_ID2:
-            value = info.bootID2;
-            message = "Device boot ID 2";
-            break;
-        case get_BSB:
-            value = info.bsb;
-            message = "Boot Status Byte";
-            if( ADC_8051 != args->device_type ) {
-                controller_error = 1;
-            }
-            break;
-        case get_SBV:
-            value = info.sbv;
-            message = "Software Boot Vector";
-            if( ADC_8051 != args->device_type ) {
-                controller_error = 1;
+    retval = SUCCESS;
+
+error:
+    atmel_frames_free( &frames );
+    if( NULL != bout.data ) {
+        free( bout.data );
+        bout.data = NULL;
+    }
+
+    return retval;
+}
+
+static int32_t segment_layout( struct programmer_arguments *args,
+                               const enum atmel_memory_unit_enum segment,
+                               segment_layout_t *layout ) {
+    layout->bottom = 0;
+    layout->target_offset = 0;
+
+    switch( segment ) {
+        case mem_flash:
+            layout->memory_size = args->memory_address_top + 1;
+            layout->page_size = args->flash_page_size;
+            layout->bottom = args->flash_address_bottom;
+            layout->top = args->flash_address_top;
+            if( args->device_type & GRP_STM32 ) {
+                layout->target_offset = STM32_FLASH_OFFSET;
             }
             break;
-        case get_SSB:
-            value = info.ssb;
-            message = "Software Security Byte";
-            if( ADC_8051 != args->device_type ) {
-                controller_error = 1;
+        case mem_eeprom:
+            if( 0 == args->eeprom_memory_size ) {
+                fprintf( stderr, "This device has no eeprom.\n" );
+                return ARGUMENT_ERROR;
             }
+            layout->memory_size = args->eeprom_memory_size;
+            layout->page_size = args->eeprom_page_size;
+            layout->top = layout->memory_size - 1;
             break;
-        case get_EB:
-            value = info.eb;
-            message = "Extra Byte";
-            if( ADC_8051 != args->device_type ) {
-                controller_error = 1;
+        case mem_user:
+            if( ADC_AVR32 != args->device_type ) {
+                fprintf( stderr, "The user page is only on ADC_AVR32 devices.\n" );
+                return ARGUMENT_ERROR;
             }
+            layout->memory_size = args->flash_page_size;
+            layout->page_size = args->flash_page_size;
+            layout->top = layout->memory_size - 1;
+            layout->target_offset = ATMEL_USER_PAGE_OFFSET;
             break;
-        case get_manufacturer:
-            value = info.manufacturerCode;
-            message = "Manufacturer Code";
-            break;
-        case get_family:
-            value = info.familyCode;
-            message = "Family Code";
-            break;
-        case get_product_name:
-            value = info.productName;
-            message = "Product Name";
+        default:
+            DEBUG( "Unknown memory type %d\n", segment );
+            return ARGUMENT_ERROR;
+    }
+
+    return SUCCESS;
+}
+
+static int32_t load_image( struct programmer_arguments *args,
+                           char *filename, const dfu_bool bin,
+                           segment_layout_t *layout,
+                           intel_buffer_out_t *bout ) {
+    int32_t retval = BUFFER_INIT_ERROR;
+    int32_t result;
+    uint8_t chunk[1024];
+    uint32_t address = 0;
+    size_t n;
+    size_t i;
+    decompress_t file = { NULL, 0, NULL };
+    FILE *fp = NULL;
+
+    if( 0 != intel_init_buffer_out(bout, layout->memory_size,
+                layout->page_size) ) {
+        DEBUG( "ERROR initializing a buffer.\n" );
+        bout->data = NULL;
+        return BUFFER_INIT_ERROR;
+    }
+    bout->info.valid_start = layout->bottom;
+    bout->info.valid_end = layout->top;
+
+    if( !bin ) {
+        result = cache_hex_to_buffer( args->cache, filename, bout,
+                                      layout->target_offset, args->quiet );
+        if( result < 0 ) {
+            DEBUG( "Something went wrong with creating the memory image.\n" );
+            goto error;
+        } else if( (result > 0) && !args->quiet ) {
+            fprintf( stderr, "WARNING: 0x%X bytes of %s are outside target "
+                    "memory.\n", result, filename );
+        }
+        return SUCCESS;
+    }
+
+    if( 0 != decompress_open(&file, filename) ) {
+        if( !args->quiet ) fprintf( stderr, "Error opening %s\n", filename );
+        goto error;
+    }
+    fp = file.fp;
+    while( 0 != (n = fread(chunk, 1, sizeof(chunk), fp)) ) {
+        for( i = 0; (i < n) && (address < layout->memory_size); i++ ) {
+            intel_process_data( bout, (char) chunk[i], 0, address++ );
+        }
+        if( i < n ) {
+            if( !args->quiet )
+                fprintf( stderr, "WARNING: %s is larger than 0x%X bytes of "
+                        "memory.\n", filename, (uint32_t) layout->memory_size );
             break;
-        case get_product_rev:
-            value = info.productRevision;
-            message = "Product Revision";
+        }
+    }
+    if( ferror(fp) ) {
+        if( !args->quiet ) fprintf( stderr, "Error reading %s\n", filename );
+        goto error;
+    }
+    if( 0 != decompress_close(&file) ) {
+        if( !args->quiet ) fprintf( stderr, "Error decoding %s with %s.\n",
+                                    filename,
+                                    (NULL != file.tool) ? file.tool : "input" );
+        goto error;
+    }
+
+    return SUCCESS;
+
+error:
+    decompress_close( &file );
+    free( bout->data );
+    bout->data = NULL;
+
+    return retval;
+}
+
+static int32_t checksum_file( struct programmer_arguments *args,
+                              const uint32_t start, const uint32_t end,
+                              segment_layout_t *layout,
+                              digest_t *digest ) {
+    int32_t retval = UNSPECIFIED_ERROR;
+    intel_buffer_out_t bout;
+    uint8_t chunk[1024];
+    uint32_t address = 0;
+    size_t n;
+    decompress_t file = { NULL, 0, NULL };
+    FILE *fp = NULL;
+    char *filename = args->com_checksum_data.file;
+
+    bout.data = NULL;
+
+    if( !args->com_checksum_data.bin ) {
+        if( SUCCESS != (retval = load_image(args, filename, false, layout,
+                        &bout)) ) {
+            goto error;
+        }
+        image_range_digest( &bout, start, end, digest );
+        retval = SUCCESS;
+        goto error;
+    }
+
+    // a binary is streamed, only the range is ever held in memory
+    if( 0 != decompress_open(&file, filename) ) {
+        if( !args->quiet ) fprintf( stderr, "Error opening %s\n", filename );
+        retval = ARGUMENT_ERROR;
+        goto error;
+    }
+    fp = file.fp;
+
+    while( address <= end ) {
+        n = sizeof(chunk);
+        if( address < start && start - address < n ) {
+            n = start - address;
+        } else if( address >= start && end - address + 1 < n ) {
+            n = end - address + 1;
+        }
+        n = fread( chunk, 1, n, fp );
+        if( 0 == n ) {
             break;
-        case get_HSB:
-            value = info.hsb;
-            message = "Hardware Security Byte";
-            if( ADC_8051 != args->device_type ) {
-                controller_error = 1;
-            }
+        }
+        if( address >= start ) {
+            digest_update( digest, chunk, n );
+        }
+        address += n;
+    }
+    if( ferror(fp) ) {
+        if( !args->quiet ) fprintf( stderr, "Error reading %s\n", filename );
+        retval = BUFFER_INIT_ERROR;
+        goto error;
+    }
+    if( 0 != decompress_close(&file) ) {
+        if( !args->quiet ) fprintf( stderr, "Error decoding %s with %s.\n",
+                                    filename,
+                                    (NULL != file.tool) ? file.tool : "input" );
+        retval = BUFFER_INIT_ERROR;
+        goto error;
+    }
+
+    // past the end of the file the memory is blank
+    memset( chunk, 0xff, sizeof(chunk) );
+    if( address < start ) {
+        address = start;
+    }
+    while( address <= end ) {
+        n = (end - address + 1 < sizeof(chunk)) ?
+                end - address + 1 : sizeof(chunk);
+        digest_update( digest, chunk, n );
+        address += n;
+        if( 0 == address ) {
             break;
+        }
+    }
+
+    retval = SUCCESS;
+
+error:
+    decompress_close( &file );
+    if( NULL != bout.data ) {
+        free( bout.data );
+        bout.data = NULL;
+    }
+
+    return retval;
+}
+
+static int32_t execute_checksum( dfu_device_t *device,
+                                 struct programmer_arguments *args ) {
+    int32_t retval = UNSPECIFIED_ERROR;
+    int32_t result;
+    digest_t digest;
+    uint8_t value[DIGEST_MAX_SIZE];
+    size_t length;
+    segment_layout_t layout;
+    uint32_t start = args->com_checksum_data.start;
+    uint32_t end = args->com_checksum_data.end;
+    enum digest_algorithm hash = args->com_checksum_data.hash;
+    enum atmel_memory_unit_enum mem_segment = args->com_checksum_data.segment;
+
+    if( SUCCESS != (retval = segment_layout(args, mem_segment, &layout)) ) {
+        return retval;
+    }
+
+    if( UINT32_MAX == start ) {
+        start = layout.bottom;
+    }
+    if( UINT32_MAX == end ) {
+        end = layout.top;
+    }
+    if( (start > end) || (end >= layout.memory_size) ) {
+        fprintf( stderr, "Range 0x%X to 0x%X is outside 0x%X bytes of memory.\n",
+                start, end, (uint32_t) layout.memory_size );
+        return ARGUMENT_ERROR;
+    }
+
+    if( !args->quiet ) {
+        fprintf( stderr, "Hashing 0x%X bytes from address 0x%X with %s.\n",
+                end - start + 1, start, digest_name(hash) );
+    }
+
+    digest_init( &digest, hash );
+    if( NULL != args->com_checksum_data.file ) {
+        retval = checksum_file( args, start, end, &layout, &digest );
+        if( SUCCESS != retval ) {
+            return retval;
+        }
+    } else {
+        if( args->device_type & GRP_STM32 ) {
+            result = stm32_read_stream( device, start, end,
+                    verify_sink, &digest, args->quiet );
+        } else {
+            security_check( device );
+            result = atmel_read_stream( device, start, end, mem_segment,
+                    verify_sink, &digest, args->quiet );
+        }
+        if( 0 != result ) {
+            DEBUG( "ERROR: could not read memory, err %d.\n", result );
+            security_message();
+            return FLASH_READ_ERROR;
+        }
+    }
+
+    length = digest_final( &digest, value );
+    digest_print( stdout, value, length );
+    fprintf( stdout, "\n" );
+    fflush( stdout );
+
+    return SUCCESS;
+}
+
+static int32_t dump_sink( void *context, const uint32_t address,
+                          const uint8_t *data, const size_t length ) {
+    dump_stream_t *dump = (dump_stream_t *) context;
+    size_t first = 0;
+    size_t last = length;
+
+    // erased bytes at the end are held back until more data follows them
+    while( (last > 0) && (0xff == data[last - 1]) ) {
+        last--;
+    }
+    if( 0 == last ) {
+        dump->blank += length;
+        return 0;
+    }
+
+    // the held back bytes and those data starts with are one erased run
+    while( 0xff == data[first] ) {
+        first++;
+    }
+    if( (0 != binout_blank(&dump->out, dump->unread)) ||
+        (0 != binout_erased(&dump->out, dump->blank - dump->unread + first)) ||
+        (0 != binout_memory(&dump->out, &data[first], last - first)) ) {
+        dump->failed = true;
+        return -1;
+    }
+    dump->position = address + last;
+    dump->blank = length - last;
+    dump->unread = 0;
+
+    return 0;
+}
+
+static int32_t dump_binary( dfu_device_t *device,
+                            struct programmer_arguments *args,
+                            const uint32_t start, const uint32_t end,
+                            const size_t page_size ) {
+    int32_t retval = UNSPECIFIED_ERROR;
+    int32_t result;
+    size_t tail;
+    dump_stream_t *dump;
+    enum atmel_memory_unit_enum mem_segment = args->com_read_data.segment;
+
+    if( NULL == (dump = (dump_stream_t *) malloc(sizeof(dump_stream_t))) ) {
+        DEBUG( "ERROR allocating the output buffer.\n" );
+        return BUFFER_INIT_ERROR;
+    }
+    if( 0 != binout_open(&dump->out, stdout, args->com_read_data.fill) ) {
+        free( dump );
+        return UNSPECIFIED_ERROR;
+    }
+    // the output always starts at address 0, below start is not read
+    dump->blank = start;
+    dump->unread = start;
+    dump->position = 0;
+    dump->failed = false;
+
+    if( args->device_type & GRP_STM32 ) {
+        result = stm32_read_stream( device, start, end,
+                dump_sink, dump, args->quiet );
+    } else {
+        security_check( device );
+        result = atmel_read_stream( device, start, end, mem_segment,
+                dump_sink, dump, args->quiet );
+    }
+    if( true == dump->failed ) {
+        fprintf( stderr, "Error writing the output.\n" );
+        goto error;
+    } else if( 0 != result ) {
+        DEBUG( "ERROR: could not read memory, err %d.\n", result );
+        security_message();
+        retval = FLASH_READ_ERROR;
+        goto error;
+    }
+
+    if( args->com_read_data.force ) {
+        tail = dump->blank;
+    } else if( 0 == dump->position ) {
+        if( !args->quiet )
+            fprintf( stderr,
+                    "Memory is blank, returning a single blank page.\n"
+                    "Use --force to return the entire memory regardless.\n");
+        tail = page_size;
+        dump->unread = page_size;
+    } else {
+        // finish the last page that has data
+        tail = (page_size - dump->position % page_size) % page_size;
+    }
+    if( (0 != binout_blank(&dump->out, dump->unread)) ||
+        (0 != binout_erased(&dump->out, tail - dump->unread)) ||
+        (0 != binout_close(&dump->out)) ) {
+        fprintf( stderr, "Error writing the output.\n" );
+        goto error;
+    }
+    if( !args->quiet )
+        fprintf( stderr, "Dumped 0x%X bytes from address offset 0x0.\n",
+                (uint32_t) (dump->position + tail) );
+
+    retval = SUCCESS;
+
+error:
+    free( dump );
+
+    return retval;
+}
+
+static uint32_t diff_unit( struct programmer_arguments *args,
+                           segment_layout_t *layout,
+                           const uint32_t address ) {
+    if( (args->device_type & GRP_STM32) &&
+            (mem_flash == args->com_diff_data.segment) ) {
+        return (uint32_t) stm32_sector( NULL, address );
+    }
+
+    return address / layout->page_size;
+}
+
+static int32_t execute_diff( dfu_device_t *device,
+                             struct programmer_arguments *args ) {
+    int32_t retval = UNSPECIFIED_ERROR;
+    int32_t count;
+    intel_buffer_out_t image[2];
+    intel_ranges_t ranges = { NULL, 0, 0 };
+    segment_layout_t layout;
+    intel_range_t *range;
+    uint32_t first;
+    uint32_t last;
+    uint32_t units = 0;
+    uint32_t previous = UINT32_MAX;
+    size_t i;
+    const char *unit = "page";
+    const dfu_bool json = args->com_diff_data.json;
+
+    image[0].data = NULL;
+    image[1].data = NULL;
+
+    if( SUCCESS != (retval = segment_layout(args,
+                    args->com_diff_data.segment, &layout)) ) {
+        return retval;
+    }
+    if( (args->device_type & GRP_STM32) &&
+            (mem_flash == args->com_diff_data.segment) ) {
+        unit = "sector";
+    }
+
+    for( i = 0; i < 2; i++ ) {
+        if( SUCCESS != (retval = load_image(args, args->com_diff_data.file[i],
+                        args->com_diff_data.bin, &layout, &image[i])) ) {
+            goto error;
+        }
+    }
+
+    count = intel_diff_buffers( &image[0], &image[1], &ranges );
+    DEBUG( "%d bytes differ in %u ranges.\n", count, (uint32_t) ranges.count );
+
+    if( json ) {
+        fprintf( stdout, "{\"bytes\": %d, \"unit\": \"%s\", \"unit_size\": %u, "
+                "\"ranges\": [", count, unit,
+                (0 == strcmp(unit, "page")) ? (uint32_t) layout.page_size : 0 );
+    }
+
+    for( i = 0; i < ranges.count; i++ ) {
+        range = &ranges.ranges[i];
+        first = diff_unit( args, &layout, range->start );
+        last = diff_unit( args, &layout, range->end );
+        // adjacent ranges can share a page, count each one once
+        units += last - first + 1;
+        if( first == previous ) {
+            units--;
+        }
+        previous = last;
+
+        if( json ) {
+            fprintf( stdout, "%s\n  {\"start\": %u, \"end\": %u, "
+                    "\"bytes\": %u, \"written\": %u, \"erased\": %u, "
+                    "\"first_%s\": %u, \"last_%s\": %u}",
+                    (0 == i) ? "" : ",", range->start, range->end,
+                    range->end - range->start + 1, range->in_region,
+                    range->outside_region, unit, first, unit, last );
+        } else {
+            fprintf( stdout, "0x%06X to 0x%06X  %6u bytes (%u written, "
+                    "%u erased)  %ss %u to %u\n", range->start, range->end,
+                    range->end - range->start + 1, range->in_region,
+                    range->outside_region, unit, first, last );
+        }
+    }
+
+    if( json ) {
+        fprintf( stdout, "%s], \"units\": %u}\n",
+                (0 == ranges.count) ? "" : "\n", units );
+    } else if( 0 == count ) {
+        fprintf( stdout, "The images are identical.\n" );
+    } else {
+        fprintf( stdout, "%d bytes differ in %u ranges, %u %s%s to update.\n",
+                count, (uint32_t) ranges.count, units, unit,
+                (1 == units) ? "" : "s" );
+    }
+    fflush( stdout );
+
+    retval = SUCCESS;
+
+error:
+    intel_free_ranges( &ranges );
+    for( i = 0; i < 2; i++ ) {
+        if( NULL != image[i].data ) {
+            free( image[i].data );
+            image[i].data = NULL;
+        }
+    }
+
+    return retval;
+}
+
+static void image_page( intel_buffer_out_t *bout, const uint32_t address,
+                        const size_t page_size, uint8_t *page ) {
+    size_t i;
+
+    for( i = 0; i < page_size; i++ ) {
+        page[i] = (bout->data[address + i] <= UINT8_MAX) ?
+                        (uint8_t) bout->data[address + i] : 0xff;
+    }
+}
+
+static int32_t execute_make_patch( dfu_device_t *device,
+                                   struct programmer_arguments *args ) {
+    int32_t retval = UNSPECIFIED_ERROR;
+    int32_t count;
+    intel_buffer_out_t image[2];
+    intel_ranges_t ranges = { NULL, 0, 0 };
+    segment_layout_t layout;
+    dfu_patch_t patch;
+    intel_range_t *range;
+    uint8_t *base = NULL;
+    uint8_t *page = NULL;
+    uint32_t address;
+    uint32_t first;
+    uint32_t last;
+    uint32_t next = 0;          /* pages below this are in the patch */
+    size_t i;
+    size_t j;
+    dfu_bool sectors = false;
+    enum atmel_memory_unit_enum segment = args->com_diff_data.segment;
+
+    image[0].data = NULL;
+    image[1].data = NULL;
+
+    if( SUCCESS != (retval = segment_layout(args, segment, &layout)) ) {
+        return retval;
+    }
+    // STM32 flash can only be erased by sector, so whole sectors are patched
+    if( (args->device_type & GRP_STM32) && (mem_flash == segment) ) {
+        sectors = true;
+    }
+    patch_init( &patch, (uint8_t) segment, (uint32_t) layout.page_size,
+                (uint32_t) layout.memory_size );
+
+    for( i = 0; i < 2; i++ ) {
+        if( SUCCESS != (retval = load_image(args, args->com_diff_data.file[i],
+                        args->com_diff_data.bin, &layout, &image[i])) ) {
+            goto error;
+        }
+    }
+
+    base = (uint8_t *) malloc( layout.page_size );
+    page = (uint8_t *) malloc( layout.page_size );
+    if( (NULL == base) || (NULL == page) ) {
+        DEBUG( "ERROR allocating the page buffers.\n" );
+        retval = BUFFER_INIT_ERROR;
+        goto error;
+    }
+
+    count = intel_diff_buffers( &image[0], &image[1], &ranges );
+    DEBUG( "%d bytes differ in %u ranges.\n", count, (uint32_t) ranges.count );
+
+    retval = BUFFER_INIT_ERROR;
+    for( i = 0; i < ranges.count; i++ ) {
+        range = &ranges.ranges[i];
+        for( first = range->start; first <= range->end; first = last + 1 ) {
+            last = range->end;
+            if( sectors ) {
+                if( 0 != stm32_sector_bounds(NULL, stm32_sector(NULL, first),
+                            &first, &last) ) {
+                    DEBUG( "ERROR: 0x%X is past the last sector.\n", first );
+                    goto error;
+                }
+                if( (first >= next) && (0 != patch_add_erase(&patch, first)) ) {
+                    goto error;
+                }
+            }
+
+            // pages shared with the previous range are already in the patch
+            for( address = first - first % layout.page_size;
+                    (address <= last) && (address <= layout.top);
+                    address += layout.page_size ) {
+                if( address < next ) continue;
+
+                image_page( &image[0], address, layout.page_size, base );
+                image_page( &image[1], address, layout.page_size, page );
+                // after a sector erase blank pages need no programming
+                for( j = 0; sectors && (j < layout.page_size); j++ ) {
+                    if( 0xff != page[j] ) break;
+                }
+                if( 0 != patch_add_page(&patch, address, base, page,
+                            (!sectors || (j < layout.page_size)) ?
+                                true : false) ) {
+                    goto error;
+                }
+                next = address + layout.page_size;
+            }
+        }
+    }
+
+    if( 0 != patch_write(&patch, stdout) ) {
+        fprintf( stderr, "Error writing the patch.\n" );
+        goto error;
+    }
+    if( !args->quiet ) {
+        fprintf( stderr, "Patch of %u pages, %u to program",
+                patch.page_count, patch.data_pages );
+        if( sectors ) {
+            fprintf( stderr, " after erasing %u sectors", patch.erase_count );
+        }
+        fprintf( stderr, " (%d bytes changed).\n", count );
+    }
+
+    retval = SUCCESS;
+
+error:
+    free( base );
+    free( page );
+    patch_free( &patch );
+    intel_free_ranges( &ranges );
+    for( i = 0; i < 2; i++ ) {
+        if( NULL != image[i].data ) {
+            free( image[i].data );
+            image[i].data = NULL;
+        }
+    }
+
+    return retval;
+}
+
+static int32_t patch_sink( void *context, const uint32_t address,
+                           const uint8_t *data, const size_t length ) {
+    patch_check_t *check = (patch_check_t *) context;
+    patch_page_t *page;
+    size_t used = 0;
+    size_t n;
+
+    while( used < length ) {
+        page = &check->patch->pages[check->next];
+        n = check->patch->page_size - check->filled;
+        if( n > length - used ) {
+            n = length - used;
+        }
+        check->crc = digest_crc32( check->crc, data + used, n );
+        check->filled += n;
+        used += n;
+
+        if( check->filled == check->patch->page_size ) {
+            if( check->crc == page->base_crc ) {
+                check->base++;
+            }
+            if( check->crc == page->image_crc ) {
+                check->image++;
+            }
+            if( (check->crc != page->base_crc) &&
+                    (check->crc != page->image_crc) &&
+                    (UINT32_MAX == check->first_bad) ) {
+                check->first_bad = page->address;
+            }
+            check->next++;
+            check->filled = 0;
+            check->crc = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int32_t patch_check( dfu_device_t *device,
+                            struct programmer_arguments *args,
+                            dfu_patch_t *patch, patch_check_t *check ) {
+    int32_t result;
+    uint32_t i;
+    uint32_t j;
+
+    memset( check, 0, sizeof(patch_check_t) );
+    check->patch = patch;
+    check->first_bad = UINT32_MAX;
+
+    // read each run of consecutive pages with a single request
+    for( i = 0; i < patch->page_count; i = j ) {
+        for( j = i + 1; j < patch->page_count; j++ ) {
+            if( patch->pages[j].address !=
+                    patch->pages[j - 1].address + patch->page_size ) break;
+        }
+        DEBUG( "Checking 0x%X to 0x%X.\n", patch->pages[i].address,
+                patch->pages[j - 1].address + patch->page_size - 1 );
+
+        if( args->device_type & GRP_STM32 ) {
+            result = stm32_read_stream( device, patch->pages[i].address,
+                    patch->pages[j - 1].address + patch->page_size - 1,
+                    patch_sink, check, true );
+        } else {
+            result = atmel_read_stream( device, patch->pages[i].address,
+                    patch->pages[j - 1].address + patch->page_size - 1,
+                    patch->segment, patch_sink, check, true );
+        }
+        if( (0 != result) || (check->next != j) ) {
+            DEBUG( "ERROR: could not read memory, err %d.\n", result );
+            return FLASH_READ_ERROR;
+        }
+    }
+
+    return SUCCESS;
+}
+
+static int32_t execute_apply_patch( dfu_device_t *device,
+                                    struct programmer_arguments *args ) {
+    int32_t retval = UNSPECIFIED_ERROR;
+    int32_t result = 0;
+    dfu_patch_t patch;
+    patch_check_t check;
+    segment_layout_t layout;
+    intel_buffer_out_t bout;
+    patch_page_t *page;
+    uint32_t first;
+    uint32_t last;
+    uint32_t start;
+    uint32_t end;
+    uint32_t i;
+    size_t j;
+
+    bout.data = NULL;
+
+    if( 0 != patch_read(&patch, args->com_flash_data.file) ) {
+        fprintf( stderr, "Unable to read the patch '%s'.\n",
+                 args->com_flash_data.file );
+        return ARGUMENT_ERROR;
+    }
+    if( (SUCCESS != (retval = segment_layout(args,
+                        (enum atmel_memory_unit_enum) patch.segment,
+                        &layout))) ||
+            (patch.page_size != layout.page_size) ||
+            (patch.memory_size != layout.memory_size) ) {
+        fprintf( stderr, "The patch was made for another target.\n" );
+        retval = ARGUMENT_ERROR;
+        goto error;
+    }
+    if( 0 == patch.page_count ) {
+        if( !args->quiet ) fprintf( stderr, "The patch is empty.\n" );
+        retval = SUCCESS;
+        goto error;
+    }
+    // make-patch planned the sectors with the built in stm32f4 table
+    for( i = 0; i < patch.erase_count; i++ ) {
+        if( (0 != stm32_sector_bounds(NULL, stm32_sector(NULL,
+                            patch.erases[i]), &first, &last)) ||
+                (0 != stm32_sector_bounds(device, stm32_sector(device,
+                            patch.erases[i]), &start, &end)) ||
+                (first != start) || (last != end) ) {
+            fprintf( stderr, "The patch does not match the flash sectors of "
+                     "the device (0x%X).\n", patch.erases[i] );
+            retval = ARGUMENT_ERROR;
+            goto error;
+        }
+    }
+
+    // ------------------ CHECK THE BASE IMAGE ----------------------------
+    if( !(args->device_type & GRP_STM32) ) {
+        security_check( device );
+    }
+    if( !args->quiet ) {
+        fprintf( stderr, "Checking %u pages...  ", patch.page_count );
+    }
+    if( SUCCESS != (retval = patch_check(device, args, &patch, &check)) ) {
+        if( !args->quiet ) fprintf( stderr, "ERROR\n" );
+        security_message();
+        goto error;
+    }
+    if( check.image == patch.page_count ) {
+        if( !args->quiet ) fprintf( stderr, "already applied\n" );
+        retval = SUCCESS;
+        goto error;
+    }
+    if( check.base != patch.page_count ) {
+        if( !args->quiet ) {
+            fprintf( stderr, "ERROR\n" );
+            fprintf( stderr, "The device does not hold the image the patch "
+                     "was made from" );
+            if( UINT32_MAX != check.first_bad ) {
+                fprintf( stderr, " (page at 0x%X)", check.first_bad );
+            }
+            fprintf( stderr, ".\n" );
+        }
+        retval = VALIDATION_ERROR_IN_REGION;
+        goto error;
+    }
+    if( !args->quiet ) fprintf( stderr, "Success\n" );
+
+    // ------------------ WRITE THE PATCH PAGES ---------------------------
+    if( 0 != intel_init_buffer_out(&bout, layout.memory_size,
+                layout.page_size) ) {
+        DEBUG( "ERROR initializing a buffer.\n" );
+        retval = BUFFER_INIT_ERROR;
+        goto error;
+    }
+    bout.info.valid_start = layout.bottom;
+    bout.info.valid_end = layout.top;
+    for( i = 0; i < patch.page_count; i++ ) {
+        page = &patch.pages[i];
+        if( page->flags & PATCH_PAGE_WRITE ) {
+            for( j = 0; j < patch.page_size; j++ ) {
+                bout.data[page->address + j] = patch.data[page->offset + j];
+            }
+        }
+    }
+
+    if( args->device_type & GRP_STM32 ) {
+        for( i = 0; (i < patch.erase_count) && (0 == result); i++ ) {
+            if( !args->quiet ) {
+                fprintf( stderr, "Erasing sector %d...  ",
+                         stm32_sector(device, patch.erases[i]) );
+            }
+            result = stm32_page_erase( device,
+                    STM32_FLASH_OFFSET + patch.erases[i], args->quiet );
+        }
+        if( (0 == result) && (0 != patch.data_pages) ) {
+            result = stm32_write_flash( device, &bout, false, true,
+                    args->quiet, NULL, false );
+        }
+    } else if( mem_user == patch.segment ) {
+        result = atmel_user( device, &bout );
+    } else {
+        // the bootloader erases each page as it programs it
+        result = atmel_flash( device, &bout,
+                (mem_eeprom == patch.segment) ? true : false, true,
+                args->quiet, NULL, NULL );
+    }
+    if( 0 != result ) {
+        DEBUG( "Error writing %s data. (err %d)\n", "patch", result );
+        retval = FLASH_WRITE_ERROR;
+        goto error;
+    }
+
+    // ------------------  VALIDATE THE PATCHED PAGES ---------------------
+    if( 0 == args->com_flash_data.suppress_validation ) {
+        if( !args->quiet ) fprintf( stderr, "Validating...  " );
+        if( (SUCCESS != (retval = patch_check(device, args, &patch, &check)))
+                || (check.image != patch.page_count) ) {
+            if( !args->quiet ) fprintf( stderr, "ERROR\n" );
+            if( SUCCESS == retval ) {
+                retval = VALIDATION_ERROR_IN_REGION;
+            }
+            goto error;
+        }
+        if( !args->quiet ) fprintf( stderr, "Success\n" );
+    }
+    if( !args->quiet ) {
+        fprintf( stderr, "0x%X bytes patched in %u pages.\n",
+                patch.data_pages * patch.page_size, patch.data_pages );
+    }
+
+    retval = SUCCESS;
+
+error:
+    patch_free( &patch );
+    if( NULL != bout.data ) {
+        free( bout.data );
+        bout.data = NULL;
+    }
+
+    return retval;
+}
+
+static int32_t execute_getfuse( dfu_device_t *device,
+                            struct programmer_arguments *args ) {
+    atmel_avr32_fuses_t info;
+    char *message = NULL;
+    int32_t value = 0;
+    int32_t status;
+
+    /* only ADC_AVR32 seems to support fuse operation */
+    if( !(ADC_AVR32 & args->device_type) ) {
+        DEBUG( "target doesn't support fuse set operation.\n" );
+        fprintf( stderr, "target doesn't support fuse set operation.\n" );
+        return ARGUMENT_ERROR;
+    }
+
+    /* Check AVR32 security bit in order to provide a better error message. */
+    security_check( device );
+
+    if( args->device_type & GRP_STM32 ) {
+        fprintf( stderr, "Operation not supported on %s.\n",
+                args->device_type_string );
+        return ARGUMENT_ERROR;
+    } else {
+        status = atmel_read_fuses( device, &info );
+    }
+
+    if( 0 != status ) {
+        DEBUG( "Error reading %s config information.\n",
+               args->device_type_string );
+        fprintf( stderr, "Error reading %s config information.\n",
+                         args->device_type_string );
+        security_message();
+        return status;
+    }
+
+    switch( args->com_getfuse_data.name ) {
+        case get_lock:
+            value = info.lock;
+            message = "Locked regions";
+            break;
+        case get_epfl:
+            value = info.epfl;
+            message = "External Privileged Fetch Lock";
+            break;
+        case get_bootprot:
+            value = info.bootprot;
+            message = "Bootloader protected area";
+            break;
+        case get_bodlevel:
+            value = info.bodlevel;
+            message = "Brown-out detector trigger level";
+            break;
+        case get_bodhyst:
+            value = info.bodhyst;
+            message = "BOD Hysteresis enable";
+            break;
+        case get_boden:
+            value = info.boden;
+            message = "BOD Enable";
+            break;
+        case get_isp_bod_en:
+            value = info.isp_bod_en;
+            message = "ISP BOD enable";
+            break;
+        case get_isp_io_cond_en:
+            value = info.isp_io_cond_en;
+            message = "ISP IO condition enable";
+            break;
+        case get_isp_force:
+            value = info.isp_force;
+            message = "ISP Force";
+            break;
+    }
+    fprintf( stdout, "%s%s0x%02x (%d)\n",
+             ((0 == args->quiet) ? message : ""),
+             ((0 == args->quiet) ? ": " : ""),
+             value, value );
+    return 0;
+}
+
+static int32_t execute_get( dfu_device_t *device,
+                            struct programmer_arguments *args ) {
+    atmel_device_info_t info;
+    char *message = NULL;
+    int16_t value = 0;
+    int32_t status;
+    int32_t controller_error = 0;
+
+    /* Check AVR32 security bit in order to provide a better error message. */
+    security_check( device );
+
+    if( args->device_type & GRP_STM32 ) {
+        fprintf( stderr, "Operation not supported on %s.\n",
+                args->device_type_string );
+        return -1;
+    } else {
+        status = atmel_read_config( device, &info );
+    }
+
+    if( 0 != status ) {
+        DEBUG( "Error reading %s config information.\n",
+               args->device_type_string );
+        fprintf( stderr, "Error reading %s config information.\n",
+                         args->device_type_string );
+        security_message();
+        return status;
+    }
+
+    switch( args->com_get_data.name ) {
+        case get_bootloader:
+            value = info.bootloaderVersion;
+            message = "Bootloader Version";
+            break;
+        case get_ID1:
+            value = info.bootID1;
+            message = "Device boot ID 1";
+            break;
+        case get_ID2:
+            value = info.bootID2;
+            message = "Device boot ID 2";
+            break;
+        case get_BSB:
+            value = info.bsb;
+            message = "Boot Status Byte";
+            if( ADC_8051 != args->device_type ) {
+                controller_error = 1;
+            }
+            break;
+        case get_SBV:
+            value = info.sbv;
+            message = "Software Boot Vector";
+            if( ADC_8051 != args->device_type ) {
+                controller_error = 1;
+            }
+            break;
+        case get_SSB:
+            value = info.ssb;
+            message = "Software Security Byte";
+            if( ADC_8051 != args->device_type ) {
+                controller_error = 1;
+            }
+            break;
+        case get_EB:
+            value = info.eb;
+            message = "Extra Byte";
+            if( ADC_8051 != args->device_type ) {
+                controller_error = 1;
+            }
+            break;
+        case get_manufacturer:
+            value = info.manufacturerCode;
+            message = "Manufacturer Code";
+            break;
+        case get_family:
+            value = info.familyCode;
+            message = "Family Code";
+            break;
+        case get_product_name:
+            value = info.productName;
+            message = "Product Name";
+            break;
+        case get_product_rev:
+            value = info.productRevision;
+            message = "Product Revision";
+            break;
+        case get_HSB:
+            value = info.hsb;
+            message = "Hardware Security Byte";
+            if( ADC_8051 != args->device_type ) {
+                controller_error = 1;
+            }
+            break;
+    }
+
+    if( 0 != controller_error ) {
+        DEBUG( "%s requires 8051 based controller\n", message );
+        fprintf( stderr, "%s requires 8051 based controller\n",
+                         message );
+        return -1;
+    }
+
+    if( value < 0 ) {
+        fprintf( stderr, "The requested device info is unavailable.\n" );
+        return -2;
+    }
+
+    fprintf( stdout, "%s%s0x%02x (%d)\n",
+             ((0 == args->quiet) ? message : ""),
+             ((0 == args->quiet) ? ": " : ""),
+             value, value );
+    return 0;
+}
+
+static int32_t execute_dump( dfu_device_t *device,
+                             struct programmer_arguments *args ) {
+    int32_t i = 0;
+    int32_t retval = UNSPECIFIED_ERROR;
+    int32_t result;             // result of fcn calls
+    intel_buffer_in_t buin;     // buffer in for storing read mem
+    enum atmel_memory_unit_enum mem_segment = args->com_read_data.segment;
+    size_t mem_size = 0;
+    size_t page_size = 0;
+    const dfuse_region_t *region;   // named target of a DfuSe file
+    uint32_t target_offset = 0; // address offset on the target device
+        // NOTE: target_offset may not be set appropriately for device
+        // classes other than ADC_AVR32
+
+    switch( mem_segment ) {
+        case mem_flash:
+            mem_size = args->memory_address_top + 1;
+            page_size = args->flash_page_size;
+            if( ADC_AVR32 == args->device_type ) {
+                target_offset = 0x80000000;
+            } else if( GRP_STM32 & args->device_type ) {
+                target_offset = STM32_FLASH_OFFSET;
+            }
+            break;
+        case mem_eeprom:
+            mem_size = args->eeprom_memory_size;
+            page_size = args->eeprom_page_size;
+            break;
+        case mem_user:
+            mem_size = args->flash_page_size;
+            page_size = args->flash_page_size;
+            target_offset = 0x80800000;
+            break;
+        default:
+            fprintf( stderr, "Dump not currenlty supported for this memory.\n" );
+            retval = ARGUMENT_ERROR;
+            goto error;
+    }
+
+    // binary output is written as it is read, without a memory image
+    if( args->com_read_data.bin ) {
+        if( mem_segment == mem_flash ) {
+            return dump_binary( device, args, args->flash_address_bottom,
+                                args->flash_address_top, page_size );
+        }
+        return dump_binary( device, args, 0, mem_size - 1, page_size );
+    }
+
+    if( 0 != intel_init_buffer_in(&buin, mem_size, page_size) ) {
+        DEBUG("ERROR initializing a buffer.\n");
+        retval = BUFFER_INIT_ERROR;
+        goto error;
+    }
+
+    if( mem_segment == mem_flash ) {
+        buin.info.data_start = args->flash_address_bottom;
+        buin.info.data_end = args->flash_address_top;
+    }
+
+    if( args->device_type & GRP_STM32 ) {
+        result = stm32_read_flash(device, &buin, mem_segment, args->quiet);
+    } else {
+        /* Check AVR32 security bit in order to provide a better error message */
+        security_check( device );   // avr32 has no eeprom, but OK
+        result = atmel_read_flash(device, &buin, mem_segment, args->quiet);
+    }
+
+    if( 0 != result ) {
+        DEBUG("ERROR: could not read memory, err %d.\n", result);
+        security_message();
+        retval = FLASH_READ_ERROR;
+        goto error;
+    }
+
+    // determine first & last page with non-blank data
+    if( args->com_read_data.force ) {
+        buin.info.data_start = 0;
+    } else {
+        // find first page with data
+        for( i = buin.info.data_start; i < buin.info.data_end; i++ ) {
+            if( buin.data[i] != 0xFF ) break;
+            if( i / buin.info.page_size >
+                    buin.info.data_start / buin.info.page_size ) {
+                // i has just jumpped to a different page than buin.data_start
+                buin.info.data_start = i;
+            }
+        }
+        if( i == buin.info.data_end ) {
+            if( !args->quiet )
+                fprintf( stderr,
+                        "Memory is blank, returning a single blank page.\n"
+                        "Use --force to return the entire memory regardless.\n");
+            buin.info.data_start = 0;
+            buin.info.data_end = buin.info.page_size - 1;
+        } else {        // find last page with data
+            for( i = buin.info.data_end; i > buin.info.data_start; i-- ) {
+                if( buin.data[i] !=0xFF ) break;
+                if( i / buin.info.page_size <
+                        buin.info.data_end / buin.info.page_size ) {
+                    buin.info.data_end = i;
+                }
+            }
+        }
+    }
+
+    if( !args->quiet )
+        fprintf( stderr, "Dumping 0x%X bytes from address offset 0x%X.\n",
+                buin.info.data_end - buin.info.data_start + 1,
+                target_offset + buin.info.data_start );
+    if( args->com_read_data.dfu ) {
+        region = dfuse_region( &device->layout, target_offset );
+        if( 0 != dfuse_file_from_buffer(stdout, &buin,
+                    args->com_read_data.force, target_offset,
+                    args->vendor_id, args->chip_id,
+                    (NULL != region) ? region->name : NULL) ) {
+            retval = UNSPECIFIED_ERROR;
+            goto error;
+        }
+    } else {
+        intel_hex_from_buffer( &buin,
+                args->com_read_data.force, target_offset );
+    }
+
+    fflush( stdout );
+
+    retval = SUCCESS;
+
+error:
+    if( NULL != buin.data ) {
+        free( buin.data );
+        buin.data = NULL;
+    }
+
+    return retval;
+}
+
+static int32_t execute_setfuse( dfu_device_t *device,
+                                  struct programmer_arguments *args ) {
+    int32_t value = args->com_setfuse_data.value;
+    int32_t name = args->com_setfuse_data.name;
+
+    /* only ADC_AVR32 seems to support fuse operation */
+    if( !(ADC_AVR32 & args->device_type) || (GRP_STM32 & args->device_type) ) {
+        fprintf( stderr,  "Operation not supported on %s\n",
+                args->device_type_string );
+        DEBUG( "target doesn't support fuse set operation.\n" );
+        return -1;
+    }
+
+    /* Check AVR32 security bit in order to provide a better error message. */
+    security_check( device );
+
+    if( 0 != atmel_set_fuse(device, name, value) ) {
+        DEBUG( "Fuse set failed.\n" );
+        fprintf( stderr, "Fuse set failed.\n" );
+        security_message();
+        return -1;
+    }
+
+    return 0;
+}
+
+static int32_t execute_configure( dfu_device_t *device,
+                                  struct programmer_arguments *args ) {
+    int32_t value = args->com_configure_data.value;
+    int32_t name = args->com_configure_data.name;
+
+    if( ADC_8051 != args->device_type ) {
+        fprintf( stderr, "Operation not supported on %s\n",
+                args->device_type_string );
+        DEBUG( "target doesn't support configure operation.\n" );
+        return -1;
+    }
+
+    if( (0xff & value) != value ) {
+        DEBUG( "Value to configure must be in range 0-255.\n" );
+        fprintf( stderr, "Value to configure must be in range 0-255.\n" );
+        return -1;
+    }
+
+    if( 0 != atmel_set_config(device, name, value) )
+    {
+        DEBUG( "Configuration set failed.\n" );
+        fprintf( stderr, "Configuration set failed.\n" );
+        return -1;
+    }
+
+    return 0;
+}
+
+static int16_t *config_value( atmel_device_info_t *info, const int32_t name ) {
+    switch( name ) {
+        case conf_BSB:
+            return &info->bsb;
+        case conf_SBV:
+            return &info->sbv;
+        case conf_SSB:
+            return &info->ssb;
+        case conf_EB:
+            return &info->eb;
+        case conf_HSB:
+            return &info->hsb;
+    }
+
+    return NULL;
+}
+
+static int32_t execute_settings( dfu_device_t *device,
+                                 struct programmer_arguments *args,
+                                 const struct setting_struct *setting,
+                                 const size_t count ) {
+    atmel_device_info_t info;
+    uint8_t properties[BUNDLE_MAX_SETTINGS];
+    uint32_t values[BUNDLE_MAX_SETTINGS];
+    size_t fuses = 0;
+    size_t configs = 0;
+    dfu_bool written = false;
+    int16_t *current;
+    size_t i;
+
+    // everything is checked before the first value is written
+    for( i = 0; i < count; i++ ) {
+        if( setting[i].fuse ) {
+            if( fuses == BUNDLE_MAX_SETTINGS ) {
+                fprintf( stderr, "More than %d fuses to set.\n",
+                         BUNDLE_MAX_SETTINGS );
+                return -1;
+            }
+            properties[fuses] = (uint8_t) setting[i].name;
+            values[fuses++] = (uint32_t) setting[i].value;
+        } else {
+            if( NULL == config_value(&info, setting[i].name) ) {
+                fprintf( stderr, "Configure property %d unrecognized.\n",
+                         setting[i].name );
+                return -1;
+            }
+            if( (0xff & setting[i].value) != setting[i].value ) {
+                DEBUG( "Value to configure must be in range 0-255.\n" );
+                fprintf( stderr, "Value to configure must be in range 0-255.\n" );
+                return -1;
+            }
+            configs++;
+        }
+    }
+
+    /* only ADC_AVR32 seems to support fuse operation */
+    if( ((0 != configs) && (ADC_8051 != args->device_type)) ||
+            ((0 != fuses) && (!(ADC_AVR32 & args->device_type) ||
+                              (GRP_STM32 & args->device_type))) ) {
+        fprintf( stderr, "Operation not supported on %s\n",
+                args->device_type_string );
+        DEBUG( "target doesn't support the %s operation.\n",
+               (0 != fuses) ? "fuse set" : "configure" );
+        return -1;
+    }
+
+    if( 0 != configs ) {
+        if( 0 != atmel_read_config(device, &info) ) {
+            fprintf( stderr, "Error reading %s config information.\n",
+                     args->device_type_string );
+            return -1;
+        }
+        for( i = 0; i < count; i++ ) {
+            if( setting[i].fuse ||
+                    (NULL == (current = config_value(&info, setting[i].name))) ||
+                    (*current == setting[i].value) ) {
+                continue;
+            }
+            if( 0 != atmel_set_config(device, setting[i].name,
+                                      setting[i].value) ) {
+                DEBUG( "Configuration set failed.\n" );
+                fprintf( stderr, "Configuration set failed.\n" );
+                return -1;
+            }
+            *current = setting[i].value;
+            written = true;
+        }
+        if( written ) {
+            // the values last written are what has to read back
+            atmel_device_info_t check;
+
+            if( 0 != atmel_read_config(device, &check) ) {
+                fprintf( stderr, "Error reading %s config information.\n",
+                         args->device_type_string );
+                return -1;
+            }
+            for( i = 0; i < count; i++ ) {
+                if( !setting[i].fuse &&
+                        (*config_value(&info, setting[i].name) !=
+                         *config_value(&check, setting[i].name)) ) {
+                    fprintf( stderr, "Configuration did not verify.\n" );
+                    return -1;
+                }
+            }
+        }
+    }
+
+    if( 0 != fuses ) {
+        /* Check AVR32 security bit in order to provide a better error message. */
+        security_check( device );
+
+        if( 0 != atmel_set_fuses(device, properties, values, fuses) ) {
+            DEBUG( "Fuse set failed.\n" );
+            fprintf( stderr, "Fuse set failed.\n" );
+            security_message();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int32_t execute_set( dfu_device_t *device,
+                            struct programmer_arguments *args ) {
+    return execute_settings( device, args, args->com_set_data.setting,
+                             args->com_set_data.settings );
+}
+
+static int32_t execute_bundle( dfu_device_t *device,
+                               struct programmer_arguments *args ) {
+    static const enum atmel_memory_unit_enum segment[] =
+            { mem_flash, mem_eeprom, mem_user };
+    struct com_bundle_struct *items = &args->com_bundle_data;
+    int32_t retval = UNSPECIFIED_ERROR;
+    dfu_bundle_t bundle;
+    segment_layout_t layout;
+    intel_buffer_out_t bout;
+    size_t i;
+
+    bout.data = NULL;
+    bundle_init( &bundle, args->vendor_id, args->chip_id );
+
+    for( i = 0; i < sizeof(segment) / sizeof(segment[0]); i++ ) {
+        if( NULL == items->file[i] ) continue;
+
+        if( (SUCCESS != (retval = segment_layout(args, segment[i], &layout)))
+                || (SUCCESS != (retval = load_image(args, items->file[i],
+                            false, &layout, &bout))) ) {
+            goto error;
+        }
+        if( 0 != bundle_add_image(&bundle, (uint32_t) segment[i], &bout) ) {
+            retval = BUFFER_INIT_ERROR;
+            goto error;
+        }
+        free( bout.data );
+        bout.data = NULL;
+    }
+    for( i = 0; i < items->settings; i++ ) {
+        if( 0 != bundle_add_setting(&bundle, items->setting[i].fuse ?
+                    BUNDLE_SETFUSE : BUNDLE_CONFIGURE,
+                    (uint32_t) items->setting[i].name,
+                    (uint32_t) items->setting[i].value) ) {
+            retval = BUFFER_INIT_ERROR;
+            goto error;
+        }
+    }
+
+    if( 0 != bundle_write(&bundle, stdout) ) {
+        fprintf( stderr, "Error writing the bundle.\n" );
+        retval = UNSPECIFIED_ERROR;
+        goto error;
+    }
+    if( !args->quiet ) {
+        fprintf( stderr, "Bundled %u entries for %s.\n", bundle.entry_count,
+                 args->device_type_string );
+    }
+
+    retval = SUCCESS;
+
+error:
+    bundle_close( &bundle );
+    if( NULL != bout.data ) {
+        free( bout.data );
+        bout.data = NULL;
+    }
+
+    return retval;
+}
+
+static int32_t bundle_image( struct programmer_arguments *args,
+                             dfu_bundle_t *bundle,
+                             const enum atmel_memory_unit_enum segment,
+                             intel_buffer_out_t *bout ) {
+    int32_t retval;
+    segment_layout_t layout;
+    bundle_entry_t *entry;
+    uint32_t i;
+    uint32_t j;
+
+    bout->data = NULL;
+    for( i = 0; i < bundle->entry_count; i++ ) {
+        entry = &bundle->entries[i];
+        if( (BUNDLE_IMAGE == entry->kind) && ((uint32_t) segment == entry->name) ) break;
+    }
+    if( i == bundle->entry_count ) {
+        return SUCCESS;
+    }
+
+    if( SUCCESS != (retval = segment_layout(args, segment, &layout)) ) {
+        return retval;
+    }
+    if( 0 != intel_init_buffer_out(bout, layout.memory_size,
+                layout.page_size) ) {
+        DEBUG( "ERROR initializing a buffer.\n" );
+        bout->data = NULL;
+        return BUFFER_INIT_ERROR;
+    }
+    bout->info.valid_start = layout.bottom;
+    bout->info.valid_end = layout.top;
+
+    for( ; i < bundle->entry_count; i++ ) {
+        entry = &bundle->entries[i];
+        if( (BUNDLE_IMAGE != entry->kind) || ((uint32_t) segment != entry->name) ) {
+            continue;
+        }
+        for( j = 0; j < entry->length; j++ ) {
+            if( 0 != intel_process_data(bout,
+                        (char) bundle->data[entry->offset + j], 0,
+                        entry->value + j) ) {
+                fprintf( stderr, "The bundle was made for another target.\n" );
+                retval = ARGUMENT_ERROR;
+                goto error;
+            }
+        }
+    }
+
+    if( mem_flash == segment ) {
+        // check that there isn't anything overlapping the bootloader
+        for( i = args->bootloader_bottom; i <= args->bootloader_top; i++ ) {
+            if( bout->data[i] <= UINT8_MAX ) {
+                if( true == args->suppressbootloader ) {
+                    bout->data[i] = UINT16_MAX;
+                } else {
+                    fprintf( stderr, "Bootloader and code overlap.\n" );
+                    fprintf( stderr, "Use --suppress-bootloader-mem to ignore\n" );
+                    retval = BUFFER_INIT_ERROR;
+                    goto error;
+                }
+            }
+        }
+    } else if( (mem_user == segment) && !args->com_flash_data.force ) {
+        fprintf( stderr, "ERROR: --force flag is required to write user page.\n" );
+        fprintf( stderr, " Last word(s) in user page contain configuration data.\n" );
+        retval = ARGUMENT_ERROR;
+        goto error;
+    }
+
+    return SUCCESS;
+
+error:
+    free( bout->data );
+    bout->data = NULL;
+
+    return retval;
+}
+
+static int32_t execute_flash_bundle( dfu_device_t *device,
+                                     struct programmer_arguments *args ) {
+    static const enum atmel_memory_unit_enum segment[] =
+            { mem_flash, mem_eeprom, mem_user };
+    int32_t retval = UNSPECIFIED_ERROR;
+    int32_t result;
+    dfu_bundle_t bundle;
+    intel_buffer_out_t bout[3];
+    bundle_entry_t *entry;
+    dfu_bool validate = (0 == args->com_flash_data.suppress_validation);
+    dfu_bool force = args->com_flash_data.force;
+    struct setting_struct setting[BUNDLE_MAX_SETTINGS];
+    size_t settings = 0;
+    uint32_t i;
+
+    for( i = 0; i < 3; i++ ) {
+        bout[i].data = NULL;
+    }
+
+    if( 0 != bundle_open(&bundle, args->com_flash_data.file) ) {
+        fprintf( stderr, "Unable to read the bundle '%s'.\n",
+                 args->com_flash_data.file );
+        return ARGUMENT_ERROR;
+    }
+    if( (bundle.vendor_id != args->vendor_id) ||
+            (bundle.chip_id != args->chip_id) ) {
+        fprintf( stderr, "The bundle was made for another target "
+                 "(0x%04X:0x%04X).\n", bundle.vendor_id, bundle.chip_id );
+        retval = ARGUMENT_ERROR;
+        goto error;
+    }
+
+    // everything is checked before the first byte is written
+    for( i = 0; i < 3; i++ ) {
+        if( SUCCESS != (retval = bundle_image(args, &bundle, segment[i],
+                        &bout[i])) ) {
+            goto error;
+        }
+    }
+    for( i = 0; i < bundle.entry_count; i++ ) {
+        entry = &bundle.entries[i];
+        if( (BUNDLE_CONFIGURE != entry->kind) &&
+                (BUNDLE_SETFUSE != entry->kind) ) {
+            continue;
+        }
+        if( settings == BUNDLE_MAX_SETTINGS ) {
+            fprintf( stderr, "The bundle has more than %d settings.\n",
+                     BUNDLE_MAX_SETTINGS );
+            retval = ARGUMENT_ERROR;
+            goto error;
+        }
+        setting[settings].fuse = (BUNDLE_SETFUSE == entry->kind);
+        setting[settings].name = (int32_t) entry->name;
+        setting[settings++].value = (int32_t) entry->value;
+    }
+
+    // ------------------ WRITE EACH SEGMENT AS ONE IMAGE -----------------
+    for( i = 0; i < 3; i++ ) {
+        if( NULL == bout[i].data ) continue;
+
+        if( mem_user == segment[i] ) {
+            result = atmel_user( device, &bout[i] );
+        } else if( args->device_type & GRP_STM32 ) {
+            result = stm32_write_flash( device, &bout[i],
+                    (mem_eeprom == segment[i]) ? true : false, force,
+                    args->quiet, NULL, false );
+        } else {
+            result = atmel_flash( device, &bout[i],
+                    (mem_eeprom == segment[i]) ? true : false, force,
+                    args->quiet, NULL, NULL );
+        }
+        if( 0 != result ) {
+            DEBUG( "Error writing %s data. (err %d)\n", "bundle", result );
+            retval = FLASH_WRITE_ERROR;
+            goto error;
+        }
+
+        if( validate ) {
+            if( 0 != (retval = execute_validate(device, &bout[i], NULL,
+                            segment[i], args->quiet)) ) {
+                fprintf( stderr, "Memory did not validate. Did you erase?\n" );
+                goto error;
+            }
+        }
+        if( !args->quiet ) {
+            print_flash_usage( &bout[i].info );
+        }
     }
 
-    if( 0 != controller_error ) {
-        DEBUG( "%s requires 8051 based controller\n", message );
-        fprintf( stderr, "%s requires 8051 based controller\n",
-                         message );
-        return -1;
+    // ------------------ WRITE THE SETTINGS ------------------------------
+    // configure values, then every fuse in one block
+    if( 0 != settings ) {
+        if( 0 != execute_settings(device, args, setting, settings) ) {
+            retval = UNSPECIFIED_ERROR;
+            goto error;
+        }
     }
 
-    if( value < 0 ) {
-        fprintf( stderr, "The requested device info is unavailable.\n" );
-        return -2;
+    retval = SUCCESS;
+
+error:
+    bundle_close( &bundle );
+    for( i = 0; i < 3; i++ ) {
+        if( NULL != bout[i].data ) {
+            free( bout[i].data );
+            bout[i].data = NULL;
+        }
     }
 
-    fprintf( stdout, "%s%s0x%02x (%d)\n",
-             ((0 == args->quiet) ? message : ""),
-             ((0 == args->quiet) ? ": " : ""),
-             value, value );
+    return retval;
+}
+
+static int32_t execute_launch( dfu_device_t *device,
+                                  struct programmer_arguments *args ) {
+    struct com_launch_struct *launch = &args->com_launch_config;
+    char port[USB_PORT_PATH_LENGTH];
+    uint64_t start;
+    int32_t result;
+
+    if( launch->wait && (0 == device->topology.depth) &&
+            (0 == launch->app_vendor) ) {
+        fprintf( stderr, "The port of the board is not known, give the ids "
+                 "of the application with --app to wait for it.\n" );
+        return ARGUMENT_ERROR;
+    }
+
+    start = command_now_us();
+    if( args->device_type & GRP_STM32 ) {
+        result = stm32_start_app( device, args->quiet );
+    } else if( launch->noreset ) {
+        result = atmel_start_app_noreset( device );
+    } else {
+        result = atmel_start_app_reset( device );
+    }
+    if( (0 != result) || !launch->wait ) {
+        return result;
+    }
+
+    result = dfu_wait_device( device, launch->app_vendor, launch->app_product,
+                              launch->timeout, port, sizeof(port) );
+    if( 0 != result ) {
+        if( 0 < result ) {
+            fprintf( stderr, "The application did not appear within %u ms.\n",
+                     launch->timeout );
+        }
+        return DEVICE_ACCESS_ERROR;
+    }
+
+    fprintf( stdout, "Application at %s after %u ms.\n", port,
+             (uint32_t) ((command_now_us() - start + 500) / 1000) );
+    fflush( stdout );
+
     return 0;
 }
 
-static int32_t execute_dump( dfu_device_t *device,
-                             struct programmer_arguments *args ) {
-    int32_t i = 0;
-    int32_t retval = UNSPECIFIED_ERROR;
-    int32_t result;             // result of fcn calls
-    intel_buffer_in_t buin;     // buffer in for storing read mem
-    enum atmel_memory_unit_enum mem_segment = args->com_read_data.segment;
-    size_t mem_size = 0;
-    size_t page_size = 0;
-    uint32_t target_offset = 0; // address offset on the target device
-        // NOTE: target_offset may not be set appropriately for device
-        // classes other than ADC_AVR32
+static void profile_args( dfu_device_t *device,
+                          struct programmer_arguments *args ) {
+    dfu_profile_t profile;
+    int32_t version;
 
-    switch( mem_segment ) {
-        case mem_flash:
-            mem_size = args->memory_address_top + 1;
-            page_size = args->flash_page_size;
-            if( ADC_AVR32 == args->device_type ) {
-                target_offset = 0x80000000;
-            } else if( GRP_STM32 & args->device_type ) {
-                target_offset = STM32_FLASH_OFFSET;
-            }
-            break;
-        case mem_eeprom:
-            mem_size = args->eeprom_memory_size;
-            page_size = args->eeprom_page_size;
-            break;
-        case mem_user:
-            mem_size = args->flash_page_size;
-            page_size = args->flash_page_size;
-            target_offset = 0x80800000;
-            break;
-        default:
-            fprintf( stderr, "Dump not currenlty supported for this memory.\n" );
-            retval = ARGUMENT_ERROR;
-            goto error;
+    if( (NULL == args->profiles) || (NULL == device->handle) ||
+            (GRP_STM32 & args->device_type) ||
+            (com_autotune == args->command) || (com_dfumode == args->command) ) {
+        return;
     }
 
-    if( 0 != intel_init_buffer_in(&buin, mem_size, page_size) ) {
-        DEBUG("ERROR initializing a buffer.\n");
-        retval = BUFFER_INIT_ERROR;
-        goto error;
+    if( 0 != profile_load(args->profiles, args->vendor_id, args->chip_id,
+                          PROFILE_ANY_VERSION, &profile) ) {
+        return;
+    }
+    if( 0 > (version = atmel_read_version(device)) ) {
+        DEBUG( "Unable to read the bootloader version (%d).\n", version );
+        return;
+    }
+    if( 0 == profile_load(args->profiles, args->vendor_id, args->chip_id,
+                          version, &device->profile) ) {
+        DEBUG( "Using the profile of bootloader 0x%X.\n", version );
     }
+}
 
-    if( mem_segment == mem_flash ) {
-        buin.info.data_start = args->flash_address_bottom;
-        buin.info.data_end = args->flash_address_top;
+static uint64_t command_now_us( void ) {
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ((uint64_t) now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+static int32_t execute_autotune( dfu_device_t *device,
+                                 struct programmer_arguments *args ) {
+    static const uint32_t erase_polls[] = { 1, 5, 20, 0 };
+    static const uint32_t transfer_sizes[] = { 0x100, 0x200, 0x400 };
+    static const uint32_t status_delays[] = { 0, 500, 2000 };
+    int32_t retval = UNSPECIFIED_ERROR;
+    intel_buffer_out_t bout;
+    dfu_profile_t best;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t fastest;
+    uint32_t size;
+    uint32_t i;
+    uint32_t j;
+    int32_t version;
+
+    bout.data = NULL;
+
+    if( GRP_STM32 & args->device_type ) {
+        fprintf( stderr, "autotune is only available for Atmel bootloaders.\n" );
+        return ARGUMENT_ERROR;
+    }
+    if( NULL == args->profiles ) {
+        fprintf( stderr, "autotune needs a profile file, use --profiles=file "
+                         "or set $" PROFILE_ENVIRONMENT ".\n" );
+        return ARGUMENT_ERROR;
+    }
+    if( 0 > (version = atmel_read_version(device)) ) {
+        fprintf( stderr, "Unable to read the bootloader version.\n" );
+        return DEVICE_ACCESS_ERROR;
+    }
+    if( !args->quiet ) {
+        fprintf( stderr, "Tuning bootloader 0x%X of %04x:%04x, "
+                 "the flash is erased.\n", version, args->vendor_id,
+                 args->chip_id );
     }
 
-    if( args->device_type & GRP_STM32 ) {
-        result = stm32_read_flash(device, &buin, mem_segment, args->quiet);
-    } else {
-        /* Check AVR32 security bit in order to provide a better error message */
-        security_check( device );   // avr32 has no eeprom, but OK
-        result = atmel_read_flash(device, &buin, mem_segment, args->quiet);
+    memset( &device->profile, 0, sizeof(dfu_profile_t) );
+    best = device->profile;
+
+    // ----------------- ERASE POLL INTERVAL ------------------------------
+    fastest = UINT64_MAX;
+    for( i = 0; i < sizeof(erase_polls) / sizeof(erase_polls[0]); i++ ) {
+        device->profile.erase_poll = erase_polls[i];
+        start = command_now_us();
+        if( 0 != atmel_erase_flash(device, ATMEL_ERASE_ALL, true) ) {
+            fprintf( stderr, "Erase failed.\n" );
+            retval = DEVICE_ACCESS_ERROR;
+            goto error;
+        }
+        elapsed = command_now_us() - start;
+        if( !args->quiet ) {
+            if( 0 == erase_polls[i] ) {
+                fprintf( stderr, "erase, poll as asked: " );
+            } else {
+                fprintf( stderr, "erase, poll %2u ms:   ", erase_polls[i] );
+            }
+            fprintf( stderr, "%6u ms\n", (uint32_t) (elapsed / 1000) );
+        }
+        if( elapsed < fastest ) {
+            fastest = elapsed;
+            best.erase_poll = erase_polls[i];
+        }
     }
+    device->profile.erase_poll = best.erase_poll;
 
-    if( 0 != result ) {
-        DEBUG("ERROR: could not read memory, err %d.\n", result);
-        security_message();
-        retval = FLASH_READ_ERROR;
+    // ----------------- TRANSFER SIZE AND STATUS DELAY -------------------
+    if( 0 != intel_init_buffer_out(&bout, args->memory_address_top + 1,
+                                   args->flash_page_size) ) {
+        DEBUG( "ERROR initializing a buffer.\n" );
+        retval = BUFFER_INIT_ERROR;
         goto error;
     }
+    bout.info.valid_start = args->flash_address_bottom;
+    bout.info.valid_end = args->flash_address_top;
+    size = bout.info.valid_end - bout.info.valid_start + 1;
+    if( size > AUTOTUNE_IMAGE_SIZE ) {
+        size = AUTOTUNE_IMAGE_SIZE;
+    }
+    for( i = 0; i < size; i++ ) {
+        bout.data[bout.info.valid_start + i] = (uint16_t) ((i * 37 + (i >> 8)) & 0x7f);
+    }
 
-    // determine first & last page with non-blank data
-    if( args->com_read_data.force ) {
-        buin.info.data_start = 0;
-    } else {
-        // find first page with data
-        for( i = buin.info.data_start; i < buin.info.data_end; i++ ) {
-            if( buin.data[i] != 0xFF ) break;
-            if( i / buin.info.page_size >
-                    buin.info.data_start / buin.info.page_size ) {
-                // i has just jumpped to a different page than buin.data_start
-                buin.info.data_start = i;
+    fastest = UINT64_MAX;
+    for( i = 0; i < sizeof(transfer_sizes) / sizeof(transfer_sizes[0]); i++ ) {
+        for( j = 0; j < sizeof(status_delays) / sizeof(status_delays[0]); j++ ) {
+            device->profile.transfer_size = transfer_sizes[i];
+            device->profile.status_delay = status_delays[j];
+            if( 0 != atmel_erase_flash(device, ATMEL_ERASE_ALL, true) ) {
+                fprintf( stderr, "Erase failed.\n" );
+                retval = DEVICE_ACCESS_ERROR;
+                goto error;
             }
-        }
-        if( i == buin.info.data_end ) {
-            if( !args->quiet )
-                fprintf( stderr,
-                        "Memory is blank, returning a single blank page.\n"
-                        "Use --force to return the entire memory regardless.\n");
-            buin.info.data_start = 0;
-            buin.info.data_end = buin.info.page_size - 1;
-        } else {        // find last page with data
-            for( i = buin.info.data_end; i > buin.info.data_start; i-- ) {
-                if( buin.data[i] !=0xFF ) break;
-                if( i / buin.info.page_size <
-                        buin.info.data_end / buin.info.page_size ) {
-                    buin.info.data_end = i;
+
+            // a setting only counts if the flash reads back right
+            start = command_now_us();
+            if( 0 != atmel_flash(device, &bout, false, true, true, NULL, NULL) ) {
+                elapsed = UINT64_MAX;
+                dfu_make_idle( device, false );
+            } else {
+                elapsed = command_now_us() - start;
+                if( 0 != execute_validate(device, &bout, NULL, mem_flash, true) ) {
+                    elapsed = UINT64_MAX;
+                }
+            }
+
+            if( !args->quiet ) {
+                fprintf( stderr, "program, %4u byte blocks, status after "
+                         "%4u us: ", transfer_sizes[i], status_delays[j] );
+                if( UINT64_MAX == elapsed ) {
+                    fprintf( stderr, "failed\n" );
+                } else {
+                    fprintf( stderr, "%6u bytes/s\n", (uint32_t)
+                             (((uint64_t) size) * 1000000 / (elapsed + 1)) );
                 }
             }
+            if( elapsed < fastest ) {
+                fastest = elapsed;
+                best.transfer_size = transfer_sizes[i];
+                best.status_delay = status_delays[j];
+            }
         }
     }
 
-    if( args->com_read_data.bin ) {
-        if( !args->quiet )
-            fprintf( stderr, "Dumping 0x%X bytes from address offset 0x%X.\n",
-                    buin.info.data_end + 1, target_offset );
-        for( i = 0; i <= buin.info.data_end; i++ ) {
-            fprintf( stdout, "%c", buin.data[i] );
-        }
-    } else {
-        if( !args->quiet )
-            fprintf( stderr, "Dumping 0x%X bytes from address offset 0x%X.\n",
-                    buin.info.data_end - buin.info.data_start + 1,
-                    target_offset + buin.info.data_start );
-        intel_hex_from_buffer( &buin,
-                args->com_read_data.force, target_offset );
+    // leave the board blank, whatever was found
+    device->profile = best;
+    if( 0 != atmel_erase_flash(device, ATMEL_ERASE_ALL, true) ) {
+        fprintf( stderr, "Erase failed.\n" );
+        retval = DEVICE_ACCESS_ERROR;
+        goto error;
+    }
+    if( UINT64_MAX == fastest ) {
+        fprintf( stderr, "No setting programmed the flash correctly.\n" );
+        retval = FLASH_WRITE_ERROR;
+        goto error;
     }
 
-    fflush( stdout );
+    if( 0 != profile_save(args->profiles, args->vendor_id, args->chip_id,
+                          version, &best) ) {
+        fprintf( stderr, "Unable to write the profile to '%s'.\n",
+                 args->profiles );
+        retval = UNSPECIFIED_ERROR;
+        goto error;
+    }
+    if( !args->quiet ) {
+        fprintf( stderr, "Saved to %s: %u byte blocks, erase poll %u ms, "
+                 "status after %u us.\n", args->profiles, best.transfer_size,
+                 best.erase_poll, best.status_delay );
+    }
 
     retval = SUCCESS;
 
 error:
-    if( NULL != buin.data ) {
-        free( buin.data );
-        buin.data = NULL;
+    if( NULL != bout.data ) {
+        free( bout.data );
+        bout.data = NULL;
     }
 
     return retval;
 }
 
-static int32_t execute_setfuse( dfu_device_t *device,
-                                  struct programmer_arguments *args ) {
-    int32_t value = args->com_setfuse_data.value;
-    int32_t name = args->com_setfuse_data.name;
+static void layout_args( dfu_device_t *device,
+                         struct programmer_arguments *args ) {
+    uint32_t size;
 
-    /* only ADC_AVR32 seems to support fuse operation */
-    if( !(ADC_AVR32 & args->device_type) || (GRP_STM32 & args->device_type) ) {
-        fprintf( stderr,  "Operation not supported on %s\n",
-                args->device_type_string );
-        DEBUG( "target doesn't support fuse set operation.\n" );
-        return -1;
+    if( !(args->device_type & GRP_STM32) ||
+            (0 != stm32_flash_size(device, &size)) ) {
+        return;
     }
-
-    /* Check AVR32 security bit in order to provide a better error message. */
-    security_check( device );
-
-    if( 0 != atmel_set_fuse(device, name, value) ) {
-        DEBUG( "Fuse set failed.\n" );
-        fprintf( stderr, "Fuse set failed.\n" );
-        security_message();
-        return -1;
+    if( size != args->memory_address_top + 1 ) {
+        DEBUG( "The device has 0x%X bytes of flash, not 0x%X.\n", size,
+               args->memory_address_top + 1 );
     }
 
-    return 0;
+    // the bootloader is in system memory, outside the flash
+    args->flash_address_top = size - 1;
+    args->memory_address_top = size - 1;
+    args->bootloader_bottom = size;
+    args->bootloader_top = size - 1;
 }
 
-static int32_t execute_configure( dfu_device_t *device,
-                                  struct programmer_arguments *args ) {
-    int32_t value = args->com_configure_data.value;
-    int32_t name = args->com_configure_data.name;
-
-    if( ADC_8051 != args->device_type ) {
-        fprintf( stderr, "Operation not supported on %s\n",
-                args->device_type_string );
-        DEBUG( "target doesn't support configure operation.\n" );
-        return -1;
+static void flash_command_args( struct programmer_arguments *args ) {
+    switch( args->command ) {
+        case com_eflash:
+            args->com_flash_data.segment = mem_eeprom;
+            args->command = com_launch;
+            break;
+        case com_user:
+            args->com_flash_data.segment = mem_user;
+            args->command = com_launch;
+            break;
+        default:
+            break;
     }
+}
 
-    if( (0xff & value) != value ) {
-        DEBUG( "Value to configure must be in range 0-255.\n" );
-        fprintf( stderr, "Value to configure must be in range 0-255.\n" );
-        return -1;
+void execute_prepare( struct programmer_arguments *args ) {
+    switch( args->command ) {
+        case com_flash:
+        case com_eflash:
+        case com_user:
+        case com_verify:
+            break;
+        default:
+            return;
     }
 
-    if( 0 != atmel_set_config(device, name, value) )
-    {
-        DEBUG( "Configuration set failed.\n" );
-        fprintf( stderr, "Configuration set failed.\n" );
-        return -1;
+    prepare.args = *args;
+    flash_command_args( &prepare.args );
+    prepare.bout.data = NULL;
+
+    if( 0 != pthread_create(&prepare.thread, NULL, prepare_worker, &prepare) ) {
+        DEBUG( "Unable to start the image worker, preparing inline.\n" );
+        return;
     }
+    prepare.started = true;
+}
 
-    return 0;
+int32_t execute_load_image( struct programmer_arguments *args,
+                            intel_buffer_out_t *bout,
+                            atmel_frames_t *frames ) {
+    struct programmer_arguments image_args = *args;
+
+    // every board writes its own overlay over the shared image
+    memset( &image_args.com_flash_data.overlay, 0, sizeof(image_overlay_t) );
+    flash_command_args( &image_args );
+
+    return prepare_flash_image( &image_args, bout, frames );
 }
 
-static int32_t execute_launch( dfu_device_t *device,
-                                  struct programmer_arguments *args ) {
-    if( args->device_type & GRP_STM32 ) {
-        return stm32_start_app( device, args->quiet );
-    } else if( args->com_launch_config.noreset ) {
-        return atmel_start_app_noreset( device );
-    } else {
-        return atmel_start_app_reset( device );
+dfu_bool execute_needs_device( struct programmer_arguments *args ) {
+    switch( args->command ) {
+        case com_bin2hex:
+        case com_hex2bin:
+        case com_diff:
+        case com_make_patch:
+        case com_bundle:
+        case com_manifest:
+            return false;
+        case com_checksum:
+            return (NULL == args->com_checksum_data.file) ? true : false;
+        default:
+            return true;
+    }
+}
+
+void execute_cleanup( void ) {
+    if( true == prepare.started ) {
+        pthread_join( prepare.thread, NULL );
+        prepare.started = false;
     }
+
+    if( NULL != prepare.bout.data ) {
+        free( prepare.bout.data );
+        prepare.bout.data = NULL;
+    }
+    atmel_frames_free( &prepare.frames );
 }
 
 int32_t execute_command( dfu_device_t *device,
                          struct programmer_arguments *args ) {
     device->type = args->device_type;
+    layout_args( device, args );
+    profile_args( device, args );
     switch( args->command ) {
         case com_erase:
             return execute_erase( device, args );
@@ -939,15 +3034,24 @@ int32_t execute_command( dfu_device_t *device,
         case com_hex2bin:
             return execute_hex2bin( device, args );
         case com_flash:
-            return execute_flash( device, args );
         case com_eflash:
-            args->com_flash_data.segment = mem_eeprom;
-            args->command = com_launch;
-            return execute_flash( device, args );
         case com_user:
-            args->com_flash_data.segment = mem_user;
-            args->command = com_launch;
+            flash_command_args( args );
             return execute_flash( device, args );
+        case com_verify:
+            return execute_verify( device, args );
+        case com_checksum:
+            return execute_checksum( device, args );
+        case com_diff:
+            return execute_diff( device, args );
+        case com_make_patch:
+            return execute_make_patch( device, args );
+        case com_apply_patch:
+            return execute_apply_patch( device, args );
+        case com_bundle:
+            return execute_bundle( device, args );
+        case com_flash_bundle:
+            return execute_flash_bundle( device, args );
 
         case com_start_app:
             args->com_launch_config.noreset = true;
@@ -963,19 +3067,19 @@ int32_t execute_command( dfu_device_t *device,
         case com_dump:
             args->command = com_read;
             args->com_read_data.force = true;
-            args->com_read_data.bin = 1;
+            args->com_read_data.bin = !args->com_read_data.dfu;
             return execute_dump( device, args );
         case com_edump:
             args->com_read_data.segment = mem_eeprom;
             args->com_read_data.force = true;
             args->command = com_read;
-            args->com_read_data.bin = 1;
+            args->com_read_data.bin = !args->com_read_data.dfu;
             return execute_dump( device, args );
         case com_udump:
             args->com_read_data.segment = mem_eeprom;
             args->com_read_data.force = true;
             args->command = com_read;
-            args->com_read_data.bin = 1;
+            args->com_read_data.bin = !args->com_read_data.dfu;
             return execute_dump( device, args );
         case com_read:
             return execute_dump( device, args );
@@ -983,10 +3087,16 @@ int32_t execute_command( dfu_device_t *device,
             return execute_configure( device, args );
         case com_setfuse:
             return execute_setfuse( device, args );
+        case com_set:
+            return execute_set( device, args );
         case com_setsecure:
             return execute_setsecure( device, args );
         case com_dfumode:
             return execute_dfumode( device, args );
+        case com_autotune:
+            return execute_autotune( device, args );
+        case com_manifest:
+            return manifest_run( args );
         default:
             fprintf( stderr, "Not supported at this time.\n" );
     }
@@ -25,6 +25,32 @@
 #include "arguments.h"
 #include "dfu-device.h"
 
+void execute_prepare( struct programmer_arguments *args );
+/* start the host side work of a command (building the image for flash)
+ * on a worker thread, so it overlaps opening the device.  args must not
+ * change until execute_command is called.
+ */
+
 int32_t execute_command( dfu_device_t *device,
                          struct programmer_arguments *args );
+
+int32_t execute_load_image( struct programmer_arguments *args,
+                            intel_buffer_out_t *bout,
+                            atmel_frames_t *frames );
+/* read the file of a flash, eflash or user command into bout the way
+ * the command would, leaving out its overlay, and encode frames for it
+ * where the command would, so both can be handed to several commands
+ * through com_flash_data.image and .frames.  The caller frees bout->data
+ * and the frames.
+ */
+
+dfu_bool execute_needs_device( struct programmer_arguments *args );
+/* false for the commands that only work on files, so main does not
+ * look for a device
+ */
+
+void execute_cleanup( void );
+/* wait for and release anything execute_prepare started that
+ * execute_command did not use (e.g. when no device was found)
+ */
 #endif
@@ -0,0 +1,197 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "decompress.h"
+#include "util.h"
+
+#define DECOMPRESS_DEBUG_THRESHOLD  40
+#define DECOMPRESS_TRACE_THRESHOLD  45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               DECOMPRESS_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               DECOMPRESS_TRACE_THRESHOLD, __VA_ARGS__ )
+
+typedef struct {
+    const char *tool;
+    size_t length;
+    uint8_t magic[6];
+} decompress_format_t;
+
+static const decompress_format_t formats[] = {
+    { "gzip", 2, { 0x1f, 0x8b } },
+    { "zstd", 4, { 0x28, 0xb5, 0x2f, 0xfd } },
+    { "xz",   6, { 0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00 } }
+};
+
+// ________  P R O T O T Y P E S  _______________________________
+static const decompress_format_t *decompress_format( const int fd );
+/* read the first bytes of fd and rewind it
+ * returns the format they match, or NULL for a plain file
+ */
+
+static int32_t decompress_start( decompress_t *file, const int fd );
+/* run the decoder with fd as its input and file->fp reading its output
+ * returns 0 on success, -1 on error (fd is closed either way)
+ */
+
+// ________  F U N C T I O N S  _______________________________
+static const decompress_format_t *decompress_format( const int fd ) {
+    uint8_t magic[6];
+    ssize_t length;
+    size_t i;
+
+    do {
+        length = read( fd, magic, sizeof(magic) );
+    } while( (-1 == length) && (EINTR == errno) );
+
+    if( (length <= 0) || (0 != lseek(fd, 0, SEEK_SET)) ) {
+        return NULL;
+    }
+    for( i = 0; i < sizeof(formats) / sizeof(formats[0]); i++ ) {
+        if( ((size_t) length >= formats[i].length) &&
+                (0 == memcmp(magic, formats[i].magic, formats[i].length)) ) {
+            return &formats[i];
+        }
+    }
+
+    return NULL;
+}
+
+static int32_t decompress_start( decompress_t *file, const int fd ) {
+    int pipefd[2];
+
+    // no other child may keep the write end open, dup2 clears the flag
+    if( 0 != pipe2(pipefd, O_CLOEXEC) ) {
+        DEBUG( "Unable to create a pipe: %s\n", strerror(errno) );
+        close( fd );
+        return -1;
+    }
+
+    fflush( NULL );
+    if( -1 == (file->pid = fork()) ) {
+        DEBUG( "Unable to start %s: %s\n", file->tool, strerror(errno) );
+        close( pipefd[0] );
+        close( pipefd[1] );
+        close( fd );
+        file->pid = 0;
+        return -1;
+    }
+
+    if( 0 == file->pid ) {
+        // the decoder, reading the file and writing the pipe
+        if( (-1 == dup2(fd, STDIN_FILENO)) ||
+                (-1 == dup2(pipefd[1], STDOUT_FILENO)) ) {
+            _exit( 127 );
+        }
+        close( fd );
+        close( pipefd[0] );
+        close( pipefd[1] );
+        execlp( file->tool, file->tool, "-dc", (char *) NULL );
+        // another thread may have held a stdio lock at the fork, so
+        // nothing is printed here, the parent reports the failed decoder
+        _exit( 127 );
+    }
+
+    close( fd );
+    close( pipefd[1] );
+    if( NULL == (file->fp = fdopen(pipefd[0], "r")) ) {
+        close( pipefd[0] );
+        decompress_close( file );
+        return -1;
+    }
+    DEBUG( "Decoding with %s (pid %d).\n", file->tool, (int) file->pid );
+
+    return 0;
+}
+
+int32_t decompress_open( decompress_t *file, const char *filename ) {
+    const decompress_format_t *format;
+    int fd;
+
+    TRACE( "%s( %p, %s )\n", __FUNCTION__, file, filename );
+
+    file->fp = NULL;
+    file->pid = 0;
+    file->tool = NULL;
+
+    if( 0 == strcmp("STDIN", filename) ) {
+        file->fp = stdin;
+        return 0;
+    }
+
+    if( -1 == (fd = open(filename, O_RDONLY)) ) {
+        DEBUG( "Unable to open %s: %s\n", filename, strerror(errno) );
+        return -1;
+    }
+
+    if( NULL != (format = decompress_format(fd)) ) {
+        file->tool = format->tool;
+        return decompress_start( file, fd );
+    }
+
+    if( NULL == (file->fp = fdopen(fd, "r")) ) {
+        close( fd );
+        return -1;
+    }
+
+    return 0;
+}
+
+int32_t decompress_close( decompress_t *file ) {
+    int32_t retval = 0;
+    char chunk[4096];
+    int status = 0;
+    pid_t pid;
+
+    if( NULL != file->fp ) {
+        if( 0 != file->pid ) {
+            while( 0 != fread(chunk, 1, sizeof(chunk), file->fp) ) ;
+        }
+        if( stdin != file->fp ) {
+            fclose( file->fp );
+        }
+        file->fp = NULL;
+    }
+
+    if( 0 != file->pid ) {
+        while( (-1 == (pid = waitpid(file->pid, &status, 0))) &&
+                (EINTR == errno) ) ;
+        if( (-1 == pid) || !WIFEXITED(status) ||
+                (0 != WEXITSTATUS(status)) ) {
+            DEBUG( "%s failed with status 0x%X.\n", file->tool, status );
+            retval = -1;
+        }
+        file->pid = 0;
+    }
+
+    return retval;
+}
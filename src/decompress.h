@@ -0,0 +1,56 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __DECOMPRESS_H__
+#define __DECOMPRESS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*  Image files may be stored compressed with gzip, zstd or xz.  The format
+ *  is recognised by its magic bytes and the file is decoded as it is read,
+ *  by the matching tool writing into a pipe, so only the compressed bytes
+ *  come off the disk and nothing is unpacked to a temporary file.  Other
+ *  files, and STDIN, are read as they are.
+ */
+
+typedef struct {
+    FILE *fp;               /* read the image from here */
+    pid_t pid;              /* of the decoder, 0 for a plain file */
+    const char *tool;       /* the decoder, for messages */
+} decompress_t;
+
+int32_t decompress_open( decompress_t *file, const char *filename );
+/*  Open filename ("STDIN" for stdin) for reading and start the decoder if
+ *  it is compressed.
+ *
+ *  returns 0 on success, -1 if the file cannot be opened or the decoder
+ *  cannot be started
+ */
+
+int32_t decompress_close( decompress_t *file );
+/*  Close the file.  Whatever was not read yet is decoded and dropped, so
+ *  damage anywhere in a compressed file is noticed.  stdin is left open.
+ *
+ *  returns 0 on success, -1 if the decoder failed
+ */
+
+#endif
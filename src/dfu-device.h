@@ -2,7 +2,9 @@
 #define __DFU_DEVICE_H__
 
 #include <stdint.h>
+#include <stddef.h>
 #include <libusb.h>
+#include "dfuse.h"
 
 // Atmel device classes are now defined with one bit per class.
 // This simplifies checking in functions which handle more than one class.
@@ -19,12 +21,66 @@
 
 typedef unsigned atmel_device_class_t;
 
+// One set of round trip statistics is kept per DFU request (DFU_DETACH to
+// DFU_ABORT), control transfer timeouts are derived from them in dfu.c.
+#define DFU_REQUEST_TYPES   7
+
+typedef struct {
+    uint32_t srtt;          // smoothed round trip time in us
+    uint32_t rttvar;        // round trip time variation in us
+    uint32_t max;           // slowest measured round trip in us
+    uint32_t samples;       // number of measured transfers
+    uint32_t timeouts;      // number of transfers that timed out
+    uint8_t backoff;        // timeout doublings since the last success
+} dfu_rtt_t;
+
+// Settings the autotune command found best for one bootloader, see
+// profile.h.  A value of 0 keeps the built in behaviour.
+typedef struct {
+    uint32_t transfer_size; // bytes of data in each download block
+    uint32_t erase_poll;    // ms between status requests while erasing
+    uint32_t status_delay;  // us from a block download to its status request
+} dfu_profile_t;
+
+// Where a device is plugged in, read by dfu_read_topology in usb.c.  The
+// transfers of devices sharing a root port, hub or transaction translator
+// can be limited together, see topology.h.
+#define DFU_MAX_PORT_DEPTH  7
+#define DFU_TOPOLOGY_NODES  3
+
+typedef struct {
+    uint8_t bus;
+    uint8_t depth;          // number of ports from the root hub
+    uint8_t ports[DFU_MAX_PORT_DEPTH];
+    uint8_t tt_depth;       // ports to the hub whose transaction translator
+                            // carries the transfers, 0 if there is none
+    uint8_t tt_multi;       // that hub has a translator for each port
+    uint8_t limited;        // node is valid, transfers go through topology.c
+    int32_t node[DFU_TOPOLOGY_NODES];
+} dfu_topology_t;
+
 typedef struct {
     struct libusb_device_handle *handle;
     int32_t interface;
     atmel_device_class_t type;
+    uint16_t transaction;   // wValue of the next DNLOAD / UPLOAD
+    dfu_rtt_t rtt[DFU_REQUEST_TYPES];
+    uint32_t slow_timeout;  // ms, replaces the adaptive timeout when set
+    uint32_t poll_timeout;  // ms, bwPollTimeout from the last DFU_GETSTATUS
+    uint8_t *buffer;        // block transfer buffer, see dfu_transfer_buffer
+    size_t buffer_size;     // bytes available to callers in buffer
+    uint8_t buffer_dma;     // buffer was mapped by libusb_dev_mem_alloc
+    dfuse_layout_t layout;  // memory map from the DfuSe interface strings
+    dfu_profile_t profile;  // tuned settings of this bootloader
+    dfu_topology_t topology;
+    uint32_t open_time;     // us dfu_device_init took to make it ready
 } dfu_device_t;
 
+// Receives memory read from a device one block at a time (address is the
+// memory address of data[0]), returning non-zero stops the read.
+typedef int32_t (*dfu_block_sink_t)( void *context, const uint32_t address,
+                                     const uint8_t *data, const size_t length );
+
 #endif /* __DFU_DEVICE_H__ */
 
 /******************* S T M 3 2   D F U   C O M M A N D S ******************
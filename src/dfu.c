@@ -25,7 +25,9 @@
 #include <stddef.h>
 #include <libusb.h>
 #include <errno.h>
+#include <time.h>
 #include "dfu.h"
+#include "topology.h"
 #include "util.h"
 #include "dfu-bool.h"
 
@@ -40,18 +42,57 @@
 #define MSG_DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
                                DFU_MESSAGE_DEBUG_THRESHOLD, __VA_ARGS__ )
 
-static uint16_t transaction = 0;
+/* timeouts are not doubled more often than this after repeated failures */
+#define DFU_MAX_BACKOFF     6
+
+static const char *dfu_request_names[DFU_REQUEST_TYPES] = {
+    "DETACH", "DNLOAD", "UPLOAD", "GETSTATUS", "CLRSTATUS", "GETSTATE", "ABORT"
+};
+
+// ________  P R O T O T Y P E S  _______________________________
+static uint32_t dfu_transfer_timeout( dfu_device_t *device,
+                                      const uint8_t request );
+/* the timeout in ms for the next transfer of type request, see DFU_TIMEOUT
+ */
+
+static void dfu_transfer_record( dfu_device_t *device,
+                                 const uint8_t request,
+                                 const uint64_t start,
+                                 const int32_t result,
+                                 const dfu_bool measured );
+/* update the round trip statistics of request after a transfer that started
+ * at start (us), only measured transfers are used for the averages
+ */
+
+static uint64_t dfu_now_us( void );
+/* monotonic time in us
+ */
+
+static int32_t dfu_transfer_direct( dfu_device_t *device,
+                                    const uint8_t request_type,
+                                    const uint8_t request,
+                                    const int32_t value,
+                                    const size_t length,
+                                    const uint32_t timeout );
+/* run a control transfer on the data already in the transfer buffer, the
+ * setup packet is written in front of it so neither libusb nor usbfs need a
+ * copy of the data.  returns the bytes transferred or a libusb error
+ */
+
+static void LIBUSB_CALL dfu_transfer_done( struct libusb_transfer *transfer );
+/* completion callback for dfu_transfer_direct
+ */
 
 // ________  F U N C T I O N S  _______________________________
-void dfu_set_transaction_num( uint16_t newnum ) {
-    TRACE( "%s( %u )\n", __FUNCTION__, newnum );
-    transaction = newnum;
-    DEBUG("wValue set to %d\n", transaction);
+void dfu_set_transaction_num( dfu_device_t *device, uint16_t newnum ) {
+    TRACE( "%s( %p, %u )\n", __FUNCTION__, device, newnum );
+    device->transaction = newnum;
+    DEBUG("wValue set to %d\n", device->transaction);
 }
 
-uint16_t dfu_get_transaction_num( void ) {
-    TRACE( "%s( %u )\n", __FUNCTION__ );
-    return transaction;
+uint16_t dfu_get_transaction_num( dfu_device_t *device ) {
+    TRACE( "%s( %p )\n", __FUNCTION__, device );
+    return device->transaction;
 }
 
 int32_t dfu_detach( dfu_device_t *device, const int32_t timeout ) {
@@ -101,7 +142,7 @@ int32_t dfu_download( dfu_device_t *device,
         }
     }
 
-    result = dfu_transfer_out( device, DFU_DNLOAD, transaction++, data, length );
+    result = dfu_transfer_out( device, DFU_DNLOAD, device->transaction++, data, length );
 
     dfu_msg_response_output( __FUNCTION__, result );
 
@@ -124,7 +165,7 @@ int32_t dfu_upload( dfu_device_t *device, const size_t length, uint8_t* data ) {
         return -2;
     }
 
-    result = dfu_transfer_in( device, DFU_UPLOAD, transaction++, data, length );
+    result = dfu_transfer_in( device, DFU_UPLOAD, device->transaction++, data, length );
 
     dfu_msg_response_output( __FUNCTION__, result );
 
@@ -158,6 +199,9 @@ int32_t dfu_get_status( dfu_device_t *device, dfu_status_t *status ) {
                                 ((0xff & buffer[2]) << 8)  |
                                 (0xff & buffer[1]);
 
+        /* the device may not answer before bwPollTimeout has passed */
+        device->poll_timeout = status->bwPollTimeout;
+
         status->bState  = buffer[4];
         status->iString = buffer[5];
 
@@ -175,6 +219,8 @@ int32_t dfu_get_status( dfu_device_t *device, dfu_status_t *status ) {
             DEBUG( "result: %d\n", result );
             return -2;
         }
+        /* The request itself failed (timeout, stall, disconnect). */
+        return result;
     }
 
     return 0;
@@ -341,12 +387,19 @@ int32_t dfu_make_idle( dfu_device_t *device, const dfu_bool initial_abort ) {
     int32_t retries = 4;
 
     if( true == initial_abort ) {
+        /* a device that is idle already has nothing to abort */
+        if( (0 == dfu_get_status(device, &status)) &&
+                (STATE_DFU_IDLE == status.bState) &&
+                (DFU_STATUS_OK == status.bStatus) ) {
+            return 0;
+        }
         dfu_abort( device );
     }
 
     while( 0 < retries ) {
         if( 0 != dfu_get_status(device, &status) ) {
             dfu_clear_status( device );
+            retries--;
             continue;
         }
 
@@ -393,19 +446,160 @@ int32_t dfu_make_idle( dfu_device_t *device, const dfu_bool initial_abort ) {
     return -2;
 }
 
+static uint64_t dfu_now_us( void ) {
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ((uint64_t) now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint32_t dfu_transfer_timeout( dfu_device_t *device,
+                                      const uint8_t request ) {
+    dfu_rtt_t *rtt;
+    uint32_t timeout;
+
+    if( 0 != device->slow_timeout ) {
+        return device->slow_timeout;
+    }
+
+    if( DFU_REQUEST_TYPES <= request ) {
+        return DFU_TIMEOUT;
+    }
+
+    rtt = &device->rtt[request];
+    if( rtt->samples < DFU_RTT_SAMPLES ) {
+        timeout = DFU_TIMEOUT_INITIAL;
+    } else {
+        /* round up to whole ms */
+        timeout = (rtt->srtt + 4 * rtt->rttvar + 999) / 1000;
+        if( timeout < DFU_TIMEOUT_MIN ) {
+            timeout = DFU_TIMEOUT_MIN;
+        }
+    }
+
+    timeout <<= rtt->backoff;
+    timeout += device->poll_timeout;
+
+    return (timeout < DFU_TIMEOUT) ? timeout : DFU_TIMEOUT;
+}
+
+static void dfu_transfer_record( dfu_device_t *device,
+                                 const uint8_t request,
+                                 const uint64_t start,
+                                 const int32_t result,
+                                 const dfu_bool measured ) {
+    dfu_rtt_t *rtt;
+    uint32_t sample;
+    uint32_t delta;
+
+    if( DFU_REQUEST_TYPES <= request ) {
+        return;
+    }
+
+    rtt = &device->rtt[request];
+    sample = (uint32_t) (dfu_now_us() - start);
+
+    if( LIBUSB_ERROR_TIMEOUT == result ) {
+        rtt->timeouts++;
+        if( rtt->backoff < DFU_MAX_BACKOFF ) {
+            rtt->backoff++;
+        }
+        DEBUG( "%s timed out after %u us, backoff %u.\n",
+               dfu_request_names[request], sample, rtt->backoff );
+        return;
+    }
+
+    if( result < 0 ) {
+        /* failed quickly, this says nothing about the latency */
+        return;
+    }
+
+    rtt->backoff = 0;
+    if( false == measured ) {
+        return;
+    }
+
+    if( sample > rtt->max ) {
+        rtt->max = sample;
+    }
+
+    if( 0 == rtt->samples ) {
+        rtt->srtt = sample;
+        rtt->rttvar = sample / 2;
+    } else {
+        delta = (rtt->srtt > sample) ? (rtt->srtt - sample) : (sample - rtt->srtt);
+        rtt->rttvar = (3 * rtt->rttvar + delta) / 4;
+        rtt->srtt = (7 * rtt->srtt + sample) / 8;
+    }
+    rtt->samples++;
+}
+
+void dfu_expect_slow( dfu_device_t *device, const uint32_t timeout ) {
+    TRACE( "%s( %p, %u )\n", __FUNCTION__, device, timeout );
+
+    if( NULL != device ) {
+        device->slow_timeout = timeout;
+    }
+}
+
+void dfu_print_stats( FILE *stream, dfu_device_t *device ) {
+    int32_t i;
+    dfu_rtt_t *rtt;
+
+    if( 0 != device->open_time ) {
+        fprintf( stream, "%-10s %8u us\n", "open", device->open_time );
+    }
+    fprintf( stream, "%-10s %8s %8s %10s %10s %10s %10s\n", "request",
+             "count", "timeouts", "srtt(us)", "rttvar(us)", "max(us)",
+             "timeout(ms)" );
+
+    for( i = 0; i < DFU_REQUEST_TYPES; i++ ) {
+        rtt = &device->rtt[i];
+        if( 0 == rtt->samples && 0 == rtt->timeouts ) {
+            continue;
+        }
+        fprintf( stream, "%-10s %8u %8u %10u %10u %10u %10u\n",
+                 dfu_request_names[i], rtt->samples, rtt->timeouts,
+                 rtt->srtt, rtt->rttvar, rtt->max,
+                 dfu_transfer_timeout(device, i) );
+    }
+}
+
 int32_t dfu_transfer_out( dfu_device_t *device,
                           uint8_t request,
                           const int32_t value,
                           uint8_t* data,
                           const size_t length ) {
-    return libusb_control_transfer( device->handle,
+    int32_t result;
+    uint32_t timeout = dfu_transfer_timeout( device, request );
+    dfu_bool measured = (0 == device->slow_timeout) && (0 == device->poll_timeout);
+    uint64_t start;
+
+    /* time spent waiting for a shared hub does not count as latency */
+    topology_enter( &device->topology );
+    start = dfu_now_us();
+
+    device->poll_timeout = 0;
+    if( (NULL != data) && (NULL != device->buffer) &&
+            (data == device->buffer + LIBUSB_CONTROL_SETUP_SIZE) ) {
+        result = dfu_transfer_direct( device,
+                LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+                request, value, length, timeout );
+    } else {
+        result = libusb_control_transfer( device->handle,
                 /* bmRequestType */ LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
                 /* bRequest      */ request,
                 /* wValue        */ value,
                 /* wIndex        */ device->interface,
                 /* Data          */ data,
                 /* wLength       */ length,
-                                    DFU_TIMEOUT );
+                                    timeout );
+    }
+    topology_leave( &device->topology, result );
+    dfu_transfer_record( device, request, start, result, measured );
+
+    return result;
 }
 
 int32_t dfu_transfer_in( dfu_device_t *device,
@@ -413,14 +607,165 @@ int32_t dfu_transfer_in( dfu_device_t *device,
                          const int32_t value,
                          uint8_t* data,
                          const size_t length ) {
-    return libusb_control_transfer( device->handle,
+    int32_t result;
+    uint32_t timeout = dfu_transfer_timeout( device, request );
+    dfu_bool measured = (0 == device->slow_timeout) && (0 == device->poll_timeout);
+    uint64_t start;
+
+    /* time spent waiting for a shared hub does not count as latency */
+    topology_enter( &device->topology );
+    start = dfu_now_us();
+
+    device->poll_timeout = 0;
+    if( (NULL != data) && (NULL != device->buffer) &&
+            (data == device->buffer + LIBUSB_CONTROL_SETUP_SIZE) ) {
+        result = dfu_transfer_direct( device,
+                LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+                request, value, length, timeout );
+    } else {
+        result = libusb_control_transfer( device->handle,
                 /* bmRequestType */ LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
                 /* bRequest      */ request,
                 /* wValue        */ value,
                 /* wIndex        */ device->interface,
                 /* Data          */ data,
                 /* wLength       */ length,
-                                    DFU_TIMEOUT );
+                                    timeout );
+    }
+    topology_leave( &device->topology, result );
+    dfu_transfer_record( device, request, start, result, measured );
+
+    return result;
+}
+
+uint8_t *dfu_transfer_buffer( dfu_device_t *device, const size_t length ) {
+    uint8_t *buffer = NULL;
+    const size_t size = LIBUSB_CONTROL_SETUP_SIZE + length;
+
+    TRACE( "%s( %p, %u )\n", __FUNCTION__, device, length );
+
+    if( (NULL == device) || (NULL == device->handle) ) {
+        DEBUG( "Invalid parameter\n" );
+        return NULL;
+    }
+
+    if( (NULL != device->buffer) && (length <= device->buffer_size) ) {
+        return device->buffer + LIBUSB_CONTROL_SETUP_SIZE;
+    }
+
+    dfu_transfer_release( device );
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+    if( NULL != (buffer = libusb_dev_mem_alloc(device->handle, size)) ) {
+        device->buffer_dma = 1;
+    }
+#endif
+    if( NULL == buffer ) {
+        DEBUG( "No device memory, using a heap transfer buffer.\n" );
+        if( NULL == (buffer = (uint8_t *) malloc(size)) ) {
+            DEBUG( "Unable to allocate a %u byte transfer buffer.\n", size );
+            return NULL;
+        }
+        device->buffer_dma = 0;
+    }
+
+    DEBUG( "Allocated a %u byte %s transfer buffer.\n", size,
+           (device->buffer_dma ? "device" : "heap") );
+
+    device->buffer = buffer;
+    device->buffer_size = length;
+
+    return device->buffer + LIBUSB_CONTROL_SETUP_SIZE;
+}
+
+void dfu_transfer_release( dfu_device_t *device ) {
+    TRACE( "%s( %p )\n", __FUNCTION__, device );
+
+    if( (NULL == device) || (NULL == device->buffer) ) {
+        return;
+    }
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+    if( device->buffer_dma ) {
+        libusb_dev_mem_free( device->handle, device->buffer,
+                             LIBUSB_CONTROL_SETUP_SIZE + device->buffer_size );
+    } else
+#endif
+    {
+        free( device->buffer );
+    }
+
+    device->buffer = NULL;
+    device->buffer_size = 0;
+    device->buffer_dma = 0;
+}
+
+static void LIBUSB_CALL dfu_transfer_done( struct libusb_transfer *transfer ) {
+    *((int *) transfer->user_data) = 1;
+}
+
+static int32_t dfu_transfer_direct( dfu_device_t *device,
+                                    const uint8_t request_type,
+                                    const uint8_t request,
+                                    const int32_t value,
+                                    const size_t length,
+                                    const uint32_t timeout ) {
+    extern libusb_context *usbcontext;
+    struct libusb_transfer *transfer;
+    int completed = 0;
+    int cancelled = 0;
+    int32_t result;
+
+    if( NULL == (transfer = libusb_alloc_transfer(0)) ) {
+        return LIBUSB_ERROR_NO_MEM;
+    }
+
+    libusb_fill_control_setup( device->buffer, request_type, request,
+                               value, device->interface, length );
+    libusb_fill_control_transfer( transfer, device->handle, device->buffer,
+                                  dfu_transfer_done, &completed, timeout );
+
+    if( 0 != (result = libusb_submit_transfer(transfer)) ) {
+        libusb_free_transfer( transfer );
+        return result;
+    }
+
+    // libusb owns the transfer until its callback ran, even after a cancel,
+    // which always ends in the callback as well
+    while( !completed ) {
+        result = libusb_handle_events_completed( usbcontext, &completed );
+        if( (0 != result) && (LIBUSB_ERROR_INTERRUPTED != result) &&
+                !cancelled ) {
+            DEBUG( "Event handling failed (%d), cancelling.\n", result );
+            libusb_cancel_transfer( transfer );
+            cancelled = 1;
+        }
+    }
+
+    switch( transfer->status ) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            result = transfer->actual_length;
+            break;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            result = LIBUSB_ERROR_TIMEOUT;
+            break;
+        case LIBUSB_TRANSFER_STALL:
+            result = LIBUSB_ERROR_PIPE;
+            break;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            result = LIBUSB_ERROR_NO_DEVICE;
+            break;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            result = LIBUSB_ERROR_OVERFLOW;
+            break;
+        default:
+            result = LIBUSB_ERROR_IO;
+            break;
+    }
+
+    libusb_free_transfer( transfer );
+
+    return result;
 }
 
 void dfu_msg_response_output( const char *function, const int32_t result ) {
@@ -22,6 +22,7 @@
 #define __DFU_H__
 
 #include <libusb.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -85,9 +86,19 @@
 
 /* Wait for 20 seconds before a timeout since erasing/flashing can take some time.
  * The longest erase cycle is for the AT32UC3A0512-TA automotive part,
- * which needs a timeout of at least 19 seconds to erase the whole flash. */
+ * which needs a timeout of at least 19 seconds to erase the whole flash.
+ * This is the budget for operations announced with dfu_expect_slow() and the
+ * upper limit for every other transfer. */
 #define DFU_TIMEOUT 20000
 
+/* Other transfers use a timeout of srtt + 4 * rttvar measured for the same
+ * request (as for TCP retransmits), doubled after every timeout.  Until
+ * DFU_RTT_SAMPLES round trips are measured DFU_TIMEOUT_INITIAL is used and
+ * the result is never below DFU_TIMEOUT_MIN (all in ms). */
+#define DFU_TIMEOUT_INITIAL 1000
+#define DFU_TIMEOUT_MIN     250
+#define DFU_RTT_SAMPLES     3
+
 /* Time (in ms) for the device to wait for the usb reset after being told to detach
  * before the giving up going into dfu mode. */
 #define DFU_DETACH_TIMEOUT 1000
@@ -105,6 +116,8 @@ int32_t dfu_make_idle( dfu_device_t *device, const dfu_bool initial_abort );
 /*  Gets the device into the dfuIDLE state if possible.
  *
  *  device    - the dfu device to commmunicate with
+ *  initial_abort - send DFU_ABORT first, unless the device already
+ *                  reports dfuIDLE and OK
  *
  *  returns 0 on success, 1 if device was reset, error otherwise
  */
@@ -121,6 +134,42 @@ int32_t dfu_transfer_in( dfu_device_t *device,
                          uint8_t* data,
                          const size_t length );
 
+uint8_t *dfu_transfer_buffer( dfu_device_t *device, const size_t length );
+/*  Get the buffer that block transfers should be built in.  Where libusb and
+ *  the platform support it, the memory is mapped for DMA by the kernel
+ *  (libusb_dev_mem_alloc) so a DNLOAD or UPLOAD from it is not copied again
+ *  on its way to the device, otherwise it is ordinary heap memory.  Passing
+ *  this buffer to dfu_download/dfu_upload also avoids the copy libusb makes
+ *  for synchronous control transfers.
+ *
+ *  The buffer is reused and only grows, so a pointer returned earlier is
+ *  invalid after a call with a larger length.
+ *
+ *  device    - the dfu device to commmunicate with
+ *  length    - the number of bytes needed
+ *
+ *  returns the buffer, or NULL if no memory could be allocated
+ */
+
+void dfu_transfer_release( dfu_device_t *device );
+/*  Free the transfer buffer, this must be called before the device handle
+ *  is closed.
+ */
+
+void dfu_expect_slow( dfu_device_t *device, const uint32_t timeout );
+/*  Announce that the following transfers start or wait for a long running
+ *  operation (such as a mass erase), so the adaptive timeout does not apply
+ *  and these round trips are not taken into the statistics.
+ *
+ *  device    - the dfu device to commmunicate with
+ *  timeout   - the timeout in ms to use, 0 returns to adaptive timeouts
+ */
+
+void dfu_print_stats( FILE *stream, dfu_device_t *device );
+/*  Print how long the device took to open, then the round trip statistics
+ *  and the current timeout for each DFU request that was used.
+ */
+
 void dfu_msg_response_output( const char *function, const int32_t result );
 /*  Used to output the response from our USB request in a human reable
  *  form.
@@ -129,12 +178,12 @@ void dfu_msg_response_output( const char *function, const int32_t result );
  *  result   - the result to interpret
  */
 
-void dfu_set_transaction_num( uint16_t newnum );
+void dfu_set_transaction_num( dfu_device_t *device, uint16_t newnum );
 /* set / reset the wValue parameter to a given value. this number is
  * significant for stm32 device commands (see dfu-device.h)
  */
 
-uint16_t dfu_get_transaction_num( void );
+uint16_t dfu_get_transaction_num( dfu_device_t *device );
 /* get the current transaction number (can be used to calculate address
  * offset for stm32 devices --- see dfu-device.h)
  */
@@ -0,0 +1,224 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dfuse.h"
+#include "util.h"
+
+#define DFUSE_DEBUG_THRESHOLD   40
+#define DFUSE_TRACE_THRESHOLD   45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               DFUSE_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               DFUSE_TRACE_THRESHOLD, __VA_ARGS__ )
+
+// ________  P R O T O T Y P E S  _______________________________
+static int32_t dfuse_parse_groups( dfuse_region_t *region, const char **next );
+/* parse the count * size sectors of one block and set the region end,
+ * *next is left on the character after the last group
+ * returns 0 on success, negative if the groups are malformed
+ */
+
+// ________  F U N C T I O N S  _______________________________
+static int32_t dfuse_parse_groups( dfuse_region_t *region, const char **next ) {
+    const char *p = *next;
+    char *end;
+    unsigned long count;
+    unsigned long size;
+    uint64_t bytes = 0;
+    dfuse_group_t *group;
+
+    for( ;; ) {
+        if( region->group_count >= DFUSE_MAX_GROUPS ) {
+            return -2;
+        }
+        count = strtoul( p, &end, 10 );
+        if( (end == p) || ('*' != *end) ) {
+            return -1;
+        }
+        p = end + 1;
+        size = strtoul( p, &end, 10 );
+        if( end == p ) {
+            return -1;
+        }
+        p = end;
+        switch( *p++ ) {
+            case ' ':
+            case 'B':
+                break;
+            case 'K':
+                size *= 1024;
+                break;
+            case 'M':
+                size *= 1024 * 1024;
+                break;
+            default:
+                return -1;
+        }
+        if( (*p < 'a') || (*p > 'g') || (0 == count) || (0 == size) ) {
+            return -1;
+        }
+
+        group = &region->group[region->group_count++];
+        group->count = (uint32_t) count;
+        group->size = (uint32_t) size;
+        group->flags = (uint8_t) (*p++ - 'a' + 1);
+        bytes += (uint64_t) group->count * group->size;
+
+        if( ',' != *p ) break;
+        p++;
+    }
+
+    if( (uint64_t) region->start + bytes - 1 > UINT32_MAX ) {
+        return -1;
+    }
+    region->end = (uint32_t) (region->start + bytes - 1);
+    *next = p;
+
+    return 0;
+}
+
+int32_t dfuse_parse( dfuse_layout_t *layout, const char *descriptor ) {
+    dfuse_layout_t parsed = *layout;
+    dfuse_region_t *region;
+    const char *next;
+    char *end;
+    size_t length;
+    unsigned long address;
+    int32_t result;
+
+    TRACE( "%s( %p, %s )\n", __FUNCTION__, layout, descriptor );
+
+    if( '@' != descriptor[0] ) {
+        return 1;
+    }
+    if( NULL == (next = strchr(descriptor, '/')) ) {
+        return -1;
+    }
+
+    // the name is padded with spaces up to the first block
+    for( length = next - descriptor - 1;
+            (length > 0) && (' ' == descriptor[length]); length-- ) ;
+    if( length >= DFUSE_NAME_LENGTH ) {
+        length = DFUSE_NAME_LENGTH - 1;
+    }
+
+    while( '/' == *next ) {
+        if( parsed.region_count >= DFUSE_MAX_REGIONS ) {
+            return -2;
+        }
+        region = &parsed.region[parsed.region_count];
+        memset( region, 0, sizeof(dfuse_region_t) );
+        memcpy( region->name, &descriptor[1], length );
+
+        address = strtoul( next + 1, &end, 0 );
+        if( (end == next + 1) || ('/' != *end) ) {
+            return -1;
+        }
+        region->start = (uint32_t) address;
+        next = end + 1;
+        if( 0 != (result = dfuse_parse_groups(region, &next)) ) {
+            return result;
+        }
+        parsed.region_count++;
+    }
+    while( ' ' == *next ) {
+        next++;
+    }
+    if( '\0' != *next ) {
+        return -1;
+    }
+
+    *layout = parsed;
+
+    return 0;
+}
+
+const dfuse_region_t *dfuse_region( const dfuse_layout_t *layout,
+                                    const uint32_t address ) {
+    uint32_t i;
+
+    for( i = 0; i < layout->region_count; i++ ) {
+        if( (address >= layout->region[i].start) &&
+                (address <= layout->region[i].end) ) {
+            return &layout->region[i];
+        }
+    }
+
+    return NULL;
+}
+
+int32_t dfuse_sector( const dfuse_region_t *region, const uint32_t address,
+                      dfuse_sector_t *sector ) {
+    const dfuse_group_t *group;
+    uint32_t start;
+    uint32_t index = 0;
+    uint32_t n;
+    uint32_t i;
+
+    if( (address < region->start) || (address > region->end) ) {
+        return -1;
+    }
+
+    start = region->start;
+    for( i = 0; i < region->group_count; i++ ) {
+        group = &region->group[i];
+        if( address - start < (uint64_t) group->count * group->size ) {
+            n = (address - start) / group->size;
+            sector->index = index + n;
+            sector->start = start + n * group->size;
+            sector->end = sector->start + group->size - 1;
+            sector->flags = group->flags;
+            return 0;
+        }
+        start += group->count * group->size;
+        index += group->count;
+    }
+
+    return -1;
+}
+
+int32_t dfuse_sector_index( const dfuse_region_t *region,
+                            const uint32_t index, dfuse_sector_t *sector ) {
+    const dfuse_group_t *group;
+    uint32_t start = region->start;
+    uint32_t first = 0;
+    uint32_t i;
+
+    for( i = 0; i < region->group_count; i++ ) {
+        group = &region->group[i];
+        if( index - first < group->count ) {
+            sector->index = index;
+            sector->start = start + (index - first) * group->size;
+            sector->end = sector->start + group->size - 1;
+            sector->flags = group->flags;
+            return 0;
+        }
+        start += group->count * group->size;
+        first += group->count;
+    }
+
+    return -1;
+}
@@ -0,0 +1,97 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __DFUSE_H__
+#define __DFUSE_H__
+
+#include <stdint.h>
+
+/*  A DfuSe bootloader (STM32) describes its memory in the string of each
+ *  alternate setting of the DFU interface, for example
+ *
+ *    @Internal Flash  /0x08000000/04*016Kg,01*064Kg,07*128Kg
+ *
+ *  that is a name, then for each block of memory its address followed by
+ *  groups of count * size sectors.  The size unit is ' ' or 'B' for bytes,
+ *  'K' or 'M', and the type letter 'a' to 'g' has the bits below.  One
+ *  string may list several blocks, each becomes a region of the layout.
+ */
+#define DFUSE_READABLE      0x01
+#define DFUSE_ERASABLE      0x02
+#define DFUSE_WRITABLE      0x04
+
+#define DFUSE_MAX_REGIONS   8
+#define DFUSE_MAX_GROUPS    8
+#define DFUSE_NAME_LENGTH   32
+
+typedef struct {
+    uint32_t count;         /* sectors in the group */
+    uint32_t size;          /* bytes in each sector */
+    uint8_t flags;          /* DFUSE_READABLE | DFUSE_ERASABLE | ... */
+} dfuse_group_t;
+
+typedef struct {
+    char name[DFUSE_NAME_LENGTH];
+    uint32_t start;         /* address of the first sector */
+    uint32_t end;           /* address of the last byte of the last sector */
+    uint32_t group_count;
+    dfuse_group_t group[DFUSE_MAX_GROUPS];
+} dfuse_region_t;
+
+typedef struct {
+    uint32_t region_count;  /* 0 when the device did not describe itself */
+    dfuse_region_t region[DFUSE_MAX_REGIONS];
+} dfuse_layout_t;
+
+typedef struct {
+    uint32_t index;         /* of the sector in its region */
+    uint32_t start;         /* first and last address of the sector */
+    uint32_t end;
+    uint8_t flags;
+} dfuse_sector_t;
+
+int32_t dfuse_parse( dfuse_layout_t *layout, const char *descriptor );
+/*  Add the regions of one interface string to layout.
+ *
+ *  returns 0 on success, 1 if the string is not a DfuSe layout (does not
+ *  start with '@'), negative if it is malformed or layout is full (layout
+ *  is unchanged then)
+ */
+
+const dfuse_region_t *dfuse_region( const dfuse_layout_t *layout,
+                                    const uint32_t address );
+/*  returns the region holding address, or NULL
+ */
+
+int32_t dfuse_sector( const dfuse_region_t *region, const uint32_t address,
+                      dfuse_sector_t *sector );
+/*  Find the sector of region that holds address.
+ *
+ *  returns 0 on success, -1 if address is not in region
+ */
+
+int32_t dfuse_sector_index( const dfuse_region_t *region,
+                            const uint32_t index, dfuse_sector_t *sector );
+/*  Find sector number index of region, counting from 0 at region->start.
+ *
+ *  returns 0 on success, -1 if the region has fewer sectors
+ */
+
+#endif
@@ -0,0 +1,331 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dfuse_file.h"
+#include "digest.h"
+#include "util.h"
+
+#define DFUSE_FILE_DEBUG_THRESHOLD  40
+#define DFUSE_FILE_TRACE_THRESHOLD  45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               DFUSE_FILE_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               DFUSE_FILE_TRACE_THRESHOLD, __VA_ARGS__ )
+
+#define DFUSE_FILE_VERSION      1
+#define DFUSE_FILE_BCD_DFU      0x011A
+#define DFUSE_FILE_NAME_LENGTH  255
+
+typedef struct {
+    FILE *fp;
+    uint32_t crc;           /* of everything read so far */
+    uint32_t size;          /* bytes read so far */
+} dfuse_reader_t;
+
+// ________  P R O T O T Y P E S  _______________________________
+static void dfuse_file_put16( uint8_t *out, const uint16_t value );
+static void dfuse_file_put32( uint8_t *out, const uint32_t value );
+static uint32_t dfuse_file_get32( const uint8_t *in );
+/* store and load little endian values
+ */
+
+static int32_t dfuse_file_read( dfuse_reader_t *reader, uint8_t *data,
+                                const size_t length );
+/* read exactly length bytes and add them to the crc
+ * returns 0 on success, -1 if the file ends first
+ */
+
+static int32_t dfuse_file_element( dfuse_reader_t *reader,
+                                   intel_buffer_out_t *bout,
+                                   const uint32_t target_offset,
+                                   const uint32_t address,
+                                   const uint32_t size );
+/* stream the data of one element into bout
+ * returns the number of bytes outside of bout, or -1 on a short file
+ */
+
+static dfu_bool dfuse_file_blank( intel_buffer_in_t *buin,
+                                  const uint32_t start, const uint32_t end );
+/* returns true if buin->data is 0xff from start to end
+ */
+
+// ________  F U N C T I O N S  _______________________________
+static void dfuse_file_put16( uint8_t *out, const uint16_t value ) {
+    out[0] = (uint8_t) value;
+    out[1] = (uint8_t) (value >> 8);
+}
+
+static void dfuse_file_put32( uint8_t *out, const uint32_t value ) {
+    out[0] = (uint8_t) value;
+    out[1] = (uint8_t) (value >> 8);
+    out[2] = (uint8_t) (value >> 16);
+    out[3] = (uint8_t) (value >> 24);
+}
+
+static uint32_t dfuse_file_get32( const uint8_t *in ) {
+    return ((uint32_t) in[0]) | (((uint32_t) in[1]) << 8) |
+           (((uint32_t) in[2]) << 16) | (((uint32_t) in[3]) << 24);
+}
+
+static int32_t dfuse_file_read( dfuse_reader_t *reader, uint8_t *data,
+                                const size_t length ) {
+    if( length != fread(data, 1, length, reader->fp) ) {
+        DEBUG( "The file ends at 0x%X.\n", reader->size );
+        return -1;
+    }
+    reader->crc = digest_crc32( reader->crc, data, length );
+    reader->size += length;
+
+    return 0;
+}
+
+static int32_t dfuse_file_element( dfuse_reader_t *reader,
+                                   intel_buffer_out_t *bout,
+                                   const uint32_t target_offset,
+                                   const uint32_t address,
+                                   const uint32_t size ) {
+    uint8_t chunk[4096];
+    uint32_t done = 0;
+    int32_t outside = 0;
+    size_t n;
+    size_t i;
+
+    while( done < size ) {
+        n = (size - done < sizeof(chunk)) ? size - done : sizeof(chunk);
+        if( 0 != dfuse_file_read(reader, chunk, n) ) {
+            return -1;
+        }
+        for( i = 0; i < n; i++ ) {
+            if( 0 != intel_process_data(bout, (char) chunk[i], target_offset,
+                        address + done + i) ) {
+                outside++;
+            }
+        }
+        done += n;
+    }
+
+    return outside;
+}
+
+int32_t dfuse_file_to_buffer( FILE *fp, intel_buffer_out_t *bout,
+                              uint32_t target_offset, dfu_bool quiet ) {
+    dfuse_reader_t reader = { fp, 0, 0 };
+    uint8_t prefix[DFUSE_FILE_PREFIX_SIZE];
+    uint8_t target[DFUSE_FILE_TARGET_SIZE];
+    uint8_t element[DFUSE_FILE_ELEMENT_SIZE];
+    uint8_t suffix[DFUSE_FILE_SUFFIX_SIZE];
+    uint32_t image_size;
+    uint32_t target_size;
+    uint32_t elements;
+    uint32_t address;
+    uint32_t size;
+    uint32_t used;
+    uint32_t t;
+    uint32_t e;
+    int32_t outside = 0;
+    int32_t result;
+
+    TRACE( "%s( %p, %p, 0x%X, %s )\n", __FUNCTION__, fp, bout, target_offset,
+           ((true == quiet) ? "true" : "false") );
+
+    if( (0 != dfuse_file_read(&reader, prefix, sizeof(prefix))) ||
+            (0 != memcmp(prefix, DFUSE_FILE_SIGNATURE, 5)) ||
+            (DFUSE_FILE_VERSION != prefix[5]) ) {
+        if( !quiet ) fprintf( stderr, "Not a DfuSe file.\n" );
+        return -1;
+    }
+    image_size = dfuse_file_get32( &prefix[6] );
+
+    for( t = 0; t < prefix[10]; t++ ) {
+        if( (0 != dfuse_file_read(&reader, target, sizeof(target))) ||
+                (0 != memcmp(target, "Target", 6)) ) {
+            if( !quiet ) fprintf( stderr, "DfuSe target %u is damaged.\n", t );
+            return -2;
+        }
+        target_size = dfuse_file_get32( &target[266] );
+        elements = dfuse_file_get32( &target[270] );
+        DEBUG( "Target %u, alternate setting %u, %u elements.\n", t,
+               target[6], elements );
+
+        for( e = 0, used = 0; e < elements; e++ ) {
+            if( 0 != dfuse_file_read(&reader, element, sizeof(element)) ) {
+                result = -1;
+            } else {
+                address = dfuse_file_get32( &element[0] );
+                size = dfuse_file_get32( &element[4] );
+                used += DFUSE_FILE_ELEMENT_SIZE;
+                DEBUG( "Element %u: 0x%X bytes at 0x%X.\n", e, size, address );
+                if( (used > target_size) || (size > target_size - used) ) {
+                    result = -1;
+                } else {
+                    used += size;
+                    result = dfuse_file_element( &reader, bout, target_offset,
+                                                 address, size );
+                }
+            }
+            if( result < 0 ) {
+                if( !quiet ) fprintf( stderr, "DfuSe element %u of target %u "
+                                      "is damaged.\n", e, t );
+                return -3;
+            }
+            outside += result;
+        }
+        if( used != target_size ) {
+            if( !quiet ) fprintf( stderr, "DfuSe target %u is damaged.\n", t );
+            return -2;
+        }
+    }
+
+    if( (reader.size != image_size) ||
+            (0 != dfuse_file_read(&reader, suffix, DFUSE_FILE_SUFFIX_SIZE - 4)) ||
+            (4 != fread(&suffix[12], 1, 4, fp)) ||
+            (0 != memcmp(&suffix[6], "\x1a\x01UFD", 5)) ||
+            (DFUSE_FILE_SUFFIX_SIZE != suffix[11]) ) {
+        if( !quiet ) fprintf( stderr, "The DfuSe file has no valid suffix.\n" );
+        return -4;
+    }
+    if( ~reader.crc != dfuse_file_get32(&suffix[12]) ) {
+        if( !quiet ) fprintf( stderr, "The DfuSe file crc does not match.\n" );
+        return -5;
+    }
+
+    if( outside && !quiet ) {
+        fprintf( stderr, "Total of 0x%X bytes in invalid addressed.\n", outside );
+    }
+
+    return outside;
+}
+
+static dfu_bool dfuse_file_blank( intel_buffer_in_t *buin,
+                                  const uint32_t start, const uint32_t end ) {
+    uint32_t i;
+
+    for( i = start; i <= end; i++ ) {
+        if( 0xff != buin->data[i] ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int32_t dfuse_file_from_buffer( FILE *fp, intel_buffer_in_t *buin,
+                                const dfu_bool force,
+                                const uint32_t target_offset,
+                                const uint16_t vendor_id,
+                                const uint16_t product_id,
+                                const char *name ) {
+    int32_t retval = -1;
+    uint8_t *file;
+    uint8_t *target;
+    uint8_t *out;
+    uint32_t page;
+    uint32_t start;
+    uint32_t end;
+    uint32_t run = UINT32_MAX;  /* start of the element being collected */
+    uint32_t elements = 0;
+    size_t pages;
+    size_t size;
+
+    TRACE( "%s( %p, %p, %s, 0x%X )\n", __FUNCTION__, fp, buin,
+           ((true == force) ? "true" : "false"), target_offset );
+
+    // at most one element per page
+    pages = (buin->info.data_end - buin->info.data_start) /
+                buin->info.page_size + 2;
+    size = DFUSE_FILE_PREFIX_SIZE + DFUSE_FILE_TARGET_SIZE +
+           pages * DFUSE_FILE_ELEMENT_SIZE +
+           (buin->info.data_end - buin->info.data_start + 1) +
+           DFUSE_FILE_SUFFIX_SIZE;
+    if( NULL == (file = (uint8_t *) calloc(1, size)) ) {
+        DEBUG( "ERROR: out of memory for 0x%X bytes.\n", (uint32_t) size );
+        return -1;
+    }
+
+    target = &file[DFUSE_FILE_PREFIX_SIZE];
+    out = &target[DFUSE_FILE_TARGET_SIZE];
+    for( start = buin->info.data_start; start <= buin->info.data_end;
+            start = end + 1 ) {
+        page = start / buin->info.page_size;
+        end = (page + 1) * buin->info.page_size - 1;
+        if( end > buin->info.data_end ) {
+            end = buin->info.data_end;
+        }
+
+        if( force || !dfuse_file_blank(buin, start, end) ) {
+            if( UINT32_MAX == run ) {
+                run = start;
+            }
+            if( end < buin->info.data_end ) continue;
+        } else if( UINT32_MAX == run ) {
+            continue;
+        } else {
+            end = start - 1;
+        }
+
+        // the pages from run to end become one element
+        dfuse_file_put32( &out[0], target_offset + run );
+        dfuse_file_put32( &out[4], end - run + 1 );
+        memcpy( &out[8], &buin->data[run], end - run + 1 );
+        out += DFUSE_FILE_ELEMENT_SIZE + end - run + 1;
+        elements++;
+        run = UINT32_MAX;
+    }
+
+    memcpy( file, DFUSE_FILE_SIGNATURE, 5 );
+    file[5] = DFUSE_FILE_VERSION;
+    dfuse_file_put32( &file[6], (uint32_t) (out - file) );
+    file[10] = 1;
+
+    memcpy( target, "Target", 6 );
+    target[6] = 0;
+    if( NULL != name ) {
+        dfuse_file_put32( &target[7], 1 );
+        strncpy( (char *) &target[11], name, DFUSE_FILE_NAME_LENGTH - 1 );
+    }
+    dfuse_file_put32( &target[266], (uint32_t) (out - target) -
+                                    DFUSE_FILE_TARGET_SIZE );
+    dfuse_file_put32( &target[270], elements );
+
+    dfuse_file_put16( &out[0], 0xffff );
+    dfuse_file_put16( &out[2], product_id );
+    dfuse_file_put16( &out[4], vendor_id );
+    dfuse_file_put16( &out[6], DFUSE_FILE_BCD_DFU );
+    memcpy( &out[8], "UFD", 3 );
+    out[11] = DFUSE_FILE_SUFFIX_SIZE;
+    out += 12;
+    dfuse_file_put32( out, ~digest_crc32(0, file, out - file) );
+    out += 4;
+
+    size = out - file;
+    if( size == fwrite(file, 1, size, fp) ) {
+        retval = 0;
+    }
+    DEBUG( "Wrote %u elements in 0x%X bytes.\n", elements, (uint32_t) size );
+    free( file );
+
+    return retval;
+}
@@ -0,0 +1,72 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __DFUSE_FILE_H__
+#define __DFUSE_FILE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "dfu-bool.h"
+#include "intel_hex.h"
+
+/*  The DfuSe file format (ST UM0391), all values little endian:
+ *
+ *    prefix   "DfuSe", uint8 version 1, uint32 size of the file without
+ *             the suffix, uint8 number of targets
+ *    target   "Target", uint8 alternate setting, uint32 named, char[255]
+ *             name, uint32 size of the elements, uint32 element count
+ *    element  uint32 address, uint32 size, then the data
+ *    suffix   uint16 bcdDevice, idProduct, idVendor, bcdDFU 0x011A,
+ *             "UFD", uint8 length 16, uint32 crc
+ *
+ *  The crc is the crc32 of everything before it, without the final
+ *  inversion.
+ */
+#define DFUSE_FILE_SIGNATURE        "DfuSe"
+#define DFUSE_FILE_PREFIX_SIZE      11
+#define DFUSE_FILE_TARGET_SIZE      274
+#define DFUSE_FILE_ELEMENT_SIZE     8
+#define DFUSE_FILE_SUFFIX_SIZE      16
+
+int32_t dfuse_file_to_buffer( FILE *fp, intel_buffer_out_t *bout,
+                              uint32_t target_offset, dfu_bool quiet );
+/*  Load the elements of every target of a DfuSe file into bout, like
+ *  intel_hex_to_buffer does for a hex file.  The file is read as a stream
+ *  and its suffix crc is checked at the end.
+ *
+ *  returns the number of bytes outside of bout, or negative if the file is
+ *  not a valid DfuSe file
+ */
+
+int32_t dfuse_file_from_buffer( FILE *fp, intel_buffer_in_t *buin,
+                                const dfu_bool force,
+                                const uint32_t target_offset,
+                                const uint16_t vendor_id,
+                                const uint16_t product_id,
+                                const char *name );
+/*  Write buin->data from data_start to data_end as a DfuSe file with one
+ *  target (alternate setting 0, called name unless that is NULL) holding
+ *  an element for each run of pages with data, or a single element with
+ *  force.  buin->data[0] is at target_offset on the device.
+ *
+ *  returns 0 on success, negative on error
+ */
+
+#endif
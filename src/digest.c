@@ -0,0 +1,644 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include "digest.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define DIGEST_HAVE_X86
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define DIGEST_HAVE_ARM_CRC32
+#endif
+
+#define ROTL(x, n)  (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define CRC32_POLY      0xEDB88320      /* IEEE 802.3, reflected */
+#define CRC32C_POLY     0x82F63B78      /* Castagnoli, reflected */
+
+typedef uint32_t (*crc_fn)( uint32_t crc, const uint8_t *data,
+                            size_t length );
+typedef void (*sha_blocks_fn)( uint32_t *state, const uint8_t *data,
+                               size_t blocks );
+
+static uint32_t crc32_table[8][256];
+static uint32_t crc32c_table[8][256];
+static pthread_once_t digest_ready = PTHREAD_ONCE_INIT;
+
+static crc_fn crc32_update;
+static crc_fn crc32c_update;
+static sha_blocks_fn sha256_blocks;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const char *digest_names[] = {
+    "none", "crc32", "crc32c", "sha1", "sha256"
+};
+
+static const size_t digest_sizes[] = { 0, 4, 4, 20, 32 };
+
+// ________  P R O T O T Y P E S  _______________________________
+static void digest_setup( void );
+/* build the crc tables and pick the fastest implementation this cpu
+ * supports, runs once before the first digest is computed
+ */
+
+static void crc_make_table( uint32_t table[8][256], const uint32_t poly );
+/* fill the slicing-by-8 table for a reflected polynomial
+ */
+
+static uint32_t crc_slice8( uint32_t table[8][256], uint32_t crc,
+                            const uint8_t *data, size_t length );
+/* update a crc (without the pre and post inversion) 8 bytes at a time
+ */
+
+static uint32_t crc32_soft( uint32_t crc, const uint8_t *data,
+                            size_t length );
+static uint32_t crc32c_soft( uint32_t crc, const uint8_t *data,
+                             size_t length );
+/* portable crc updates, also without the inversion
+ */
+
+static void sha1_blocks( uint32_t *state, const uint8_t *data, size_t blocks );
+static void sha256_blocks_soft( uint32_t *state, const uint8_t *data,
+                                size_t blocks );
+/* run the compression function over a number of 64 byte blocks
+ */
+
+static void sha_update( digest_sha_t *sha, sha_blocks_fn compress,
+                        const uint8_t *data, size_t length );
+static void sha_final( digest_sha_t *sha, sha_blocks_fn compress,
+                       uint8_t *out, const size_t words );
+/* the block buffering and padding shared by SHA-1 and SHA-256, final
+ * writes the first words of the state to out, big endian
+ */
+
+#ifdef DIGEST_HAVE_X86
+static uint32_t crc32_pclmul( uint32_t crc, const uint8_t *data,
+                              size_t length );
+/* fold 64 bytes per step with carry-less multiplies, only used when the cpu
+ * reports pclmulqdq and sse4.1 support
+ */
+
+static uint32_t crc32c_sse42( uint32_t crc, const uint8_t *data,
+                              size_t length );
+/* the sse4.2 crc32 instruction computes CRC-32C directly
+ */
+
+static void sha256_blocks_shani( uint32_t *state, const uint8_t *data,
+                                 size_t blocks );
+/* four rounds per instruction pair using the sha extensions
+ */
+#endif
+
+#ifdef DIGEST_HAVE_ARM_CRC32
+static uint32_t crc32_arm( uint32_t crc, const uint8_t *data,
+                           size_t length );
+static uint32_t crc32c_arm( uint32_t crc, const uint8_t *data,
+                            size_t length );
+/* the armv8 crc32 instructions cover both polynomials
+ */
+#endif
+
+// ________  F U N C T I O N S  _______________________________
+static void digest_setup( void ) {
+    crc_make_table( crc32_table, CRC32_POLY );
+    crc_make_table( crc32c_table, CRC32C_POLY );
+
+    crc32_update = crc32_soft;
+    crc32c_update = crc32c_soft;
+    sha256_blocks = sha256_blocks_soft;
+
+#if defined(DIGEST_HAVE_ARM_CRC32)
+    crc32_update = crc32_arm;
+    crc32c_update = crc32c_arm;
+#elif defined(DIGEST_HAVE_X86)
+    {
+        unsigned int eax, ebx, ecx, edx;
+
+        if( __get_cpuid(1, &eax, &ebx, &ecx, &edx) ) {
+            if( (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1) ) {
+                crc32_update = crc32_pclmul;
+            }
+            if( ecx & bit_SSE4_2 ) {
+                crc32c_update = crc32c_sse42;
+            }
+            if( (ecx & bit_SSE4_1) && (ecx & bit_SSSE3) &&
+                    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+                    (ebx & bit_SHA) ) {
+                sha256_blocks = sha256_blocks_shani;
+            }
+        }
+    }
+#endif
+}
+
+static void crc_make_table( uint32_t table[8][256], const uint32_t poly ) {
+    uint32_t i;
+    uint32_t j;
+    uint32_t c;
+
+    for( i = 0; i < 256; i++ ) {
+        c = i;
+        for( j = 0; j < 8; j++ ) {
+            c = (c & 1) ? (poly ^ (c >> 1)) : (c >> 1);
+        }
+        table[0][i] = c;
+    }
+    for( i = 0; i < 256; i++ ) {
+        for( j = 1; j < 8; j++ ) {
+            c = table[j - 1][i];
+            table[j][i] = table[0][c & 0xff] ^ (c >> 8);
+        }
+    }
+}
+
+static uint32_t crc_slice8( uint32_t table[8][256], uint32_t crc,
+                            const uint8_t *data, size_t length ) {
+    uint32_t lo;
+    uint32_t hi;
+
+    for( ; length >= 8; data += 8, length -= 8 ) {
+        lo = crc ^ ((uint32_t) data[0] | ((uint32_t) data[1] << 8) |
+                    ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24));
+        hi = (uint32_t) data[4] | ((uint32_t) data[5] << 8) |
+             ((uint32_t) data[6] << 16) | ((uint32_t) data[7] << 24);
+        crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+              table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+              table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+    }
+    for( ; length > 0; data++, length-- ) {
+        crc = table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+static uint32_t crc32_soft( uint32_t crc, const uint8_t *data,
+                            size_t length ) {
+    return crc_slice8( crc32_table, crc, data, length );
+}
+
+static uint32_t crc32c_soft( uint32_t crc, const uint8_t *data,
+                             size_t length ) {
+    return crc_slice8( crc32c_table, crc, data, length );
+}
+
+#ifdef DIGEST_HAVE_X86
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul( uint32_t crc, const uint8_t *data,
+                              size_t length ) {
+    /* x^(4*128+32) mod P, x^(4*128-32) mod P, the same for one 128 bit
+     * lane, x^64 mod P and the Barrett constants, all bit reflected */
+    const __m128i k1k2 = _mm_set_epi64x( 0x01c6e41596, 0x0154442bd4 );
+    const __m128i k3k4 = _mm_set_epi64x( 0x00ccaa009e, 0x01751997d0 );
+    const __m128i k5k0 = _mm_set_epi64x( 0, 0x0163cd6124 );
+    const __m128i poly = _mm_set_epi64x( 0x01f7011641, 0x01db710641 );
+    const __m128i mask32 = _mm_setr_epi32( ~0, 0, ~0, 0 );
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    if( length < 64 ) {
+        return crc32_soft( crc, data, length );
+    }
+
+    x1 = _mm_loadu_si128( (const __m128i *) (data + 0x00) );
+    x2 = _mm_loadu_si128( (const __m128i *) (data + 0x10) );
+    x3 = _mm_loadu_si128( (const __m128i *) (data + 0x20) );
+    x4 = _mm_loadu_si128( (const __m128i *) (data + 0x30) );
+    x1 = _mm_xor_si128( x1, _mm_cvtsi32_si128((int) crc) );
+    data += 64;
+    length -= 64;
+
+    // four lanes of 128 bits, each folded 512 bits forward per step
+    for( ; length >= 64; data += 64, length -= 64 ) {
+        x5 = _mm_clmulepi64_si128( x1, k1k2, 0x00 );
+        x6 = _mm_clmulepi64_si128( x2, k1k2, 0x00 );
+        x7 = _mm_clmulepi64_si128( x3, k1k2, 0x00 );
+        x8 = _mm_clmulepi64_si128( x4, k1k2, 0x00 );
+        x1 = _mm_clmulepi64_si128( x1, k1k2, 0x11 );
+        x2 = _mm_clmulepi64_si128( x2, k1k2, 0x11 );
+        x3 = _mm_clmulepi64_si128( x3, k1k2, 0x11 );
+        x4 = _mm_clmulepi64_si128( x4, k1k2, 0x11 );
+        x1 = _mm_xor_si128( _mm_xor_si128(x1, x5),
+                _mm_loadu_si128((const __m128i *) (data + 0x00)) );
+        x2 = _mm_xor_si128( _mm_xor_si128(x2, x6),
+                _mm_loadu_si128((const __m128i *) (data + 0x10)) );
+        x3 = _mm_xor_si128( _mm_xor_si128(x3, x7),
+                _mm_loadu_si128((const __m128i *) (data + 0x20)) );
+        x4 = _mm_xor_si128( _mm_xor_si128(x4, x8),
+                _mm_loadu_si128((const __m128i *) (data + 0x30)) );
+    }
+
+    // fold the four lanes into one, then the remaining whole lanes
+    x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+    x1 = _mm_clmulepi64_si128( x1, k3k4, 0x11 );
+    x1 = _mm_xor_si128( _mm_xor_si128(x1, x2), x5 );
+    x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+    x1 = _mm_clmulepi64_si128( x1, k3k4, 0x11 );
+    x1 = _mm_xor_si128( _mm_xor_si128(x1, x3), x5 );
+    x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+    x1 = _mm_clmulepi64_si128( x1, k3k4, 0x11 );
+    x1 = _mm_xor_si128( _mm_xor_si128(x1, x4), x5 );
+    for( ; length >= 16; data += 16, length -= 16 ) {
+        x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+        x1 = _mm_clmulepi64_si128( x1, k3k4, 0x11 );
+        x1 = _mm_xor_si128( _mm_xor_si128(x1, x5),
+                _mm_loadu_si128((const __m128i *) data) );
+    }
+
+    // 128 bits down to 64, then a Barrett reduction to 32
+    x2 = _mm_clmulepi64_si128( x1, k3k4, 0x10 );
+    x1 = _mm_xor_si128( _mm_srli_si128(x1, 8), x2 );
+    x2 = _mm_srli_si128( x1, 4 );
+    x1 = _mm_and_si128( x1, mask32 );
+    x1 = _mm_xor_si128( _mm_clmulepi64_si128(x1, k5k0, 0x00), x2 );
+
+    x0 = _mm_and_si128( x1, mask32 );
+    x0 = _mm_clmulepi64_si128( x0, poly, 0x10 );
+    x0 = _mm_and_si128( x0, mask32 );
+    x0 = _mm_clmulepi64_si128( x0, poly, 0x00 );
+    x1 = _mm_xor_si128( x1, x0 );
+    crc = (uint32_t) _mm_extract_epi32( x1, 1 );
+
+    return crc32_soft( crc, data, length );
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42( uint32_t crc, const uint8_t *data,
+                              size_t length ) {
+#ifdef __x86_64__
+    uint64_t wide = crc;
+    uint64_t value;
+
+    for( ; length >= 8; data += 8, length -= 8 ) {
+        memcpy( &value, data, 8 );
+        wide = _mm_crc32_u64( wide, value );
+    }
+    crc = (uint32_t) wide;
+#endif
+    for( ; length > 0; data++, length-- ) {
+        crc = _mm_crc32_u8( crc, *data );
+    }
+
+    return crc;
+}
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani( uint32_t *state, const uint8_t *data,
+                                 size_t blocks ) {
+    const __m128i swap = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL,
+                                         0x0405060700010203ULL );
+    __m128i abef, cdgh, abef_save, cdgh_save;
+    __m128i w[4];
+    __m128i msg, tmp;
+    int i;
+
+    // the instructions want the state as ABEF and CDGH
+    tmp  = _mm_shuffle_epi32( _mm_loadu_si128((const __m128i *) &state[0]),
+                              0xB1 );
+    cdgh = _mm_shuffle_epi32( _mm_loadu_si128((const __m128i *) &state[4]),
+                              0x1B );
+    abef = _mm_alignr_epi8( tmp, cdgh, 8 );
+    cdgh = _mm_blend_epi16( cdgh, tmp, 0xF0 );
+
+    for( ; blocks > 0; blocks--, data += 64 ) {
+        abef_save = abef;
+        cdgh_save = cdgh;
+
+        for( i = 0; i < 16; i++ ) {
+            if( i < 4 ) {
+                w[i] = _mm_shuffle_epi8(
+                        _mm_loadu_si128((const __m128i *) (data + 16 * i)),
+                        swap );
+            } else {
+                tmp = _mm_add_epi32(
+                        _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]),
+                        _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4) );
+                w[i & 3] = _mm_sha256msg2_epu32( tmp, w[(i + 3) & 3] );
+            }
+            msg = _mm_add_epi32( w[i & 3],
+                    _mm_loadu_si128((const __m128i *) &sha256_k[4 * i]) );
+            cdgh = _mm_sha256rnds2_epu32( cdgh, abef, msg );
+            abef = _mm_sha256rnds2_epu32( abef, cdgh,
+                                          _mm_shuffle_epi32(msg, 0x0E) );
+        }
+
+        abef = _mm_add_epi32( abef, abef_save );
+        cdgh = _mm_add_epi32( cdgh, cdgh_save );
+    }
+
+    tmp  = _mm_shuffle_epi32( abef, 0x1B );
+    cdgh = _mm_shuffle_epi32( cdgh, 0xB1 );
+    _mm_storeu_si128( (__m128i *) &state[0],
+                      _mm_blend_epi16(tmp, cdgh, 0xF0) );
+    _mm_storeu_si128( (__m128i *) &state[4],
+                      _mm_alignr_epi8(cdgh, tmp, 8) );
+}
+#endif
+
+#ifdef DIGEST_HAVE_ARM_CRC32
+static uint32_t crc32_arm( uint32_t crc, const uint8_t *data,
+                           size_t length ) {
+    uint64_t value;
+
+    for( ; length >= 8; data += 8, length -= 8 ) {
+        memcpy( &value, data, 8 );
+        crc = __crc32d( crc, value );
+    }
+    for( ; length > 0; data++, length-- ) {
+        crc = __crc32b( crc, *data );
+    }
+
+    return crc;
+}
+
+static uint32_t crc32c_arm( uint32_t crc, const uint8_t *data,
+                            size_t length ) {
+    uint64_t value;
+
+    for( ; length >= 8; data += 8, length -= 8 ) {
+        memcpy( &value, data, 8 );
+        crc = __crc32cd( crc, value );
+    }
+    for( ; length > 0; data++, length-- ) {
+        crc = __crc32cb( crc, *data );
+    }
+
+    return crc;
+}
+#endif
+
+uint32_t digest_crc32( uint32_t crc, const uint8_t *data, size_t length ) {
+    pthread_once( &digest_ready, digest_setup );
+
+    return ~crc32_update( ~crc, data, length );
+}
+
+uint32_t digest_crc32c( uint32_t crc, const uint8_t *data, size_t length ) {
+    pthread_once( &digest_ready, digest_setup );
+
+    return ~crc32c_update( ~crc, data, length );
+}
+
+static void sha1_blocks( uint32_t *state, const uint8_t *data, size_t blocks ) {
+    uint32_t w[80];
+    uint32_t a, b, c, d, e;
+    uint32_t f, k, t;
+    int i;
+
+    for( ; blocks > 0; blocks--, data += 64 ) {
+        for( i = 0; i < 16; i++ ) {
+            w[i] = ((uint32_t) data[4 * i] << 24) |
+                   ((uint32_t) data[4 * i + 1] << 16) |
+                   ((uint32_t) data[4 * i + 2] << 8) |
+                   ((uint32_t) data[4 * i + 3]);
+        }
+        for( i = 16; i < 80; i++ ) {
+            w[i] = ROTL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        a = state[0]; b = state[1]; c = state[2]; d = state[3]; e = state[4];
+
+        for( i = 0; i < 80; i++ ) {
+            if( i < 20 ) {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            } else if( i < 40 ) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            } else if( i < 60 ) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            t = ROTL(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = ROTL(b, 30); b = a; a = t;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c;
+        state[3] += d; state[4] += e;
+    }
+}
+
+static void sha256_blocks_soft( uint32_t *state, const uint8_t *data,
+                                size_t blocks ) {
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    uint32_t t1, t2;
+    int i;
+
+    for( ; blocks > 0; blocks--, data += 64 ) {
+        for( i = 0; i < 16; i++ ) {
+            w[i] = ((uint32_t) data[4 * i] << 24) |
+                   ((uint32_t) data[4 * i + 1] << 16) |
+                   ((uint32_t) data[4 * i + 2] << 8) |
+                   ((uint32_t) data[4 * i + 3]);
+        }
+        for( i = 16; i < 64; i++ ) {
+            t1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            t2 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+        }
+
+        a = state[0]; b = state[1]; c = state[2]; d = state[3];
+        e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+        for( i = 0; i < 64; i++ ) {
+            t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) +
+                 ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+            t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +
+                 ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+static void sha_update( digest_sha_t *sha, sha_blocks_fn compress,
+                        const uint8_t *data, size_t length ) {
+    size_t used = (size_t) (sha->length % 64);
+    size_t n;
+
+    sha->length += length;
+
+    if( 0 != used ) {
+        n = 64 - used;
+        if( n > length ) {
+            n = length;
+        }
+        memcpy( &sha->block[used], data, n );
+        data += n;
+        length -= n;
+        if( 64 != used + n ) {
+            return;
+        }
+        compress( sha->state, sha->block, 1 );
+    }
+
+    if( length >= 64 ) {
+        compress( sha->state, data, length / 64 );
+        data += length & ~((size_t) 63);
+        length &= 63;
+    }
+
+    memcpy( sha->block, data, length );
+}
+
+static void sha_final( digest_sha_t *sha, sha_blocks_fn compress,
+                       uint8_t *out, const size_t words ) {
+    const uint64_t bits = sha->length * 8;
+    size_t used = (size_t) (sha->length % 64);
+    size_t i;
+
+    sha->block[used++] = 0x80;
+    if( used > 56 ) {
+        memset( &sha->block[used], 0, 64 - used );
+        compress( sha->state, sha->block, 1 );
+        used = 0;
+    }
+    memset( &sha->block[used], 0, 56 - used );
+    for( i = 0; i < 8; i++ ) {
+        sha->block[56 + i] = 0xff & (bits >> (56 - 8 * i));
+    }
+    compress( sha->state, sha->block, 1 );
+
+    for( i = 0; i < words; i++ ) {
+        out[4 * i]     = 0xff & (sha->state[i] >> 24);
+        out[4 * i + 1] = 0xff & (sha->state[i] >> 16);
+        out[4 * i + 2] = 0xff & (sha->state[i] >> 8);
+        out[4 * i + 3] = 0xff & sha->state[i];
+    }
+}
+
+int32_t digest_parse_algorithm( const char *name ) {
+    int32_t i;
+
+    for( i = DIGEST_CRC32; i <= DIGEST_SHA256; i++ ) {
+        if( 0 == strcasecmp(name, digest_names[i]) ) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+const char *digest_name( const enum digest_algorithm algorithm ) {
+    return digest_names[algorithm];
+}
+
+void digest_init( digest_t *digest, const enum digest_algorithm algorithm ) {
+    static const uint32_t sha1_initial[5] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+    };
+    static const uint32_t sha256_initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    pthread_once( &digest_ready, digest_setup );
+
+    digest->algorithm = algorithm;
+    digest->crc = 0;
+    digest->sha.length = 0;
+    if( DIGEST_SHA1 == algorithm ) {
+        memcpy( digest->sha.state, sha1_initial, sizeof(sha1_initial) );
+    } else if( DIGEST_SHA256 == algorithm ) {
+        memcpy( digest->sha.state, sha256_initial, sizeof(sha256_initial) );
+    }
+}
+
+void digest_update( digest_t *digest, const uint8_t *data, size_t length ) {
+    switch( digest->algorithm ) {
+        case DIGEST_CRC32:
+            digest->crc = digest_crc32( digest->crc, data, length );
+            break;
+        case DIGEST_CRC32C:
+            digest->crc = digest_crc32c( digest->crc, data, length );
+            break;
+        case DIGEST_SHA1:
+            sha_update( &digest->sha, sha1_blocks, data, length );
+            break;
+        case DIGEST_SHA256:
+            sha_update( &digest->sha, sha256_blocks, data, length );
+            break;
+        default:
+            break;
+    }
+}
+
+size_t digest_final( digest_t *digest, uint8_t *out ) {
+    switch( digest->algorithm ) {
+        case DIGEST_CRC32:
+        case DIGEST_CRC32C:
+            out[0] = 0xff & (digest->crc >> 24);
+            out[1] = 0xff & (digest->crc >> 16);
+            out[2] = 0xff & (digest->crc >> 8);
+            out[3] = 0xff & digest->crc;
+            break;
+        case DIGEST_SHA1:
+            sha_final( &digest->sha, sha1_blocks, out, 5 );
+            break;
+        case DIGEST_SHA256:
+            sha_final( &digest->sha, sha256_blocks, out, 8 );
+            break;
+        default:
+            break;
+    }
+
+    return digest_sizes[digest->algorithm];
+}
+
+void digest_print( FILE *stream, const uint8_t *digest, const size_t length ) {
+    size_t i;
+
+    for( i = 0; i < length; i++ ) {
+        fprintf( stream, "%02x", digest[i] );
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __DIGEST_H__
+#define __DIGEST_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t digest_crc32( uint32_t crc, const uint8_t *data, size_t length );
+/*  Update a CRC-32 (IEEE 802.3, reflected 0xEDB88320) with length bytes.
+ *
+ *  crc     - the running value, start with 0
+ *  data    - the bytes to add
+ *  length  - the number of bytes in data
+ *
+ *  returns the updated crc (pre and post inversion are handled internally so
+ *  the result can be fed straight back in for the next chunk)
+ */
+
+uint32_t digest_crc32c( uint32_t crc, const uint8_t *data, size_t length );
+/*  The same for CRC-32C (Castagnoli, reflected 0x82F63B78).
+ *
+ *  Both use the crc instructions of the cpu when it has them (sse4.2 and
+ *  pclmulqdq on x86, the crc32 extension on armv8) and slicing-by-8 tables
+ *  otherwise, so results do not depend on the machine.
+ */
+
+enum digest_algorithm { DIGEST_NONE, DIGEST_CRC32, DIGEST_CRC32C,
+                        DIGEST_SHA1, DIGEST_SHA256 };
+
+#define DIGEST_MAX_SIZE     32      /* bytes in the largest digest */
+
+typedef struct {
+    uint32_t state[8];      /* five words are used by SHA-1 */
+    uint64_t length;        /* bytes hashed so far */
+    uint8_t block[64];      /* partial block waiting for more data */
+} digest_sha_t;
+
+typedef struct {
+    enum digest_algorithm algorithm;
+    uint32_t crc;
+    digest_sha_t sha;
+} digest_t;
+
+int32_t digest_parse_algorithm( const char *name );
+/*  Look up an algorithm by name ("crc32", "crc32c", "sha1" or "sha256",
+ *  in any case).
+ *
+ *  returns the digest_algorithm, or -1 if the name is unknown
+ */
+
+const char *digest_name( const enum digest_algorithm algorithm );
+/*  returns the name of algorithm as accepted by digest_parse_algorithm
+ */
+
+void digest_init( digest_t *digest, const enum digest_algorithm algorithm );
+void digest_update( digest_t *digest, const uint8_t *data, size_t length );
+size_t digest_final( digest_t *digest, uint8_t *out );
+/*  Run any algorithm through the same calls.  final writes the digest to
+ *  out (at least DIGEST_MAX_SIZE bytes, a crc is stored big endian so it
+ *  prints the way it is usually written) and returns its length in bytes.
+ *  SHA-256 uses the sha extensions when the cpu has them.
+ */
+
+void digest_print( FILE *stream, const uint8_t *digest, const size_t length );
+/*  Print a digest as lower case hex without a line ending.
+ */
+
+#endif
@@ -37,8 +37,20 @@
 #include <string.h>
 
 #include "intel_hex.h"
+#include "decompress.h"
+#include "dfuse_file.h"
 #include "util.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IHEX_HAVE_SSE2
+#endif
+
+#if defined(IHEX_HAVE_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define IHEX_HAVE_AVX2
+#endif
+
 struct intel_record {
     uint8_t count;      // single byte count
     uint8_t type;       // single byte type
@@ -49,6 +61,7 @@ struct intel_record {
 
 #define IHEX_COLS 16
 #define IHEX_64KB_PAGE 0x10000
+#define IHEX_REPORT_RANGES 8    // mismatching ranges listed by validation
 
 
 #define IHEX_DEBUG_THRESHOLD    50
@@ -95,6 +108,57 @@ static void ihex_clear_record( struct intel_record *record, uint32_t address );
 /* wipes out a record (resets it to zero)
  */
 
+typedef uint32_t (*intel_mismatch_fn)( const uint16_t *image,
+                                       const uint8_t *memory );
+/* compares a fixed number of entries of an image with memory and returns a
+ * bit mask with a bit set for each address that does not validate.  entries
+ * above 0xFF are unassigned and must read back as 0xFF
+ */
+
+static uint32_t intel_mismatch_scalar( const uint16_t *image,
+                                       const uint8_t *memory );
+/* one entry at a time, used where no vector unit is available and for the
+ * tail of the range
+ */
+
+#ifdef IHEX_HAVE_SSE2
+static uint32_t intel_mismatch_sse2( const uint16_t *image,
+                                     const uint8_t *memory );
+/* 16 entries per call
+ */
+#endif
+
+#ifdef IHEX_HAVE_AVX2
+static uint32_t intel_mismatch_avx2( const uint16_t *image,
+                                     const uint8_t *memory );
+/* 32 entries per call, only used when the cpu reports avx2 support
+ */
+#endif
+
+typedef uint32_t (*intel_diff_fn)( const uint16_t *first,
+                                   const uint16_t *second );
+/* the same for two images, with entries above 0xFF in either taken as 0xFF
+ */
+
+static uint32_t intel_diff_scalar( const uint16_t *first,
+                                   const uint16_t *second );
+#ifdef IHEX_HAVE_SSE2
+static uint32_t intel_diff_sse2( const uint16_t *first,
+                                 const uint16_t *second );
+#endif
+#ifdef IHEX_HAVE_AVX2
+static uint32_t intel_diff_avx2( const uint16_t *first,
+                                 const uint16_t *second );
+#endif
+/* 1, 16 and 32 entries per call
+ */
+
+static void intel_range_add( intel_ranges_t *ranges, const uint32_t address,
+                             const dfu_bool in_region );
+/* add a mismatching address to the list, extending the last range when it is
+ * adjacent
+ */
+
 
 // ________  F U N C T I O N S  _______________________________
 static int intel_validate_checksum( struct intel_record *record ) {
@@ -270,6 +334,7 @@ int32_t intel_process_data( intel_buffer_out_t *bout, char value,
 
 int32_t intel_hex_to_buffer( char *filename, intel_buffer_out_t *bout,
                              uint32_t target_offset, dfu_bool quiet ) {
+    decompress_t file = { NULL, 0, NULL };
     FILE *fp = NULL;
     struct intel_record record;
     // unsigned int count, type, checksum, address; char data[256]
@@ -292,16 +357,21 @@ int32_t intel_hex_to_buffer( char *filename, intel_buffer_out_t *bout,
         goto error;
     }
 
-    if( 0 == strcmp("STDIN", filename) ) {
-        fp = stdin;
-    } else {
-        fp = fopen( filename, "r" );
-        if( NULL == fp ) {
-            if( !quiet ) fprintf( stderr, "Error opening %s\n", filename );
-            retval = -3;
-            goto error;
-        }
+    // compressed files are decoded as they are read
+    if( 0 != decompress_open(&file, filename) ) {
+        if( !quiet ) fprintf( stderr, "Error opening %s\n", filename );
+        retval = -3;
+        goto error;
+    }
+    fp = file.fp;
+
+    // a DfuSe file starts with its signature where a hex record has ':'
+    if( 'D' == (i = getc(fp)) ) {
+        ungetc( i, fp );
+        retval = dfuse_file_to_buffer( fp, bout, target_offset, quiet );
+        goto error;
     }
+    ungetc( i, fp );
 
     // iterate through ihex file and assign values to memory and user
     do {
@@ -370,9 +440,14 @@ int32_t intel_hex_to_buffer( char *filename, intel_buffer_out_t *bout,
     retval = invalid_address_count;
 
 error:
-    if( NULL != fp ) {
-        fclose( fp );
-        fp = NULL;
+    if( 0 != decompress_close(&file) ) {
+        // a parse error may only be the decoder giving up
+        if( !quiet ) fprintf( stderr, "Error decoding %s with %s.\n",
+                              filename,
+                              (NULL != file.tool) ? file.tool : "input" );
+        if( retval >= 0 ) {
+            retval = -6;
+        }
     }
 
     if( retval & !quiet ) {
@@ -614,56 +689,355 @@ int32_t intel_init_buffer_in( intel_buffer_in_t *buin,
     return 0;
 }
 
+static uint32_t intel_mismatch_scalar( const uint16_t *image,
+                                       const uint8_t *memory ) {
+    const uint8_t expected = (*image <= UINT8_MAX) ? (uint8_t) *image : 0xff;
+
+    return (expected != *memory) ? 1 : 0;
+}
+
+#ifdef IHEX_HAVE_SSE2
+static uint32_t intel_mismatch_sse2( const uint16_t *image,
+                                     const uint8_t *memory ) {
+    const __m128i high = _mm_set1_epi16( (short) 0xff00 );
+    const __m128i low = _mm_set1_epi16( 0x00ff );
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = _mm_loadu_si128( (const __m128i *) image );
+    __m128i b = _mm_loadu_si128( (const __m128i *) &image[8] );
+    __m128i assigned;
+    __m128i expected;
+
+    // low byte of assigned entries, 0xFF for unassigned ones
+    assigned = _mm_cmpeq_epi16( _mm_and_si128(a, high), zero );
+    a = _mm_or_si128( _mm_and_si128(a, low), _mm_andnot_si128(assigned, low) );
+    assigned = _mm_cmpeq_epi16( _mm_and_si128(b, high), zero );
+    b = _mm_or_si128( _mm_and_si128(b, low), _mm_andnot_si128(assigned, low) );
+
+    expected = _mm_packus_epi16( a, b );
+    expected = _mm_cmpeq_epi8( expected,
+                               _mm_loadu_si128((const __m128i *) memory) );
+
+    return 0xffff & ~((uint32_t) _mm_movemask_epi8( expected ));
+}
+#endif
+
+#ifdef IHEX_HAVE_AVX2
+__attribute__((target("avx2")))
+static uint32_t intel_mismatch_avx2( const uint16_t *image,
+                                     const uint8_t *memory ) {
+    const __m256i high = _mm256_set1_epi16( (short) 0xff00 );
+    const __m256i low = _mm256_set1_epi16( 0x00ff );
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i a = _mm256_loadu_si256( (const __m256i *) image );
+    __m256i b = _mm256_loadu_si256( (const __m256i *) &image[16] );
+    __m256i assigned;
+    __m256i expected;
+
+    assigned = _mm256_cmpeq_epi16( _mm256_and_si256(a, high), zero );
+    a = _mm256_or_si256( _mm256_and_si256(a, low),
+                         _mm256_andnot_si256(assigned, low) );
+    assigned = _mm256_cmpeq_epi16( _mm256_and_si256(b, high), zero );
+    b = _mm256_or_si256( _mm256_and_si256(b, low),
+                         _mm256_andnot_si256(assigned, low) );
+
+    // the pack works per 128 bit lane, put the quadwords back in order
+    expected = _mm256_permute4x64_epi64( _mm256_packus_epi16(a, b), 0xd8 );
+    expected = _mm256_cmpeq_epi8( expected,
+                                  _mm256_loadu_si256((const __m256i *) memory) );
+
+    return ~((uint32_t) _mm256_movemask_epi8( expected ));
+}
+#endif
+
+static uint32_t intel_diff_scalar( const uint16_t *first,
+                                   const uint16_t *second ) {
+    const uint8_t a = (*first <= UINT8_MAX) ? (uint8_t) *first : 0xff;
+    const uint8_t b = (*second <= UINT8_MAX) ? (uint8_t) *second : 0xff;
+
+    return (a != b) ? 1 : 0;
+}
+
+#ifdef IHEX_HAVE_SSE2
+static uint32_t intel_diff_sse2( const uint16_t *first,
+                                 const uint16_t *second ) {
+    const __m128i high = _mm_set1_epi16( (short) 0xff00 );
+    const __m128i low = _mm_set1_epi16( 0x00ff );
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v[4];
+    __m128i assigned;
+    int i;
+
+    v[0] = _mm_loadu_si128( (const __m128i *) first );
+    v[1] = _mm_loadu_si128( (const __m128i *) &first[8] );
+    v[2] = _mm_loadu_si128( (const __m128i *) second );
+    v[3] = _mm_loadu_si128( (const __m128i *) &second[8] );
+    for( i = 0; i < 4; i++ ) {
+        assigned = _mm_cmpeq_epi16( _mm_and_si128(v[i], high), zero );
+        v[i] = _mm_or_si128( _mm_and_si128(v[i], low),
+                             _mm_andnot_si128(assigned, low) );
+    }
+
+    return 0xffff & ~((uint32_t) _mm_movemask_epi8( _mm_cmpeq_epi8(
+                _mm_packus_epi16(v[0], v[1]), _mm_packus_epi16(v[2], v[3])) ));
+}
+#endif
+
+#ifdef IHEX_HAVE_AVX2
+__attribute__((target("avx2")))
+static uint32_t intel_diff_avx2( const uint16_t *first,
+                                 const uint16_t *second ) {
+    const __m256i high = _mm256_set1_epi16( (short) 0xff00 );
+    const __m256i low = _mm256_set1_epi16( 0x00ff );
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i v[4];
+    __m256i assigned;
+    int i;
+
+    v[0] = _mm256_loadu_si256( (const __m256i *) first );
+    v[1] = _mm256_loadu_si256( (const __m256i *) &first[16] );
+    v[2] = _mm256_loadu_si256( (const __m256i *) second );
+    v[3] = _mm256_loadu_si256( (const __m256i *) &second[16] );
+    for( i = 0; i < 4; i++ ) {
+        assigned = _mm256_cmpeq_epi16( _mm256_and_si256(v[i], high), zero );
+        v[i] = _mm256_or_si256( _mm256_and_si256(v[i], low),
+                                _mm256_andnot_si256(assigned, low) );
+    }
+
+    // both packs are out of order the same way, which the compare ignores
+    // but the mask does not, so put the quadwords back in order first
+    return ~((uint32_t) _mm256_movemask_epi8( _mm256_cmpeq_epi8(
+                _mm256_permute4x64_epi64(_mm256_packus_epi16(v[0], v[1]), 0xd8),
+                _mm256_permute4x64_epi64(_mm256_packus_epi16(v[2], v[3]), 0xd8)) ));
+}
+#endif
+
+static void intel_range_add( intel_ranges_t *ranges, const uint32_t address,
+                             const dfu_bool in_region ) {
+    intel_range_t *range = NULL;
+
+    if( NULL == ranges ) {
+        return;
+    }
+
+    if( 0 != ranges->count ) {
+        range = &ranges->ranges[ranges->count - 1];
+        if( range->end + 1 != address ) {
+            range = NULL;
+        }
+    }
+
+    if( NULL == range ) {
+        if( ranges->count == ranges->capacity ) {
+            size_t capacity = (0 == ranges->capacity) ? 16 : 2 * ranges->capacity;
+            intel_range_t *grown = realloc( ranges->ranges,
+                                            capacity * sizeof(intel_range_t) );
+            if( NULL != grown ) {
+                ranges->ranges = grown;
+                ranges->capacity = capacity;
+            }
+        }
+
+        if( ranges->count < ranges->capacity ) {
+            range = &ranges->ranges[ranges->count++];
+            range->start = address;
+            range->in_region = 0;
+            range->outside_region = 0;
+        } else if( 0 != ranges->count ) {
+            DEBUG( "Out of memory, widening the last range.\n" );
+            range = &ranges->ranges[ranges->count - 1];
+        } else {
+            return;
+        }
+    }
+
+    range->end = address;
+    if( in_region ) {
+        range->in_region++;
+    } else {
+        range->outside_region++;
+    }
+}
+
+int32_t intel_diff_buffers( intel_buffer_out_t *first,
+                            intel_buffer_out_t *second,
+                            intel_ranges_t *ranges ) {
+    intel_diff_fn diff = intel_diff_scalar;
+    uint32_t width = 1;
+    uint32_t i;
+    uint32_t mask;
+    uint32_t bit;
+    int32_t count = 0;
+
+    TRACE( "%s( %p, %p, %p )\n", __FUNCTION__, first, second, ranges );
+
+    if( (first->info.valid_start > first->info.valid_end) ||
+        (first->info.valid_end >= second->info.total_size) ) {
+        return 0;
+    }
+
+#ifdef IHEX_HAVE_SSE2
+    diff = intel_diff_sse2;
+    width = 16;
+#endif
+#ifdef IHEX_HAVE_AVX2
+    if( __builtin_cpu_supports("avx2") ) {
+        diff = intel_diff_avx2;
+        width = 32;
+    }
+#endif
+
+    for( i = first->info.valid_start; i <= first->info.valid_end; i += width ) {
+        if( first->info.valid_end - i + 1 < width ) {
+            diff = intel_diff_scalar;
+            width = 1;
+        }
+
+        if( 0 == (mask = diff(&first->data[i], &second->data[i])) ) {
+            continue;
+        }
+
+        for( bit = 0; bit < width; bit++ ) {
+            if( mask & (((uint32_t) 1) << bit) ) {
+                count++;
+                intel_range_add( ranges, i + bit,
+                                 (second->data[i + bit] <= UINT8_MAX) );
+            }
+        }
+    }
+
+    return count;
+}
+
+void intel_free_ranges( intel_ranges_t *ranges ) {
+    if( NULL == ranges ) {
+        return;
+    }
+
+    free( ranges->ranges );
+    ranges->ranges = NULL;
+    ranges->count = 0;
+    ranges->capacity = 0;
+}
+
+int32_t intel_compare_buffer( intel_buffer_in_t *buin,
+                              intel_buffer_out_t *bout,
+                              intel_ranges_t *ranges ) {
+    intel_mismatch_fn mismatch = intel_mismatch_scalar;
+    uint32_t width = 1;
+    uint32_t i;
+    uint32_t mask;
+    uint32_t bit;
+    int32_t invalid_data_region = 0;
+    int32_t invalid_outside_data_region = 0;
+
+    TRACE( "%s( %p, %p, %p )\n", __FUNCTION__, buin, bout, ranges );
+
+    if( bout->info.valid_start > bout->info.valid_end ) {
+        return 0;
+    }
+
+#ifdef IHEX_HAVE_SSE2
+    mismatch = intel_mismatch_sse2;
+    width = 16;
+#endif
+#ifdef IHEX_HAVE_AVX2
+    if( __builtin_cpu_supports("avx2") ) {
+        mismatch = intel_mismatch_avx2;
+        width = 32;
+    }
+#endif
+
+    DEBUG( "Comparing 0x%X bytes, %u per step.\n",
+            bout->info.valid_end - bout->info.valid_start + 1, width );
+
+    for( i = bout->info.valid_start; i <= bout->info.valid_end; i += width ) {
+        // finish off the tail one byte at a time
+        if( bout->info.valid_end - i + 1 < width ) {
+            mismatch = intel_mismatch_scalar;
+            width = 1;
+        }
+
+        if( 0 == (mask = mismatch(&bout->data[i], &buin->data[i])) ) {
+            continue;
+        }
+
+        for( bit = 0; bit < width; bit++ ) {
+            if( mask & (((uint32_t) 1) << bit) ) {
+                if( bout->data[i + bit] <= UINT8_MAX ) {
+                    invalid_data_region++;
+                } else {
+                    invalid_outside_data_region++;
+                }
+                intel_range_add( ranges, i + bit,
+                                 (bout->data[i + bit] <= UINT8_MAX) );
+            }
+        }
+    }
+
+    return invalid_data_region ?
+        -1 * invalid_data_region : invalid_outside_data_region;
+}
+
 int32_t intel_validate_buffer( intel_buffer_in_t *buin,
                                intel_buffer_out_t *bout,
                                dfu_bool quiet) {
-    int32_t i;
+    intel_ranges_t ranges;
     int32_t invalid_data_region = 0;
     int32_t invalid_outside_data_region = 0;
+    int32_t result;
+    size_t i;
 
     DEBUG( "Validating image from byte 0x%X to 0x%X.\n",
             bout->info.valid_start, bout->info.valid_end );
 
+    memset( &ranges, 0, sizeof(ranges) );
+
     if( !quiet ) fprintf( stderr, "Validating...  " );
-    for( i = bout->info.valid_start; i <= bout->info.valid_end; i++ ) {
-        if(  bout->data[i] <= UINT8_MAX ) {
-            // Memory should have been programmed here
-            if( ((uint8_t) bout->data[i]) != buin->data[i] ) {
-                if ( !invalid_data_region ) {
-                    if( !quiet ) fprintf( stderr, "ERROR\n" );
-                    DEBUG( "Image did not validate at byte: 0x%X of 0x%X.\n", i,
-                            bout->info.valid_end - bout->info.valid_start + 1 );
-                    DEBUG( "Wanted 0x%02x but read 0x%02x.\n",
-                            0xff & bout->data[i], buin->data[i] );
-                    DEBUG( "suppressing additional warnings.\n");
-                }
-                invalid_data_region++;
-            }
+    result = intel_compare_buffer( buin, bout, &ranges );
+
+    for( i = 0; i < ranges.count; i++ ) {
+        invalid_data_region += ranges.ranges[i].in_region;
+        invalid_outside_data_region += ranges.ranges[i].outside_region;
+        DEBUG( "Mismatch from 0x%X to 0x%X: %u program, %u blank bytes.\n",
+                ranges.ranges[i].start, ranges.ranges[i].end,
+                ranges.ranges[i].in_region, ranges.ranges[i].outside_region );
+    }
+
+    if( 0 != ranges.count ) {
+        i = ranges.ranges[0].start;
+        if( bout->data[i] <= UINT8_MAX ) {
+            DEBUG( "Image did not validate at byte: 0x%X of 0x%X.\n", i,
+                    bout->info.valid_end - bout->info.valid_start + 1 );
+            DEBUG( "Wanted 0x%02x but read 0x%02x.\n",
+                    0xff & bout->data[i], buin->data[i] );
         } else {
-            // Memory should be blank here
-            if( 0xff != buin->data[i] ) {
-                if ( !invalid_data_region ) {
-                    DEBUG( "Outside program region: byte 0x%X epected 0xFF.\n", i);
-                    DEBUG( "but read 0x%02X.  supressing additional warnings.\n",
-                            buin->data[i] );
-                }
-                invalid_outside_data_region++;
-            }
+            DEBUG( "Outside program region: byte 0x%X epected 0xFF.\n", i);
+            DEBUG( "but read 0x%02X.\n", buin->data[i] );
         }
     }
 
     if( !quiet ) {
-        if ( 0 == invalid_data_region + invalid_outside_data_region ) {
+        if ( 0 == result ) {
             fprintf( stderr, "Success\n" );
         } else {
+            if( 0 != invalid_data_region ) fprintf( stderr, "ERROR\n" );
             fprintf( stderr,
                     "%d invalid bytes in program region, %d outside region.\n",
                     invalid_data_region, invalid_outside_data_region );
+            for( i = 0; i < ranges.count && i < IHEX_REPORT_RANGES; i++ ) {
+                fprintf( stderr, "  0x%X to 0x%X does not match.\n",
+                         ranges.ranges[i].start, ranges.ranges[i].end );
+            }
+            if( ranges.count > IHEX_REPORT_RANGES ) {
+                fprintf( stderr, "  ... and %u more ranges.\n",
+                         (unsigned int) (ranges.count - IHEX_REPORT_RANGES) );
+            }
         }
     }
 
-    return invalid_data_region ?
-        -1 * invalid_data_region : invalid_outside_data_region;
+    intel_free_ranges( &ranges );
+
+    return result;
 }
 
 int32_t intel_flash_prep_buffer( intel_buffer_out_t *bout ) {
@@ -693,3 +1067,18 @@ int32_t intel_flash_prep_buffer( intel_buffer_out_t *bout ) {
     }
     return 0;
 }
+
+void intel_flash_data_limits( intel_buffer_out_t *bout ) {
+    uint32_t i;
+
+    TRACE( "%s( %p )\n", __FUNCTION__, bout );
+
+    bout->info.data_start = UINT32_MAX;
+    for( i = 0; i < bout->info.total_size; i++ ) {
+        if( bout->data[i] <= UINT8_MAX ) {
+            bout->info.data_end = i;
+            if( bout->info.data_start == UINT32_MAX )
+                bout->info.data_start = i;
+        }
+    }
+}
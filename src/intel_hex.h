@@ -45,6 +45,19 @@ typedef struct {
     uint8_t *data;
 } intel_buffer_in_t;
 
+typedef struct {
+    uint32_t start;             // first address that did not validate
+    uint32_t end;               // last address that did not validate
+    uint32_t in_region;         // bytes in the range that are program data
+    uint32_t outside_region;    // bytes in the range that should be blank
+} intel_range_t;
+
+typedef struct {
+    intel_range_t *ranges;      // mismatching ranges in address order
+    size_t count;               // the number of ranges
+    size_t capacity;            // the number of ranges allocated
+} intel_ranges_t;
+
 
 int32_t intel_process_data( intel_buffer_out_t *bout,
         char value, uint32_t target_offset, uint32_t address);
@@ -120,6 +133,35 @@ int32_t intel_validate_buffer(  intel_buffer_in_t *buin,
  * not validate, negative number if bytes inside region that do not validate
  */
 
+int32_t intel_compare_buffer( intel_buffer_in_t *buin,
+                              intel_buffer_out_t *bout,
+                              intel_ranges_t *ranges );
+/* compare buffer_in with buffer_out over the valid range like
+ * intel_validate_buffer, but without any output.  the comparison is
+ * vectorized where the cpu allows it.  when ranges is not NULL it is filled
+ * with the contiguous address ranges that did not validate (it must start
+ * zeroed, release it with intel_free_ranges), so those ranges can be
+ * reported or programmed again.  if memory runs out the last range is
+ * widened instead, so the list always covers every mismatch.
+ * returns the same values as intel_validate_buffer
+ */
+
+int32_t intel_diff_buffers( intel_buffer_out_t *first,
+                            intel_buffer_out_t *second,
+                            intel_ranges_t *ranges );
+/* compare two images of the same memory over the valid range of first, with
+ * unassigned entries taken as 0xFF the way they end up in flash.  when
+ * ranges is not NULL it is filled with the differing address ranges as in
+ * intel_compare_buffer, where in_region counts bytes assigned in second and
+ * outside_region bytes only first has data for.  vectorized like
+ * intel_compare_buffer.
+ * returns the number of bytes that differ
+ */
+
+void intel_free_ranges( intel_ranges_t *ranges );
+/* release the memory held by a range list and empty it
+ */
+
 int32_t intel_flash_prep_buffer( intel_buffer_out_t *bout );
 /* prepare the buffer so that valid data fills each page that contains data.
  * unassigned data in buffer is given a value of 0xff (blank memory)
@@ -127,4 +169,9 @@ int32_t intel_flash_prep_buffer( intel_buffer_out_t *bout );
  * return 0 on success, -1 if assigning data would extend flash above size
  */
 
+void intel_flash_data_limits( intel_buffer_out_t *bout );
+/* set bout->info.data_start / data_end to the first / last assigned
+ * address, data_start is UINT32_MAX if there is no data
+ */
+
 #endif
@@ -63,9 +63,13 @@ int main( int argc, char **argv )
         libusb_set_option(usbcontext, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_DEBUG);
     }
 
-    if( !(args.command == com_bin2hex || args.command == com_hex2bin) ) {
+    /* build the image while the device is opened */
+    execute_prepare( &args );
+
+    if( execute_needs_device(&args) ) {
         device = dfu_device_init( args.vendor_id, args.chip_id,
                                   args.bus_id, args.device_address,
+                                  NULL, NULL,
                                   &dfu_device,
                                   args.initial_abort,
                                   args.honor_interfaceclass,
@@ -84,6 +88,10 @@ int main( int argc, char **argv )
     }
 
 error:
+    if( args.stats && NULL != dfu_device.handle ) {
+        dfu_print_stats( stderr, &dfu_device );
+    }
+
     if( NULL != dfu_device.handle ) {
         int rv;
 
@@ -103,9 +111,12 @@ error:
     }
 
     if( NULL != dfu_device.handle ) {
+        dfu_transfer_release( &dfu_device );
         libusb_close(dfu_device.handle);
     }
 
+    execute_cleanup();
+
     libusb_exit(usbcontext);
 
     return retval;
@@ -0,0 +1,704 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <libusb.h>
+
+#include "manifest.h"
+#include "commands.h"
+#include "dfu.h"
+#include "usb.h"
+#include "topology.h"
+#include "util.h"
+
+#define MANIFEST_DEBUG_THRESHOLD    40
+#define MANIFEST_TRACE_THRESHOLD    45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               MANIFEST_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               MANIFEST_TRACE_THRESHOLD, __VA_ARGS__ )
+
+#define MANIFEST_MAX_LINE       1024
+#define MANIFEST_MAX_WORDS      32      /* of a command, with the target */
+#define MANIFEST_SEPARATORS     " \t\r\n"
+
+typedef struct {
+    char *words;            /* the target and the line, argv points here */
+    uint32_t line;
+    struct programmer_arguments args;
+} manifest_step_t;
+
+typedef struct {
+    char *target;           /* as written on the board line */
+    char *port;             /* "bus-port.port...", or NULL */
+    char *serial;           /* usb serial number, or NULL */
+    uint32_t line;
+    manifest_step_t *steps;
+    size_t step_count;
+    int32_t retval;
+    size_t failed;          /* the step that returned retval */
+} manifest_job_t;
+
+/* the boards waiting for one worker, the others steal from the tail */
+typedef struct {
+    pthread_mutex_t lock;
+    size_t *jobs;
+    size_t head;
+    size_t tail;
+} manifest_queue_t;
+
+typedef struct {
+    const char *filename;
+    manifest_job_t *jobs;
+    size_t job_count;
+    intel_buffer_out_t *images;
+    atmel_frames_t *frames;     /* encoded from each image */
+    struct programmer_arguments **readers;  /* the command of each image */
+    size_t image_count;
+    manifest_queue_t *queues;
+    uint32_t workers;
+    dfu_bool quiet;         /* no line for each board that is done */
+} manifest_t;
+
+typedef struct {
+    manifest_t *manifest;
+    uint32_t index;
+    pthread_t thread;
+    dfu_bool running;       /* thread has to be joined */
+} manifest_worker_t;
+
+// ________  P R O T O T Y P E S  _______________________________
+static int32_t manifest_read( manifest_t *manifest,
+                              struct programmer_arguments *args );
+/* parse the file into jobs, each step with the global options of args
+ * returns 0 on success, ARGUMENT_ERROR after printing what is wrong
+ */
+
+static int32_t manifest_add_step( manifest_t *manifest,
+                                  manifest_job_t *job, const char *text,
+                                  const uint32_t line,
+                                  struct programmer_arguments *args );
+/* parse one command of job through parse_arguments
+ */
+
+static dfu_bool manifest_flashes( struct programmer_arguments *args );
+/* true for a command that writes a file that can be shared
+ */
+
+static dfu_bool manifest_same_image( struct programmer_arguments *a,
+                                     struct programmer_arguments *b );
+/* true if both commands read the same file into the same image
+ */
+
+static int32_t manifest_load_images( manifest_t *manifest );
+/* read each file the jobs flash once and point the steps at it
+ */
+
+static dfu_bool manifest_take( manifest_queue_t *queue, const dfu_bool own,
+                               size_t *job );
+/* the next job of a worker from the head of its queue, or one stolen
+ * from the tail of another, false if queue is empty
+ */
+
+static void *manifest_worker( void *arg );
+/* run jobs until no queue has any left
+ */
+
+static void manifest_run_job( manifest_t *manifest, manifest_job_t *job );
+/* open the board of job and run its steps, stopping at the first error
+ */
+
+static void manifest_free( manifest_t *manifest );
+
+// ________  F U N C T I O N S  _______________________________
+static int32_t manifest_read( manifest_t *manifest,
+                              struct programmer_arguments *args ) {
+    char text[MANIFEST_MAX_LINE];
+    char *start;
+    char *word;
+    char *comment;
+    manifest_job_t *job = NULL;
+    manifest_job_t *jobs;
+    uint32_t line = 0;
+    FILE *fp;
+    size_t i;
+
+    if( NULL == (fp = fopen(manifest->filename, "r")) ) {
+        fprintf( stderr, "Unable to open manifest '%s'.\n",
+                 manifest->filename );
+        return ARGUMENT_ERROR;
+    }
+
+    while( NULL != fgets(text, sizeof(text), fp) ) {
+        line++;
+        if( (NULL == strchr(text, '\n')) && !feof(fp) ) {
+            fprintf( stderr, "%s:%u: line is too long.\n",
+                     manifest->filename, line );
+            goto error;
+        }
+        if( NULL != (comment = strchr(text, '#')) ) {
+            *comment = '\0';
+        }
+        start = &text[strspn(text, MANIFEST_SEPARATORS)];
+        if( '\0' == *start ) {
+            continue;
+        }
+
+        if( (0 != strncmp(start, "board", 5)) ||
+                (NULL == strchr(MANIFEST_SEPARATORS, start[5])) ) {
+            if( NULL == job ) {
+                fprintf( stderr, "%s:%u: a board line must come first.\n",
+                         manifest->filename, line );
+                goto error;
+            }
+            if( 0 != manifest_add_step(manifest, job, text, line, args) ) {
+                goto error;
+            }
+            continue;
+        }
+
+        // board target [port=bus-port.port...] [serial=string]
+        jobs = (manifest_job_t *) realloc( manifest->jobs,
+                (manifest->job_count + 1) * sizeof(manifest_job_t) );
+        if( NULL == jobs ) {
+            fprintf( stderr, "Out of memory.\n" );
+            goto error;
+        }
+        manifest->jobs = jobs;
+        job = &jobs[manifest->job_count++];
+        memset( job, 0, sizeof(manifest_job_t) );
+        job->line = line;
+
+        strtok( text, MANIFEST_SEPARATORS );
+        while( NULL != (word = strtok(NULL, MANIFEST_SEPARATORS)) ) {
+            char **value = NULL;
+
+            if( NULL == job->target ) {
+                value = &job->target;
+            } else if( 0 == strncmp("port=", word, 5) ) {
+                value = &job->port;
+                word += 5;
+            } else if( 0 == strncmp("serial=", word, 7) ) {
+                value = &job->serial;
+                word += 7;
+            }
+            if( (NULL == value) || (NULL != *value) || ('\0' == *word) ) {
+                fprintf( stderr, "%s:%u: unexpected '%s' on the board line.\n",
+                         manifest->filename, line, word );
+                goto error;
+            }
+            if( NULL == (*value = strdup(word)) ) {
+                fprintf( stderr, "Out of memory.\n" );
+                goto error;
+            }
+        }
+        if( NULL == job->target ) {
+            fprintf( stderr, "%s:%u: the board has no target.\n",
+                     manifest->filename, line );
+            goto error;
+        }
+    }
+
+    if( ferror(fp) ) {
+        fprintf( stderr, "Error reading manifest '%s'.\n", manifest->filename );
+        goto error;
+    }
+    fclose( fp );
+    fp = NULL;
+
+    if( 0 == manifest->job_count ) {
+        fprintf( stderr, "%s: no boards.\n", manifest->filename );
+        return ARGUMENT_ERROR;
+    }
+    for( i = 0; i < manifest->job_count; i++ ) {
+        job = &manifest->jobs[i];
+        if( 0 == job->step_count ) {
+            fprintf( stderr, "%s:%u: the board has no commands.\n",
+                     manifest->filename, job->line );
+            return ARGUMENT_ERROR;
+        }
+        if( (1 < manifest->job_count) && (NULL == job->port) &&
+                (NULL == job->serial) ) {
+            fprintf( stderr, "%s:%u: give the port or serial number of "
+                             "each board.\n", manifest->filename, job->line );
+            return ARGUMENT_ERROR;
+        }
+    }
+
+    return SUCCESS;
+
+error:
+    if( NULL != fp ) {
+        fclose( fp );
+    }
+    return ARGUMENT_ERROR;
+}
+
+static int32_t manifest_add_step( manifest_t *manifest,
+                                  manifest_job_t *job, const char *text,
+                                  const uint32_t line,
+                                  struct programmer_arguments *args ) {
+    char program[] = "dfu-programmer";
+    char *argv[MANIFEST_MAX_WORDS + 1];
+    size_t argc = 0;
+    manifest_step_t *steps;
+    manifest_step_t *step;
+    enum commands_enum last;
+    char *word;
+
+    if( 0 != job->step_count ) {
+        last = job->steps[job->step_count - 1].args.command;
+        if( (com_launch == last) || (com_start_app == last) ||
+                (com_reset == last) ) {
+            fprintf( stderr, "%s:%u: nothing can follow a launch.\n",
+                     manifest->filename, line );
+            return ARGUMENT_ERROR;
+        }
+    }
+
+    steps = (manifest_step_t *) realloc( job->steps,
+            (job->step_count + 1) * sizeof(manifest_step_t) );
+    if( NULL == steps ) {
+        fprintf( stderr, "Out of memory.\n" );
+        return ARGUMENT_ERROR;
+    }
+    job->steps = steps;
+    step = &steps[job->step_count];
+    memset( step, 0, sizeof(manifest_step_t) );
+    step->line = line;
+
+    // parse_arguments keeps pointers into the words, so they stay
+    step->words = (char *) malloc( strlen(job->target) + strlen(text) + 2 );
+    if( NULL == step->words ) {
+        fprintf( stderr, "Out of memory.\n" );
+        return ARGUMENT_ERROR;
+    }
+    job->step_count++;
+    sprintf( step->words, "%s %s", job->target, text );
+
+    argv[argc++] = program;
+    for( word = strtok(step->words, MANIFEST_SEPARATORS); NULL != word;
+            word = strtok(NULL, MANIFEST_SEPARATORS) ) {
+        if( MANIFEST_MAX_WORDS == argc ) {
+            fprintf( stderr, "%s:%u: too many words.\n",
+                     manifest->filename, line );
+            return ARGUMENT_ERROR;
+        }
+        argv[argc++] = word;
+    }
+    argv[argc] = NULL;
+
+    if( 0 != parse_arguments(&step->args, argc, argv) ) {
+        fprintf( stderr, "%s:%u: invalid command.\n",
+                 manifest->filename, line );
+        return ARGUMENT_ERROR;
+    }
+    if( (com_dfumode == step->args.command) ||
+            (com_manifest == step->args.command) ) {
+        fprintf( stderr, "%s:%u: not available in a manifest.\n",
+                 manifest->filename, line );
+        return ARGUMENT_ERROR;
+    }
+
+    // the options given with the manifest apply to every command
+    step->args.quiet |= args->quiet;
+    step->args.stats |= args->stats;
+    if( NULL == step->args.cache ) {
+        step->args.cache = args->cache;
+    }
+    if( NULL == step->args.profiles ) {
+        step->args.profiles = args->profiles;
+    }
+
+    // counters in the serial data count the boards before this one
+    if( manifest_flashes(&step->args) ) {
+        overlay_count( &step->args.com_flash_data.overlay,
+                       (uint32_t) (manifest->job_count - 1) );
+    }
+
+    return SUCCESS;
+}
+
+static dfu_bool manifest_flashes( struct programmer_arguments *args ) {
+    switch( args->command ) {
+        case com_flash:
+        case com_eflash:
+        case com_user:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static dfu_bool manifest_same_image( struct programmer_arguments *a,
+                                     struct programmer_arguments *b ) {
+    return ((a->command == b->command) && (a->target == b->target) &&
+            (a->com_flash_data.segment == b->com_flash_data.segment) &&
+            (a->com_flash_data.force == b->com_flash_data.force) &&
+            (a->suppressbootloader == b->suppressbootloader) &&
+            (0 == strcmp(a->com_flash_data.file, b->com_flash_data.file)))
+            ? true : false;
+}
+
+static int32_t manifest_load_images( manifest_t *manifest ) {
+    struct programmer_arguments *args;
+    size_t count = 0;
+    size_t i;
+    size_t j;
+    size_t k;
+    int32_t retval;
+
+    for( i = 0; i < manifest->job_count; i++ ) {
+        count += manifest->jobs[i].step_count;
+    }
+    manifest->images = (intel_buffer_out_t *)
+            calloc( count, sizeof(intel_buffer_out_t) );
+    manifest->frames = (atmel_frames_t *)
+            calloc( count, sizeof(atmel_frames_t) );
+    manifest->readers = (struct programmer_arguments **)
+            calloc( count, sizeof(struct programmer_arguments *) );
+    if( (NULL == manifest->images) || (NULL == manifest->frames) ||
+            (NULL == manifest->readers) ) {
+        fprintf( stderr, "Out of memory.\n" );
+        return BUFFER_INIT_ERROR;
+    }
+
+    for( i = 0; i < manifest->job_count; i++ ) {
+        for( j = 0; j < manifest->jobs[i].step_count; j++ ) {
+            args = &manifest->jobs[i].steps[j].args;
+            if( !manifest_flashes(args) ) {
+                continue;
+            }
+
+            for( k = 0; k < manifest->image_count; k++ ) {
+                if( manifest_same_image(args, manifest->readers[k]) ) {
+                    break;
+                }
+            }
+            if( k == manifest->image_count ) {
+                DEBUG( "Reading %s for line %u.\n", args->com_flash_data.file,
+                       manifest->jobs[i].steps[j].line );
+                if( 0 != (retval = execute_load_image(args,
+                                &manifest->images[k],
+                                &manifest->frames[k])) ) {
+                    fprintf( stderr, "%s:%u: unable to use '%s'.\n",
+                             manifest->filename,
+                             manifest->jobs[i].steps[j].line,
+                             args->com_flash_data.file );
+                    return retval;
+                }
+                manifest->readers[k] = args;
+                manifest->image_count++;
+            }
+            args->com_flash_data.image = &manifest->images[k];
+            if( 0 != manifest->frames[k].count ) {
+                args->com_flash_data.frames = &manifest->frames[k];
+            }
+        }
+    }
+
+    return SUCCESS;
+}
+
+static dfu_bool manifest_take( manifest_queue_t *queue, const dfu_bool own,
+                               size_t *job ) {
+    dfu_bool taken = false;
+
+    pthread_mutex_lock( &queue->lock );
+    if( queue->head != queue->tail ) {
+        *job = own ? queue->jobs[queue->head++] : queue->jobs[--queue->tail];
+        taken = true;
+    }
+    pthread_mutex_unlock( &queue->lock );
+
+    return taken;
+}
+
+static void *manifest_worker( void *arg ) {
+    manifest_worker_t *worker = (manifest_worker_t *) arg;
+    manifest_t *manifest = worker->manifest;
+    manifest_queue_t *queue;
+    manifest_queue_t *longest;
+    size_t waiting;
+    size_t most;
+    uint32_t victim;
+    size_t job = 0;
+
+    for( ;; ) {
+        if( !manifest_take(&manifest->queues[worker->index], true, &job) ) {
+            // nothing of our own left, help the queue with the most boards
+            do {
+                longest = NULL;
+                most = 0;
+                for( victim = 1; victim < manifest->workers; victim++ ) {
+                    queue = &manifest->queues[(worker->index + victim)
+                                              % manifest->workers];
+                    pthread_mutex_lock( &queue->lock );
+                    waiting = queue->tail - queue->head;
+                    pthread_mutex_unlock( &queue->lock );
+                    if( waiting > most ) {
+                        most = waiting;
+                        longest = queue;
+                    }
+                }
+                // another worker may empty it first, then look again
+            } while( (NULL != longest) &&
+                     !manifest_take(longest, false, &job) );
+            if( NULL == longest ) {
+                break;
+            }
+            DEBUG( "Worker %u took the board of line %u.\n",
+                   worker->index, manifest->jobs[job].line );
+        }
+
+        manifest_run_job( manifest, &manifest->jobs[job] );
+    }
+
+    return NULL;
+}
+
+static void manifest_run_job( manifest_t *manifest, manifest_job_t *job ) {
+    struct programmer_arguments *first = &job->steps[0].args;
+    struct programmer_arguments *last = &job->steps[job->step_count - 1].args;
+    dfu_device_t device;
+    dfu_bool needs_device = false;
+    size_t i;
+    int rv;
+
+    TRACE( "%s( board of line %u )\n", __FUNCTION__, job->line );
+
+    memset( &device, 0, sizeof(device) );
+    job->retval = SUCCESS;
+
+    for( i = 0; i < job->step_count; i++ ) {
+        if( execute_needs_device(&job->steps[i].args) ) {
+            needs_device = true;
+        }
+    }
+    if( needs_device ) {
+        if( NULL == dfu_device_init(first->vendor_id, first->chip_id,
+                                    first->bus_id, first->device_address,
+                                    job->port, job->serial, &device,
+                                    first->initial_abort,
+                                    first->honor_interfaceclass,
+                                    DFU_PROTOCOL_DFUMODE) ) {
+            fprintf( stderr, "Board of line %u: no device present.\n",
+                     job->line );
+            job->retval = DEVICE_ACCESS_ERROR;
+            job->failed = 0;
+            return;
+        }
+    }
+
+    for( i = 0; i < job->step_count; i++ ) {
+        if( 0 != (job->retval = execute_command(&device,
+                                                &job->steps[i].args)) ) {
+            job->failed = i;
+            break;
+        }
+    }
+
+    if( first->stats && (NULL != device.handle) ) {
+        fprintf( stderr, "Board of line %u:\n", job->line );
+        dfu_print_stats( stderr, &device );
+    }
+
+    if( NULL != device.handle ) {
+        rv = libusb_release_interface( device.handle, device.interface );
+
+        // as in main, a reset makes the board go away before the release
+        if( (0 != rv) && (SUCCESS == job->retval) &&
+                !(com_launch == last->command &&
+                  0 == last->com_launch_config.noreset) ) {
+            fprintf( stderr, "Board of line %u: failed to release interface "
+                             "%d.\n", job->line, device.interface );
+            job->retval = DEVICE_ACCESS_ERROR;
+            job->failed = job->step_count - 1;
+        }
+
+        dfu_transfer_release( &device );
+        libusb_close( device.handle );
+    }
+
+    if( !manifest->quiet || (SUCCESS != job->retval) ) {
+        fprintf( stderr, "Board of line %u (%s): %s.\n", job->line,
+                 (NULL != job->port) ? job->port :
+                 (NULL != job->serial) ? job->serial : job->target,
+                 (SUCCESS == job->retval) ? "done" : "failed" );
+    }
+}
+
+static void manifest_free( manifest_t *manifest ) {
+    manifest_job_t *job;
+    size_t i;
+    size_t j;
+
+    for( i = 0; i < manifest->image_count; i++ ) {
+        free( manifest->images[i].data );
+        atmel_frames_free( &manifest->frames[i] );
+    }
+    free( manifest->images );
+    free( manifest->frames );
+    free( manifest->readers );
+
+    for( i = 0; i < manifest->job_count; i++ ) {
+        job = &manifest->jobs[i];
+        for( j = 0; j < job->step_count; j++ ) {
+            free( job->steps[j].words );
+            if( manifest_flashes(&job->steps[j].args) ) {
+                overlay_free( &job->steps[j].args.com_flash_data.overlay );
+            }
+        }
+        free( job->steps );
+        free( job->target );
+        free( job->port );
+        free( job->serial );
+    }
+    free( manifest->jobs );
+
+    if( NULL != manifest->queues ) {
+        for( i = 0; i < manifest->workers; i++ ) {
+            pthread_mutex_destroy( &manifest->queues[i].lock );
+            free( manifest->queues[i].jobs );
+        }
+        free( manifest->queues );
+    }
+}
+
+int32_t manifest_run( struct programmer_arguments *args ) {
+    manifest_t manifest;
+    manifest_worker_t *workers = NULL;
+    manifest_job_t *job;
+    int32_t retval;
+    size_t i;
+    size_t j;
+
+    TRACE( "%s( %s, %u )\n", __FUNCTION__, args->com_manifest_data.file,
+           args->com_manifest_data.jobs );
+
+    memset( &manifest, 0, sizeof(manifest) );
+    manifest.filename = args->com_manifest_data.file;
+    manifest.quiet = args->quiet ? true : false;
+
+    if( 0 != (retval = manifest_read(&manifest, args)) ) {
+        goto done;
+    }
+    // a bad file stops the run before any board is touched
+    if( 0 != (retval = manifest_load_images(&manifest)) ) {
+        goto done;
+    }
+
+    // count, and limit, the transfers of every board from here on
+    topology_set_limits( args->com_manifest_data.limits );
+
+    manifest.workers = args->com_manifest_data.jobs;
+    if( manifest.workers > manifest.job_count ) {
+        manifest.workers = (uint32_t) manifest.job_count;
+    }
+    if( 1 < manifest.workers ) {
+        // progress bars of several boards would only garble each other
+        for( i = 0; i < manifest.job_count; i++ ) {
+            for( j = 0; j < manifest.jobs[i].step_count; j++ ) {
+                manifest.jobs[i].steps[j].args.quiet = 1;
+            }
+        }
+    }
+
+    manifest.queues = (manifest_queue_t *)
+            calloc( manifest.workers, sizeof(manifest_queue_t) );
+    workers = (manifest_worker_t *)
+            calloc( manifest.workers, sizeof(manifest_worker_t) );
+    if( (NULL == manifest.queues) || (NULL == workers) ) {
+        fprintf( stderr, "Out of memory.\n" );
+        retval = UNSPECIFIED_ERROR;
+        manifest.workers = 0;
+        goto done;
+    }
+    // every lock is ready before anything can fail, manifest_free destroys
+    // all of them
+    for( i = 0; i < manifest.workers; i++ ) {
+        pthread_mutex_init( &manifest.queues[i].lock, NULL );
+    }
+    for( i = 0; i < manifest.workers; i++ ) {
+        manifest.queues[i].jobs = (size_t *)
+                malloc( manifest.job_count * sizeof(size_t) );
+        if( NULL == manifest.queues[i].jobs ) {
+            fprintf( stderr, "Out of memory.\n" );
+            retval = UNSPECIFIED_ERROR;
+            goto done;
+        }
+    }
+    // deal the boards out in turn, stealing evens out the slow ones
+    for( i = 0; i < manifest.job_count; i++ ) {
+        manifest_queue_t *queue = &manifest.queues[i % manifest.workers];
+        queue->jobs[queue->tail++] = i;
+    }
+
+    // this thread is worker 0
+    for( i = 0; i < manifest.workers; i++ ) {
+        workers[i].manifest = &manifest;
+        workers[i].index = (uint32_t) i;
+        if( 0 == i ) {
+            continue;
+        }
+        if( 0 == pthread_create(&workers[i].thread, NULL, manifest_worker,
+                                &workers[i]) ) {
+            workers[i].running = true;
+        } else {
+            DEBUG( "Unable to start worker %u, the others take its boards.\n",
+                   (uint32_t) i );
+        }
+    }
+    manifest_worker( &workers[0] );
+    for( i = 1; i < manifest.workers; i++ ) {
+        if( workers[i].running ) {
+            pthread_join( workers[i].thread, NULL );
+        }
+    }
+
+    retval = SUCCESS;
+    for( i = 0; i < manifest.job_count; i++ ) {
+        job = &manifest.jobs[i];
+        if( SUCCESS != job->retval ) {
+            fprintf( stderr, "%s:%u: failed with error %d.\n",
+                     manifest.filename, job->steps[job->failed].line,
+                     job->retval );
+            if( SUCCESS == retval ) {
+                retval = job->retval;
+            }
+        }
+    }
+
+    if( args->stats ) {
+        topology_print_stats( stderr );
+    }
+
+done:
+    free( workers );
+    manifest_free( &manifest );
+
+    return retval;
+}
@@ -0,0 +1,71 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__
+
+#include <stdint.h>
+#include "arguments.h"
+
+/*  A manifest lists the boards of a programming station.  Each board
+ *  starts with a board line giving its target and where it is plugged
+ *  in, followed by its commands, one per line, written as on the command
+ *  line without the target:
+ *
+ *    # the fixture by the door
+ *    board atmega32u4 port=1-2.3
+ *        erase
+ *        flash --serial=00000100:28656:+1 app.hex
+ *        flash --eeprom calibration.hex
+ *        launch
+ *
+ *    board at32uc3a0512 serial=0123456789
+ *        erase --force
+ *        flash --suppress-bootloader-mem app32.hex
+ *
+ *  port is the usb bus and the hub ports on the way to the board, as the
+ *  names in /sys/bus/usb/devices, serial the usb serial number string.
+ *  A manifest with a single board may leave both out.  Everything after
+ *  a '#' is a comment.  Nothing can follow launch, start or reset.
+ *
+ *  Boards flashing the same file share one image of it, the --serial
+ *  data of each board is an overlay written over its own copy of only
+ *  the pages it touches (see overlay.h).  A --serial counter counts the
+ *  boards above it in the manifest, so the board above programs serial
+ *  0x100 if it is the first and 0x103 if it is the fourth.
+ */
+#define MANIFEST_DEFAULT_WORKERS    4
+#define MANIFEST_MAX_WORKERS        64
+
+int32_t manifest_run( struct programmer_arguments *args );
+/*  Read the manifest args->com_manifest_data.file and the image files
+ *  its flash commands use, each once, then program the boards with up
+ *  to args->com_manifest_data.jobs of them at a time.  A board is done
+ *  by one worker, its commands in order; a worker that runs out of
+ *  boards takes the last waiting board of another.  The transfers of
+ *  all boards are kept within args->com_manifest_data.limits, see
+ *  topology.h.  The global options of args apply to every command, and
+ *  progress bars are left out when more than one worker runs.
+ *
+ *  returns 0 if every board was programmed, otherwise the error of the
+ *  first board in the manifest that failed
+ */
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "overlay.h"
+#include "util.h"
+
+#define OVERLAY_DEBUG_THRESHOLD     40
+#define OVERLAY_TRACE_THRESHOLD     45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               OVERLAY_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               OVERLAY_TRACE_THRESHOLD, __VA_ARGS__ )
+
+// ________  P R O T O T Y P E S  _______________________________
+static int32_t overlay_index( const intel_buffer_out_t *bout,
+                              const uint32_t target_offset,
+                              const uint32_t address, uint32_t *index );
+/* the position in bout->data of a memory address, ignoring the top bit
+ * as intel_process_data does.  returns 0, or -1 if it is outside bout
+ */
+
+// ________  F U N C T I O N S  _______________________________
+static int32_t overlay_index( const intel_buffer_out_t *bout,
+                              const uint32_t target_offset,
+                              const uint32_t address, uint32_t *index ) {
+    const uint32_t offset = target_offset & 0x7fffffff;
+    const uint32_t at = address & 0x7fffffff;
+
+    if( (at < offset) || (at - offset >= bout->info.total_size) ) {
+        DEBUG( "Address 0x%X is outside valid range 0x%X to 0x%X.\n",
+               at, offset, offset + bout->info.total_size - 1 );
+        return -1;
+    }
+    *index = at - offset;
+
+    return 0;
+}
+
+int32_t overlay_parse( image_overlay_t *overlay, const char *text ) {
+    overlay_run_t run;
+    overlay_run_t *runs;
+    const char *colon;
+    char *end;
+    unsigned long value;
+    size_t i;
+
+    TRACE( "%s( %p, %s )\n", __FUNCTION__, overlay, text );
+
+    memset( &run, 0, sizeof(run) );
+
+    if( NULL == (colon = strchr(text, ':')) ) {
+        return -1;
+    }
+    run.length = (size_t) (colon - text) / 2;
+    if( (0 == run.length) || (0 != ((colon - text) & 1)) ) {
+        return -1;
+    }
+    for( i = 0; text + i < colon; i++ ) {
+        if( !isxdigit((unsigned char) text[i]) ) {
+            return -1;
+        }
+    }
+
+    value = strtoul( colon + 1, &end, 10 );
+    if( (end == colon + 1) || (value > UINT32_MAX) ) {
+        return -1;
+    }
+    run.address = (uint32_t) value;
+    if( ':' == *end ) {
+        if( '+' != end[1] ) {
+            return -1;
+        }
+        colon = &end[2];
+        value = strtoul( colon, &end, 0 );
+        if( (end == colon) || (value > UINT32_MAX) ) {
+            return -1;
+        }
+        run.step = (uint32_t) value;
+    }
+    if( '\0' != *end ) {
+        return -1;
+    }
+
+    runs = (overlay_run_t *) realloc( overlay->runs,
+            (overlay->count + 1) * sizeof(overlay_run_t) );
+    if( NULL == runs ) {
+        return -2;
+    }
+    overlay->runs = runs;
+    if( NULL == (run.data = (uint8_t *) malloc(run.length)) ) {
+        return -2;
+    }
+    for( i = 0; i < run.length; i++ ) {
+        char digits[3] = { text[2 * i], text[2 * i + 1], '\0' };
+        run.data[i] = (uint8_t) strtoul( digits, NULL, 16 );
+    }
+    runs[overlay->count++] = run;
+
+    return 0;
+}
+
+void overlay_count( image_overlay_t *overlay, const uint32_t boards ) {
+    overlay_run_t *run;
+    uint64_t addend;
+    uint32_t sum;
+    size_t i;
+    size_t j;
+
+    for( i = 0; i < overlay->count; i++ ) {
+        run = &overlay->runs[i];
+        addend = (uint64_t) run->step * boards;
+        // big endian, so the carry moves towards data[0]
+        for( j = run->length, sum = 0; (j > 0) && ((0 != addend) ||
+                                                   (0 != sum)); j-- ) {
+            sum += run->data[j - 1] + (uint32_t) (addend & 0xff);
+            run->data[j - 1] = (uint8_t) sum;
+            sum >>= 8;
+            addend >>= 8;
+        }
+    }
+}
+
+int32_t overlay_apply( const image_overlay_t *overlay,
+                       intel_buffer_out_t *bout,
+                       const uint32_t target_offset ) {
+    const overlay_run_t *run;
+    size_t i;
+    size_t j;
+
+    for( i = 0; i < overlay->count; i++ ) {
+        run = &overlay->runs[i];
+        for( j = 0; j < run->length; j++ ) {
+            if( 0 != intel_process_data(bout, (char) run->data[j],
+                        target_offset, run->address + j) ) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int32_t overlay_pages_build( overlay_pages_t *pages,
+                             const image_overlay_t *overlay,
+                             const intel_buffer_out_t *base,
+                             const uint32_t target_offset ) {
+    const size_t page_size = base->info.page_size;
+    overlay_extent_t *extent;
+    overlay_extent_t swap;
+    uint32_t first;
+    uint32_t last;
+    size_t count = 0;
+    size_t i;
+    size_t j;
+
+    TRACE( "%s( %p, %p, %p, 0x%X )\n", __FUNCTION__, pages, overlay, base,
+           target_offset );
+
+    memset( pages, 0, sizeof(overlay_pages_t) );
+    if( 0 == overlay->count ) {
+        return 0;
+    }
+
+    pages->extents = (overlay_extent_t *)
+            calloc( overlay->count, sizeof(overlay_extent_t) );
+    if( NULL == pages->extents ) {
+        return -2;
+    }
+
+    // the pages of each run, sorted by address and merged where they meet
+    for( i = 0; i < overlay->count; i++ ) {
+        if( (0 != overlay_index(base, target_offset,
+                        overlay->runs[i].address, &first)) ||
+                (0 != overlay_index(base, target_offset,
+                        overlay->runs[i].address +
+                        overlay->runs[i].length - 1, &last)) ) {
+            overlay_pages_free( pages );
+            return -1;
+        }
+        extent = &pages->extents[count++];
+        extent->start = first - first % page_size;
+        extent->end = last - last % page_size + page_size - 1;
+        if( extent->end >= base->info.total_size ) {
+            extent->end = base->info.total_size - 1;
+        }
+        for( j = count - 1; (j > 0) &&
+                (pages->extents[j - 1].start > pages->extents[j].start); j-- ) {
+            swap = pages->extents[j - 1];
+            pages->extents[j - 1] = pages->extents[j];
+            pages->extents[j] = swap;
+        }
+    }
+    for( i = 1, j = 0; i < count; i++ ) {
+        if( pages->extents[i].start <= pages->extents[j].end + 1 ) {
+            if( pages->extents[i].end > pages->extents[j].end ) {
+                pages->extents[j].end = pages->extents[i].end;
+            }
+        } else {
+            pages->extents[++j] = pages->extents[i];
+        }
+    }
+    pages->count = j + 1;
+
+    for( i = 0; i < pages->count; i++ ) {
+        extent = &pages->extents[i];
+        extent->data = (uint16_t *) malloc( (extent->end - extent->start + 1)
+                                            * sizeof(uint16_t) );
+        if( NULL == extent->data ) {
+            overlay_pages_free( pages );
+            return -2;
+        }
+        memcpy( extent->data, &base->data[extent->start],
+                (extent->end - extent->start + 1) * sizeof(uint16_t) );
+    }
+
+    // later runs win, as they would writing into the image in turn
+    for( i = 0; i < overlay->count; i++ ) {
+        overlay_index( base, target_offset, overlay->runs[i].address, &first );
+        for( j = 0; j < pages->count; j++ ) {
+            extent = &pages->extents[j];
+            if( (first >= extent->start) && (first <= extent->end) ) {
+                break;
+            }
+        }
+        for( count = 0; count < overlay->runs[i].length; count++ ) {
+            extent->data[first - extent->start + count] =
+                    overlay->runs[i].data[count];
+        }
+    }
+
+    // every page here has data now, so nothing on it stays unassigned
+    for( i = 0; i < pages->count; i++ ) {
+        extent = &pages->extents[i];
+        for( j = 0; j <= extent->end - extent->start; j++ ) {
+            if( extent->data[j] > UINT8_MAX ) {
+                extent->data[j] = 0xff;
+            }
+        }
+    }
+
+    DEBUG( "Overlay of %u runs touches %u extents.\n",
+           (uint32_t) overlay->count, (uint32_t) pages->count );
+    return 0;
+}
+
+void overlay_pages_fold( const overlay_pages_t *pages,
+                         const intel_buffer_out_t *base,
+                         intel_buffer_in_t *buin ) {
+    const overlay_extent_t *extent;
+    uint8_t expected;
+    uint32_t address;
+    size_t i;
+
+    for( i = 0; i < pages->count; i++ ) {
+        extent = &pages->extents[i];
+        for( address = extent->start; address <= extent->end; address++ ) {
+            if( (address < base->info.valid_start) ||
+                    (address > base->info.valid_end) ) {
+                continue;
+            }
+            expected = (base->data[address] <= UINT8_MAX) ?
+                       (uint8_t) base->data[address] : 0xff;
+            if( buin->data[address] ==
+                    (uint8_t) extent->data[address - extent->start] ) {
+                buin->data[address] = expected;
+            } else {
+                buin->data[address] = (uint8_t) ~expected;
+            }
+        }
+    }
+}
+
+void overlay_pages_free( overlay_pages_t *pages ) {
+    size_t i;
+
+    if( NULL == pages->extents ) {
+        return;
+    }
+    for( i = 0; i < pages->count; i++ ) {
+        free( pages->extents[i].data );
+    }
+    free( pages->extents );
+    memset( pages, 0, sizeof(overlay_pages_t) );
+}
+
+void overlay_free( image_overlay_t *overlay ) {
+    size_t i;
+
+    for( i = 0; i < overlay->count; i++ ) {
+        free( overlay->runs[i].data );
+    }
+    free( overlay->runs );
+    memset( overlay, 0, sizeof(image_overlay_t) );
+}
@@ -0,0 +1,106 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __OVERLAY_H__
+#define __OVERLAY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "intel_hex.h"
+
+/*  An overlay is the handful of bytes that differ from board to board,
+ *  serial numbers, MAC addresses or calibration data, kept apart from the
+ *  image they are written over so that image can be shared.  Each run is
+ *  given as --serial=hexdigits:address[:+step]; a step makes the run a
+ *  counter, the bytes are one big endian number that a manifest advances
+ *  by step for each board after the first.  Later runs win where runs
+ *  overlap.
+ */
+typedef struct {
+    uint32_t address;       /* memory address of the first byte */
+    size_t length;
+    uint8_t *data;
+    uint32_t step;          /* counter increment, 0 for fixed bytes */
+} overlay_run_t;
+
+typedef struct {
+    overlay_run_t *runs;    /* in the order given */
+    size_t count;
+} image_overlay_t;
+
+/*  The pages of an image an overlay writes, copied from the image and
+ *  merged into extents of whole pages.
+ */
+typedef struct {
+    uint32_t start;         /* first image address of the extent */
+    uint32_t end;           /* last image address of the extent */
+    uint16_t *data;         /* data[0] is address start */
+} overlay_extent_t;
+
+typedef struct {
+    overlay_extent_t *extents;      /* in address order */
+    size_t count;
+} overlay_pages_t;
+
+int32_t overlay_parse( image_overlay_t *overlay, const char *text );
+/*  Add the run written in text as hexdigits:address[:+step].
+ *
+ *  returns 0 on success, -1 if text is malformed, -2 if out of memory
+ */
+
+void overlay_count( image_overlay_t *overlay, const uint32_t boards );
+/*  Advance every counter of overlay by its step times boards, wrapping
+ *  within the bytes of the run.
+ */
+
+int32_t overlay_apply( const image_overlay_t *overlay,
+                       intel_buffer_out_t *bout,
+                       const uint32_t target_offset );
+/*  Write the overlay into bout as if it had been in the hex file, where
+ *  target_offset is the memory address of bout->data[0].
+ *
+ *  returns 0 on success, -1 if a byte is outside bout
+ */
+
+int32_t overlay_pages_build( overlay_pages_t *pages,
+                             const image_overlay_t *overlay,
+                             const intel_buffer_out_t *base,
+                             const uint32_t target_offset );
+/*  Copy the pages of base (already prepared by intel_flash_prep_buffer)
+ *  that overlay writes and write it into them, erasing what neither sets
+ *  as intel_flash_prep_buffer would.  base is only read, so boards may
+ *  share it; the copy is as large as the pages the overlay touches.
+ *
+ *  returns 0 on success, -1 if a byte is outside base, -2 if out of memory
+ */
+
+void overlay_pages_fold( const overlay_pages_t *pages,
+                         const intel_buffer_out_t *base,
+                         intel_buffer_in_t *buin );
+/*  Turn buin, read back from a device programmed with base and pages, into
+ *  what a device programmed with base alone would read where pages match,
+ *  and a certain mismatch where they do not, so it validates against base.
+ */
+
+void overlay_pages_free( overlay_pages_t *pages );
+
+void overlay_free( image_overlay_t *overlay );
+
+#endif
@@ -0,0 +1,364 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "patch.h"
+#include "digest.h"
+#include "util.h"
+
+#define PATCH_DEBUG_THRESHOLD   40
+#define PATCH_TRACE_THRESHOLD   45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               PATCH_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               PATCH_TRACE_THRESHOLD, __VA_ARGS__ )
+
+// ________  P R O T O T Y P E S  _______________________________
+static void patch_put32( uint8_t *out, const uint32_t value );
+static uint32_t patch_get32( const uint8_t *in );
+/* store and load a little endian uint32
+ */
+
+static int32_t patch_emit( FILE *fp, uint32_t *crc, const uint8_t *data,
+                           const size_t length );
+/* write length bytes and add them to the running crc
+ * returns 0 on success, -1 on a write error
+ */
+
+static uint8_t *patch_load( const char *filename, size_t *length );
+/* read a whole file into a new buffer, returns NULL on error
+ */
+
+// ________  F U N C T I O N S  _______________________________
+static void patch_put32( uint8_t *out, const uint32_t value ) {
+    out[0] = (uint8_t) value;
+    out[1] = (uint8_t) (value >> 8);
+    out[2] = (uint8_t) (value >> 16);
+    out[3] = (uint8_t) (value >> 24);
+}
+
+static uint32_t patch_get32( const uint8_t *in ) {
+    return ((uint32_t) in[0]) | ((uint32_t) in[1] << 8) |
+           ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+static int32_t patch_emit( FILE *fp, uint32_t *crc, const uint8_t *data,
+                           const size_t length ) {
+    if( length != fwrite(data, 1, length, fp) ) {
+        return -1;
+    }
+    *crc = digest_crc32( *crc, data, length );
+
+    return 0;
+}
+
+static uint8_t *patch_load( const char *filename, size_t *length ) {
+    FILE *fp;
+    uint8_t *buffer = NULL;
+    uint8_t *grown;
+    size_t size = 0;
+    size_t n;
+
+    if( 0 == strcmp("STDIN", filename) ) {
+        fp = stdin;
+    } else if( NULL == (fp = fopen(filename, "rb")) ) {
+        DEBUG( "ERROR: unable to open %s.\n", filename );
+        return NULL;
+    }
+
+    *length = 0;
+    do {
+        if( *length == size ) {
+            size = (0 == size) ? 0x10000 : 2 * size;
+            if( NULL == (grown = (uint8_t *) realloc(buffer, size)) ) {
+                DEBUG( "ERROR: out of memory at %u bytes.\n", (uint32_t) size );
+                goto error;
+            }
+            buffer = grown;
+        }
+        n = fread( buffer + *length, 1, size - *length, fp );
+        *length += n;
+    } while( 0 != n );
+
+    if( ferror(fp) ) {
+        DEBUG( "ERROR: unable to read %s.\n", filename );
+        goto error;
+    }
+    if( stdin != fp ) {
+        fclose( fp );
+    }
+
+    return buffer;
+
+error:
+    if( stdin != fp ) {
+        fclose( fp );
+    }
+    free( buffer );
+
+    return NULL;
+}
+
+void patch_init( dfu_patch_t *patch, const uint8_t segment,
+                 const uint32_t page_size, const uint32_t memory_size ) {
+    memset( patch, 0, sizeof(dfu_patch_t) );
+    patch->segment = segment;
+    patch->page_size = page_size;
+    patch->memory_size = memory_size;
+}
+
+int32_t patch_add_erase( dfu_patch_t *patch, const uint32_t address ) {
+    uint32_t *grown;
+
+    TRACE( "%s( %p, 0x%X )\n", __FUNCTION__, patch, address );
+
+    grown = (uint32_t *) realloc( patch->erases,
+                (patch->erase_count + 1) * sizeof(uint32_t) );
+    if( NULL == grown ) {
+        DEBUG( "ERROR: out of memory.\n" );
+        return -1;
+    }
+    patch->erases = grown;
+    patch->erases[patch->erase_count++] = address;
+
+    return 0;
+}
+
+int32_t patch_add_page( dfu_patch_t *patch, const uint32_t address,
+                        const uint8_t *base, const uint8_t *image,
+                        const dfu_bool write ) {
+    patch_page_t *page;
+    uint8_t *data;
+
+    TRACE( "%s( %p, 0x%X, %p, %p, %s )\n", __FUNCTION__, patch, address,
+           base, image, ((true == write) ? "true" : "false") );
+
+    // both lists grow in steps of 64 entries
+    if( 0 == patch->page_count % 64 ) {
+        page = (patch_page_t *) realloc( patch->pages,
+                    (patch->page_count + 64) * sizeof(patch_page_t) );
+        if( NULL == page ) {
+            DEBUG( "ERROR: out of memory.\n" );
+            return -1;
+        }
+        patch->pages = page;
+    }
+    if( write && (0 == patch->data_pages % 64) ) {
+        data = (uint8_t *) realloc( patch->data,
+                    (size_t) (patch->data_pages + 64) * patch->page_size );
+        if( NULL == data ) {
+            DEBUG( "ERROR: out of memory.\n" );
+            return -1;
+        }
+        patch->data = data;
+    }
+
+    page = &patch->pages[patch->page_count++];
+    page->address = address;
+    page->base_crc = digest_crc32( 0, base, patch->page_size );
+    page->image_crc = digest_crc32( 0, image, patch->page_size );
+    page->flags = 0;
+    page->offset = 0;
+    if( write ) {
+        page->flags |= PATCH_PAGE_WRITE;
+        page->offset = (size_t) patch->data_pages * patch->page_size;
+        memcpy( patch->data + page->offset, image, patch->page_size );
+        patch->data_pages++;
+    }
+
+    return 0;
+}
+
+int32_t patch_write( dfu_patch_t *patch, FILE *fp ) {
+    uint8_t header[PATCH_HEADER_SIZE];
+    uint8_t record[PATCH_RECORD_SIZE];
+    uint32_t crc = 0;
+    uint32_t i;
+    patch_page_t *page;
+
+    TRACE( "%s( %p, %p )\n", __FUNCTION__, patch, fp );
+
+    memset( header, 0, sizeof(header) );
+    memcpy( header, PATCH_MAGIC, 8 );
+    header[8] = (uint8_t) PATCH_VERSION;
+    header[9] = (uint8_t) (PATCH_VERSION >> 8);
+    header[10] = patch->segment;
+    patch_put32( &header[12], patch->page_size );
+    patch_put32( &header[16], patch->memory_size );
+    patch_put32( &header[20], patch->erase_count );
+    patch_put32( &header[24], patch->page_count );
+    patch_put32( &header[28], patch->data_pages );
+    if( 0 != patch_emit(fp, &crc, header, sizeof(header)) ) {
+        goto error;
+    }
+
+    for( i = 0; i < patch->erase_count; i++ ) {
+        patch_put32( record, patch->erases[i] );
+        if( 0 != patch_emit(fp, &crc, record, 4) ) {
+            goto error;
+        }
+    }
+
+    for( i = 0; i < patch->page_count; i++ ) {
+        page = &patch->pages[i];
+        patch_put32( &record[0], page->address );
+        patch_put32( &record[4], page->base_crc );
+        patch_put32( &record[8], page->image_crc );
+        patch_put32( &record[12], page->flags );
+        if( 0 != patch_emit(fp, &crc, record, sizeof(record)) ) {
+            goto error;
+        }
+    }
+
+    // the data was collected in record order
+    if( (0 != patch->data_pages) && (0 != patch_emit(fp, &crc, patch->data,
+                (size_t) patch->data_pages * patch->page_size)) ) {
+        goto error;
+    }
+
+    patch_put32( record, crc );
+    if( (4 != fwrite(record, 1, 4, fp)) || (0 != fflush(fp)) ) {
+        goto error;
+    }
+
+    return 0;
+
+error:
+    DEBUG( "ERROR: unable to write the patch.\n" );
+    return -1;
+}
+
+int32_t patch_read( dfu_patch_t *patch, const char *filename ) {
+    uint8_t *file;
+    uint8_t *record;
+    size_t length;
+    size_t expected;
+    uint32_t i;
+    uint32_t data_pages = 0;
+    patch_page_t *page;
+
+    TRACE( "%s( %p, %s )\n", __FUNCTION__, patch, filename );
+
+    memset( patch, 0, sizeof(dfu_patch_t) );
+    if( NULL == (file = patch_load(filename, &length)) ) {
+        return -1;
+    }
+
+    if( (length < PATCH_HEADER_SIZE + 4) ||
+            (0 != memcmp(file, PATCH_MAGIC, 8)) ) {
+        DEBUG( "ERROR: %s is not a patch file.\n", filename );
+        goto error;
+    }
+    if( PATCH_VERSION != (file[8] | (file[9] << 8)) ) {
+        DEBUG( "ERROR: unsupported patch version %u.\n",
+               file[8] | (file[9] << 8) );
+        goto error;
+    }
+    if( patch_get32(&file[length - 4]) != digest_crc32(0, file, length - 4) ) {
+        DEBUG( "ERROR: %s is corrupted.\n", filename );
+        goto error;
+    }
+
+    patch->segment = file[10];
+    patch->page_size = patch_get32( &file[12] );
+    patch->memory_size = patch_get32( &file[16] );
+    patch->erase_count = patch_get32( &file[20] );
+    patch->page_count = patch_get32( &file[24] );
+    patch->data_pages = patch_get32( &file[28] );
+
+    // the counts come from the file, size them as 64 bit to check them
+    expected = PATCH_HEADER_SIZE + 4;
+    if( (0 == patch->page_size) ||
+            ((uint64_t) patch->erase_count * 4 +
+             (uint64_t) patch->page_count * PATCH_RECORD_SIZE +
+             (uint64_t) patch->data_pages * patch->page_size !=
+             (uint64_t) (length - expected)) ) {
+        DEBUG( "ERROR: the patch size does not match its header.\n" );
+        goto error;
+    }
+
+    patch->erases = (uint32_t *) malloc( (patch->erase_count + 1) *
+                                         sizeof(uint32_t) );
+    patch->pages = (patch_page_t *) malloc( (patch->page_count + 1) *
+                                            sizeof(patch_page_t) );
+    patch->data = (uint8_t *) malloc( (size_t) patch->data_pages *
+                                      patch->page_size + 1 );
+    if( (NULL == patch->erases) || (NULL == patch->pages) ||
+            (NULL == patch->data) ) {
+        DEBUG( "ERROR: out of memory.\n" );
+        goto error;
+    }
+
+    record = &file[PATCH_HEADER_SIZE];
+    for( i = 0; i < patch->erase_count; i++, record += 4 ) {
+        patch->erases[i] = patch_get32( record );
+    }
+    for( i = 0; i < patch->page_count; i++, record += PATCH_RECORD_SIZE ) {
+        page = &patch->pages[i];
+        page->address = patch_get32( &record[0] );
+        page->base_crc = patch_get32( &record[4] );
+        page->image_crc = patch_get32( &record[8] );
+        page->flags = patch_get32( &record[12] );
+        page->offset = 0;
+        if( page->flags & PATCH_PAGE_WRITE ) {
+            page->offset = (size_t) data_pages++ * patch->page_size;
+        }
+        if( (0 != page->address % patch->page_size) ||
+                ((uint64_t) page->address + patch->page_size >
+                    patch->memory_size) ||
+                ((0 != i) && (page->address <= patch->pages[i-1].address)) ) {
+            DEBUG( "ERROR: page 0x%X is out of order or range.\n",
+                   page->address );
+            goto error;
+        }
+    }
+    if( data_pages != patch->data_pages ) {
+        DEBUG( "ERROR: %u pages are flagged, the header says %u.\n",
+               data_pages, patch->data_pages );
+        goto error;
+    }
+    memcpy( patch->data, record, (size_t) data_pages * patch->page_size );
+
+    free( file );
+    return 0;
+
+error:
+    free( file );
+    patch_free( patch );
+
+    return -1;
+}
+
+void patch_free( dfu_patch_t *patch ) {
+    free( patch->erases );
+    free( patch->pages );
+    free( patch->data );
+    patch->erases = NULL;
+    patch->pages = NULL;
+    patch->data = NULL;
+    patch->erase_count = 0;
+    patch->page_count = 0;
+    patch->data_pages = 0;
+}
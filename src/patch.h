@@ -0,0 +1,110 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __PATCH_H__
+#define __PATCH_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "dfu-bool.h"
+
+/*  A patch file holds the work needed to turn a device programmed with one
+ *  image (the base) into another, so it is computed once per release and
+ *  replayed on every board.  All values are little endian:
+ *
+ *    header   "DFUPATCH", uint16 version, uint8 segment, uint8 0,
+ *             uint32 page size, memory size, erase count, page count and
+ *             the number of pages that carry data
+ *    erases   uint32 segment address of each sector to erase first
+ *    pages    uint32 address, crc32 of the page in the base image, crc32
+ *             in the new image and flags, for each page touched
+ *    data     the new contents of each page flagged PATCH_PAGE_WRITE
+ *    trailer  uint32 crc32 of everything before it
+ *
+ *  Pages without data are only checked, they are left erased by a sector
+ *  erase.
+ */
+#define PATCH_MAGIC             "DFUPATCH"
+#define PATCH_VERSION           1
+#define PATCH_HEADER_SIZE       32
+#define PATCH_RECORD_SIZE       16
+
+#define PATCH_PAGE_WRITE        0x01    /* the page has data to program */
+
+typedef struct {
+    uint32_t address;       /* first byte of the page in the segment */
+    uint32_t base_crc;      /* crc32 of the page in the base image */
+    uint32_t image_crc;     /* and once the patch is applied */
+    uint32_t flags;
+    size_t offset;          /* of the page contents in dfu_patch_t.data */
+} patch_page_t;
+
+typedef struct {
+    uint8_t segment;        /* atmel_memory_unit_enum the patch is for */
+    uint32_t page_size;
+    uint32_t memory_size;   /* bytes in the segment, to match the target */
+    uint32_t erase_count;
+    uint32_t *erases;
+    uint32_t page_count;
+    patch_page_t *pages;
+    uint32_t data_pages;    /* pages flagged PATCH_PAGE_WRITE */
+    uint8_t *data;
+} dfu_patch_t;
+
+void patch_init( dfu_patch_t *patch, const uint8_t segment,
+                 const uint32_t page_size, const uint32_t memory_size );
+/*  Start an empty patch for a segment of the given geometry.
+ */
+
+int32_t patch_add_erase( dfu_patch_t *patch, const uint32_t address );
+/*  Append a sector erase, address is the start of the sector.
+ *
+ *  returns 0 on success, negative if memory ran out
+ */
+
+int32_t patch_add_page( dfu_patch_t *patch, const uint32_t address,
+                        const uint8_t *base, const uint8_t *image,
+                        const dfu_bool write );
+/*  Append the page at address.  base and image are the page_size bytes of
+ *  the page before and after the patch, the image is stored only when
+ *  write is set.  Pages must be added in address order.
+ *
+ *  returns 0 on success, negative if memory ran out
+ */
+
+int32_t patch_write( dfu_patch_t *patch, FILE *fp );
+/*  Write the patch file to fp.
+ *
+ *  returns 0 on success, negative on error
+ */
+
+int32_t patch_read( dfu_patch_t *patch, const char *filename );
+/*  Load a patch file ("STDIN" reads standard input) and check its header
+ *  and trailer.  patch is released again when this fails.
+ *
+ *  returns 0 on success, negative if the file is unreadable or not a patch
+ */
+
+void patch_free( dfu_patch_t *patch );
+/*  Release the memory held by a patch and empty it.
+ */
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "profile.h"
+#include "util.h"
+
+#define PROFILE_DEBUG_THRESHOLD     40
+#define PROFILE_TRACE_THRESHOLD     45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               PROFILE_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               PROFILE_TRACE_THRESHOLD, __VA_ARGS__ )
+
+#define PROFILE_HEADER \
+    "# vendor product version transfer_size erase_poll status_delay\n"
+
+// ________  P R O T O T Y P E S  _______________________________
+static int32_t profile_parse( const char *line, uint16_t *vendor_id,
+                              uint16_t *product_id, int32_t *version,
+                              dfu_profile_t *profile );
+/* read one line of a profile file
+ * returns 0 for a profile, 1 for a comment or blank line, -1 if malformed
+ */
+
+// ________  F U N C T I O N S  _______________________________
+static int32_t profile_parse( const char *line, uint16_t *vendor_id,
+                              uint16_t *product_id, int32_t *version,
+                              dfu_profile_t *profile ) {
+    unsigned int vendor;
+    unsigned int product;
+
+    line += strspn( line, " \t" );
+    if( ('#' == *line) || ('\n' == *line) || ('\0' == *line) ) {
+        return 1;
+    }
+
+    if( (6 != sscanf(line, "%x %x %i %u %u %u", &vendor, &product, version,
+                     &profile->transfer_size, &profile->erase_poll,
+                     &profile->status_delay)) ||
+            (vendor > UINT16_MAX) || (product > UINT16_MAX) ) {
+        return -1;
+    }
+    *vendor_id = (uint16_t) vendor;
+    *product_id = (uint16_t) product;
+
+    return 0;
+}
+
+int32_t profile_load( const char *filename, const uint16_t vendor_id,
+                      const uint16_t product_id, const int32_t version,
+                      dfu_profile_t *profile ) {
+    char line[256];
+    FILE *fp;
+    uint16_t vendor;
+    uint16_t product;
+    int32_t found;
+    dfu_profile_t entry;
+    uint32_t line_count = 0;
+    int32_t retval = 1;
+
+    TRACE( "%s( %s, 0x%04X, 0x%04X, %d )\n", __FUNCTION__, filename,
+           vendor_id, product_id, version );
+
+    if( NULL == (fp = fopen(filename, "r")) ) {
+        if( ENOENT != errno ) {
+            DEBUG( "Unable to open profiles '%s': %s\n", filename,
+                   strerror(errno) );
+            return -1;
+        }
+        return 1;
+    }
+
+    while( NULL != fgets(line, sizeof(line), fp) ) {
+        line_count++;
+        memset( &entry, 0, sizeof(entry) );
+        switch( profile_parse(line, &vendor, &product, &found, &entry) ) {
+            case 0:
+                break;
+            case 1:
+                continue;
+            default:
+                DEBUG( "Ignoring line %u of '%s'.\n", line_count, filename );
+                continue;
+        }
+        if( (vendor == vendor_id) && (product == product_id) &&
+                ((PROFILE_ANY_VERSION == version) || (found == version)) ) {
+            *profile = entry;
+            retval = 0;
+            break;
+        }
+    }
+
+    fclose( fp );
+
+    if( 0 == retval ) {
+        DEBUG( "Profile %04x:%04x 0x%X: transfer %u, erase poll %u ms, "
+               "status delay %u us.\n", vendor_id, product_id, found,
+               profile->transfer_size, profile->erase_poll,
+               profile->status_delay );
+    }
+
+    return retval;
+}
+
+int32_t profile_save( const char *filename, const uint16_t vendor_id,
+                      const uint16_t product_id, const int32_t version,
+                      const dfu_profile_t *profile ) {
+    char temp[4096];
+    char line[256];
+    FILE *in;
+    FILE *out;
+    uint16_t vendor;
+    uint16_t product;
+    int32_t found;
+    dfu_profile_t entry;
+    int fd;
+
+    TRACE( "%s( %s, 0x%04X, 0x%04X, %d )\n", __FUNCTION__, filename,
+           vendor_id, product_id, version );
+
+    if( sizeof(temp) <= (size_t) snprintf(temp, sizeof(temp),
+                "%s.XXXXXX", filename) ) {
+        return -1;
+    }
+    if( -1 == (fd = mkstemp(temp)) ) {
+        DEBUG( "Unable to create %s: %s\n", temp, strerror(errno) );
+        return -2;
+    }
+    if( NULL == (out = fdopen(fd, "w")) ) {
+        close( fd );
+        remove( temp );
+        return -2;
+    }
+
+    // keep every other line, the new profile goes last
+    if( NULL != (in = fopen(filename, "r")) ) {
+        while( NULL != fgets(line, sizeof(line), in) ) {
+            if( (0 == profile_parse(line, &vendor, &product, &found, &entry)) &&
+                    (vendor == vendor_id) && (product == product_id) &&
+                    (found == version) ) {
+                continue;
+            }
+            fputs( line, out );
+        }
+        fclose( in );
+    } else {
+        fputs( PROFILE_HEADER, out );
+    }
+    fprintf( out, "%04x %04x 0x%X %u %u %u\n", vendor_id, product_id,
+             (uint32_t) version, profile->transfer_size, profile->erase_poll,
+             profile->status_delay );
+
+    if( 0 != fclose(out) ) {
+        DEBUG( "Unable to write %s: %s\n", temp, strerror(errno) );
+        remove( temp );
+        return -3;
+    }
+    if( 0 != rename(temp, filename) ) {
+        DEBUG( "Unable to rename %s: %s\n", temp, strerror(errno) );
+        remove( temp );
+        return -4;
+    }
+
+    return 0;
+}
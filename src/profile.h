@@ -0,0 +1,60 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdint.h>
+#include "dfu-device.h"
+
+/*  A profile file holds the settings the autotune command measured for
+ *  each bootloader, one line per vendor id, product id and bootloader
+ *  version (as reported by the device):
+ *
+ *    # vendor product version transfer_size erase_poll status_delay
+ *    03eb 2ff4 0x1000 512 5 0
+ *
+ *  transfer_size is in bytes, erase_poll in ms and status_delay in us, 0
+ *  keeps the built in behaviour.  Lines starting with '#' are comments.
+ */
+#define PROFILE_ENVIRONMENT     "DFU_PROGRAMMER_PROFILES"
+
+/* matches the first profile of a device, whatever its version */
+#define PROFILE_ANY_VERSION     -1
+
+int32_t profile_load( const char *filename, const uint16_t vendor_id,
+                      const uint16_t product_id, const int32_t version,
+                      dfu_profile_t *profile );
+/*  Find the profile of a bootloader in filename and copy it to profile.
+ *
+ *  returns 0 if it was found, 1 if there is none (or no file), negative if
+ *  the file can not be read
+ */
+
+int32_t profile_save( const char *filename, const uint16_t vendor_id,
+                      const uint16_t product_id, const int32_t version,
+                      const dfu_profile_t *profile );
+/*  Add the profile of a bootloader to filename, replacing the one it had.
+ *  The file is written next to the old one and renamed into place.
+ *
+ *  returns 0 on success, negative on error
+ */
+
+#endif
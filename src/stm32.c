@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
 #include <errno.h>
@@ -42,6 +43,13 @@
 #define STM32_MIN_SECTOR_BOUND      0x4000  /* 16 kb */
 #define STM32_OTP_BYTES_SIZE        528     /* number of OTP bytes (0x210) */
 #define STM32_OPTION_BYTES_SIZE     16      /* number option bytes */
+#define STM32_RESET_COST            0x0400  /* bytes that take about as long
+                                               to send and program as one
+                                               address pointer reset */
+/* true if a byte of a transfer plan image is to be sent */
+#define STM32_ASSIGNED(data, a)     ((NULL == (data)) || ((data)[a] <= UINT8_MAX))
+#define STM32_MAX_PIECES            (STM32_MAX_TRANSFER_SIZE / \
+                                     (STM32_RESET_COST + 1) + 1)
 
 #define SET_ADDR_PTR            0x21
 #define ERASE_CMD               0x41
@@ -49,6 +57,20 @@
 #define GET_CMD                 0x00
 
 //___ T Y P E D E F S   ( P R I V A T E ) ____________________________________
+typedef struct {
+  uint32_t start;           /* first and last address of the transfer, */
+  uint32_t end;             /* offsets from STM32_FLASH_OFFSET */
+} stm32_transfer_t;
+
+typedef struct {
+  size_t count;             /* transfers in the schedule */
+  size_t size;              /* transfers allocated */
+  stm32_transfer_t *transfer;
+  uint32_t pointer;         /* where the address pointer is */
+  dfu_bool pointer_set;     /* false until the pointer is first set */
+  uint32_t resets;          /* address pointer resets the schedule needs */
+  uint32_t padding;         /* 0xFF bytes the schedule adds */
+} stm32_plan_t;
 
 //___ P R O T O T Y P E S   ( P R I V A T E ) ________________________________
 static inline int32_t stm32_get_status( dfu_device_t *device );
@@ -78,6 +100,17 @@ static int32_t stm32_read_block( dfu_device_t *device,
   /* read a block of memory, assumes address pointer is already set
    */
 
+static int32_t stm32_read_blocks( dfu_device_t *device,
+                                  intel_buffer_info_t *info,
+                                  uint8_t *data,
+                                  dfu_block_sink_t sink,
+                                  void *context,
+                                  const dfu_bool quiet );
+  /* read info->data_start to info->data_end in blocks, into data (indexed
+   * by address) when it is not NULL or else into the transfer buffer, and
+   * hand each block to sink if there is one
+   */
+
 static inline void print_progress( intel_buffer_info_t *info,
                     uint32_t *progress );
   /* calculate how many progress indicator steps to print and print them
@@ -90,12 +123,66 @@ static int32_t stm32_erase( dfu_device_t *device, uint8_t *command,
    * although with different commands
    */
 
+static int32_t stm32_write_recover( dfu_device_t *device,
+                                    dfu_checkpoint_t *checkpoint );
+  /* @brief spend one checkpoint retry returning the device to dfuIDLE
+   * @param checkpoint holding the address to resume from, may be NULL
+   * @retrn 0 if the write should continue from the checkpoint, negative if
+   *        there is no checkpoint, no retries are left or recovery failed
+   */
+
+static dfu_bool stm32_reachable( const stm32_plan_t *plan,
+                                 const uint32_t start, const uint32_t end,
+                                 uint16_t *block );
+  /* @brief check if a transfer can be sent without moving the address
+   *        pointer, the device puts block wBlockNum at
+   *        pointer + (wBlockNum - 2) * wTransferSize whatever its wLength,
+   *        so a short transfer is only reachable at a full block offset
+   * @param block set to the wBlockNum for the transfer
+   * @retrn true if start to end is reachable from plan->pointer
+   */
+
+static int32_t stm32_plan_add( stm32_plan_t *plan, const uint32_t start,
+                               const uint32_t end );
+  /* @brief append a transfer to the schedule, moving the pointer to start
+   *        if the transfer is not reachable from it
+   * @retrn 0 on success, -1 if out of memory
+   */
+
+static int32_t stm32_plan( dfu_device_t *device, const uint16_t *data,
+                           const uint32_t start, const uint32_t end,
+                           const uint32_t lower, const uint32_t upper,
+                           stm32_plan_t *plan );
+  /* @brief compute the transfers for the data from start to end up front
+   * @param data the image indexed by offset, values above 0xFF are not sent,
+   *        or NULL to send every byte from start to end
+   * @param lower, upper the range that may be padded with 0xFF
+   * @retrn 0 on success, -1 if out of memory (plan->transfer is freed)
+   *
+   * Each 2 kb block of the address grid is sent whole, padding its holes,
+   * when that costs less than the address resets for sending its data in
+   * pieces.  Whole blocks stay reachable from a grid aligned pointer, so a
+   * contiguous run needs one reset however long it is.
+   */
+
+static const dfuse_region_t *stm32_flash_region( dfu_device_t *device );
+  /* @brief find the flash in the memory layout the device described
+   * @retrn the region holding STM32_FLASH_OFFSET, or NULL if there is no
+   *        layout and the built in sector table applies
+   */
+
+static uint32_t stm32_sector_end( dfu_device_t *device,
+                                  const uint32_t address );
+  /* @brief find where a transfer starting at address has to stop
+   * @param address offset from STM32_FLASH_OFFSET
+   * @retrn the last offset of the sector holding address
+   */
+
 
 //___ V A R I A B L E S ______________________________________________________
 extern int debug;       /* defined in main.c */
 
-/* FIXME : these should be read from usb device descriptor because they are
- * device specififc */
+/* the stm32f4 layout, used when the device does not describe its memory */
 static const uint32_t stm32_sector_addresses[] = {
   0x08000000,   /* sector  0,  16 kb */
   0x08004000,   /* sector  1,  16 kb */
@@ -153,7 +240,7 @@ static int32_t stm32_set_address_ptr( dfu_device_t *device, uint32_t address ) {
     return -1;
   }
 
-  dfu_set_transaction_num( 0 );     /* set wValue to zero */
+  dfu_set_transaction_num( device, 0 );     /* set wValue to zero */
   if( length != dfu_download(device, length, command) ) {
     DEBUG( "dfu_download failed\n" );
     return -2;
@@ -273,30 +360,205 @@ static inline void print_progress( intel_buffer_info_t *info,
 static int32_t stm32_erase( dfu_device_t *device, uint8_t *command,
                             uint8_t command_length, dfu_bool quiet ) {
   int32_t status;
-  dfu_set_transaction_num( 0 );     /* set wValue to zero */
+  int32_t retval = UNSPECIFIED_ERROR;
+
+  /* a mass erase keeps the bootloader busy for many seconds */
+  dfu_expect_slow( device, DFU_TIMEOUT );
+
+  dfu_set_transaction_num( device, 0 );     /* set wValue to zero */
   if( command_length != dfu_download(device, command_length, command) ) {
     if( !quiet ) fprintf( stderr, "ERROR\n" );
     DEBUG( "dfu_download failed\n" );
-    return UNSPECIFIED_ERROR;
+    goto finally;
   }
 
   /* call dfu get status to trigger command */
   if( (status = stm32_get_status(device)) ) {
     if( !quiet ) fprintf( stderr, "ERROR\n" );
     DEBUG("Error %d triggering %s\n", status, __FUNCTION__);
-    return UNSPECIFIED_ERROR;
+    goto finally;
   }
 
   /* check status again for erase status, this can take a while */
   if( (status = stm32_get_status(device)) ) {
     DEBUG("Error %d: %s unsuccessful\n", status, __FUNCTION__);
     if( !quiet ) fprintf( stderr, "ERROR\n" );
-    return UNSPECIFIED_ERROR;
+    goto finally;
   } else {
     if( !quiet ) fprintf( stderr, "DONE\n" );
   }
+  retval = SUCCESS;
 
-  return SUCCESS;
+finally:
+  dfu_expect_slow( device, 0 );
+  return retval;
+}
+
+static int32_t stm32_write_recover( dfu_device_t *device,
+                                    dfu_checkpoint_t *checkpoint ) {
+  TRACE( "%s( %p, %p )\n", __FUNCTION__, device, checkpoint );
+
+  if( (NULL == checkpoint) || (0 == checkpoint->retries) ) {
+    return -1;
+  }
+  checkpoint->retries--;
+
+  DEBUG( "Recovering device to resume at 0x%X, %u retries left.\n",
+      checkpoint->resume_from, checkpoint->retries );
+
+  /* the caller sets the address pointer again before the next block */
+  if( 0 != dfu_make_idle(device, false) ) {
+    DEBUG( "Unable to return the device to dfuIDLE.\n" );
+    return -2;
+  }
+
+  return 0;
+}
+
+static dfu_bool stm32_reachable( const stm32_plan_t *plan,
+                                 const uint32_t start, const uint32_t end,
+                                 uint16_t *block ) {
+  if( !plan->pointer_set || (start < plan->pointer) ||
+      (0 != (start - plan->pointer) % STM32_MAX_TRANSFER_SIZE) ||
+      ((start - plan->pointer) / STM32_MAX_TRANSFER_SIZE + 2 > UINT16_MAX) ) {
+    return false;
+  }
+  *block = (uint16_t) ((start - plan->pointer) / STM32_MAX_TRANSFER_SIZE + 2);
+
+  return true;
+}
+
+static int32_t stm32_plan_add( stm32_plan_t *plan, const uint32_t start,
+                               const uint32_t end ) {
+  stm32_transfer_t *grown;
+  uint16_t block;
+
+  if( plan->count == plan->size ) {
+    plan->size = (0 == plan->size) ? 64 : 2 * plan->size;
+    grown = (stm32_transfer_t *)
+      realloc( plan->transfer, plan->size * sizeof(stm32_transfer_t) );
+    if( NULL == grown ) {
+      return -1;
+    }
+    plan->transfer = grown;
+  }
+  plan->transfer[plan->count].start = start;
+  plan->transfer[plan->count].end = end;
+  plan->count++;
+
+  if( !stm32_reachable(plan, start, end, &block) ) {
+    plan->pointer = start;
+    plan->pointer_set = true;
+    plan->resets++;
+  }
+
+  return 0;
+}
+
+static int32_t stm32_plan( dfu_device_t *device, const uint16_t *data,
+                           const uint32_t start, const uint32_t end,
+                           const uint32_t lower, const uint32_t upper,
+                           stm32_plan_t *plan ) {
+  stm32_transfer_t piece[STM32_MAX_PIECES];
+  stm32_plan_t trial;       // the pointer after sending the pieces
+  uint32_t pieces;
+  uint32_t address;
+  uint32_t base;            // first and last address of the grid block
+  uint32_t top;
+  uint32_t last;            // last address of the block that data may use
+  uint32_t sector_end;
+  uint32_t assigned;        // bytes of data in the block
+  uint32_t whole_cost;      // as bytes, see STM32_RESET_COST
+  uint32_t pieces_cost;
+  uint16_t block;
+  uint32_t i;
+
+  memset( plan, 0, sizeof(stm32_plan_t) );
+
+  for( address = start; address <= end; ) {
+    if( !STM32_ASSIGNED(data, address) ) {
+      address++;
+      continue;
+    }
+
+    base = address - address % STM32_MAX_TRANSFER_SIZE;
+    top = base + STM32_MAX_TRANSFER_SIZE - 1;
+    sector_end = stm32_sector_end( device, address );
+    last = (top < sector_end) ? top : sector_end;
+    if( last > end ) {
+      last = end;
+    }
+
+    /* split the data of the block in pieces at the holes too big to pad */
+    for( pieces = 0, assigned = 0, i = address; i <= last; i++ ) {
+      if( !STM32_ASSIGNED(data, i) ) continue;
+      assigned++;
+      if( (0 < pieces) && ((i - piece[pieces - 1].end - 1 <= STM32_RESET_COST) ||
+                           (STM32_MAX_PIECES == pieces)) ) {
+        piece[pieces - 1].end = i;
+      } else {
+        piece[pieces].start = i;
+        piece[pieces].end = i;
+        pieces++;
+      }
+    }
+
+    trial = *plan;
+    for( pieces_cost = 0, i = 0; i < pieces; i++ ) {
+      pieces_cost += piece[i].end - piece[i].start + 1;
+      if( !stm32_reachable(&trial, piece[i].start, piece[i].end, &block) ) {
+        pieces_cost += STM32_RESET_COST;
+        trial.pointer = piece[i].start;
+        trial.pointer_set = true;
+      }
+    }
+    /* a run going on into the next block needs the grid pointer back */
+    if( (piece[pieces - 1].end == top) && (top < end) &&
+        STM32_ASSIGNED(data, top + 1) && (0 != (top + 1 - trial.pointer) %
+                                    STM32_MAX_TRANSFER_SIZE) ) {
+      pieces_cost += STM32_RESET_COST;
+    }
+
+    /* the whole block only while none of it is planned yet, a sector
+     * smaller than the block can leave its first part sent as pieces */
+    whole_cost = UINT32_MAX;
+    if( (top <= sector_end) && (base >= lower) && (top <= upper) &&
+        ((0 == plan->count) || (plan->transfer[plan->count - 1].end < base)) ) {
+      whole_cost = STM32_MAX_TRANSFER_SIZE;
+      if( !stm32_reachable(plan, base, top, &block) ) {
+        whole_cost += STM32_RESET_COST;
+      }
+    }
+
+    if( whole_cost <= pieces_cost ) {
+      if( 0 != stm32_plan_add(plan, base, top) ) goto error;
+      plan->padding += STM32_MAX_TRANSFER_SIZE - assigned;
+      address = top + 1;
+    } else {
+      for( i = 0; i < pieces; i++ ) {
+        if( 0 != stm32_plan_add(plan, piece[i].start, piece[i].end) ) {
+          goto error;
+        }
+        plan->padding += piece[i].end - piece[i].start + 1;
+      }
+      plan->padding -= assigned;
+      address = last + 1;
+    }
+    if( 0 == address ) break;   // wrapped past the top of memory
+  }
+
+  DEBUG( "Planned %u transfers with %u address resets and 0x%X padding.\n",
+      (uint32_t) plan->count, plan->resets, plan->padding );
+  plan->pointer_set = false;
+
+  return 0;
+
+error:
+  DEBUG( "ERROR: out of memory for %u transfers.\n", (uint32_t) plan->size );
+  free( plan->transfer );
+  plan->transfer = NULL;
+
+  return -1;
 }
 
 //___ F U N C T I O N S ______________________________________________________
@@ -347,7 +609,7 @@ int32_t stm32_start_app( dfu_device_t *device, dfu_bool quiet ) {
   }
 
   if( !quiet ) fprintf( stderr, "Launching program...  \n" );
-  dfu_set_transaction_num( 0 );     /* set wValue to zero */
+  dfu_set_transaction_num( device, 0 );     /* set wValue to zero */
   if( 0 != dfu_download(device, 0, NULL) ) {
     if( !quiet ) fprintf( stderr, "ERROR\n" );
     DEBUG( "dfu_download failed\n" );
@@ -368,19 +630,68 @@ int32_t stm32_read_flash( dfu_device_t *device, intel_buffer_in_t *buin,
   TRACE( "%s( %p, %p, %u, %s )\n", __FUNCTION__, device, buin,
       mem_segment, ((true == quiet) ? "true" : "false"));
 
-  uint8_t  reset_address_flag;  // reset address offset required
-  uint32_t address_offset;  // keep record of sent progress as bytes * 32
+  if( (NULL == buin) || (NULL == device) ) {
+    DEBUG( "invalid arguments.\n" );
+    if( !quiet )
+      fprintf( stderr, "Program Error, use debug for more info.\n" );
+    return ARGUMENT_ERROR;
+  }
+
+  return stm32_read_blocks( device, &buin->info, buin->data,
+                            NULL, NULL, quiet );
+}
+
+int32_t stm32_read_stream( dfu_device_t *device, const uint32_t start,
+    const uint32_t end, dfu_block_sink_t sink, void *context,
+    const dfu_bool quiet ) {
+  TRACE( "%s( %p, 0x%X, 0x%X, %s )\n", __FUNCTION__, device, start, end,
+      ((true == quiet) ? "true" : "false"));
+  intel_buffer_info_t info;
+
+  if( (NULL == device) || (NULL == sink) || (start > end) ) {
+    DEBUG( "invalid arguments.\n" );
+    if( !quiet )
+      fprintf( stderr, "Program Error, use debug for more info.\n" );
+    return ARGUMENT_ERROR;
+  }
+
+  memset( &info, 0, sizeof(info) );
+  info.data_start = start;
+  info.data_end = end;
+
+  return stm32_read_blocks( device, &info, NULL, sink, context, quiet );
+}
+
+static int32_t stm32_read_blocks( dfu_device_t *device,
+                                  intel_buffer_info_t *info,
+                                  uint8_t *data,
+                                  dfu_block_sink_t sink,
+                                  void *context,
+                                  const dfu_bool quiet ) {
   uint16_t  xfer_size = 0;      // the size of a transfer
-  uint8_t mem_section = 0;       // tracks the current memory page
+  uint16_t block_num;       // wBlockNum of the transfer
   uint32_t progress = 0;      // used to indicate progress
+  uint8_t *block = NULL;    // where the current block is read to
+  stm32_plan_t plan;        // the transfers to read
+  size_t t;
   int32_t status;
   int32_t retval = UNSPECIFIED_ERROR;   // the return value for this function
 
-  if( (NULL == buin) || (NULL == device) ) {
-    DEBUG( "invalid arguments.\n" );
+  /* without a destination, blocks go through the transfer buffer */
+  if( NULL == data ) {
+    if( NULL == (block = dfu_transfer_buffer(device, STM32_MAX_TRANSFER_SIZE)) ) {
+      DEBUG( "ERROR: No transfer buffer.\n" );
+      if( !quiet )
+        fprintf( stderr, "Program Error, use debug for more info.\n" );
+      return UNSPECIFIED_ERROR;
+    }
+  }
+
+  if( 0 != stm32_plan(device, NULL, info->data_start, info->data_end,
+                      info->data_start, info->data_end, &plan) ) {
     if( !quiet )
       fprintf( stderr, "Program Error, use debug for more info.\n" );
-    return ARGUMENT_ERROR;
+    return UNSPECIFIED_ERROR;
   }
 
   if( !quiet ) {
@@ -389,68 +700,61 @@ int32_t stm32_read_flash( dfu_device_t *device, intel_buffer_in_t *buin,
       fprintf( stderr, "[================================] " );
     }
     fprintf( stderr, "Reading 0x%X bytes...\n",
-        buin->info.data_end - buin->info.data_start + 1 );
+        info->data_end - info->data_start + 1 );
     if( debug <= STM32_DEBUG_THRESHOLD ) {
       /* NOTE: From here on we should go to finally on error */
       fprintf( stderr, "[" );
     }
   }
 
-  /* read the data */
-  buin->info.block_start = buin->info.data_start;
-  reset_address_flag = 0;
-  address_offset = buin->info.block_start;
+  /* read the data, the address pointer is set where the plan needs it */
+  for( t = 0; t < plan.count; t++ ) {
+    info->block_start = plan.transfer[t].start;
+    info->block_end = plan.transfer[t].end;
+    xfer_size = info->block_end - info->block_start + 1;
 
-  while( buin->info.block_start <= buin->info.data_end ) {
-    if( reset_address_flag ) {
-      address_offset = buin->info.block_start;
+    if( !stm32_reachable(&plan, info->block_start, info->block_end,
+                         &block_num) ) {
       if( (status = stm32_set_address_ptr(device,
-              STM32_FLASH_OFFSET + address_offset)) ) {
-        DEBUG("Error setting address 0x%X\n", address_offset);
+              STM32_FLASH_OFFSET + info->block_start)) ) {
+        DEBUG("Error setting address 0x%X\n", info->block_start);
         retval = UNSPECIFIED_ERROR;
         goto finally;
       }
-      dfu_set_transaction_num( 2 ); /* sets block offset 0 */
-      reset_address_flag = 0;
+      plan.pointer = info->block_start;
+      plan.pointer_set = true;
+      block_num = 2;                /* block offset 0 */
     }
+    dfu_set_transaction_num( device, block_num );
 
-    // find end value for the current transfer
-    buin->info.block_end = buin->info.block_start + STM32_MAX_TRANSFER_SIZE - 1;
-    mem_section = buin->info.block_start / STM32_MIN_SECTOR_BOUND;
-    if( buin->info.block_end / STM32_MIN_SECTOR_BOUND > mem_section ) {
-      buin->info.block_end = STM32_MIN_SECTOR_BOUND * mem_section - 1;
-    }
-    if( buin->info.block_end > buin->info.data_end ) {
-      buin->info.block_end = buin->info.data_end;
-    }
-    xfer_size = buin->info.block_end - buin->info.block_start + 1;
-    if( xfer_size != STM32_MAX_TRANSFER_SIZE ) {
-      DEBUG("xfer_size change, need addr reset\n");
-      reset_address_flag = 1;
+    if( NULL != data ) {
+      block = &data[info->block_start];
+    } else {
+      /* a short upload leaves the rest blank, as in a fresh buffer */
+      memset( block, 0xff, xfer_size );
     }
 
-    if( (status = stm32_read_block( device, xfer_size,
-            &buin->data[buin->info.block_start] )) ) {
+    if( (status = stm32_read_block( device, xfer_size, block )) ) {
       DEBUG( "Error reading block 0x%X to 0x%X: err %d.\n",
-          buin->info.block_start, buin->info.block_end, status );
+          info->block_start, info->block_end, status );
       retval = ( status == -10 ) ? DEVICE_ACCESS_ERROR : FLASH_READ_ERROR;
       /* read protect error code in read_block is -10 */
       goto finally;
     }
 
-    buin->info.block_start = buin->info.block_end + 1;
-    if( reset_address_flag == 0 && (buin->info.block_start !=
-        (STM32_MAX_TRANSFER_SIZE * (dfu_get_transaction_num() - 2))
-        + address_offset) ) {
-      DEBUG("block start & address mismatch, reset req\n");
-      reset_address_flag = 1;
+    if( (NULL != sink) && (0 != (status = sink(context, info->block_start,
+            block, xfer_size))) ) {
+      DEBUG( "Reading stopped at 0x%X: err %d.\n", info->block_start, status );
+      retval = UNSPECIFIED_ERROR;
+      goto finally;
     }
 
-    if( !quiet ) print_progress( &buin->info, &progress );
+    if( !quiet ) print_progress( info, &progress );
   }
   retval = SUCCESS;
 
 finally:
+  free( plan.transfer );
   if ( !quiet ) {
     if( SUCCESS == retval ) {
       if ( debug <= STM32_DEBUG_THRESHOLD ) {
@@ -474,19 +778,23 @@ finally:
 }
 
 int32_t stm32_write_flash( dfu_device_t *device, intel_buffer_out_t *bout,
-    const dfu_bool eeprom, const dfu_bool force, const dfu_bool quiet ) {
-  TRACE( "%s( %p, %p, %s, %s )\n", __FUNCTION__, device, bout,
+    const dfu_bool eeprom, const dfu_bool force, const dfu_bool quiet,
+    dfu_checkpoint_t *checkpoint, const dfu_bool prepared ) {
+  TRACE( "%s( %p, %p, %s, %s, %s )\n", __FUNCTION__, device, bout,
           ((true == eeprom) ? "true" : "false"),
-          ((true == quiet) ? "true" : "false") );
+          ((true == quiet) ? "true" : "false"),
+          ((true == prepared) ? "true" : "false") );
 
   uint32_t i;
   uint32_t progress = 0;    // keep record of sent progress as bytes * 32
-  uint32_t address_offset;  // keep record of sent progress as bytes * 32
-  uint8_t  reset_address_flag;  // reset address offset required
   uint16_t  xfer_size = 0;      // the size of a transfer
-  uint8_t mem_section = 0;   // tracks the current memory page
+  uint16_t block_num;       // wBlockNum of the transfer
+  stm32_plan_t plan;        // the transfers to program
+  size_t t;
+  const dfuse_region_t *region;
+  dfuse_sector_t sector;
   int32_t retval = UNSPECIFIED_ERROR;   // the return value for this function
-  uint8_t buffer[STM32_MAX_TRANSFER_SIZE];     // buffer holding out data
+  uint8_t *buffer;          // transfer buffer holding out data
   int32_t status;
 
   /* check arguments */
@@ -503,23 +811,19 @@ int32_t stm32_write_flash( dfu_device_t *device, intel_buffer_out_t *bout,
     return BUFFER_INIT_ERROR;
   }
 
-  /* for each page with data, fill unassigned values on the page with 0xFF
-   * bout->data[0] always aligns with a flash page boundary irrespective
-   * of where valid_start is located */
-  if( 0 != intel_flash_prep_buffer( bout ) ) {
-    if( !quiet )
-      fprintf( stderr, "Program Error, use debug for more info.\n" );
-    return BUFFER_INIT_ERROR;
-  }
-
-  /* determine the limits of where actual data resides in the buffer */
-  bout->info.data_start = UINT32_MAX;
-  for( i = 0; i < bout->info.total_size; i++ ) {
-    if( bout->data[i] <= UINT8_MAX ) {
-      bout->info.data_end = i;
-      if( bout->info.data_start == UINT32_MAX )
-        bout->info.data_start = i;
+  /* a prepared image may be shared with other threads, which only read it */
+  if( !prepared ) {
+    /* for each page with data, fill unassigned values on the page with 0xFF
+     * bout->data[0] always aligns with a flash page boundary irrespective
+     * of where valid_start is located */
+    if( 0 != intel_flash_prep_buffer( bout ) ) {
+      if( !quiet )
+        fprintf( stderr, "Program Error, use debug for more info.\n" );
+      return BUFFER_INIT_ERROR;
     }
+
+    /* determine the limits of where actual data resides in the buffer */
+    intel_flash_data_limits( bout );
   }
 
   /* debug info about data limits */
@@ -554,6 +858,38 @@ int32_t stm32_write_flash( dfu_device_t *device, intel_buffer_out_t *bout,
     return BUFFER_INIT_ERROR;
   }
 
+  /* with a layout from the device all of the data must be writable flash */
+  if( NULL != (region = stm32_flash_region(device)) ) {
+    for( i = bout->info.data_start; ; i = sector.end - STM32_FLASH_OFFSET + 1 ) {
+      if( (0 != dfuse_sector(region, STM32_FLASH_OFFSET + i, &sector)) ||
+          !(sector.flags & DFUSE_WRITABLE) ) {
+        DEBUG( "ERROR: 0x%X is not writable in %s.\n", i, region->name );
+        if( !quiet )
+          fprintf( stderr, "The image does not fit the device flash (0x%X).\n",
+              i );
+        return BUFFER_INIT_ERROR;
+      }
+      if( sector.end - STM32_FLASH_OFFSET >= bout->info.data_end ) break;
+    }
+  }
+
+  /* blocks are gathered straight into the transfer buffer */
+  if( NULL == (buffer = dfu_transfer_buffer(device, STM32_MAX_TRANSFER_SIZE)) ) {
+    DEBUG( "ERROR: No transfer buffer.\n" );
+    if( !quiet )
+      fprintf( stderr, "Program Error, use debug for more info.\n" );
+    return UNSPECIFIED_ERROR;
+  }
+
+  /* small holes are padded when that saves moving the address pointer */
+  if( 0 != stm32_plan(device, bout->data, bout->info.data_start,
+                      bout->info.data_end, bout->info.valid_start,
+                      bout->info.valid_end, &plan) ) {
+    if( !quiet )
+      fprintf( stderr, "Program Error, use debug for more info.\n" );
+    return UNSPECIFIED_ERROR;
+  }
+
   if( !quiet ) {
     if( debug <= STM32_DEBUG_THRESHOLD ) {
       /* NOTE: from here on we should run finally block */
@@ -567,76 +903,72 @@ int32_t stm32_write_flash( dfu_device_t *device, intel_buffer_out_t *bout,
     }
   }
 
-  /* program the data */
-  bout->info.block_start = bout->info.data_start;
-  reset_address_flag = 1;
+  /* program the data, skipping anything the checkpoint says is written */
+  for( t = 0; (NULL != checkpoint) && (t < plan.count) &&
+              (plan.transfer[t].end < checkpoint->resume_from); t++ ) ;
+  if( 0 < t ) {
+    DEBUG( "Resuming at 0x%X.\n", plan.transfer[t].start );
+  }
 
-  while( bout->info.block_start <= bout->info.data_end ) {
-    if( reset_address_flag ) {
-      address_offset = bout->info.block_start;
+  while( t < plan.count ) {
+    bout->info.block_start = plan.transfer[t].start;
+    bout->info.block_end = plan.transfer[t].end;
+    xfer_size = bout->info.block_end - bout->info.block_start + 1;
+
+    if( !stm32_reachable(&plan, bout->info.block_start, bout->info.block_end,
+                         &block_num) ) {
       if( (status = stm32_set_address_ptr(device,
-              STM32_FLASH_OFFSET + address_offset)) ) {
-        DEBUG("Error setting address 0x%X\n", address_offset);
+              STM32_FLASH_OFFSET + bout->info.block_start)) ) {
+        DEBUG("Error setting address 0x%X\n", bout->info.block_start);
+        if( 0 == stm32_write_recover(device, checkpoint) ) {
+          continue;
+        }
         retval = DEVICE_ACCESS_ERROR;
         goto finally;
       }
-      dfu_set_transaction_num( 2 ); /* sets block offset 0 */
-      reset_address_flag = 0;
-    }
-
-    /* find end address (info.block_end) for data section to write */
-    mem_section = bout->info.block_start / STM32_MIN_SECTOR_BOUND;
-    for( i = 0, bout->info.block_end = bout->info.block_start;
-         bout->info.block_end <= bout->info.data_end;
-         bout->info.block_end++, i++ ) {
-      xfer_size = bout->info.block_end - bout->info.block_start + 1;
-      // check if the current value is valid
-      if( bout->data[bout->info.block_end] > UINT8_MAX ) break;
-      // check if the current data packet is too big
-      if( xfer_size > STM32_MAX_TRANSFER_SIZE ) break;
-      // check if the current data value is outside of the memory sector
-      if( bout->info.block_end / STM32_MIN_SECTOR_BOUND - mem_section ) break;
-
-      buffer[i] = (uint8_t) bout->data[bout->info.block_end];
-    }
-    bout->info.block_end--; // bout->info.block_end was one step beyond the last data value to flash
-    xfer_size = bout->info.block_end - bout->info.block_start + 1;
-    if( xfer_size != STM32_MAX_TRANSFER_SIZE ) {
-      DEBUG("xfer_size %u not max %u, need addr reset\n",
-          xfer_size, STM32_MAX_TRANSFER_SIZE);
-      reset_address_flag = 1;
+      plan.pointer = bout->info.block_start;
+      plan.pointer_set = true;
+      block_num = 2;                /* block offset 0 */
+    }
+    dfu_set_transaction_num( device, block_num );
+
+    /* holes the plan pads are programmed as erased flash */
+    for( i = 0; i < xfer_size; i++ ) {
+      buffer[i] = (bout->data[bout->info.block_start + i] <= UINT8_MAX) ?
+        (uint8_t) bout->data[bout->info.block_start + i] : 0xff;
     }
 
     /* write the data */
-    DEBUG("Program data block: 0x%X to 0x%X, 0x%X bytes.\n",
-        bout->info.block_start, bout->info.block_end, xfer_size);
+    DEBUG("Program data block: 0x%X to 0x%X, 0x%X bytes, wBlockNum %u.\n",
+        bout->info.block_start, bout->info.block_end, xfer_size, block_num);
 
     if( (status = stm32_write_block( device, xfer_size, buffer )) ) {
       DEBUG( "Error flashing the block: err %d.\n", status );
+      if( 0 == stm32_write_recover(device, checkpoint) ) {
+        plan.pointer_set = false;
+        continue;
+      }
       retval = FLASH_WRITE_ERROR;
       goto finally;
     }
+    t++;
 
-    // incrment bout->info.block_start to the next valid address
-    for( bout->info.block_start = bout->info.block_end + 1;
-         bout->info.block_start <= bout->info.data_end;
-         bout->info.block_start++ ) {
-      if( (bout->data[bout->info.block_start] <= UINT8_MAX) ) break;
-    } // bout->info.block_start is now on the first valid data for the next segment
-
-    if( reset_address_flag == 0 && (bout->info.block_start !=
-        (STM32_MAX_TRANSFER_SIZE * (dfu_get_transaction_num() - 2))
-        + address_offset) ) {
-      DEBUG("block start does not match addr, reset req\n");
-      reset_address_flag = 1;
+    if( 0 != checkpoint_advance(checkpoint, bout->info.block_end + 1) ) {
+      DEBUG( "WARNING: unable to save the checkpoint.\n" );
     }
 
     // display progress in 32 increments (if not hidden)
     if ( !quiet ) print_progress( &bout->info, &progress );
   }
   retval = SUCCESS;
+  checkpoint_clear( checkpoint );
 
 finally:
+  free( plan.transfer );
+  if( SUCCESS != retval && 0 != checkpoint_save(checkpoint) ) {
+    DEBUG( "WARNING: unable to save the checkpoint.\n" );
+  }
+
   if ( !quiet ) {
     if( SUCCESS == retval ) {
       if ( debug <= STM32_DEBUG_THRESHOLD ) {
@@ -660,6 +992,85 @@ finally:
   return retval;
 }
 
+static const dfuse_region_t *stm32_flash_region( dfu_device_t *device ) {
+  if( NULL == device ) {
+    return NULL;
+  }
+  return dfuse_region( &device->layout, STM32_FLASH_OFFSET );
+}
+
+static uint32_t stm32_sector_end( dfu_device_t *device,
+                                  const uint32_t address ) {
+  const dfuse_region_t *region = stm32_flash_region( device );
+  dfuse_sector_t sector;
+
+  if( (NULL != region) &&
+      (0 == dfuse_sector(region, STM32_FLASH_OFFSET + address, &sector)) ) {
+    return sector.end - STM32_FLASH_OFFSET;
+  }
+
+  return (address / STM32_MIN_SECTOR_BOUND + 1) * STM32_MIN_SECTOR_BOUND - 1;
+}
+
+int32_t stm32_flash_size( dfu_device_t *device, uint32_t *size ) {
+  const dfuse_region_t *region = stm32_flash_region( device );
+
+  if( NULL == region ) {
+    return -1;
+  }
+  *size = region->end - STM32_FLASH_OFFSET + 1;
+
+  return 0;
+}
+
+int32_t stm32_sector( dfu_device_t *device, const uint32_t address ) {
+  const dfuse_region_t *region = stm32_flash_region( device );
+  dfuse_sector_t found;
+  int32_t sector;
+
+  if( NULL != region ) {
+    if( 0 != dfuse_sector(region, STM32_FLASH_OFFSET + address, &found) ) {
+      return -1;
+    }
+    return (int32_t) found.index;
+  }
+
+  if( address >= 0x100000 ) {   /* sector 11 ends at 1 MB */
+    return -1;
+  }
+  for( sector = mem_st_sector11; sector > mem_st_sector0; sector-- ) {
+    if( STM32_FLASH_OFFSET + address >= stm32_sector_addresses[sector] ) {
+      break;
+    }
+  }
+
+  return sector;
+}
+
+int32_t stm32_sector_bounds( dfu_device_t *device, const int32_t sector,
+    uint32_t *start, uint32_t *end ) {
+  const dfuse_region_t *region = stm32_flash_region( device );
+  dfuse_sector_t found;
+
+  if( NULL != region ) {
+    if( (sector < 0) || (0 != dfuse_sector_index(region, sector, &found)) ) {
+      return -1;
+    }
+    *start = found.start - STM32_FLASH_OFFSET;
+    *end = found.end - STM32_FLASH_OFFSET;
+    return 0;
+  }
+
+  if( (sector < mem_st_sector0) || (sector > mem_st_sector11) ) {
+    return -1;
+  }
+  *start = stm32_sector_addresses[sector] - STM32_FLASH_OFFSET;
+  *end = (mem_st_sector11 == sector) ? 0xFFFFF :
+      stm32_sector_addresses[sector + 1] - STM32_FLASH_OFFSET - 1;
+
+  return 0;
+}
+
 int32_t stm32_get_commands( dfu_device_t *device ) {
   TRACE("%s( %p )\n", __FUNCTION__, device);
   int32_t result;
@@ -673,7 +1084,7 @@ int32_t stm32_get_commands( dfu_device_t *device ) {
     return UNSPECIFIED_ERROR;
   }
 
-  dfu_set_transaction_num( 0 );
+  dfu_set_transaction_num( device, 0 );
   result = dfu_upload( device, xfer_len, buffer );
   if( result < 0) {
     dfu_status_t status;
@@ -23,6 +23,7 @@
 #include "dfu-bool.h"
 #include "dfu-device.h"
 #include "intel_hex.h"
+#include "checkpoint.h"
 
 #define STM32_FLASH_OFFSET 0x08000000
 
@@ -76,8 +77,17 @@ int32_t stm32_read_flash( dfu_device_t *device,
    * stm32_memory_unit_enum.
    */
 
+int32_t stm32_read_stream( dfu_device_t *device, const uint32_t start,
+    const uint32_t end, dfu_block_sink_t sink, void *context,
+    const dfu_bool quiet );
+  /* read flash from start to end (offsets from STM32_FLASH_OFFSET) like
+   * stm32_read_flash, handing each block to sink as it arrives so only one
+   * block is held in memory.  returns SUCCESS or an error code
+   */
+
 int32_t stm32_write_flash( dfu_device_t *device, intel_buffer_out_t *bout,
-    const dfu_bool eeprom, const dfu_bool force, const dfu_bool hide_progress );
+    const dfu_bool eeprom, const dfu_bool force, const dfu_bool hide_progress,
+    dfu_checkpoint_t *checkpoint, const dfu_bool prepared );
   /* Flash data from the buffer to the main program memory on the device.
    * buffer contains the data to flash where buffer[0] is aligned with memory
    * address zero (which could be inside the bootloader and unavailable).
@@ -86,6 +96,33 @@ int32_t stm32_write_flash( dfu_device_t *device, intel_buffer_out_t *bout,
    * flash_page_size is the size of flash pages - used for alignment
    * eeprom bool tells if you want to flash to eeprom or flash memory
    * hide_progress bool sets whether to display progress
+   * checkpoint (may be NULL) is advanced as blocks are acknowledged; after a
+   * failed block the device is returned to dfuIDLE, the address pointer is
+   * set again and the block is retried.  Programming starts at
+   * checkpoint->resume_from if that is set
+   * prepared bool tells that bout already went through
+   * intel_flash_prep_buffer and has its data limits set, it is then only read
+   */
+
+int32_t stm32_flash_size( dfu_device_t *device, uint32_t *size );
+  /* @brief get the flash size from the layout the device described
+   * @retrn 0 on success, -1 if the device has no layout
+   */
+
+int32_t stm32_sector( dfu_device_t *device, const uint32_t address );
+  /* @brief find the flash sector holding an address, from the device layout
+   *        or, without one (or with device NULL), the stm32f4 sector table
+   * @param address offset from STM32_FLASH_OFFSET
+   * @retrn the sector number counting from 0, or -1 if the address is past
+   *        the last sector
+   */
+
+int32_t stm32_sector_bounds( dfu_device_t *device, const int32_t sector,
+    uint32_t *start, uint32_t *end );
+  /* @brief find the first and last address of a flash sector, like
+   *        stm32_sector
+   * @param start, end set to offsets from STM32_FLASH_OFFSET
+   * @retrn 0 on success, -1 if sector is not a flash sector
    */
 
 int32_t stm32_get_commands( dfu_device_t *device );
@@ -0,0 +1,311 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "topology.h"
+#include "dfu-bool.h"
+#include "util.h"
+
+#define TOPOLOGY_DEBUG_THRESHOLD    40
+#define TOPOLOGY_TRACE_THRESHOLD    45
+
+#define DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               TOPOLOGY_DEBUG_THRESHOLD, __VA_ARGS__ )
+#define TRACE(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
+                               TOPOLOGY_TRACE_THRESHOLD, __VA_ARGS__ )
+
+/* "bus-port.port...:port" and the terminating zero */
+#define TOPOLOGY_NAME_LENGTH    (4 + DFU_MAX_PORT_DEPTH * 4 + 4 + 1)
+
+typedef struct {
+    enum topology_kind kind;
+    char name[TOPOLOGY_NAME_LENGTH];
+    uint32_t active;        /* transfers in flight */
+    uint32_t peak;
+    uint64_t transfers;
+    uint64_t bytes;
+    uint64_t since;         /* us when active last became non zero */
+    uint64_t busy;          /* us with at least one transfer in flight */
+    uint64_t waited;        /* us transfers spent waiting for room */
+} topology_node_t;
+
+static const char *topology_kind_names[DFU_TOPOLOGY_NODES] = {
+    "root", "hub", "tt"
+};
+
+static pthread_mutex_t topology_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t topology_room = PTHREAD_COND_INITIALIZER;
+static dfu_bool topology_enabled = false;
+static uint32_t topology_limits[DFU_TOPOLOGY_NODES];
+static topology_node_t topology_nodes[TOPOLOGY_MAX_NODES];
+static size_t topology_node_count = 0;
+
+// ________  P R O T O T Y P E S  _______________________________
+static uint64_t topology_now_us( void );
+
+static void topology_path( char *name, const size_t size,
+                           const dfu_topology_t *topology,
+                           const uint8_t depth );
+/* write the name of the port path of topology cut to depth ports, the
+ * bus alone for the root hub
+ */
+
+static int32_t topology_node( const enum topology_kind kind,
+                              const char *name );
+/* the index of a node, added if it is new, -1 if there is no room
+ * must be called with topology_lock held
+ */
+
+static dfu_bool topology_has_room( const dfu_topology_t *topology );
+/* true if no node of topology is at its limit
+ * must be called with topology_lock held
+ */
+
+// ________  F U N C T I O N S  _______________________________
+static uint64_t topology_now_us( void ) {
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ((uint64_t) now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+static void topology_path( char *name, const size_t size,
+                           const dfu_topology_t *topology,
+                           const uint8_t depth ) {
+    size_t length;
+    uint8_t i;
+
+    length = snprintf( name, size, "%u", topology->bus );
+    for( i = 0; (i < depth) && (length < size); i++ ) {
+        length += snprintf( &name[length], size - length, "%c%u",
+                            (0 == i) ? '-' : '.', topology->ports[i] );
+    }
+}
+
+static int32_t topology_node( const enum topology_kind kind,
+                              const char *name ) {
+    size_t i;
+
+    for( i = 0; i < topology_node_count; i++ ) {
+        if( (kind == topology_nodes[i].kind) &&
+                (0 == strcmp(name, topology_nodes[i].name)) ) {
+            return (int32_t) i;
+        }
+    }
+
+    if( TOPOLOGY_MAX_NODES == topology_node_count ) {
+        DEBUG( "No room for %s %s, it is not limited.\n",
+               topology_kind_names[kind], name );
+        return -1;
+    }
+
+    memset( &topology_nodes[i], 0, sizeof(topology_node_t) );
+    topology_nodes[i].kind = kind;
+    strncpy( topology_nodes[i].name, name, TOPOLOGY_NAME_LENGTH - 1 );
+    topology_node_count++;
+
+    return (int32_t) i;
+}
+
+static dfu_bool topology_has_room( const dfu_topology_t *topology ) {
+    topology_node_t *node;
+    int32_t i;
+
+    for( i = 0; i < DFU_TOPOLOGY_NODES; i++ ) {
+        if( (topology->node[i] < 0) || (0 == topology_limits[i]) ) {
+            continue;
+        }
+        node = &topology_nodes[topology->node[i]];
+        if( node->active >= topology_limits[i] ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int32_t topology_parse_limits( const char *text,
+                               uint32_t limits[DFU_TOPOLOGY_NODES] ) {
+    const char *item = text;
+    unsigned long value;
+    char *end;
+    size_t length;
+    int32_t i;
+
+    while( '\0' != *item ) {
+        for( i = 0; i < DFU_TOPOLOGY_NODES; i++ ) {
+            length = strlen( topology_kind_names[i] );
+            if( (0 == strncmp(item, topology_kind_names[i], length)) &&
+                    (':' == item[length]) ) {
+                break;
+            }
+        }
+        if( DFU_TOPOLOGY_NODES == i ) {
+            return -1;
+        }
+
+        item += strlen( topology_kind_names[i] ) + 1;
+        value = strtoul( item, &end, 0 );
+        if( (end == item) || (value > UINT32_MAX) ||
+                (('\0' != *end) && (',' != *end)) ) {
+            return -1;
+        }
+        limits[i] = (uint32_t) value;
+
+        item = ('\0' == *end) ? end : (end + 1);
+    }
+
+    return 0;
+}
+
+void topology_set_limits( const uint32_t limits[DFU_TOPOLOGY_NODES] ) {
+    TRACE( "%s( %u, %u, %u )\n", __FUNCTION__, limits[TOPOLOGY_ROOT_PORT],
+           limits[TOPOLOGY_HUB], limits[TOPOLOGY_TT] );
+
+    pthread_mutex_lock( &topology_lock );
+    memcpy( topology_limits, limits, sizeof(topology_limits) );
+    topology_enabled = true;
+    pthread_mutex_unlock( &topology_lock );
+}
+
+void topology_attach( dfu_topology_t *topology ) {
+    char name[TOPOLOGY_NAME_LENGTH];
+    size_t length;
+
+    topology->limited = false;
+
+    pthread_mutex_lock( &topology_lock );
+    if( (false == topology_enabled) || (0 == topology->depth) ) {
+        pthread_mutex_unlock( &topology_lock );
+        return;
+    }
+
+    topology_path( name, sizeof(name), topology, 1 );
+    topology->node[TOPOLOGY_ROOT_PORT] =
+            topology_node( TOPOLOGY_ROOT_PORT, name );
+
+    topology_path( name, sizeof(name), topology, topology->depth - 1 );
+    topology->node[TOPOLOGY_HUB] = topology_node( TOPOLOGY_HUB, name );
+
+    topology->node[TOPOLOGY_TT] = -1;
+    if( 0 != topology->tt_depth ) {
+        topology_path( name, sizeof(name), topology, topology->tt_depth );
+        if( topology->tt_multi ) {
+            length = strlen( name );
+            snprintf( &name[length], sizeof(name) - length, ":%u",
+                      topology->ports[topology->tt_depth] );
+        }
+        topology->node[TOPOLOGY_TT] = topology_node( TOPOLOGY_TT, name );
+    }
+
+    topology->limited = true;
+    pthread_mutex_unlock( &topology_lock );
+}
+
+void topology_enter( dfu_topology_t *topology ) {
+    topology_node_t *node;
+    uint64_t start;
+    uint64_t now;
+    int32_t i;
+
+    if( false == topology->limited ) {
+        return;
+    }
+
+    pthread_mutex_lock( &topology_lock );
+    start = topology_now_us();
+    while( !topology_has_room(topology) ) {
+        pthread_cond_wait( &topology_room, &topology_lock );
+    }
+    now = topology_now_us();
+
+    for( i = 0; i < DFU_TOPOLOGY_NODES; i++ ) {
+        if( topology->node[i] < 0 ) {
+            continue;
+        }
+        node = &topology_nodes[topology->node[i]];
+        if( 0 == node->active++ ) {
+            node->since = now;
+        }
+        if( node->active > node->peak ) {
+            node->peak = node->active;
+        }
+        node->waited += now - start;
+    }
+    pthread_mutex_unlock( &topology_lock );
+}
+
+void topology_leave( dfu_topology_t *topology, const int32_t result ) {
+    topology_node_t *node;
+    uint64_t now;
+    int32_t i;
+
+    if( false == topology->limited ) {
+        return;
+    }
+
+    pthread_mutex_lock( &topology_lock );
+    now = topology_now_us();
+    for( i = 0; i < DFU_TOPOLOGY_NODES; i++ ) {
+        if( topology->node[i] < 0 ) {
+            continue;
+        }
+        node = &topology_nodes[topology->node[i]];
+        node->transfers++;
+        if( result > 0 ) {
+            node->bytes += result;
+        }
+        if( 0 == --node->active ) {
+            node->busy += now - node->since;
+        }
+    }
+    pthread_cond_broadcast( &topology_room );
+    pthread_mutex_unlock( &topology_lock );
+}
+
+void topology_print_stats( FILE *stream ) {
+    topology_node_t *node;
+    size_t i;
+
+    pthread_mutex_lock( &topology_lock );
+    fprintf( stream, "%-4s %-16s %5s %5s %10s %10s %9s %10s %8s\n", "node",
+             "port", "limit", "peak", "transfers", "bytes", "busy(ms)",
+             "waited(ms)", "KB/s" );
+    for( i = 0; i < topology_node_count; i++ ) {
+        node = &topology_nodes[i];
+        fprintf( stream, "%-4s %-16s %5u %5u %10llu %10llu %9llu %10llu "
+                 "%8llu\n", topology_kind_names[node->kind], node->name,
+                 topology_limits[node->kind], node->peak,
+                 (unsigned long long) node->transfers,
+                 (unsigned long long) node->bytes,
+                 (unsigned long long) (node->busy / 1000),
+                 (unsigned long long) (node->waited / 1000),
+                 (unsigned long long) ((0 == node->busy) ? 0 :
+                        node->bytes * 1000000 / 1024 / node->busy) );
+    }
+    pthread_mutex_unlock( &topology_lock );
+}
@@ -0,0 +1,74 @@
+/*
+ * dfu-programmer
+ *
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "dfu-device.h"
+
+/*  Boards programmed at the same time share the bandwidth of the usb
+ *  between them and the host.  Full and low speed devices behind a high
+ *  speed hub also share its transaction translator, one for the hub or
+ *  one for each port.  Each root port, hub and translator in use is a
+ *  node here, and a limit caps the control transfers in flight through
+ *  each kind of node; a transfer waits until every node on its way has
+ *  room.  Nodes are named after their port path: root port 1-2, hub
+ *  1-2.4 (the root hub of bus 1 is just 1) and translator 1-2.4, or
+ *  1-2.4:3 for the one of port 3.
+ *
+ *  Limits are given as root:count,hub:count,tt:count, any of them may be
+ *  left out and 0 is no limit.
+ */
+enum topology_kind { TOPOLOGY_ROOT_PORT, TOPOLOGY_HUB, TOPOLOGY_TT };
+
+#define TOPOLOGY_MAX_NODES  64
+
+int32_t topology_parse_limits( const char *text,
+                               uint32_t limits[DFU_TOPOLOGY_NODES] );
+/*  Read the limits in text into limits, which keeps the kinds not given.
+ *
+ *  returns 0 on success, -1 if text is malformed
+ */
+
+void topology_set_limits( const uint32_t limits[DFU_TOPOLOGY_NODES] );
+/*  Start limiting and counting the transfers of the devices attached
+ *  from now on.
+ */
+
+void topology_attach( dfu_topology_t *topology );
+/*  Find or add the nodes on the way to a device once its ports are known,
+ *  nothing is done unless topology_set_limits was called.
+ */
+
+void topology_enter( dfu_topology_t *topology );
+/*  Wait until the nodes of the device have room for one more transfer.
+ */
+
+void topology_leave( dfu_topology_t *topology, const int32_t result );
+/*  A transfer of the device ended with result (bytes, or a libusb error).
+ */
+
+void topology_print_stats( FILE *stream );
+/*  Print the transfers, bytes and throughput of each node.
+ */
+
+#endif
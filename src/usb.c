@@ -5,9 +5,14 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include <libusb.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include "dfu.h"
+#include "dfuse.h"
+#include "topology.h"
 #include "util.h"
 #include "dfu-bool.h"
 
@@ -22,10 +27,127 @@
 #define MSG_DEBUG(...)  dfu_debug( __FILE__, __FUNCTION__, __LINE__, \
                                DFU_MESSAGE_DEBUG_THRESHOLD, __VA_ARGS__ )
 
+/* how often the device list is read when libusb has no hotplug events */
+#define USB_WAIT_POLL_MS            10
+
+/* what dfu_wait_device looks for */
+struct dfu_wait {
+    uint8_t bus;
+    uint8_t depth;                  // 0 if the port is not known
+    uint8_t ports[DFU_MAX_PORT_DEPTH];
+    uint8_t address;                // of the device that left
+    uint16_t vendor;                // 0 for any
+    uint16_t product;
+    int found;
+    char *port;                     // the port it arrived at
+    size_t port_size;
+};
+
+static int dfu_port_path( libusb_device *device, char *path,
+                          const size_t size );
+/*  write "bus-port.port..." of device to path, returns the number of
+ *  ports or <= 0 if they are not known
+ */
+
+static dfu_bool dfu_match_location( libusb_device *device,
+                                    const uint8_t iSerialNumber,
+                                    const char *port,
+                                    const char *serial );
+/*  true if device is plugged into port and reports serial, NULL matches
+ *  any port or serial number
+ */
+
+static dfu_bool dfu_match_arrival( libusb_device *device,
+                                   struct dfu_wait *wait );
+/*  true if device is the one wait looks for, which is then recorded
+ */
+
+static int LIBUSB_CALL dfu_wait_arrived( libusb_context *context,
+                                         libusb_device *device,
+                                         libusb_hotplug_event event,
+                                         void *user_data );
+/*  hotplug callback of dfu_wait_device, user_data is the struct dfu_wait
+ */
+
+static int32_t dfu_select_configuration( libusb_device *device,
+                                         dfu_device_t *dfu_device,
+                                         const uint8_t bConfigurationValue );
+/*  make bConfigurationValue the configuration of the device opened in
+ *  dfu_device, sending SET_CONFIGURATION only when another one is active.
+ *  returns 0 on success, < 0 otherwise
+ */
+
+static uint64_t usb_now_us( void );
+/*  monotonic time in us
+ */
+
+static int dfu_port_path( libusb_device *device, char *path,
+                          const size_t size )
+{
+    uint8_t ports[7];
+    int count;
+    int length;
+    int i;
+
+    count = libusb_get_port_numbers( device, ports, sizeof(ports) );
+    if( count <= 0 ) {
+        return count;
+    }
+    length = snprintf( path, size, "%u", libusb_get_bus_number(device) );
+    for( i = 0; i < count; i++ ) {
+        length += snprintf( &path[length], size - length, "%c%u",
+                            (0 == i) ? '-' : '.', ports[i] );
+    }
+
+    return count;
+}
+
+static dfu_bool dfu_match_location( libusb_device *device,
+                                    const uint8_t iSerialNumber,
+                                    const char *port,
+                                    const char *serial )
+{
+    char path[USB_PORT_PATH_LENGTH];
+    unsigned char text[256];
+    libusb_device_handle *handle;
+    int length;
+
+    if( NULL != port ) {
+        if( dfu_port_path(device, path, sizeof(path)) <= 0 ) {
+            return false;
+        }
+        DEBUG( "device at port %s\n", path );
+        if( 0 != strcmp(path, port) ) {
+            return false;
+        }
+    }
+
+    if( NULL != serial ) {
+        if( (0 == iSerialNumber) || libusb_open(device, &handle) ) {
+            return false;
+        }
+        length = libusb_get_string_descriptor_ascii( handle, iSerialNumber,
+                                                     text, sizeof(text) - 1 );
+        libusb_close( handle );
+        if( length < 0 ) {
+            return false;
+        }
+        text[length] = '\0';
+        DEBUG( "device with serial number %s\n", text );
+        if( 0 != strcmp((char *) text, serial) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 struct libusb_device *dfu_find_device( const uint32_t vendor,
                                        const uint32_t product,
                                        const uint32_t bus_number,
-                                       const uint32_t device_address)
+                                       const uint32_t device_address,
+                                       const char *port,
+                                       const char *serial )
 {
     libusb_device **list;
     size_t devicecount;
@@ -53,7 +175,8 @@ struct libusb_device *dfu_find_device( const uint32_t vendor,
             (product == descriptor.idProduct) &&
             ((bus_number == 0)
              || ((libusb_get_bus_number(dev) == bus_number) &&
-                 (libusb_get_device_address(dev) == device_address))) )
+                 (libusb_get_device_address(dev) == device_address))) &&
+            dfu_match_location(dev, descriptor.iSerialNumber, port, serial) )
         {
             device = dev;
             break;
@@ -138,6 +261,112 @@ dfu_bool dfu_find_interface(struct libusb_device *device,
     return false;
 }
 
+void dfu_read_layout(libusb_device *device, dfu_device_t *dfu_device,
+                     const uint8_t bConfigurationValue)
+{
+    TRACE( "%s()\n", __FUNCTION__ );
+
+    struct libusb_config_descriptor *config = NULL;
+    unsigned char descriptor[256];
+
+    memset( &dfu_device->layout, 0, sizeof(dfuse_layout_t) );
+
+    if( libusb_get_config_descriptor_by_value(device, bConfigurationValue,
+                                              &config) ) {
+        DEBUG( "can't get config descriptor %d\n", bConfigurationValue );
+        return;
+    }
+
+    for( int32_t i = 0; i < config->bNumInterfaces; i++ ) {
+        const struct libusb_interface *interface = &config->interface[i];
+
+        for( int32_t s = 0; s < interface->num_altsetting; s++ ) {
+            const struct libusb_interface_descriptor *setting =
+                    &interface->altsetting[s];
+
+            if( (setting->bInterfaceNumber != dfu_device->interface) ||
+                (0 == setting->iInterface) ) {
+                continue;
+            }
+            if( 0 >= libusb_get_string_descriptor_ascii(dfu_device->handle,
+                        setting->iInterface, descriptor, sizeof(descriptor)) ) {
+                DEBUG( "can't get string %d\n", setting->iInterface );
+                continue;
+            }
+
+            int32_t result = dfuse_parse( &dfu_device->layout,
+                                          (const char *) descriptor );
+            DEBUG( "alt %d: '%s' (%d)\n", setting->bAlternateSetting,
+                   descriptor, result );
+            if( result < 0 ) {
+                fprintf( stderr, "Ignoring the memory layout '%s'.\n",
+                         descriptor );
+            }
+        }
+    }
+
+    for( uint32_t r = 0; r < dfu_device->layout.region_count; r++ ) {
+        dfuse_region_t *region = &dfu_device->layout.region[r];
+        DEBUG( "region %s: 0x%08X to 0x%08X in %u groups\n", region->name,
+               region->start, region->end, region->group_count );
+    }
+
+    libusb_free_config_descriptor( config );
+}
+
+void dfu_read_topology(libusb_device *device, dfu_device_t *dfu_device)
+{
+    dfu_topology_t *topology = &dfu_device->topology;
+    struct libusb_device_descriptor descriptor;
+    libusb_device **list;
+    libusb_device *hub;
+    extern libusb_context *usbcontext;
+    ssize_t devicecount;
+    int speed;
+    int count;
+    int depth;
+
+    TRACE( "%s()\n", __FUNCTION__ );
+
+    memset( topology, 0, sizeof(dfu_topology_t) );
+    topology->bus = libusb_get_bus_number( device );
+    count = libusb_get_port_numbers( device, topology->ports,
+                                     sizeof(topology->ports) );
+    topology->depth = (count > 0) ? count : 0;
+
+    /* the parents are only valid while a device list is held */
+    devicecount = libusb_get_device_list( usbcontext, &list );
+
+    /* the split transactions of a full or low speed device are handled
+       by the closest high speed hub, a root hub has no translator */
+    speed = libusb_get_device_speed( device );
+    if( (devicecount >= 0) &&
+            ((LIBUSB_SPEED_LOW == speed) || (LIBUSB_SPEED_FULL == speed)) ) {
+        depth = topology->depth - 1;
+        for( hub = libusb_get_parent(device); (NULL != hub) && (depth > 0);
+                hub = libusb_get_parent(hub), depth-- ) {
+            if( LIBUSB_SPEED_HIGH == libusb_get_device_speed(hub) ) {
+                topology->tt_depth = depth;
+                /* bDeviceProtocol 2 is a hub with a translator per port */
+                if( 0 == libusb_get_device_descriptor(hub, &descriptor) ) {
+                    topology->tt_multi = (2 == descriptor.bDeviceProtocol);
+                }
+                break;
+            }
+        }
+    }
+
+    if( devicecount >= 0 ) {
+        libusb_free_device_list( list, 1 );
+    }
+
+    DEBUG( "bus %u, %u ports deep, translator %u ports deep%s\n",
+           topology->bus, topology->depth, topology->tt_depth,
+           topology->tt_multi ? " (one per port)" : "" );
+
+    topology_attach( topology );
+}
+
 void dfu_detach_drivers(libusb_device *device, dfu_device_t *dfu_device)
 {
     TRACE( "%s()\n", __FUNCTION__ );
@@ -155,10 +384,43 @@ void dfu_detach_drivers(libusb_device *device, dfu_device_t *dfu_device)
     }
 }
 
+static int32_t dfu_select_configuration( libusb_device *device,
+                                         dfu_device_t *dfu_device,
+                                         const uint8_t bConfigurationValue )
+{
+    int active = -1;
+
+    TRACE( "%s( %d )\n", __FUNCTION__, bConfigurationValue );
+
+    /* SET_CONFIGURATION resets the interfaces of a device, which the one
+       it is already in does not need, and the kernel driver of the DFU
+       interface, if any, is detached when it is claimed */
+    if( (0 == libusb_get_configuration(dfu_device->handle, &active)) &&
+            (active == bConfigurationValue) ) {
+        DEBUG( "configuration %d already active...\n", active );
+        if( LIBUSB_SUCCESS != libusb_set_auto_detach_kernel_driver(
+                    dfu_device->handle, 1) ) {
+            dfu_detach_drivers( device, dfu_device );
+        }
+        return 0;
+    }
+
+    dfu_detach_drivers( device, dfu_device );
+    if( 0 != libusb_set_configuration(dfu_device->handle, bConfigurationValue) ) {
+        DEBUG( "Failed to set configuration.\n" );
+        return -1;
+    }
+    DEBUG( "set configuration %d...\n", bConfigurationValue );
+
+    return 0;
+}
+
 struct libusb_device *dfu_device_init( const uint32_t vendor,
                                        const uint32_t product,
                                        const uint32_t bus_number,
                                        const uint32_t device_address,
+                                       const char *port,
+                                       const char *serial,
                                        dfu_device_t *dfu_device,
                                        const dfu_bool initial_abort,
                                        const dfu_bool honor_interfaceclass,
@@ -171,7 +433,9 @@ struct libusb_device *dfu_device_init( const uint32_t vendor,
 
     DEBUG( "%s(%08x, %08x)\n", __FUNCTION__, vendor, product );
 
-    libusb_device * device = dfu_find_device(vendor, product, bus_number, device_address);
+    uint64_t start = usb_now_us();
+    libusb_device * device = dfu_find_device(vendor, product, bus_number, device_address,
+                                              port, serial);
     if (device == NULL) {
         return NULL;
     }
@@ -191,19 +455,23 @@ struct libusb_device *dfu_device_init( const uint32_t vendor,
 
     DEBUG( "opened interface %d...\n", dfu_device->interface );
 
-    dfu_detach_drivers(device, dfu_device);
+    dfu_read_topology(device, dfu_device);
 
-    if( 0 == libusb_set_configuration(dfu_device->handle, bConfigurationValue) ) {
-        DEBUG( "set configuration %d...\n", bConfigurationValue);
+    if( 0 == dfu_select_configuration(device, dfu_device, bConfigurationValue) ) {
         if( 0 == libusb_claim_interface(dfu_device->handle, dfu_device->interface) )
         {
             DEBUG( "claimed interface %d...\n", dfu_device->interface );
 
             if (expected_protocol == 1) {
+                dfu_device->open_time = (uint32_t) (usb_now_us() - start);
                 return device;
             }
 
+            dfu_read_layout( device, dfu_device, bConfigurationValue );
+
             if ( 0 == dfu_make_idle(dfu_device, initial_abort) ) {
+                dfu_device->open_time = (uint32_t) (usb_now_us() - start);
+                DEBUG( "opened in %u us\n", dfu_device->open_time );
                 return device;
 
             } else {
@@ -214,8 +482,6 @@ struct libusb_device *dfu_device_init( const uint32_t vendor,
         } else {
             DEBUG( "Failed to claim the DFU interface.\n" );
         }
-    } else {
-        DEBUG( "Failed to set configuration.\n" );
     }
 
     libusb_close(dfu_device->handle);
@@ -224,3 +490,189 @@ struct libusb_device *dfu_device_init( const uint32_t vendor,
 
     return NULL;
 }
+
+static dfu_bool dfu_match_arrival( libusb_device *device,
+                                   struct dfu_wait *wait )
+{
+    struct libusb_device_descriptor descriptor;
+    uint8_t ports[DFU_MAX_PORT_DEPTH];
+    int count;
+
+    // the device that left may still be listed until it is gone
+    if( (libusb_get_bus_number(device) == wait->bus) &&
+            (libusb_get_device_address(device) == wait->address) ) {
+        return false;
+    }
+
+    if( 0 != wait->depth ) {
+        count = libusb_get_port_numbers( device, ports, sizeof(ports) );
+        if( (libusb_get_bus_number(device) != wait->bus) ||
+                (count != wait->depth) ||
+                (0 != memcmp(ports, wait->ports, wait->depth)) ) {
+            return false;
+        }
+    }
+
+    if( 0 != wait->vendor ) {
+        if( libusb_get_device_descriptor(device, &descriptor) ||
+                (descriptor.idVendor != wait->vendor) ||
+                (descriptor.idProduct != wait->product) ) {
+            return false;
+        }
+    }
+
+    if( dfu_port_path(device, wait->port, wait->port_size) <= 0 ) {
+        snprintf( wait->port, wait->port_size, "%u,%u",
+                  libusb_get_bus_number(device),
+                  libusb_get_device_address(device) );
+    }
+    wait->found = 1;
+
+    return true;
+}
+
+static int LIBUSB_CALL dfu_wait_arrived( libusb_context *context,
+                                         libusb_device *device,
+                                         libusb_hotplug_event event,
+                                         void *user_data )
+{
+    struct dfu_wait *wait = (struct dfu_wait *) user_data;
+
+    if( !wait->found ) {
+        dfu_match_arrival( device, wait );
+    }
+
+    return 0;
+}
+
+static uint64_t usb_now_us( void ) {
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ((uint64_t) now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+int32_t dfu_wait_device( dfu_device_t *dfu_device,
+                         const uint16_t vendor,
+                         const uint16_t product,
+                         const uint32_t timeout,
+                         char *port,
+                         const size_t port_size )
+{
+    extern libusb_context *usbcontext;
+    libusb_hotplug_callback_handle callback;
+    libusb_device **list;
+    libusb_device *device;
+    struct dfu_wait wait;
+    struct timeval tv;
+    uint64_t deadline;
+    uint64_t now;
+    ssize_t devicecount;
+    ssize_t i;
+
+    TRACE( "%s( %p, 0x%04x, 0x%04x, %u )\n", __FUNCTION__, dfu_device,
+           vendor, product, timeout );
+
+    if( (NULL == dfu_device) || (NULL == dfu_device->handle) ||
+            (NULL == port) || (0 == port_size) ) {
+        DEBUG( "Invalid parameter\n" );
+        return -1;
+    }
+
+    memset( &wait, 0, sizeof(wait) );
+    device = libusb_get_device( dfu_device->handle );
+    wait.bus = libusb_get_bus_number( device );
+    wait.address = libusb_get_device_address( device );
+    wait.depth = dfu_device->topology.depth;
+    memcpy( wait.ports, dfu_device->topology.ports, sizeof(wait.ports) );
+    wait.vendor = vendor;
+    wait.product = product;
+    wait.port = port;
+    wait.port_size = port_size;
+
+    if( (0 == wait.depth) && (0 == wait.vendor) ) {
+        DEBUG( "Neither the port nor the ids to wait for are known.\n" );
+        return -2;
+    }
+
+    deadline = usb_now_us() / 1000 + timeout;
+
+    if( libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) &&
+            (LIBUSB_SUCCESS == libusb_hotplug_register_callback(usbcontext,
+                    LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED,
+                    LIBUSB_HOTPLUG_ENUMERATE,
+                    (0 != vendor) ? vendor : LIBUSB_HOTPLUG_MATCH_ANY,
+                    (0 != vendor) ? product : LIBUSB_HOTPLUG_MATCH_ANY,
+                    LIBUSB_HOTPLUG_MATCH_ANY, dfu_wait_arrived, &wait,
+                    &callback)) ) {
+        DEBUG( "Waiting for hotplug events.\n" );
+        while( !wait.found &&
+                ((now = usb_now_us() / 1000) < deadline) ) {
+            tv.tv_sec = (deadline - now) / 1000;
+            tv.tv_usec = ((deadline - now) % 1000) * 1000;
+            libusb_handle_events_timeout_completed( usbcontext, &tv,
+                                                    &wait.found );
+        }
+        libusb_hotplug_deregister_callback( usbcontext, callback );
+    } else {
+        DEBUG( "Polling the devices every %d ms.\n", USB_WAIT_POLL_MS );
+        while( 1 ) {
+            devicecount = libusb_get_device_list( usbcontext, &list );
+            for( i = 0; (i < devicecount) && !wait.found; i++ ) {
+                dfu_match_arrival( list[i], &wait );
+            }
+            if( devicecount >= 0 ) {
+                libusb_free_device_list( list, 1 );
+            }
+            if( wait.found || (usb_now_us() / 1000 >= deadline) ) {
+                break;
+            }
+            usleep( USB_WAIT_POLL_MS * 1000 );
+        }
+    }
+
+    if( !wait.found ) {
+        return 1;
+    }
+    DEBUG( "Device arrived at %s.\n", port );
+
+    return 0;
+}
+
+int32_t dfu_device_identity( dfu_device_t *dfu_device, char *identity,
+                             const size_t size )
+{
+    struct libusb_device_descriptor descriptor;
+    dfu_topology_t *topology = &dfu_device->topology;
+    unsigned char text[256];
+    int length;
+    int i;
+
+    TRACE( "%s( %p, %p, %zu )\n", __FUNCTION__, dfu_device, identity, size );
+
+    if( (0 == libusb_get_device_descriptor(
+                    libusb_get_device(dfu_device->handle), &descriptor)) &&
+            (0 != descriptor.iSerialNumber) ) {
+        length = libusb_get_string_descriptor_ascii( dfu_device->handle,
+                descriptor.iSerialNumber, text, sizeof(text) - 1 );
+        if( length > 0 ) {
+            text[length] = '\0';
+            snprintf( identity, size, "serial %s", text );
+            return 0;
+        }
+    }
+
+    if( 0 == topology->depth ) {
+        DEBUG( "Neither serial number nor port of the device are known.\n" );
+        return -1;
+    }
+
+    length = snprintf( identity, size, "port %u", topology->bus );
+    for( i = 0; (i < topology->depth) && (length < (int) size); i++ ) {
+        length += snprintf( &identity[length], size - length, "%c%u",
+                            (0 == i) ? '-' : '.', topology->ports[i] );
+    }
+
+    return 0;
+}
@@ -5,10 +5,15 @@
 
 #include "dfu.h"
 
+/* "bus-port.port..." plus the terminating zero, 7 is the usb hub depth */
+#define USB_PORT_PATH_LENGTH    (3 + 7 * 4 + 1)
+
 libusb_device *dfu_find_device(const uint32_t vendor,
                                const uint32_t product,
                                const uint32_t bus_number,
-                               const uint32_t device_address);
+                               const uint32_t device_address,
+                               const char *port,
+                               const char *serial);
 
 dfu_bool dfu_find_interface(libusb_device *device,
                             const dfu_bool honor_interfaceclass,
@@ -24,13 +29,57 @@ dfu_bool dfu_find_interface(libusb_device *device,
  *  returns the interface number if found, < 0 otherwise
  */
 
+void dfu_read_layout(libusb_device *device,
+                     dfu_device_t *dfu_device,
+                     const uint8_t bConfigurationValue);
+/*  Read the string of each alternate setting of the claimed interface and
+ *  collect the DfuSe memory layout in dfu_device->layout.  Devices that
+ *  do not describe their memory this way are left with an empty layout.
+ */
+
+void dfu_read_topology(libusb_device *device,
+                       dfu_device_t *dfu_device);
+/*  Record the ports from the root hub to the device, and the hub whose
+ *  transaction translator it is reached through, in dfu_device->topology
+ *  and attach it to the transfer limits of topology.h.
+ */
+
+int32_t dfu_device_identity(dfu_device_t *dfu_device,
+                            char *identity,
+                            const size_t size);
+/*  Write what tells the device open in dfu_device apart from others of
+ *  its kind to identity: "serial <number>" if it reports a serial number,
+ *  otherwise "port <bus-port.port...>" from its topology.
+ *
+ *  returns 0 on success, < 0 if neither is known
+ */
+
 void dfu_detach_drivers(libusb_device *device,
                         dfu_device_t *dfu_device);
 
+int32_t dfu_wait_device(dfu_device_t *dfu_device,
+                        const uint16_t vendor,
+                        const uint16_t product,
+                        const uint32_t timeout,
+                        char *port,
+                        const size_t port_size);
+/*  Wait up to timeout ms for a device to arrive after the one dfu_device
+ *  has open left, e.g. when the bootloader started the application: one
+ *  plugged into the same port, if the port is known, with vendor:product,
+ *  unless vendor is 0.  Hotplug events are used where libusb has them,
+ *  otherwise the device list is polled.
+ *
+ *  [out] port - "bus-port.port..." the device arrived at
+ *
+ *  returns 0 when it arrived, 1 on timeout, < 0 on errors
+ */
+
 libusb_device *dfu_device_init( const uint32_t vendor,
                                 const uint32_t product,
                                 const uint32_t bus,
                                 const uint32_t dev_addr,
+                                const char *port,
+                                const char *serial,
                                 dfu_device_t *device,
                                 const dfu_bool initial_abort,
                                 const dfu_bool honor_interfaceclass,
@@ -40,6 +89,8 @@ libusb_device *dfu_device_init( const uint32_t vendor,
  *
  *  vendor  - the vender number of the device to look for
  *  product - the product number of the device to look for
+ *  port    - "bus-port.port..." the device is plugged into, or NULL
+ *  serial  - the serial number string of the device, or NULL
  *  [out] device - the dfu device to commmunicate with
  *
  *  return a pointer to the usb_device if found, or NULL otherwise